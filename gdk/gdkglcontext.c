@@ -99,6 +99,8 @@
 
 #include <epoxy/gl.h>
 
+#include <string.h>
+
 typedef struct {
   GdkGLContext *shared_context;
 
@@ -116,9 +118,17 @@ typedef struct {
   guint debug_enabled : 1;
   guint forward_compatible : 1;
   guint is_legacy : 1;
+  guint has_buffer_storage : 1;
 
   int use_es;
 
+  /* Ring of persistently mapped pixel buffer memory for uploads,
+   * see gdk_gl_context_upload_texture_buffered() */
+  guint upload_buffer;
+  guchar *upload_data;
+  gsize upload_pos;
+  GQueue upload_fences;
+
   int max_debug_label_length;
 
   GdkGLContextPaintData *paint_data;
@@ -151,6 +161,9 @@ gdk_gl_context_clear_old_updated_area (GdkGLContext *context)
     }
 }
 
+static void gdk_gl_context_clear_upload_buffer (GdkGLContext *context,
+                                                gboolean      delete);
+
 static void
 gdk_gl_context_dispose (GObject *gobject)
 {
@@ -160,6 +173,10 @@ gdk_gl_context_dispose (GObject *gobject)
 
   gdk_gl_context_clear_old_updated_area (context);
 
+  /* The backends have freed the upload buffer and destroyed their
+   * context before chaining up, only forget what may be left */
+  gdk_gl_context_clear_upload_buffer (context, FALSE);
+
   current = g_private_get (&thread_current_context);
   if (current == context)
     g_private_replace (&thread_current_context, NULL);
@@ -222,6 +239,260 @@ gdk_gl_context_get_property (GObject    *gobject,
     }
 }
 
+/* Uploads go through a ring of UPLOAD_BUFFER_SIZE bytes that stays
+ * mapped for the lifetime of the context. The pixels are copied or
+ * converted straight into the ring, and glTexImage2D() only schedules
+ * the transfer from there, so it doesn't have to wait for the GPU to
+ * finish with the previous frame. Every upload is followed by a fence,
+ * and memory is only reused after the fence of the upload that last
+ * used it has signalled.
+ */
+#define UPLOAD_BUFFER_SIZE (32 * 1024 * 1024)
+#define UPLOAD_ALIGNMENT 64
+#define MIN_BUFFERED_UPLOAD_SIZE (64 * 1024)
+#define MAX_BUFFERED_UPLOAD_SIZE (UPLOAD_BUFFER_SIZE / 2)
+
+typedef struct {
+  GLsync sync;
+  gsize start; /* position of the upload in the ring, see upload_pos */
+} UploadFence;
+
+static void
+upload_fence_wait (UploadFence *fence)
+{
+  GLenum status;
+
+  do
+    status = glClientWaitSync (fence->sync, GL_SYNC_FLUSH_COMMANDS_BIT, G_TIME_SPAN_SECOND * 1000);
+  while (status == GL_TIMEOUT_EXPIRED);
+}
+
+static void
+upload_fence_free (UploadFence *fence)
+{
+  glDeleteSync (fence->sync);
+  g_free (fence);
+}
+
+static gboolean
+gdk_gl_context_ensure_upload_buffer (GdkGLContext *context)
+{
+  GdkGLContextPrivate *priv = gdk_gl_context_get_instance_private (context);
+  const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+  if (priv->upload_buffer != 0)
+    return TRUE;
+
+  if (!priv->has_buffer_storage)
+    return FALSE;
+
+  glGenBuffers (1, &priv->upload_buffer);
+  glBindBuffer (GL_PIXEL_UNPACK_BUFFER, priv->upload_buffer);
+
+  if (priv->use_es)
+    glBufferStorageEXT (GL_PIXEL_UNPACK_BUFFER, UPLOAD_BUFFER_SIZE, NULL, flags);
+  else
+    glBufferStorage (GL_PIXEL_UNPACK_BUFFER, UPLOAD_BUFFER_SIZE, NULL, flags);
+
+  priv->upload_data = glMapBufferRange (GL_PIXEL_UNPACK_BUFFER, 0, UPLOAD_BUFFER_SIZE, flags);
+
+  glBindBuffer (GL_PIXEL_UNPACK_BUFFER, 0);
+
+  if (priv->upload_data == NULL)
+    {
+      GDK_DISPLAY_NOTE (gdk_draw_context_get_display (GDK_DRAW_CONTEXT (context)), OPENGL,
+                        g_message ("Failed to map upload buffer, uploading synchronously"));
+
+      glDeleteBuffers (1, &priv->upload_buffer);
+      priv->upload_buffer = 0;
+      priv->has_buffer_storage = FALSE;
+      return FALSE;
+    }
+
+  gdk_gl_context_label_object (context, GL_BUFFER, priv->upload_buffer, "Upload buffer");
+
+  priv->upload_pos = 0;
+  g_queue_init (&priv->upload_fences);
+
+  return TRUE;
+}
+
+/* Forgets the upload buffer. If @delete is %FALSE, the buffer and
+ * fences are left to be destroyed with the GL context */
+static void
+gdk_gl_context_clear_upload_buffer (GdkGLContext *context,
+                                    gboolean      delete)
+{
+  GdkGLContextPrivate *priv = gdk_gl_context_get_instance_private (context);
+
+  if (priv->upload_buffer == 0)
+    return;
+
+  if (delete)
+    {
+      /* Deleting the buffer also unmaps it */
+      g_queue_clear_full (&priv->upload_fences, (GDestroyNotify) upload_fence_free);
+      glDeleteBuffers (1, &priv->upload_buffer);
+    }
+  else
+    {
+      g_queue_clear_full (&priv->upload_fences, g_free);
+    }
+
+  priv->upload_buffer = 0;
+  priv->upload_data = NULL;
+}
+
+/*
+ * gdk_gl_context_free_upload_buffer:
+ * @context: a #GdkGLContext
+ *
+ * Deletes the buffer that gdk_gl_context_upload_texture() uses, for
+ * when @context won't be used for uploads anymore. If @context isn't
+ * current, it is bound for this and the previously current context
+ * is bound again afterwards.
+ *
+ * Backends call this in their dispose, before they destroy their
+ * native context.
+ */
+void
+gdk_gl_context_free_upload_buffer (GdkGLContext *context)
+{
+  GdkGLContextPrivate *priv = gdk_gl_context_get_instance_private (context);
+  GdkGLContext *current;
+  GdkDisplay *display;
+
+  if (priv->upload_buffer == 0)
+    return;
+
+  current = gdk_gl_context_get_current ();
+  if (current == context)
+    {
+      gdk_gl_context_clear_upload_buffer (context, TRUE);
+      return;
+    }
+
+  /* Go through the display rather than gdk_gl_context_make_current(),
+   * @context may be in dispose and must not become the current context */
+  display = gdk_draw_context_get_display (GDK_DRAW_CONTEXT (context));
+  if (display == NULL || !gdk_display_make_gl_context_current (display, context))
+    {
+      gdk_gl_context_clear_upload_buffer (context, FALSE);
+      return;
+    }
+
+  gdk_gl_context_clear_upload_buffer (context, TRUE);
+
+  if (current != NULL)
+    gdk_display_make_gl_context_current (gdk_draw_context_get_display (GDK_DRAW_CONTEXT (current)), current);
+  else
+    gdk_display_make_gl_context_current (display, NULL);
+}
+
+/* Returns the offset of size bytes in the upload buffer that the
+ * GPU is done reading from */
+static gsize
+gdk_gl_context_reserve_upload (GdkGLContext *context,
+                               gsize         size)
+{
+  GdkGLContextPrivate *priv = gdk_gl_context_get_instance_private (context);
+  UploadFence *fence;
+  gsize start, end;
+
+  /* upload_pos only ever grows, the offset in the buffer is
+   * upload_pos % UPLOAD_BUFFER_SIZE. Uploads never wrap around. */
+  start = (priv->upload_pos + UPLOAD_ALIGNMENT - 1) & ~((gsize) UPLOAD_ALIGNMENT - 1);
+  if (start % UPLOAD_BUFFER_SIZE + size > UPLOAD_BUFFER_SIZE)
+    start = (start / UPLOAD_BUFFER_SIZE + 1) * UPLOAD_BUFFER_SIZE;
+  end = start + size;
+
+  /* Wait for the uploads that used this memory during the last
+   * round through the buffer. Fences signal in order, so waiting
+   * for the newest of them is enough. */
+  while ((fence = g_queue_peek_head (&priv->upload_fences)) != NULL &&
+         fence->start + UPLOAD_BUFFER_SIZE < end)
+    {
+      UploadFence *next = g_queue_peek_nth (&priv->upload_fences, 1);
+
+      if (next == NULL || next->start + UPLOAD_BUFFER_SIZE >= end)
+        upload_fence_wait (fence);
+
+      upload_fence_free (g_queue_pop_head (&priv->upload_fences));
+    }
+
+  priv->upload_pos = end;
+
+  return start % UPLOAD_BUFFER_SIZE;
+}
+
+/* Like the rest of gdk_gl_context_upload_texture(), but through
+ * the upload buffer. If convert is TRUE, data gets converted to
+ * convert_format on the way.
+ */
+static gboolean
+gdk_gl_context_upload_texture_buffered (GdkGLContext    *context,
+                                        const guchar    *data,
+                                        int              width,
+                                        int              height,
+                                        int              stride,
+                                        GdkMemoryFormat  data_format,
+                                        gboolean         convert,
+                                        GdkMemoryFormat  convert_format,
+                                        guint            bpp,
+                                        guint            gl_format,
+                                        guint            gl_type,
+                                        guint            texture_target)
+{
+  GdkGLContextPrivate *priv = gdk_gl_context_get_instance_private (context);
+  const gsize size = (gsize) width * height * bpp;
+  UploadFence *fence;
+  guchar *dest;
+  gsize offset;
+
+  if (size < MIN_BUFFERED_UPLOAD_SIZE || size > MAX_BUFFERED_UPLOAD_SIZE)
+    return FALSE;
+
+  if (!gdk_gl_context_ensure_upload_buffer (context))
+    return FALSE;
+
+  offset = gdk_gl_context_reserve_upload (context, size);
+  dest = priv->upload_data + offset;
+
+  if (convert)
+    {
+      gdk_memory_convert (dest, width * bpp,
+                          convert_format,
+                          data, stride, data_format,
+                          width, height);
+    }
+  else if (stride == width * bpp)
+    {
+      memcpy (dest, data, size);
+    }
+  else
+    {
+      int i;
+
+      for (i = 0; i < height; i++)
+        memcpy (dest + i * width * bpp, data + i * stride, width * bpp);
+    }
+
+  glBindBuffer (GL_PIXEL_UNPACK_BUFFER, priv->upload_buffer);
+  glPixelStorei (GL_UNPACK_ALIGNMENT, 1);
+
+  glTexImage2D (texture_target, 0, GL_RGBA, width, height, 0, gl_format, gl_type, GSIZE_TO_POINTER (offset));
+
+  glPixelStorei (GL_UNPACK_ALIGNMENT, 4);
+  glBindBuffer (GL_PIXEL_UNPACK_BUFFER, 0);
+
+  fence = g_new (UploadFence, 1);
+  fence->sync = glFenceSync (GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  fence->start = priv->upload_pos - size;
+  g_queue_push_tail (&priv->upload_fences, fence);
+
+  return TRUE;
+}
+
 void
 gdk_gl_context_upload_texture (GdkGLContext    *context,
                                const guchar    *data,
@@ -233,6 +504,8 @@ gdk_gl_context_upload_texture (GdkGLContext    *context,
 {
   GdkGLContextPrivate *priv = gdk_gl_context_get_instance_private (context);
   guchar *copy = NULL;
+  gboolean convert = FALSE;
+  GdkMemoryFormat convert_format = GDK_MEMORY_DEFAULT;
   guint gl_format;
   guint gl_type;
   guint bpp;
@@ -244,13 +517,8 @@ gdk_gl_context_upload_texture (GdkGLContext    *context,
       /* GLES only supports rgba, so convert if necessary */
       if (data_format != GDK_MEMORY_R8G8B8A8_PREMULTIPLIED)
         {
-          copy = g_malloc (width * height * 4);
-          gdk_memory_convert (copy, width * 4,
-                              GDK_MEMORY_R8G8B8A8_PREMULTIPLIED,
-                              data, stride, data_format,
-                              width, height);
-          stride = width * 4;
-          data = copy;
+          convert = TRUE;
+          convert_format = GDK_MEMORY_R8G8B8A8_PREMULTIPLIED;
         }
 
       bpp = 4;
@@ -279,19 +547,32 @@ gdk_gl_context_upload_texture (GdkGLContext    *context,
         }
       else /* Fall-back, convert to cairo-surface-format */
         {
-          copy = g_malloc (width * height * 4);
-          gdk_memory_convert (copy, width * 4,
-                              GDK_MEMORY_DEFAULT,
-                              data, stride, data_format,
-                              width, height);
-          stride = width * 4;
+          convert = TRUE;
+          convert_format = GDK_MEMORY_DEFAULT;
           bpp = 4;
-          data = copy;
           gl_format = GL_BGRA;
           gl_type = GL_UNSIGNED_INT_8_8_8_8_REV;
         }
     }
 
+  if (gdk_gl_context_upload_texture_buffered (context,
+                                              data, width, height, stride, data_format,
+                                              convert, convert_format,
+                                              bpp, gl_format, gl_type,
+                                              texture_target))
+    return;
+
+  if (convert)
+    {
+      copy = g_malloc (width * height * 4);
+      gdk_memory_convert (copy, width * 4,
+                          convert_format,
+                          data, stride, data_format,
+                          width, height);
+      stride = width * 4;
+      data = copy;
+    }
+
   /* GL_UNPACK_ROW_LENGTH is available on desktop GL, OpenGL ES >= 3.0, or if
    * the GL_EXT_unpack_subimage extension for OpenGL ES 2.0 is available
    */
@@ -1036,6 +1317,8 @@ gdk_gl_context_check_extensions (GdkGLContext *context)
 
       priv->has_unpack_subimage = epoxy_has_gl_extension ("GL_EXT_unpack_subimage");
       priv->has_khr_debug = epoxy_has_gl_extension ("GL_KHR_debug");
+      priv->has_buffer_storage = priv->gl_version >= 30 &&
+                                 epoxy_has_gl_extension ("GL_EXT_buffer_storage");
     }
   else
     {
@@ -1044,6 +1327,8 @@ gdk_gl_context_check_extensions (GdkGLContext *context)
 
       priv->has_unpack_subimage = TRUE;
       priv->has_khr_debug = epoxy_has_gl_extension ("GL_KHR_debug");
+      priv->has_buffer_storage = priv->gl_version >= 32 &&
+                                 (priv->gl_version >= 44 || epoxy_has_gl_extension ("GL_ARB_buffer_storage"));
 
       /* We asked for a core profile, but we didn't get one, so we're in legacy mode */
       if (priv->gl_version < 32)
@@ -1064,6 +1349,9 @@ gdk_gl_context_check_extensions (GdkGLContext *context)
   else
     g_warning ("GL implementation doesn't support any form of non-power-of-two textures");
 
+  if (GDK_DISPLAY_DEBUG_CHECK (gdk_draw_context_get_display (GDK_DRAW_CONTEXT (context)), GL_NO_UPLOAD_BUFFER))
+    priv->has_buffer_storage = FALSE;
+
   GDK_DISPLAY_NOTE (gdk_draw_context_get_display (GDK_DRAW_CONTEXT (context)), OPENGL,
     g_message ("%s version: %d.%d (%s)\n"
                        "* GLSL version: %s\n"
@@ -1072,6 +1360,7 @@ gdk_gl_context_check_extensions (GdkGLContext *context)
                        " - GL_ARB_texture_rectangle: %s\n"
                        " - GL_KHR_debug: %s\n"
                        " - GL_EXT_unpack_subimage: %s\n"
+                       " - Buffer storage: %s\n"
                        "* Using texture rectangle: %s",
                        priv->use_es ? "OpenGL ES" : "OpenGL",
                        priv->gl_version / 10, priv->gl_version % 10,
@@ -1081,6 +1370,7 @@ gdk_gl_context_check_extensions (GdkGLContext *context)
                        has_texture_rectangle ? "yes" : "no",
                        priv->has_khr_debug ? "yes" : "no",
                        priv->has_unpack_subimage ? "yes" : "no",
+                       priv->has_buffer_storage ? "yes" : "no",
                        priv->use_texture_rectangle ? "yes" : "no"));
 
   priv->extensions_checked = TRUE;
@@ -21,6 +21,22 @@
 
 #include "gdkmemorytextureprivate.h"
 
+#include "gdkparalleltaskprivate.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#include <immintrin.h>
+#define HAVE_SSSE3_CONVERT 1
+#define HAVE_AVX2_CONVERT 1
+#endif
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#define HAVE_NEON_CONVERT 1
+#endif
+
 struct _GdkMemoryTexture
 {
   GdkTexture parent_instance;
@@ -283,19 +299,482 @@ typedef void (* ConversionFunc) (guchar       *dest_data,
                                  gsize         width,
                                  gsize         height);
 
-static ConversionFunc converters[GDK_MEMORY_N_FORMATS][3] =
+typedef enum {
+  CONVERT_MEMCPY,
+  CONVERT_SWIZZLE,
+  CONVERT_OPAQUE,
+  CONVERT_PREMULTIPLY
+} ConversionKind;
+
+/* Describes what the converter does per pixel, so the vectorized
+ * row functions below can build their shuffle masks from it.
+ */
+typedef struct {
+  ConversionFunc func;
+  ConversionKind kind;
+  gint8 src_byte[4];   /* source byte of each dest byte, -1 for opaque alpha */
+  guint8 alpha_byte;   /* dest byte holding alpha */
+} Converter;
+
+#define MEMCPY_CONVERTER \
+  { convert_memcpy, CONVERT_MEMCPY, { 0, 1, 2, 3 }, 0 }
+#define SWIZZLE_CONVERTER(A,R,G,B) \
+  { convert_swizzle ## A ## R ## G ## B, CONVERT_SWIZZLE, \
+    { [A] = 0, [R] = 1, [G] = 2, [B] = 3 }, A }
+#define SWIZZLE_OPAQUE_CONVERTER(A,R,G,B) \
+  { convert_swizzle_opaque_## A ## R ## G ## B, CONVERT_OPAQUE, \
+    { [A] = -1, [R] = 0, [G] = 1, [B] = 2 }, A }
+#define SWIZZLE_PREMULTIPLY_CONVERTER(A,R,G,B, A2,R2,G2,B2) \
+  { convert_swizzle_premultiply_ ## A ## R ## G ## B ## _ ## A2 ## R2 ## G2 ## B2, CONVERT_PREMULTIPLY, \
+    { [A] = A2, [R] = R2, [G] = G2, [B] = B2 }, A }
+
+static const Converter converters[GDK_MEMORY_N_FORMATS][3] =
 {
-  { convert_memcpy, convert_swizzle3210, convert_swizzle2103 },
-  { convert_swizzle3210, convert_memcpy, convert_swizzle3012 },
-  { convert_swizzle2103, convert_swizzle1230, convert_memcpy },
-  { convert_swizzle_premultiply_3210_3210, convert_swizzle_premultiply_0123_3210, convert_swizzle_premultiply_3012_3210,  },
-  { convert_swizzle_premultiply_3210_0123, convert_swizzle_premultiply_0123_0123, convert_swizzle_premultiply_3012_0123 },
-  { convert_swizzle_premultiply_3210_3012, convert_swizzle_premultiply_0123_3012, convert_swizzle_premultiply_3012_3012 },
-  { convert_swizzle_premultiply_3210_0321, convert_swizzle_premultiply_0123_0321, convert_swizzle_premultiply_3012_0321 },
-  { convert_swizzle_opaque_3210, convert_swizzle_opaque_0123, convert_swizzle_opaque_3012 },
-  { convert_swizzle_opaque_3012, convert_swizzle_opaque_0321, convert_swizzle_opaque_3210 }
+  { MEMCPY_CONVERTER, SWIZZLE_CONVERTER (3,2,1,0), SWIZZLE_CONVERTER (2,1,0,3) },
+  { SWIZZLE_CONVERTER (3,2,1,0), MEMCPY_CONVERTER, SWIZZLE_CONVERTER (3,0,1,2) },
+  { SWIZZLE_CONVERTER (2,1,0,3), SWIZZLE_CONVERTER (1,2,3,0), MEMCPY_CONVERTER },
+  { SWIZZLE_PREMULTIPLY_CONVERTER (3,2,1,0, 3,2,1,0), SWIZZLE_PREMULTIPLY_CONVERTER (0,1,2,3, 3,2,1,0), SWIZZLE_PREMULTIPLY_CONVERTER (3,0,1,2, 3,2,1,0) },
+  { SWIZZLE_PREMULTIPLY_CONVERTER (3,2,1,0, 0,1,2,3), SWIZZLE_PREMULTIPLY_CONVERTER (0,1,2,3, 0,1,2,3), SWIZZLE_PREMULTIPLY_CONVERTER (3,0,1,2, 0,1,2,3) },
+  { SWIZZLE_PREMULTIPLY_CONVERTER (3,2,1,0, 3,0,1,2), SWIZZLE_PREMULTIPLY_CONVERTER (0,1,2,3, 3,0,1,2), SWIZZLE_PREMULTIPLY_CONVERTER (3,0,1,2, 3,0,1,2) },
+  { SWIZZLE_PREMULTIPLY_CONVERTER (3,2,1,0, 0,3,2,1), SWIZZLE_PREMULTIPLY_CONVERTER (0,1,2,3, 0,3,2,1), SWIZZLE_PREMULTIPLY_CONVERTER (3,0,1,2, 0,3,2,1) },
+  { SWIZZLE_OPAQUE_CONVERTER (3,2,1,0), SWIZZLE_OPAQUE_CONVERTER (0,1,2,3), SWIZZLE_OPAQUE_CONVERTER (3,0,1,2) },
+  { SWIZZLE_OPAQUE_CONVERTER (3,0,1,2), SWIZZLE_OPAQUE_CONVERTER (0,3,2,1), SWIZZLE_OPAQUE_CONVERTER (3,2,1,0) }
 };
 
+/* Byte shuffles for 4 consecutive pixels, i.e. one 128-bit vector
+ * of destination pixels. Index 0x80 produces a zero byte.
+ */
+typedef struct {
+  guint8 shuffle[16];         /* the source byte of each dest byte */
+  guint8 alpha_shuffle[16];   /* the source alpha byte of each dest byte */
+  guint8 alpha_mask[16];      /* 0xFF for the alpha bytes in dest */
+} ConversionMasks;
+
+static void
+converter_init_masks (const Converter *converter,
+                      ConversionMasks *masks)
+{
+  const guint src_bpp = converter->kind == CONVERT_OPAQUE ? 3 : 4;
+  const int src_alpha = converter->src_byte[converter->alpha_byte];
+  guint p, j;
+
+  for (p = 0; p < 4; p++)
+    for (j = 0; j < 4; j++)
+      {
+        const guint i = 4 * p + j;
+
+        if (converter->src_byte[j] < 0)
+          masks->shuffle[i] = 0x80;
+        else
+          masks->shuffle[i] = src_bpp * p + converter->src_byte[j];
+
+        if (src_alpha < 0)
+          masks->alpha_shuffle[i] = 0x80;
+        else
+          masks->alpha_shuffle[i] = 4 * p + src_alpha;
+
+        masks->alpha_mask[i] = j == converter->alpha_byte ? 0xFF : 0;
+      }
+}
+
+/* Converts the leading pixels of a single row that fit the vector
+ * size and returns how many it converted. The rest of the row is left
+ * to the converter's scalar function.
+ */
+typedef gsize (* RowConversionFunc) (ConversionKind         kind,
+                                     const ConversionMasks *masks,
+                                     guchar                *dest,
+                                     const guchar          *src,
+                                     gsize                  width);
+
+/* All the functions below reproduce PREMULTIPLY() exactly:
+ * t = c * a + 0x80 fits into 16 bits, and so does (t >> 8) + t.
+ *
+ * Converting from 3 bytes per pixel loads 4 bytes past the pixels
+ * that are converted, so those loops stop early enough to not read
+ * past the end of the row.
+ */
+
+#ifdef HAVE_SSSE3_CONVERT
+static inline __m128i
+premultiply_epi16 (__m128i c,
+                   __m128i a)
+{
+  __m128i t = _mm_add_epi16 (_mm_mullo_epi16 (c, a), _mm_set1_epi16 (0x80));
+
+  return _mm_srli_epi16 (_mm_add_epi16 (_mm_srli_epi16 (t, 8), t), 8);
+}
+
+__attribute__((target ("ssse3")))
+static gsize
+convert_row_ssse3 (ConversionKind         kind,
+                   const ConversionMasks *masks,
+                   guchar                *dest,
+                   const guchar          *src,
+                   gsize                  width)
+{
+  const __m128i shuffle = _mm_loadu_si128 ((const __m128i *) masks->shuffle);
+  const __m128i alpha_shuffle = _mm_loadu_si128 ((const __m128i *) masks->alpha_shuffle);
+  const __m128i alpha_mask = _mm_loadu_si128 ((const __m128i *) masks->alpha_mask);
+  const __m128i zero = _mm_setzero_si128 ();
+  gsize x = 0;
+
+  switch (kind)
+    {
+    case CONVERT_SWIZZLE:
+      for (; x + 4 <= width; x += 4)
+        {
+          __m128i p = _mm_loadu_si128 ((const __m128i *) (src + 4 * x));
+
+          _mm_storeu_si128 ((__m128i *) (dest + 4 * x), _mm_shuffle_epi8 (p, shuffle));
+        }
+      break;
+
+    case CONVERT_OPAQUE:
+      for (; x + 6 <= width; x += 4)
+        {
+          __m128i p = _mm_loadu_si128 ((const __m128i *) (src + 3 * x));
+
+          _mm_storeu_si128 ((__m128i *) (dest + 4 * x),
+                            _mm_or_si128 (_mm_shuffle_epi8 (p, shuffle), alpha_mask));
+        }
+      break;
+
+    case CONVERT_PREMULTIPLY:
+      for (; x + 4 <= width; x += 4)
+        {
+          __m128i p = _mm_loadu_si128 ((const __m128i *) (src + 4 * x));
+          __m128i c = _mm_shuffle_epi8 (p, shuffle);
+          __m128i a = _mm_shuffle_epi8 (p, alpha_shuffle);
+          __m128i lo = premultiply_epi16 (_mm_unpacklo_epi8 (c, zero), _mm_unpacklo_epi8 (a, zero));
+          __m128i hi = premultiply_epi16 (_mm_unpackhi_epi8 (c, zero), _mm_unpackhi_epi8 (a, zero));
+          __m128i result = _mm_packus_epi16 (lo, hi);
+
+          _mm_storeu_si128 ((__m128i *) (dest + 4 * x),
+                            _mm_or_si128 (_mm_andnot_si128 (alpha_mask, result),
+                                          _mm_and_si128 (alpha_mask, c)));
+        }
+      break;
+
+    case CONVERT_MEMCPY:
+    default:
+      break;
+    }
+
+  return x;
+}
+#endif
+
+#ifdef HAVE_AVX2_CONVERT
+__attribute__((target ("avx2")))
+static inline __m256i
+premultiply_epi16_avx2 (__m256i c,
+                        __m256i a)
+{
+  __m256i t = _mm256_add_epi16 (_mm256_mullo_epi16 (c, a), _mm256_set1_epi16 (0x80));
+
+  return _mm256_srli_epi16 (_mm256_add_epi16 (_mm256_srli_epi16 (t, 8), t), 8);
+}
+
+/* The byte shuffles work within each 128-bit lane, which holds
+ * 4 pixels, so the masks are simply used for both lanes.
+ */
+__attribute__((target ("avx2")))
+static gsize
+convert_row_avx2 (ConversionKind         kind,
+                  const ConversionMasks *masks,
+                  guchar                *dest,
+                  const guchar          *src,
+                  gsize                  width)
+{
+  const __m256i shuffle = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i *) masks->shuffle));
+  const __m256i alpha_shuffle = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i *) masks->alpha_shuffle));
+  const __m256i alpha_mask = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i *) masks->alpha_mask));
+  const __m256i zero = _mm256_setzero_si256 ();
+  gsize x = 0;
+
+  switch (kind)
+    {
+    case CONVERT_SWIZZLE:
+      for (; x + 8 <= width; x += 8)
+        {
+          __m256i p = _mm256_loadu_si256 ((const __m256i *) (src + 4 * x));
+
+          _mm256_storeu_si256 ((__m256i *) (dest + 4 * x), _mm256_shuffle_epi8 (p, shuffle));
+        }
+      break;
+
+    case CONVERT_OPAQUE:
+      for (; x + 10 <= width; x += 8)
+        {
+          __m256i p = _mm256_inserti128_si256 (_mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *) (src + 3 * x))),
+                                               _mm_loadu_si128 ((const __m128i *) (src + 3 * x + 12)),
+                                               1);
+
+          _mm256_storeu_si256 ((__m256i *) (dest + 4 * x),
+                               _mm256_or_si256 (_mm256_shuffle_epi8 (p, shuffle), alpha_mask));
+        }
+      break;
+
+    case CONVERT_PREMULTIPLY:
+      for (; x + 8 <= width; x += 8)
+        {
+          __m256i p = _mm256_loadu_si256 ((const __m256i *) (src + 4 * x));
+          __m256i c = _mm256_shuffle_epi8 (p, shuffle);
+          __m256i a = _mm256_shuffle_epi8 (p, alpha_shuffle);
+          __m256i lo = premultiply_epi16_avx2 (_mm256_unpacklo_epi8 (c, zero), _mm256_unpacklo_epi8 (a, zero));
+          __m256i hi = premultiply_epi16_avx2 (_mm256_unpackhi_epi8 (c, zero), _mm256_unpackhi_epi8 (a, zero));
+          __m256i result = _mm256_packus_epi16 (lo, hi);
+
+          _mm256_storeu_si256 ((__m256i *) (dest + 4 * x),
+                               _mm256_blendv_epi8 (result, c, alpha_mask));
+        }
+      break;
+
+    case CONVERT_MEMCPY:
+    default:
+      break;
+    }
+
+  return x;
+}
+#endif
+
+#ifdef HAVE_NEON_CONVERT
+static gsize
+convert_row_neon (ConversionKind         kind,
+                  const ConversionMasks *masks,
+                  guchar                *dest,
+                  const guchar          *src,
+                  gsize                  width)
+{
+  const uint8x16_t shuffle = vld1q_u8 (masks->shuffle);
+  const uint8x16_t alpha_shuffle = vld1q_u8 (masks->alpha_shuffle);
+  const uint8x16_t alpha_mask = vld1q_u8 (masks->alpha_mask);
+  const uint16x8_t round = vdupq_n_u16 (0x80);
+  gsize x = 0;
+
+  switch (kind)
+    {
+    case CONVERT_SWIZZLE:
+      for (; x + 4 <= width; x += 4)
+        vst1q_u8 (dest + 4 * x, vqtbl1q_u8 (vld1q_u8 (src + 4 * x), shuffle));
+      break;
+
+    case CONVERT_OPAQUE:
+      for (; x + 6 <= width; x += 4)
+        vst1q_u8 (dest + 4 * x, vorrq_u8 (vqtbl1q_u8 (vld1q_u8 (src + 3 * x), shuffle), alpha_mask));
+      break;
+
+    case CONVERT_PREMULTIPLY:
+      for (; x + 4 <= width; x += 4)
+        {
+          uint8x16_t p = vld1q_u8 (src + 4 * x);
+          uint8x16_t c = vqtbl1q_u8 (p, shuffle);
+          uint8x16_t a = vqtbl1q_u8 (p, alpha_shuffle);
+          uint16x8_t lo = vaddq_u16 (vmull_u8 (vget_low_u8 (c), vget_low_u8 (a)), round);
+          uint16x8_t hi = vaddq_u16 (vmull_u8 (vget_high_u8 (c), vget_high_u8 (a)), round);
+          uint8x16_t result = vcombine_u8 (vshrn_n_u16 (vsraq_n_u16 (lo, lo, 8), 8),
+                                           vshrn_n_u16 (vsraq_n_u16 (hi, hi, 8), 8));
+
+          vst1q_u8 (dest + 4 * x, vbslq_u8 (alpha_mask, c, result));
+        }
+      break;
+
+    case CONVERT_MEMCPY:
+    default:
+      break;
+    }
+
+  return x;
+}
+#endif
+
+/* Returns %FALSE if @impl isn't compiled in or the CPU can't run it */
+static gboolean
+get_row_conversion_func_for_impl (GdkMemoryConvertImpl  impl,
+                                  RowConversionFunc    *func)
+{
+  switch (impl)
+    {
+    case GDK_MEMORY_CONVERT_SCALAR:
+      *func = NULL;
+      return TRUE;
+
+    case GDK_MEMORY_CONVERT_SSSE3:
+#ifdef HAVE_SSSE3_CONVERT
+      *func = convert_row_ssse3;
+      return __builtin_cpu_supports ("ssse3");
+#else
+      return FALSE;
+#endif
+
+    case GDK_MEMORY_CONVERT_AVX2:
+#ifdef HAVE_AVX2_CONVERT
+      *func = convert_row_avx2;
+      return __builtin_cpu_supports ("avx2");
+#else
+      return FALSE;
+#endif
+
+    case GDK_MEMORY_CONVERT_NEON:
+#ifdef HAVE_NEON_CONVERT
+      *func = convert_row_neon;
+      return TRUE;
+#else
+      return FALSE;
+#endif
+
+    default:
+      g_assert_not_reached ();
+      return FALSE;
+    }
+}
+
+static RowConversionFunc
+get_row_conversion_func (void)
+{
+  static gsize initialized = FALSE;
+  static RowConversionFunc func = NULL;
+
+  if (g_once_init_enter (&initialized))
+    {
+#if defined(HAVE_AVX2_CONVERT)
+      if (__builtin_cpu_supports ("avx2"))
+        func = convert_row_avx2;
+      else
+#endif
+#if defined(HAVE_SSSE3_CONVERT)
+      if (__builtin_cpu_supports ("ssse3"))
+        func = convert_row_ssse3;
+#elif defined(HAVE_NEON_CONVERT)
+      func = convert_row_neon;
+#endif
+
+      g_once_init_leave (&initialized, TRUE);
+    }
+
+  return func;
+}
+
+/* Conversions of at least this many pixels are split into bands
+ * of rows that are converted in parallel */
+#define MIN_PARALLEL_PIXELS (512 * 512)
+#define BAND_PIXELS (64 * 1024)
+
+typedef struct
+{
+  const Converter *converter;
+  RowConversionFunc convert_row;
+  ConversionMasks masks;
+  guchar *dest_data;
+  gsize dest_stride;
+  const guchar *src_data;
+  gsize src_stride;
+  gsize src_bpp;
+  gsize width;
+  gsize height;
+  gsize band_height;
+  int n_bands;
+  int next_band;
+} Conversion;
+
+static void
+convert_rows (Conversion *conversion,
+              gsize       y_start,
+              gsize       y_end)
+{
+  const Converter *converter = conversion->converter;
+  guchar *dest_data = conversion->dest_data + y_start * conversion->dest_stride;
+  const guchar *src_data = conversion->src_data + y_start * conversion->src_stride;
+  gsize y;
+
+  if (conversion->convert_row == NULL)
+    {
+      converter->func (dest_data, conversion->dest_stride,
+                       src_data, conversion->src_stride,
+                       conversion->width, y_end - y_start);
+      return;
+    }
+
+  for (y = y_start; y < y_end; y++)
+    {
+      gsize x = conversion->convert_row (converter->kind, &conversion->masks,
+                                         dest_data, src_data, conversion->width);
+
+      if (x < conversion->width)
+        converter->func (dest_data + 4 * x, conversion->dest_stride,
+                         src_data + conversion->src_bpp * x, conversion->src_stride,
+                         conversion->width - x, 1);
+
+      dest_data += conversion->dest_stride;
+      src_data += conversion->src_stride;
+    }
+}
+
+static void
+convert_bands (gpointer data)
+{
+  Conversion *conversion = data;
+  int band;
+
+  while ((band = g_atomic_int_add (&conversion->next_band, 1)) < conversion->n_bands)
+    {
+      gsize y_start = band * conversion->band_height;
+      gsize y_end = MIN (y_start + conversion->band_height, conversion->height);
+
+      convert_rows (conversion, y_start, y_end);
+    }
+}
+
+static void
+memory_convert (RowConversionFunc  convert_row,
+                guchar            *dest_data,
+                gsize              dest_stride,
+                GdkMemoryFormat    dest_format,
+                const guchar      *src_data,
+                gsize              src_stride,
+                GdkMemoryFormat    src_format,
+                gsize              width,
+                gsize              height)
+{
+  Conversion conversion;
+  guint n_tasks;
+
+  g_assert (dest_format < 3);
+  g_assert (src_format < GDK_MEMORY_N_FORMATS);
+
+  conversion.converter = &converters[src_format][dest_format];
+  conversion.dest_data = dest_data;
+  conversion.dest_stride = dest_stride;
+  conversion.src_data = src_data;
+  conversion.src_stride = src_stride;
+  conversion.src_bpp = gdk_memory_format_bytes_per_pixel (src_format);
+  conversion.width = width;
+  conversion.height = height;
+
+  if (conversion.converter->kind == CONVERT_MEMCPY)
+    conversion.convert_row = NULL;
+  else
+    conversion.convert_row = convert_row;
+
+  if (conversion.convert_row != NULL)
+    converter_init_masks (conversion.converter, &conversion.masks);
+
+  n_tasks = gdk_parallel_task_get_max_tasks ();
+  if (n_tasks < 2 || width * height < MIN_PARALLEL_PIXELS)
+    {
+      convert_rows (&conversion, 0, height);
+      return;
+    }
+
+  conversion.band_height = MAX (BAND_PIXELS / width, 1);
+  conversion.n_bands = (height + conversion.band_height - 1) / conversion.band_height;
+  conversion.next_band = 0;
+
+  gdk_parallel_task_run (convert_bands, &conversion, MIN (n_tasks, (guint) conversion.n_bands));
+}
+
 void
 gdk_memory_convert (guchar          *dest_data,
                     gsize            dest_stride,
@@ -306,8 +785,42 @@ gdk_memory_convert (guchar          *dest_data,
                     gsize            width,
                     gsize            height)
 {
-  g_assert (dest_format < 3);
-  g_assert (src_format < GDK_MEMORY_N_FORMATS);
+  memory_convert (get_row_conversion_func (),
+                  dest_data, dest_stride, dest_format,
+                  src_data, src_stride, src_format,
+                  width, height);
+}
+
+/*<private>
+ * gdk_memory_convert_with_impl:
+ * @impl: the row conversion to use
+ *
+ * Like gdk_memory_convert(), but uses @impl instead of the best
+ * row conversion for the CPU, so tests can compare them.
+ *
+ * Returns: %FALSE if @impl isn't available on this CPU and nothing
+ *   was converted
+ */
+gboolean
+gdk_memory_convert_with_impl (GdkMemoryConvertImpl  impl,
+                              guchar               *dest_data,
+                              gsize                 dest_stride,
+                              GdkMemoryFormat       dest_format,
+                              const guchar         *src_data,
+                              gsize                 src_stride,
+                              GdkMemoryFormat       src_format,
+                              gsize                 width,
+                              gsize                 height)
+{
+  RowConversionFunc convert_row;
+
+  if (!get_row_conversion_func_for_impl (impl, &convert_row))
+    return FALSE;
+
+  memory_convert (convert_row,
+                  dest_data, dest_stride, dest_format,
+                  src_data, src_stride, src_format,
+                  width, height);
 
-  converters[src_format][dest_format] (dest_data, dest_stride, src_data, src_stride, width, height);
+  return TRUE;
 }
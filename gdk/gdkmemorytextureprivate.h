@@ -31,6 +31,14 @@ G_BEGIN_DECLS
 
 #define GDK_MEMORY_CAIRO_FORMAT_ARGB32 GDK_MEMORY_DEFAULT
 
+typedef enum {
+  GDK_MEMORY_CONVERT_SCALAR,
+  GDK_MEMORY_CONVERT_SSSE3,
+  GDK_MEMORY_CONVERT_AVX2,
+  GDK_MEMORY_CONVERT_NEON,
+  GDK_MEMORY_CONVERT_N_IMPLS
+} GdkMemoryConvertImpl;
+
 gsize                   gdk_memory_format_bytes_per_pixel   (GdkMemoryFormat    format);
 
 GdkMemoryFormat         gdk_memory_texture_get_format       (GdkMemoryTexture  *self);
@@ -45,7 +53,15 @@ void                    gdk_memory_convert                  (guchar            *
                                                              GdkMemoryFormat    src_format,
                                                              gsize              width,
                                                              gsize              height);
-
+gboolean                gdk_memory_convert_with_impl        (GdkMemoryConvertImpl impl,
+                                                             guchar            *dest_data,
+                                                             gsize              dest_stride,
+                                                             GdkMemoryFormat    dest_format,
+                                                             const guchar      *src_data,
+                                                             gsize              src_stride,
+                                                             GdkMemoryFormat    src_format,
+                                                             gsize              width,
+                                                             gsize              height);
 
 G_END_DECLS
 
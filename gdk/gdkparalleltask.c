@@ -0,0 +1,147 @@
+/* GDK - The GIMP Drawing Kit
+ *
+ * Copyright 2020 GNOME Foundation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "gdkparalleltaskprivate.h"
+
+typedef struct _TaskData TaskData;
+
+struct _TaskData
+{
+  GdkTaskFunc task_func;
+  gpointer task_data;
+
+  GMutex mutex;
+  GCond cond;
+  guint n_running_tasks;
+};
+
+/* Set while running a task, so tasks that start tasks themselves
+ * don't wait for pool threads that are all busy waiting as well */
+static GPrivate in_task;
+
+static void
+gdk_parallel_task_thread_func (gpointer data,
+                               gpointer unused)
+{
+  TaskData *task = data;
+
+  g_private_set (&in_task, GUINT_TO_POINTER (TRUE));
+  task->task_func (task->task_data);
+  g_private_set (&in_task, NULL);
+
+  g_mutex_lock (&task->mutex);
+  task->n_running_tasks--;
+  if (task->n_running_tasks == 0)
+    g_cond_signal (&task->cond);
+  g_mutex_unlock (&task->mutex);
+}
+
+static GThreadPool *
+gdk_parallel_task_get_pool (void)
+{
+  static GThreadPool *pool;
+
+  if (g_once_init_enter (&pool))
+    {
+      GThreadPool *the_pool;
+
+      /* The calling thread runs one of the tasks itself */
+      the_pool = g_thread_pool_new (gdk_parallel_task_thread_func,
+                                    NULL,
+                                    MAX (2, g_get_num_processors ()) - 1,
+                                    FALSE,
+                                    NULL);
+
+      g_once_init_leave (&pool, the_pool);
+    }
+
+  return pool;
+}
+
+/**
+ * gdk_parallel_task_get_max_tasks:
+ *
+ * Returns the number of tasks that gdk_parallel_task_run() can
+ * run at the same time.
+ *
+ * Returns: the maximum number of useful tasks
+ */
+guint
+gdk_parallel_task_get_max_tasks (void)
+{
+  return MAX (1, g_get_num_processors ());
+}
+
+/**
+ * gdk_parallel_task_run:
+ * @task_func: the function to run
+ * @task_data: data to pass to @task_func
+ * @n_tasks: how often to run @task_func, or 0 for as often as
+ *   there are processors
+ *
+ * Runs @task_func @n_tasks times in parallel, one of them on the
+ * calling thread, and waits for all of them to finish.
+ *
+ * @task_func is expected to split up the work between the tasks
+ * itself, usually by picking work items from @task_data until
+ * none are left.
+ *
+ * When called from within a task, @task_func is only run once,
+ * on the calling thread.
+ */
+void
+gdk_parallel_task_run (GdkTaskFunc task_func,
+                       gpointer    task_data,
+                       guint       n_tasks)
+{
+  GThreadPool *pool;
+  TaskData task;
+  guint i;
+
+  if (n_tasks == 0)
+    n_tasks = gdk_parallel_task_get_max_tasks ();
+
+  if (n_tasks == 1 || g_private_get (&in_task) != NULL)
+    {
+      task_func (task_data);
+      return;
+    }
+
+  pool = gdk_parallel_task_get_pool ();
+
+  task.task_func = task_func;
+  task.task_data = task_data;
+  g_mutex_init (&task.mutex);
+  g_cond_init (&task.cond);
+  task.n_running_tasks = n_tasks;
+
+  for (i = 1; i < n_tasks; i++)
+    g_thread_pool_push (pool, &task, NULL);
+
+  gdk_parallel_task_thread_func (&task, NULL);
+
+  g_mutex_lock (&task.mutex);
+  while (task.n_running_tasks > 0)
+    g_cond_wait (&task.cond, &task.mutex);
+  g_mutex_unlock (&task.mutex);
+
+  g_mutex_clear (&task.mutex);
+  g_cond_clear (&task.cond);
+}
@@ -442,7 +442,11 @@ gdk_macos_gl_context_dispose (GObject *gobject)
 
   if (self->gl_context != nil)
     {
-      NSOpenGLContext *gl_context = g_steal_pointer (&self->gl_context);
+      NSOpenGLContext *gl_context;
+
+      gdk_gl_context_free_upload_buffer (GDK_GL_CONTEXT (self));
+
+      gl_context = g_steal_pointer (&self->gl_context);
 
       if (gl_context == [NSOpenGLContext currentContext])
         [NSOpenGLContext clearCurrentContext];
@@ -483,6 +483,8 @@ gdk_wayland_gl_context_dispose (GObject *gobject)
       GdkDisplay *display = gdk_surface_get_display (surface);
       GdkWaylandDisplay *display_wayland = GDK_WAYLAND_DISPLAY (display);
 
+      gdk_gl_context_free_upload_buffer (context);
+
       if (eglGetCurrentContext () == context_wayland->egl_context)
         eglMakeCurrent(display_wayland->egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE,
                        EGL_NO_CONTEXT);
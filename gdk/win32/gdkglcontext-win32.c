@@ -57,6 +57,8 @@ _gdk_win32_gl_context_dispose (GObject *gobject)
 
   if (display_win32 != NULL)
     {
+      gdk_gl_context_free_upload_buffer (context);
+
       if (display_win32->have_wgl)
         {
           if (wglGetCurrentContext () == context_win32->hglrc)
@@ -695,6 +695,8 @@ gdk_x11_gl_context_dispose (GObject *gobject)
       GdkDisplay *display = gdk_gl_context_get_display (context);
       Display *dpy = gdk_x11_display_get_xdisplay (display);
 
+      gdk_gl_context_free_upload_buffer (context);
+
       if (glXGetCurrentContext () == context_x11->glx_context)
         glXMakeContextCurrent (dpy, None, None, NULL);
 
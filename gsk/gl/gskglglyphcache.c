@@ -8,11 +8,13 @@
 
 #include "gdk/gdkglcontextprivate.h"
 #include "gdk/gdkmemorytextureprivate.h"
+#include "gdk/gdkparalleltaskprivate.h"
 
 #include <graphene.h>
 #include <cairo.h>
 #include <epoxy/gl.h>
 #include <string.h>
+#include <math.h>
 
 /* Cache eviction strategy
  *
@@ -22,8 +24,9 @@
  *
  * We keep count of the pixels of each atlas that are
  * taken up by old data. When the fraction of old pixels
- * gets too high, we drop the atlas and all the items it
- * contained.
+ * gets too high, the atlas is retired. We move the glyphs
+ * that are still in use to another atlas and drop the
+ * rest.
  *
  * Big glyphs are not stored in the atlas, they get their
  * own texture, but they are still cached.
@@ -31,6 +34,19 @@
 
 #define MAX_FRAME_AGE (60)
 #define MAX_GLYPH_SIZE 128 /* Will get its own texture if bigger */
+#define MIN_PARALLEL_GLYPHS 4 /* per task */
+
+/* Glyphs that are missing while adding the ops for a frame are
+ * rasterized together in parallel and uploaded before the ops are
+ * executed, see gsk_gl_glyph_cache_upload_pending().
+ */
+typedef struct
+{
+  GlyphCacheKey *key; /* owned by the hash table */
+  GskGLCachedGlyph *value;
+  cairo_scaled_font_t *scaled_font;
+  guchar *data;
+} PendingGlyph;
 
 static guint    glyph_cache_hash       (gconstpointer v);
 static gboolean glyph_cache_equal      (gconstpointer v1,
@@ -51,6 +67,9 @@ gsk_gl_glyph_cache_new (GdkDisplay *display,
                                                    glyph_cache_key_free, glyph_cache_value_free);
 
   glyph_cache->atlases = gsk_gl_texture_atlases_ref (atlases);
+  glyph_cache->disk_cache = gsk_glyph_disk_cache_get_default ();
+  glyph_cache->prewarm_tasks = g_ptr_array_new_with_free_func (g_object_unref);
+  glyph_cache->pending = g_array_new (FALSE, FALSE, sizeof (PendingGlyph));
 
   glyph_cache->ref_count = 1;
 
@@ -73,6 +92,8 @@ gsk_gl_glyph_cache_unref (GskGLGlyphCache *self)
   if (self->ref_count == 1)
     {
       gsk_gl_texture_atlases_unref (self->atlases);
+      g_ptr_array_unref (self->prewarm_tasks);
+      g_array_unref (self->pending);
       g_hash_table_unref (self->hash_table);
       g_free (self);
       return;
@@ -110,129 +131,272 @@ glyph_cache_value_free (gpointer v)
   g_free (v);
 }
 
-static gboolean
-render_glyph (GlyphCacheKey    *key,
-              GskGLCachedGlyph *value,
-              GskImageRegion   *region)
+/* Apart from hex boxes, glyphs are drawn with just the cairo
+ * font, which is thread-safe, so they can be rasterized in a thread */
+static void
+rasterize_glyph (cairo_scaled_font_t    *scaled_font,
+                 const CacheKeyData     *key,
+                 const GskGLCachedGlyph *value,
+                 guchar                 *data,
+                 int                     width,
+                 int                     height,
+                 int                     stride)
 {
   cairo_surface_t *surface;
   cairo_t *cr;
-  cairo_scaled_font_t *scaled_font;
-  PangoGlyphString glyph_string;
-  PangoGlyphInfo glyph_info;
-  int surface_width, surface_height;
-  int stride;
-  unsigned char *data;
-
-  scaled_font = pango_cairo_font_get_scaled_font ((PangoCairoFont *)key->data.font);
-  if (G_UNLIKELY (!scaled_font || cairo_scaled_font_status (scaled_font) != CAIRO_STATUS_SUCCESS))
-    {
-      g_warning ("Failed to get a font");
-      return FALSE;
-    }
 
-  surface_width = value->draw_width * key->data.scale / 1024;
-  surface_height = value->draw_height * key->data.scale / 1024;
-
-  stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32, surface_width);
-  data = g_malloc0 (stride * surface_height);
   surface = cairo_image_surface_create_for_data (data, CAIRO_FORMAT_ARGB32,
-                                                 surface_width, surface_height,
+                                                 width, height,
                                                  stride);
-  cairo_surface_set_device_scale (surface, key->data.scale / 1024.0, key->data.scale / 1024.0);
+  cairo_surface_set_device_scale (surface, key->scale / 1024.0, key->scale / 1024.0);
 
   cr = cairo_create (surface);
 
   cairo_set_scaled_font (cr, scaled_font);
   cairo_set_source_rgba (cr, 1, 1, 1, 1);
 
-  glyph_info.glyph = key->data.glyph;
-  glyph_info.geometry.width = value->draw_width * 1024;
-  if (glyph_info.glyph & PANGO_GLYPH_UNKNOWN_FLAG)
-    glyph_info.geometry.x_offset = 250 * key->data.xshift;
-  else
-    glyph_info.geometry.x_offset = 250 * key->data.xshift - value->draw_x * 1024;
-  glyph_info.geometry.y_offset = 250 * key->data.yshift - value->draw_y * 1024;
+  if (key->glyph & PANGO_GLYPH_UNKNOWN_FLAG)
+    {
+      PangoGlyphString glyph_string;
+      PangoGlyphInfo glyph_info;
 
-  glyph_string.num_glyphs = 1;
-  glyph_string.glyphs = &glyph_info;
+      /* Hex boxes are drawn by pango */
+      glyph_info.glyph = key->glyph;
+      glyph_info.geometry.width = value->draw_width * 1024;
+      glyph_info.geometry.x_offset = 250 * key->xshift;
+      glyph_info.geometry.y_offset = 250 * key->yshift - value->draw_y * 1024;
 
-  pango_cairo_show_glyph_string (cr, key->data.font, &glyph_string);
-  cairo_destroy (cr);
+      glyph_string.num_glyphs = 1;
+      glyph_string.glyphs = &glyph_info;
 
-  cairo_surface_flush (surface);
-
-  region->width = cairo_image_surface_get_width (surface);
-  region->height = cairo_image_surface_get_height (surface);
-  region->stride = cairo_image_surface_get_stride (surface);
-  region->data = data;
-  if (value->atlas)
-    {
-      region->x = (gsize)(value->tx * value->atlas->width);
-      region->y = (gsize)(value->ty * value->atlas->height);
+      pango_cairo_show_glyph_string (cr, key->font, &glyph_string);
     }
   else
     {
-      region->x = 0;
-      region->y = 0;
+      cairo_glyph_t glyph;
+
+      glyph.index = key->glyph;
+      glyph.x = (double)(250 * key->xshift - value->draw_x * 1024) / PANGO_SCALE;
+      glyph.y = (double)(250 * key->yshift - value->draw_y * 1024) / PANGO_SCALE;
+
+      cairo_show_glyphs (cr, &glyph, 1);
     }
 
+  cairo_destroy (cr);
+
+  cairo_surface_flush (surface);
   cairo_surface_destroy (surface);
+}
+
+static cairo_scaled_font_t *
+get_scaled_font (PangoFont *font)
+{
+  cairo_scaled_font_t *scaled_font;
+
+  scaled_font = pango_cairo_font_get_scaled_font ((PangoCairoFont *)font);
+  if (G_UNLIKELY (!scaled_font || cairo_scaled_font_status (scaled_font) != CAIRO_STATUS_SUCCESS))
+    {
+      g_warning ("Failed to get a font");
+      return NULL;
+    }
 
-  return TRUE;
+  return scaled_font;
 }
 
+/* @pixels are the pixels of the glyph with a stride of 4 * width if
+ * it has been rasterized already, or %NULL to rasterize it now */
 static void
-upload_glyph (GlyphCacheKey    *key,
-              GskGLCachedGlyph *value)
+upload_glyph (GskGLGlyphCache  *self,
+              GlyphCacheKey    *key,
+              GskGLCachedGlyph *value,
+              const guchar     *pixels)
 {
-  GskImageRegion r;
+  const int width = value->draw_width * key->data.scale / 1024;
+  const int height = value->draw_height * key->data.scale / 1024;
+  cairo_scaled_font_t *scaled_font;
   guchar *pixel_data;
   guchar *free_data = NULL;
+  guchar *rendered_data = NULL;
   guint gl_format;
   guint gl_type;
+  int x, y;
 
   gdk_gl_context_push_debug_group_printf (gdk_gl_context_get_current (),
                                           "Uploading glyph %d",
                                           key->data.glyph);
 
-  if (render_glyph (key, value, &r))
+  if (pixels == NULL)
     {
-      glPixelStorei (GL_UNPACK_ROW_LENGTH, r.stride / 4);
-      glBindTexture (GL_TEXTURE_2D, value->texture_id);
+      scaled_font = get_scaled_font (key->data.font);
+      if (scaled_font == NULL)
+        goto out;
 
-      if (gdk_gl_context_get_use_es (gdk_gl_context_get_current ()))
-        {
-          pixel_data = free_data = g_malloc (r.width * r.height * 4);
-          gdk_memory_convert (pixel_data, r.width * 4,
-                              GDK_MEMORY_R8G8B8A8_PREMULTIPLIED,
-                              r.data, r.width * 4,
-                              GDK_MEMORY_DEFAULT, r.width, r.height);
-          gl_format = GL_RGBA;
-          gl_type = GL_UNSIGNED_BYTE;
-        }
-      else
-        {
-          pixel_data = r.data;
-          gl_format = GL_BGRA;
-          gl_type = GL_UNSIGNED_INT_8_8_8_8_REV;
-        }
+      pixels = rendered_data = g_malloc0 (width * height * 4);
+      rasterize_glyph (scaled_font, &key->data, value, rendered_data, width, height, width * 4);
+    }
 
-      glTexSubImage2D (GL_TEXTURE_2D, 0, r.x, r.y, r.width, r.height,
-                       gl_format, gl_type, pixel_data);
-      glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
-      g_free (r.data);
-      g_free (free_data);
+  if (value->atlas)
+    {
+      x = (gsize)(value->tx * value->atlas->width);
+      y = (gsize)(value->ty * value->atlas->height);
+    }
+  else
+    {
+      x = 0;
+      y = 0;
     }
 
+  glPixelStorei (GL_UNPACK_ROW_LENGTH, width);
+  glBindTexture (GL_TEXTURE_2D, value->texture_id);
+
+  if (gdk_gl_context_get_use_es (gdk_gl_context_get_current ()))
+    {
+      pixel_data = free_data = g_malloc (width * height * 4);
+      gdk_memory_convert (pixel_data, width * 4,
+                          GDK_MEMORY_R8G8B8A8_PREMULTIPLIED,
+                          pixels, width * 4,
+                          GDK_MEMORY_DEFAULT, width, height);
+      gl_format = GL_RGBA;
+      gl_type = GL_UNSIGNED_BYTE;
+    }
+  else
+    {
+      pixel_data = (guchar *)pixels;
+      gl_format = GL_BGRA;
+      gl_type = GL_UNSIGNED_INT_8_8_8_8_REV;
+    }
+
+  glTexSubImage2D (GL_TEXTURE_2D, 0, x, y, width, height,
+                   gl_format, gl_type, pixel_data);
+  glPixelStorei (GL_UNPACK_ROW_LENGTH, 0);
+  g_free (rendered_data);
+  g_free (free_data);
+
+out:
   gdk_gl_context_pop_debug_group (gdk_gl_context_get_current ());
 }
 
+static void
+queue_glyph (GskGLGlyphCache  *self,
+             GlyphCacheKey    *key,
+             GskGLCachedGlyph *value)
+{
+  PendingGlyph pending;
+
+  pending.scaled_font = get_scaled_font (key->data.font);
+  if (pending.scaled_font == NULL)
+    return;
+
+  pending.key = key;
+  pending.value = value;
+  pending.data = NULL;
+  cairo_scaled_font_reference (pending.scaled_font);
+
+  g_array_append_val (self->pending, pending);
+}
+
+typedef struct
+{
+  PendingGlyph *glyphs;
+  guint n_glyphs;
+  int next_glyph;
+} Rasterization;
+
+static void
+rasterize_pending_glyphs (gpointer data)
+{
+  Rasterization *rasterization = data;
+  int i;
+
+  while ((i = g_atomic_int_add (&rasterization->next_glyph, 1)) < (int)rasterization->n_glyphs)
+    {
+      PendingGlyph *pending = &rasterization->glyphs[i];
+      const int width = pending->value->draw_width * pending->key->data.scale / 1024;
+      const int height = pending->value->draw_height * pending->key->data.scale / 1024;
+
+      pending->data = g_malloc0 (width * height * 4);
+      rasterize_glyph (pending->scaled_font, &pending->key->data, pending->value,
+                       pending->data, width, height, width * 4);
+    }
+}
+
+/**
+ * gsk_gl_glyph_cache_upload_pending:
+ * @self: the cache
+ *
+ * Rasterizes the glyphs that were added since the last call in
+ * parallel and uploads them. This needs to happen before the
+ * glyphs are drawn.
+ */
+void
+gsk_gl_glyph_cache_upload_pending (GskGLGlyphCache *self)
+{
+  Rasterization rasterization;
+  guint n_tasks;
+  guint i;
+
+  if (self->pending->len == 0)
+    return;
+
+  rasterization.glyphs = (PendingGlyph *)self->pending->data;
+  rasterization.n_glyphs = self->pending->len;
+  rasterization.next_glyph = 0;
+
+  if (self->pending->len >= MIN_PARALLEL_GLYPHS)
+    n_tasks = MIN (self->pending->len / MIN_PARALLEL_GLYPHS, gdk_parallel_task_get_max_tasks ());
+  else
+    n_tasks = 1;
+
+  gdk_parallel_task_run (rasterize_pending_glyphs, &rasterization, n_tasks);
+
+  GSK_NOTE(GLYPH_CACHE, g_message ("Rasterized %u glyphs in %u tasks", self->pending->len, n_tasks));
+
+  for (i = 0; i < self->pending->len; i++)
+    {
+      PendingGlyph *pending = &g_array_index (self->pending, PendingGlyph, i);
+      const int width = pending->value->draw_width * pending->key->data.scale / 1024;
+      const int height = pending->value->draw_height * pending->key->data.scale / 1024;
+
+      upload_glyph (self, pending->key, pending->value, pending->data);
+
+      if (self->disk_cache != NULL)
+        gsk_glyph_disk_cache_add (self->disk_cache,
+                                  pending->key->data.font, pending->key->data.scale,
+                                  pending->key->data.glyph,
+                                  pending->key->data.xshift, pending->key->data.yshift,
+                                  width, height,
+                                  pending->data, width * 4);
+
+      g_free (pending->data);
+      cairo_scaled_font_destroy (pending->scaled_font);
+    }
+
+  g_array_set_size (self->pending, 0);
+}
+
+static void
+set_atlas_position (GskGLCachedGlyph  *value,
+                    GskGLTextureAtlas *atlas,
+                    int                packed_x,
+                    int                packed_y,
+                    int                width,
+                    int                height)
+{
+  value->tx = (float)(packed_x + 1) / atlas->width;
+  value->ty = (float)(packed_y + 1) / atlas->height;
+  value->tw = (float)width / atlas->width;
+  value->th = (float)height / atlas->height;
+
+  value->atlas = atlas;
+  value->texture_id = atlas->texture_id;
+}
+
 static void
 add_to_cache (GskGLGlyphCache  *self,
               GlyphCacheKey    *key,
               GskGLDriver      *driver,
-              GskGLCachedGlyph *value)
+              GskGLCachedGlyph *value,
+              const guchar     *pixels)
 {
   const int width = value->draw_width * key->data.scale / 1024;
   const int height = value->draw_height * key->data.scale / 1024;
@@ -245,14 +409,8 @@ add_to_cache (GskGLGlyphCache  *self,
 
       gsk_gl_texture_atlases_pack (self->atlases, width + 2, height + 2, &atlas, &packed_x, &packed_y);
 
-      value->tx = (float)(packed_x + 1) / atlas->width;
-      value->ty = (float)(packed_y + 1) / atlas->height;
-      value->tw = (float)width / atlas->width;
-      value->th = (float)height / atlas->height;
+      set_atlas_position (value, atlas, packed_x, packed_y, width, height);
       value->used = TRUE;
-
-      value->atlas = atlas;
-      value->texture_id = atlas->texture_id;
     }
   else
     {
@@ -269,7 +427,90 @@ add_to_cache (GskGLGlyphCache  *self,
       value->th = 1.0f;
     }
 
-  upload_glyph (key, value);
+  if (pixels == NULL && self->disk_cache != NULL)
+    pixels = gsk_glyph_disk_cache_lookup (self->disk_cache,
+                                          key->data.font, key->data.scale,
+                                          key->data.glyph,
+                                          key->data.xshift, key->data.yshift,
+                                          width, height);
+
+  if (pixels == NULL && !(key->data.glyph & PANGO_GLYPH_UNKNOWN_FLAG))
+    queue_glyph (self, key, value);
+  else
+    upload_glyph (self, key, value, pixels);
+}
+
+/* Moves the glyph, including its padding, off a retired atlas */
+static void
+relocate_glyph (GskGLGlyphCache  *self,
+                GlyphCacheKey    *key,
+                GskGLCachedGlyph *value)
+{
+  const int width = value->draw_width * key->data.scale / 1024;
+  const int height = value->draw_height * key->data.scale / 1024;
+  GskGLTextureAtlas *atlas = NULL;
+  int packed_x = 0;
+  int packed_y = 0;
+
+  gsk_gl_texture_atlases_relocate (self->atlases,
+                                   value->atlas,
+                                   roundf (value->tx * value->atlas->width) - 1,
+                                   roundf (value->ty * value->atlas->height) - 1,
+                                   width + 2, height + 2,
+                                   &atlas, &packed_x, &packed_y);
+
+  set_atlas_position (value, atlas, packed_x, packed_y, width, height);
+}
+
+static GskGLCachedGlyph *
+glyph_value_new (const GlyphCacheKey *lookup)
+{
+  GskGLCachedGlyph *value;
+  PangoRectangle ink_rect;
+
+  pango_font_get_glyph_extents (lookup->data.font, lookup->data.glyph, &ink_rect, NULL);
+  pango_extents_to_pixels (&ink_rect, NULL);
+  if (lookup->data.xshift != 0)
+    ink_rect.width += 1;
+  if (lookup->data.yshift != 0)
+    ink_rect.height += 1;
+
+  value = g_new0 (GskGLCachedGlyph, 1);
+
+  value->draw_x = ink_rect.x;
+  value->draw_y = ink_rect.y;
+  value->draw_width = ink_rect.width;
+  value->draw_height = ink_rect.height;
+  value->accessed = TRUE;
+  value->atlas = NULL; /* For now */
+
+  return value;
+}
+
+static GlyphCacheKey *
+glyph_key_copy (const GlyphCacheKey *lookup)
+{
+  GlyphCacheKey *key;
+
+  key = g_new0 (GlyphCacheKey, 1);
+
+  key->data.font = g_object_ref (lookup->data.font);
+  key->data.glyph = lookup->data.glyph;
+  key->data.xshift = lookup->data.xshift;
+  key->data.yshift = lookup->data.yshift;
+  key->data.scale = lookup->data.scale;
+  key->hash = lookup->hash;
+
+  return key;
+}
+
+static gboolean
+glyph_has_pixels (const GlyphCacheKey    *key,
+                  const GskGLCachedGlyph *value)
+{
+  return key->data.scale > 0 &&
+         value->draw_width * key->data.scale / 1024 > 0 &&
+         value->draw_height * key->data.scale / 1024 > 0;
 }
 
 void
@@ -297,43 +538,245 @@ gsk_gl_glyph_cache_lookup_or_add (GskGLGlyphCache         *cache,
 
   {
     GlyphCacheKey *key;
-    PangoRectangle ink_rect;
-
-    pango_font_get_glyph_extents (lookup->data.font, lookup->data.glyph, &ink_rect, NULL);
-    pango_extents_to_pixels (&ink_rect, NULL);
-    if (lookup->data.xshift != 0)
-      ink_rect.width += 1;
-    if (lookup->data.yshift != 0)
-      ink_rect.height += 1;
-
-    value = g_new0 (GskGLCachedGlyph, 1);
-
-    value->draw_x = ink_rect.x;
-    value->draw_y = ink_rect.y;
-    value->draw_width = ink_rect.width;
-    value->draw_height = ink_rect.height;
-    value->accessed = TRUE;
-    value->atlas = NULL; /* For now */
-
-    key = g_new0 (GlyphCacheKey, 1);
-
-    key->data.font = g_object_ref (lookup->data.font);
-    key->data.glyph = lookup->data.glyph;
-    key->data.xshift = lookup->data.xshift;
-    key->data.yshift = lookup->data.yshift;
-    key->data.scale = lookup->data.scale;
-    key->hash = lookup->hash;
-
-    if (key->data.scale > 0 &&
-        value->draw_width * key->data.scale / 1024 > 0 &&
-        value->draw_height * key->data.scale / 1024 > 0)
-      add_to_cache (cache, key, driver, value);
+
+    value = glyph_value_new (lookup);
+    key = glyph_key_copy (lookup);
+
+    if (glyph_has_pixels (key, value))
+      add_to_cache (cache, key, driver, value, NULL);
 
     *cached_glyph_out = value;
     g_hash_table_insert (cache->hash_table, key, value);
   }
 }
 
+typedef struct
+{
+  GlyphCacheKey *key;
+  GskGLCachedGlyph *value;
+  guchar *data; /* NULL if the disk cache has the glyph */
+} PrewarmGlyph;
+
+typedef struct
+{
+  cairo_scaled_font_t *scaled_font;
+  GArray *glyphs; /* PrewarmGlyph */
+  gboolean done; /* only touched on the main thread */
+} PrewarmJob;
+
+static void
+prewarm_job_free (gpointer data)
+{
+  PrewarmJob *job = data;
+  guint i;
+
+  for (i = 0; i < job->glyphs->len; i++)
+    {
+      PrewarmGlyph *glyph = &g_array_index (job->glyphs, PrewarmGlyph, i);
+
+      g_clear_pointer (&glyph->key, glyph_cache_key_free);
+      g_clear_pointer (&glyph->value, glyph_cache_value_free);
+      g_free (glyph->data);
+    }
+
+  g_array_unref (job->glyphs);
+  cairo_scaled_font_destroy (job->scaled_font);
+  g_free (job);
+}
+
+static void
+prewarm_thread (GTask        *task,
+                gpointer      source_object,
+                gpointer      task_data,
+                GCancellable *cancellable)
+{
+  PrewarmJob *job = task_data;
+  guint i;
+
+  for (i = 0; i < job->glyphs->len; i++)
+    {
+      PrewarmGlyph *glyph = &g_array_index (job->glyphs, PrewarmGlyph, i);
+      const int width = glyph->value->draw_width * glyph->key->data.scale / 1024;
+      const int height = glyph->value->draw_height * glyph->key->data.scale / 1024;
+
+      if (glyph->data == NULL)
+        continue;
+
+      rasterize_glyph (job->scaled_font, &glyph->key->data, glyph->value,
+                       glyph->data, width, height, width * 4);
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+/* Runs on the main thread once the thread has returned, so the job
+ * isn't freed while the thread still uses it */
+static void
+prewarm_done (GObject      *source_object,
+              GAsyncResult *result,
+              gpointer      user_data)
+{
+  PrewarmJob *job = g_task_get_task_data (G_TASK (result));
+
+  job->done = TRUE;
+}
+
+/**
+ * gsk_gl_glyph_cache_prewarm:
+ * @self: the cache
+ * @font: the font
+ * @text: the text to take the glyphs from
+ * @scale: the scale to rasterize the glyphs at, times 1024
+ *
+ * Rasterizes the glyphs that @text shapes to in a thread, in all
+ * horizontal subpixel positions. They get added to the cache in one
+ * of the following frames, so drawing them later doesn't have to
+ * wait for the rasterizer.
+ */
+void
+gsk_gl_glyph_cache_prewarm (GskGLGlyphCache *self,
+                            PangoFont       *font,
+                            const char      *text,
+                            guint            scale)
+{
+  cairo_scaled_font_t *scaled_font;
+  PangoGlyphString *glyphs;
+  PangoAnalysis analysis = { 0, };
+  GHashTable *seen;
+  PrewarmJob *job;
+  GTask *task;
+  int i;
+  guint xshift;
+
+  scaled_font = get_scaled_font (font);
+  if (scaled_font == NULL || scale == 0)
+    return;
+
+  glyphs = pango_glyph_string_new ();
+  analysis.font = font;
+  analysis.language = pango_language_get_default ();
+  pango_shape (text, strlen (text), &analysis, glyphs);
+
+  job = g_new0 (PrewarmJob, 1);
+  job->scaled_font = cairo_scaled_font_reference (scaled_font);
+  job->glyphs = g_array_new (FALSE, FALSE, sizeof (PrewarmGlyph));
+
+  seen = g_hash_table_new (NULL, NULL);
+
+  for (i = 0; i < glyphs->num_glyphs; i++)
+    {
+      const PangoGlyph glyph = glyphs->glyphs[i].glyph;
+
+      if (glyph == PANGO_GLYPH_EMPTY || (glyph & PANGO_GLYPH_UNKNOWN_FLAG))
+        continue;
+
+      if (!g_hash_table_add (seen, GUINT_TO_POINTER (glyph)))
+        continue;
+
+      for (xshift = 0; xshift < 4; xshift++)
+        {
+          GlyphCacheKey lookup;
+          PrewarmGlyph prewarm;
+          int width, height;
+
+          lookup.data.font = font;
+          lookup.data.scale = scale;
+          glyph_cache_key_set_glyph_and_phase (&lookup, glyph, xshift, 0);
+
+          if (g_hash_table_contains (self->hash_table, &lookup))
+            continue;
+
+          prewarm.key = glyph_key_copy (&lookup);
+          prewarm.value = glyph_value_new (&lookup);
+
+          width = prewarm.value->draw_width * scale / 1024;
+          height = prewarm.value->draw_height * scale / 1024;
+
+          if (!glyph_has_pixels (prewarm.key, prewarm.value) ||
+              width >= MAX_GLYPH_SIZE || height >= MAX_GLYPH_SIZE)
+            {
+              glyph_cache_key_free (prewarm.key);
+              glyph_cache_value_free (prewarm.value);
+              continue;
+            }
+
+          if (self->disk_cache != NULL &&
+              gsk_glyph_disk_cache_lookup (self->disk_cache, font, scale,
+                                           glyph, xshift, 0, width, height))
+            prewarm.data = NULL;
+          else
+            prewarm.data = g_malloc0 (width * height * 4);
+
+          g_array_append_val (job->glyphs, prewarm);
+        }
+    }
+
+  g_hash_table_unref (seen);
+  pango_glyph_string_free (glyphs);
+
+  GSK_NOTE(GLYPH_CACHE, g_message ("Prewarming %u glyphs", job->glyphs->len));
+
+  if (job->glyphs->len == 0)
+    {
+      prewarm_job_free (job);
+      return;
+    }
+
+  task = g_task_new (NULL, NULL, prewarm_done, NULL);
+  g_task_set_source_tag (task, gsk_gl_glyph_cache_prewarm);
+  g_task_set_task_data (task, job, prewarm_job_free);
+  g_task_run_in_thread (task, prewarm_thread);
+
+  g_ptr_array_add (self->prewarm_tasks, task);
+}
+
+static void
+add_prewarmed_glyphs (GskGLGlyphCache *self,
+                      GskGLDriver     *driver)
+{
+  guint added = 0;
+  guint i, j;
+
+  for (i = self->prewarm_tasks->len; i > 0; i--)
+    {
+      GTask *task = g_ptr_array_index (self->prewarm_tasks, i - 1);
+      PrewarmJob *job = g_task_get_task_data (task);
+
+      if (!job->done)
+        continue;
+
+      for (j = 0; j < job->glyphs->len; j++)
+        {
+          PrewarmGlyph *glyph = &g_array_index (job->glyphs, PrewarmGlyph, j);
+          const int width = glyph->value->draw_width * glyph->key->data.scale / 1024;
+          const int height = glyph->value->draw_height * glyph->key->data.scale / 1024;
+
+          /* Drawn since we started */
+          if (g_hash_table_contains (self->hash_table, glyph->key))
+            continue;
+
+          add_to_cache (self, glyph->key, driver, glyph->value, glyph->data);
+
+          if (self->disk_cache != NULL && glyph->data != NULL)
+            gsk_glyph_disk_cache_add (self->disk_cache,
+                                      glyph->key->data.font, glyph->key->data.scale,
+                                      glyph->key->data.glyph,
+                                      glyph->key->data.xshift, glyph->key->data.yshift,
+                                      width, height,
+                                      glyph->data, width * 4);
+
+          g_hash_table_insert (self->hash_table, glyph->key, glyph->value);
+          glyph->key = NULL;
+          glyph->value = NULL;
+          added++;
+        }
+
+      g_ptr_array_remove_index_fast (self->prewarm_tasks, i - 1);
+    }
+
+  GSK_NOTE(GLYPH_CACHE, if (added > 0) g_message ("Added %d prewarmed glyphs", added));
+}
+
 void
 gsk_gl_glyph_cache_begin_frame (GskGLGlyphCache *self,
                                 GskGLDriver     *driver,
@@ -343,9 +786,13 @@ gsk_gl_glyph_cache_begin_frame (GskGLGlyphCache *self,
   GlyphCacheKey *key;
   GskGLCachedGlyph *value;
   guint dropped = 0;
+  guint relocated = 0;
 
   self->timestamp++;
 
+  /* Glyphs need to be uploaded before moving them around */
+  gsk_gl_glyph_cache_upload_pending (self);
+
   if (removed_atlases->len > 0)
     {
       g_hash_table_iter_init (&iter, self->hash_table);
@@ -353,8 +800,17 @@ gsk_gl_glyph_cache_begin_frame (GskGLGlyphCache *self,
         {
           if (g_ptr_array_find (removed_atlases, value->atlas, NULL))
             {
-              g_hash_table_iter_remove (&iter);
-              dropped++;
+              if (value->used &&
+                  gsk_gl_texture_atlases_is_retired (self->atlases, value->atlas))
+                {
+                  relocate_glyph (self, key, value);
+                  relocated++;
+                }
+              else
+                {
+                  g_hash_table_iter_remove (&iter);
+                  dropped++;
+                }
             }
         }
     }
@@ -391,7 +847,16 @@ gsk_gl_glyph_cache_begin_frame (GskGLGlyphCache *self,
        }
 
       GSK_NOTE(GLYPH_CACHE, g_message ("%d glyphs cached", g_hash_table_size (self->hash_table)));
+
+      if (self->disk_cache != NULL)
+        gsk_glyph_disk_cache_save (self->disk_cache);
     }
 
+  /* After dealing with removed atlases, the prewarmed
+   * glyphs must not end up on one of them */
+  if (self->prewarm_tasks->len > 0)
+    add_prewarmed_glyphs (self, driver);
+
   GSK_NOTE(GLYPH_CACHE, if (dropped > 0) g_message ("Dropped %d glyphs", dropped));
+  GSK_NOTE(GLYPH_CACHE, if (relocated > 0) g_message ("Moved %d glyphs", relocated));
 }
@@ -4,6 +4,7 @@
 #include "gskgldriverprivate.h"
 #include "gskglimageprivate.h"
 #include "gskgltextureatlasprivate.h"
+#include "gskglyphdiskcacheprivate.h"
 #include <pango/pango.h>
 #include <gdk/gdk.h>
 
@@ -14,6 +15,9 @@ typedef struct
   GdkDisplay *display;
   GHashTable *hash_table;
   GskGLTextureAtlases *atlases;
+  GskGlyphDiskCache *disk_cache; /* NULL if disabled */
+  GPtrArray *prewarm_tasks; /* GTasks rasterizing glyphs in a thread */
+  GArray *pending; /* glyphs that still need to be rasterized and uploaded */
 
   int timestamp;
 } GskGLGlyphCache;
@@ -40,14 +44,14 @@ typedef struct _GlyphCacheKey GlyphCacheKey;
 #define PHASE(x) ((int)(floor (4 * (x + 0.125)) - 4 * floor (x + 0.125)))
 
 static inline void
-glyph_cache_key_set_glyph_and_shift (GlyphCacheKey *key,
+glyph_cache_key_set_glyph_and_phase (GlyphCacheKey *key,
                                      PangoGlyph glyph,
-                                     float x,
-                                     float y)
+                                     guint xshift,
+                                     guint yshift)
 {
   key->data.glyph = glyph;
-  key->data.xshift = PHASE (x);
-  key->data.yshift = PHASE (y);
+  key->data.xshift = xshift;
+  key->data.yshift = yshift;
   key->hash = GPOINTER_TO_UINT (key->data.font) ^
               key->data.glyph ^
               (key->data.xshift << 24) ^
@@ -55,6 +59,15 @@ glyph_cache_key_set_glyph_and_shift (GlyphCacheKey *key,
               key->data.scale;
 }
 
+static inline void
+glyph_cache_key_set_glyph_and_shift (GlyphCacheKey *key,
+                                     PangoGlyph glyph,
+                                     float x,
+                                     float y)
+{
+  glyph_cache_key_set_glyph_and_phase (key, glyph, PHASE (x), PHASE (y));
+}
+
 typedef struct _GskGLCachedGlyph GskGLCachedGlyph;
 
 struct _GskGLCachedGlyph
@@ -88,5 +101,10 @@ void                     gsk_gl_glyph_cache_lookup_or_add   (GskGLGlyphCache
                                                              GlyphCacheKey          *lookup,
                                                              GskGLDriver            *driver,
                                                              const GskGLCachedGlyph **cached_glyph_out);
+void                     gsk_gl_glyph_cache_upload_pending  (GskGLGlyphCache        *self);
+void                     gsk_gl_glyph_cache_prewarm         (GskGLGlyphCache        *self,
+                                                             PangoFont              *font,
+                                                             const char             *text,
+                                                             guint                   scale);
 
 #endif
@@ -5,6 +5,7 @@
 #include "gdk/gdkglcontextprivate.h"
 
 #include <epoxy/gl.h>
+#include <math.h>
 
 #define MAX_FRAME_AGE 60
 
@@ -55,6 +56,44 @@ gsk_gl_icon_cache_unref (GskGLIconCache *self)
   self->ref_count--;
 }
 
+static void
+set_atlas_position (IconData          *icon_data,
+                    GskGLTextureAtlas *atlas,
+                    int                packed_x,
+                    int                packed_y)
+{
+  const int width = icon_data->source_texture->width;
+  const int height = icon_data->source_texture->height;
+
+  icon_data->atlas = atlas;
+  icon_data->texture_id = atlas->texture_id;
+  icon_data->x = (float)(packed_x + 1) / atlas->width;
+  icon_data->y = (float)(packed_y + 1) / atlas->height;
+  icon_data->x2 = icon_data->x + (float)width / atlas->width;
+  icon_data->y2 = icon_data->y + (float)height / atlas->height;
+}
+
+/* Moves the icon, including its padding, off a retired atlas */
+static void
+relocate_icon (GskGLIconCache *self,
+               IconData       *icon_data)
+{
+  const int width = icon_data->source_texture->width;
+  const int height = icon_data->source_texture->height;
+  GskGLTextureAtlas *atlas = NULL;
+  int packed_x = 0;
+  int packed_y = 0;
+
+  gsk_gl_texture_atlases_relocate (self->atlases,
+                                   icon_data->atlas,
+                                   roundf (icon_data->x * icon_data->atlas->width) - 1,
+                                   roundf (icon_data->y * icon_data->atlas->height) - 1,
+                                   width + 2, height + 2,
+                                   &atlas, &packed_x, &packed_y);
+
+  set_atlas_position (icon_data, atlas, packed_x, packed_y);
+}
+
 void
 gsk_gl_icon_cache_begin_frame (GskGLIconCache *self,
                                GPtrArray      *removed_atlases)
@@ -65,22 +104,33 @@ gsk_gl_icon_cache_begin_frame (GskGLIconCache *self,
 
   self->timestamp++;
 
-  /* Drop icons on removed atlases */
+  /* Move icons that are still in use off removed atlases, drop the rest */
   if (removed_atlases->len > 0)
     {
       guint dropped = 0;
+      guint relocated = 0;
 
       g_hash_table_iter_init (&iter, self->icons);
       while (g_hash_table_iter_next (&iter, (gpointer *)&texture, (gpointer *)&icon_data))
         {
           if (g_ptr_array_find (removed_atlases, icon_data->atlas, NULL))
             {
-              g_hash_table_iter_remove (&iter);
-              dropped++;
+              if (icon_data->used &&
+                  gsk_gl_texture_atlases_is_retired (self->atlases, icon_data->atlas))
+                {
+                  relocate_icon (self, icon_data);
+                  relocated++;
+                }
+              else
+                {
+                  g_hash_table_iter_remove (&iter);
+                  dropped++;
+                }
             }
         }
 
       GSK_NOTE(GLYPH_CACHE, if (dropped > 0) g_message ("Dropped %d icons", dropped));
+      GSK_NOTE(GLYPH_CACHE, if (relocated > 0) g_message ("Moved %d icons", relocated));
     }
 
   if (self->timestamp % MAX_FRAME_AGE == 0)
@@ -143,15 +193,10 @@ gsk_gl_icon_cache_lookup_or_add (GskGLIconCache  *self,
     gsk_gl_texture_atlases_pack (self->atlases, width + 2, height + 2, &atlas, &packed_x, &packed_y);
 
     icon_data = g_new0 (IconData, 1);
-    icon_data->atlas = atlas;
     icon_data->accessed = TRUE;
     icon_data->used = TRUE;
-    icon_data->texture_id = atlas->texture_id;
     icon_data->source_texture = g_object_ref (texture);
-    icon_data->x = (float)(packed_x + 1) / atlas->width;
-    icon_data->y = (float)(packed_y + 1) / atlas->width;
-    icon_data->x2 = icon_data->x + (float)width / atlas->width;
-    icon_data->y2 = icon_data->y + (float)height / atlas->height;
+    set_atlas_position (icon_data, atlas, packed_x, packed_y);
 
     g_hash_table_insert (self->icons, texture, icon_data);
 
@@ -0,0 +1,371 @@
+#include "config.h"
+
+#include "gskglopcacheprivate.h"
+#include "gskrendernodeprivate.h"
+
+#include <string.h>
+
+/* Caching strategy
+ *
+ * Nodes are identified by their position in the node tree, so a node
+ * that replaces an equal one from the last frame (which happens to
+ * every ancestor of a widget that was redrawn) can still reuse the ops
+ * recorded for the old one.
+ *
+ * Before recording the ops for a node, we forget all tracked program
+ * state so the recorded range sends every uniform it depends on and
+ * can be replayed anywhere. After replaying a range, we forget all the
+ * state again since we don't know what the range changed.
+ *
+ * Ranges that render offscreen or use textures other than the shared
+ * texture atlases are not cached, since those textures only live as
+ * long as the frame. Ranges using atlas textures are dropped as soon
+ * as any atlas gets dropped.
+ */
+
+#define MIN_CACHED_OPS 8
+#define MAX_MISSES 2
+
+struct _GskGLOpCacheEntry
+{
+  GskRenderNode *node;
+  int timestamp;
+  guint misses; /* Consecutive frames the ops could not be reused */
+
+  /* The builder state the ops were recorded with */
+  GskTransform *modelview;
+  float dx;
+  float dy;
+  float opacity;
+  GskRoundedRect clip;
+  graphene_rect_t viewport;
+  graphene_matrix_t projection;
+  int render_target;
+
+  /* Only valid if vertices != NULL */
+  OpBuffer ops;
+  GArray *vertices;
+  int last_texture;
+  guint atlas_generation;
+  guint uses_atlases : 1;
+};
+
+static void
+entry_clear (GskGLOpCacheEntry *entry)
+{
+  if (entry->vertices != NULL)
+    {
+      op_buffer_destroy (&entry->ops);
+      g_clear_pointer (&entry->vertices, g_array_unref);
+    }
+
+  g_clear_pointer (&entry->modelview, gsk_transform_unref);
+  g_clear_pointer (&entry->node, gsk_render_node_unref);
+}
+
+static void
+entry_free (gpointer data)
+{
+  GskGLOpCacheEntry *entry = data;
+
+  entry_clear (entry);
+  g_free (entry);
+}
+
+void
+gsk_gl_op_cache_init (GskGLOpCache *self)
+{
+  self->entries = g_hash_table_new_full (NULL, NULL, NULL, entry_free);
+  self->path = 0;
+  self->timestamp = 0;
+}
+
+void
+gsk_gl_op_cache_free (GskGLOpCache *self)
+{
+  g_clear_pointer (&self->entries, g_hash_table_unref);
+}
+
+void
+gsk_gl_op_cache_begin_frame (GskGLOpCache *self)
+{
+  self->timestamp++;
+  self->path = 0;
+}
+
+void
+gsk_gl_op_cache_end_frame (GskGLOpCache *self)
+{
+  GHashTableIter iter;
+  GskGLOpCacheEntry *entry;
+
+  /* Everything that was not part of this frame is gone */
+  g_hash_table_iter_init (&iter, self->entries);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&entry))
+    {
+      if (entry->timestamp != self->timestamp)
+        g_hash_table_iter_remove (&iter);
+    }
+}
+
+/* Returns the path to pass to gsk_gl_op_cache_leave() */
+guint
+gsk_gl_op_cache_enter (GskGLOpCache *self,
+                       guint         child_index)
+{
+  guint parent_path = self->path;
+
+  self->path = (parent_path * 16777619) ^ (child_index + 1);
+
+  return parent_path;
+}
+
+void
+gsk_gl_op_cache_leave (GskGLOpCache *self,
+                       guint         parent_path)
+{
+  self->path = parent_path;
+}
+
+static gboolean
+node_unchanged (GskRenderNode *old_node,
+                GskRenderNode *node)
+{
+  cairo_region_t *region;
+  gboolean unchanged;
+
+  if (old_node == node)
+    return TRUE;
+
+  if (!gsk_render_node_can_diff (old_node, node))
+    return FALSE;
+
+  region = cairo_region_create ();
+  gsk_render_node_diff (old_node, node, region);
+  unchanged = cairo_region_is_empty (region);
+  cairo_region_destroy (region);
+
+  return unchanged;
+}
+
+static gboolean
+entry_matches_builder (const GskGLOpCacheEntry *entry,
+                       const RenderOpBuilder   *builder)
+{
+  return entry->dx == builder->dx &&
+         entry->dy == builder->dy &&
+         entry->opacity == builder->current_opacity &&
+         entry->render_target == builder->current_render_target &&
+         memcmp (&entry->clip, builder->current_clip, sizeof (GskRoundedRect)) == 0 &&
+         memcmp (&entry->viewport, &builder->current_viewport, sizeof (graphene_rect_t)) == 0 &&
+         memcmp (&entry->projection, &builder->current_projection, sizeof (graphene_matrix_t)) == 0 &&
+         gsk_transform_equal (entry->modelview, builder->current_modelview);
+}
+
+static gboolean
+is_atlas_texture (GskGLTextureAtlases *atlases,
+                  int                  texture_id)
+{
+  guint i;
+
+  for (i = 0; i < atlases->atlases->len; i++)
+    {
+      const GskGLTextureAtlas *atlas = g_ptr_array_index (atlases->atlases, i);
+
+      if (atlas->texture_id == texture_id)
+        return TRUE;
+    }
+
+  return FALSE;
+}
+
+static void
+replay_entry (const GskGLOpCacheEntry *entry,
+              RenderOpBuilder         *builder)
+{
+  ops_append (builder,
+              &entry->ops,
+              (const GskQuadVertex *)entry->vertices->data,
+              entry->vertices->len);
+
+  if (entry->last_texture != 0)
+    builder->current_texture = entry->last_texture;
+}
+
+/**
+ * gsk_gl_op_cache_replay:
+ * @self: the cache
+ * @builder: the builder to add ops to
+ * @node: the node about to be added at the current path
+ * @atlases: the texture atlases used by the glyph and icon caches
+ * @recording: (out caller-allocates): state to pass to gsk_gl_op_cache_commit()
+ *
+ * Adds the ops recorded for @node in a previous frame to @builder,
+ * if there are any and they are still valid.
+ *
+ * Returns: %TRUE if the ops were added. If %FALSE is returned, the
+ *   caller has to add the ops for @node itself and then call
+ *   gsk_gl_op_cache_commit().
+ */
+gboolean
+gsk_gl_op_cache_replay (GskGLOpCache          *self,
+                        RenderOpBuilder       *builder,
+                        GskRenderNode         *node,
+                        GskGLTextureAtlases   *atlases,
+                        GskGLOpCacheRecording *recording)
+{
+  GskGLOpCacheEntry *entry;
+  gboolean unchanged;
+
+  recording->entry = NULL;
+
+  entry = g_hash_table_lookup (self->entries, GUINT_TO_POINTER (self->path));
+
+  if (entry == NULL)
+    {
+      entry = g_new0 (GskGLOpCacheEntry, 1);
+      g_hash_table_insert (self->entries, GUINT_TO_POINTER (self->path), entry);
+    }
+  else if (entry->timestamp == self->timestamp)
+    {
+      /* Added more than once this frame, e.g. the child of a shadow node */
+      return FALSE;
+    }
+
+  entry->timestamp = self->timestamp;
+
+  unchanged = entry->node != NULL && node_unchanged (entry->node, node);
+
+  if (entry->vertices != NULL &&
+      unchanged &&
+      entry_matches_builder (entry, builder) &&
+      (!entry->uses_atlases || entry->atlas_generation == atlases->generation))
+    {
+      replay_entry (entry, builder);
+      entry->misses = 0;
+      return TRUE;
+    }
+
+  /* Every frame the node stays the same takes back one miss, so nodes
+   * that stop changing get recorded again.
+   */
+  if (unchanged)
+    {
+      if (entry->misses > 0)
+        entry->misses--;
+    }
+  else if (entry->misses <= MAX_MISSES)
+    entry->misses++;
+
+  entry_clear (entry);
+  entry->node = gsk_render_node_ref (node);
+
+  /* Nodes that change every frame, like the ancestors of a blinking
+   * cursor, are not worth copying the ops for. We still keep the node
+   * around to notice when they stop changing.
+   */
+  if (entry->misses > MAX_MISSES)
+    return FALSE;
+
+  entry->modelview = gsk_transform_ref (builder->current_modelview);
+  entry->dx = builder->dx;
+  entry->dy = builder->dy;
+  entry->opacity = builder->current_opacity;
+  entry->clip = *builder->current_clip;
+  entry->viewport = builder->current_viewport;
+  entry->projection = builder->current_projection;
+  entry->render_target = builder->current_render_target;
+
+  recording->entry = entry;
+  recording->first_op = builder->render_ops.index->len;
+  recording->first_vertex = builder->vertices->len;
+  recording->prev_texture = builder->current_texture;
+
+  /* Make sure the range sends all the state it needs */
+  ops_invalidate_state (builder);
+  builder->current_texture = 0;
+
+  return FALSE;
+}
+
+void
+gsk_gl_op_cache_commit (GskGLOpCache          *self,
+                        RenderOpBuilder       *builder,
+                        GskRenderNode         *node,
+                        GskGLTextureAtlases   *atlases,
+                        GskGLOpCacheRecording *recording)
+{
+  GskGLOpCacheEntry *entry = recording->entry;
+  OpBuffer *buffer = &builder->render_ops;
+  const guint n_ops = buffer->index->len - recording->first_op;
+  const guint n_vertices = builder->vertices->len - recording->first_vertex;
+  gboolean cacheable = n_ops >= MIN_CACHED_OPS;
+  gboolean uses_atlases = FALSE;
+  int last_texture = 0;
+  guint i;
+
+  if (entry == NULL)
+    return;
+
+  g_assert (entry->node == node);
+  g_assert (entry->vertices == NULL);
+
+  for (i = recording->first_op; cacheable && i < buffer->index->len; i++)
+    {
+      const OpBufferEntry *e = &g_array_index (buffer->index, OpBufferEntry, i);
+
+      switch (e->kind)
+        {
+        case OP_CHANGE_SOURCE_TEXTURE:
+          {
+            const OpTexture *op = (const OpTexture *)&buffer->buf[e->pos];
+
+            if (is_atlas_texture (atlases, op->texture_id))
+              {
+                last_texture = op->texture_id;
+                uses_atlases = TRUE;
+              }
+            else
+              cacheable = FALSE;
+          }
+          break;
+
+        case OP_CHANGE_RENDER_TARGET:
+        case OP_CHANGE_EXTRA_SOURCE_TEXTURE:
+        case OP_CLEAR:
+        case OP_DUMP_FRAMEBUFFER:
+          cacheable = FALSE;
+          break;
+
+        default:
+          break;
+        }
+    }
+
+  if (cacheable)
+    {
+      op_buffer_init (&entry->ops);
+      op_buffer_append_range (&entry->ops, buffer, recording->first_op, n_ops);
+
+      for (i = 1; i < entry->ops.index->len; i++)
+        {
+          const OpBufferEntry *e = &g_array_index (entry->ops.index, OpBufferEntry, i);
+
+          if (e->kind == OP_DRAW)
+            ((OpDraw *)&entry->ops.buf[e->pos])->vao_offset -= recording->first_vertex;
+        }
+
+      entry->vertices = g_array_sized_new (FALSE, FALSE, sizeof (GskQuadVertex), n_vertices);
+      g_array_append_vals (entry->vertices,
+                           &g_array_index (builder->vertices, GskQuadVertex, recording->first_vertex),
+                           n_vertices);
+
+      entry->last_texture = last_texture;
+      entry->uses_atlases = uses_atlases;
+      entry->atlas_generation = atlases->generation;
+    }
+
+  /* Nothing in the range changed the bound texture */
+  if (builder->current_texture == 0)
+    builder->current_texture = recording->prev_texture;
+}
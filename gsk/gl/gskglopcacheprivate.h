@@ -0,0 +1,51 @@
+#ifndef __GSK_GL_OP_CACHE_H__
+#define __GSK_GL_OP_CACHE_H__
+
+#include <glib.h>
+#include "gskglrenderopsprivate.h"
+#include "gskgltextureatlasprivate.h"
+
+typedef struct _GskGLOpCacheEntry GskGLOpCacheEntry;
+
+typedef struct
+{
+  GHashTable *entries; /* path -> GskGLOpCacheEntry */
+
+  /* Identifies the position of the node currently being
+   * added in the node tree, see gsk_gl_op_cache_enter() */
+  guint path;
+
+  int timestamp;
+} GskGLOpCache;
+
+typedef struct
+{
+  GskGLOpCacheEntry *entry; /* NULL if the ops are not recorded */
+  guint first_op;
+  guint first_vertex;
+  int prev_texture;
+} GskGLOpCacheRecording;
+
+
+void     gsk_gl_op_cache_init        (GskGLOpCache          *self);
+void     gsk_gl_op_cache_free        (GskGLOpCache          *self);
+void     gsk_gl_op_cache_begin_frame (GskGLOpCache          *self);
+void     gsk_gl_op_cache_end_frame   (GskGLOpCache          *self);
+
+guint    gsk_gl_op_cache_enter       (GskGLOpCache          *self,
+                                      guint                  child_index);
+void     gsk_gl_op_cache_leave       (GskGLOpCache          *self,
+                                      guint                  parent_path);
+
+gboolean gsk_gl_op_cache_replay      (GskGLOpCache          *self,
+                                      RenderOpBuilder       *builder,
+                                      GskRenderNode         *node,
+                                      GskGLTextureAtlases   *atlases,
+                                      GskGLOpCacheRecording *recording);
+void     gsk_gl_op_cache_commit      (GskGLOpCache          *self,
+                                      RenderOpBuilder       *builder,
+                                      GskRenderNode         *node,
+                                      GskGLTextureAtlases   *atlases,
+                                      GskGLOpCacheRecording *recording);
+
+#endif
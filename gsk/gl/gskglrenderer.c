@@ -16,6 +16,7 @@
 #include "gskglrenderopsprivate.h"
 #include "gskcairoblurprivate.h"
 #include "gskglshadowcacheprivate.h"
+#include "gskglopcacheprivate.h"
 #include "gskglnodesampleprivate.h"
 #include "gsktransform.h"
 #include "glutilsprivate.h"
@@ -25,6 +26,7 @@
 
 #include "gdk/gdkgltextureprivate.h"
 #include "gdk/gdkglcontextprivate.h"
+#include "gdk/gdkparalleltaskprivate.h"
 #include "gdk/gdkprofilerprivate.h"
 #include "gdk/gdkrgbaprivate.h"
 
@@ -42,6 +44,13 @@
 
 #define SHADOW_EXTRA_SIZE  4
 
+/* Containers with at least this many children record runs of
+ * at least MIN_DETACHED_RUN simple children on worker threads,
+ * in chunks of DETACHED_CHUNK_SIZE children */
+#define MIN_PARALLEL_CHILDREN 64
+#define MIN_DETACHED_RUN       8
+#define DETACHED_CHUNK_SIZE   32
+
 #if DEBUG_OPS
 #define OP_PRINT(format, ...) g_print(format, ## __VA_ARGS__)
 #else
@@ -523,6 +532,13 @@ static gboolean add_offscreen_ops             (GskGLRenderer   *self,
 static void gsk_gl_renderer_add_render_ops     (GskGLRenderer   *self,
                                                 GskRenderNode   *node,
                                                 RenderOpBuilder *builder);
+static void add_cached_render_ops              (GskGLRenderer   *self,
+                                                GskRenderNode   *node,
+                                                guint            child_index,
+                                                RenderOpBuilder *builder);
+static void add_container_ops_parallel         (GskGLRenderer   *self,
+                                                GskRenderNode   *node,
+                                                RenderOpBuilder *builder);
 
 struct _GskGLRenderer
 {
@@ -542,10 +558,12 @@ struct _GskGLRenderer
   GskGLGlyphCache *glyph_cache;
   GskGLIconCache *icon_cache;
   GskGLShadowCache shadow_cache;
+  GskGLOpCache op_cache;
 
 #ifdef G_ENABLE_DEBUG
   struct {
     GQuark frames;
+    GQuark merged_draws;
   } profile_counters;
   struct {
     GQuark cpu_time;
@@ -554,6 +572,11 @@ struct _GskGLRenderer
 #endif
 
   cairo_region_t *render_region;
+
+  guint use_op_cache : 1;
+  guint op_cache_active : 1;
+  guint use_parallel_ops : 1;
+  guint use_draw_merging : 1;
 };
 
 struct _GskGLRendererClass
@@ -3574,6 +3597,11 @@ gsk_gl_renderer_realize (GskRenderer  *renderer,
   self->glyph_cache = get_glyph_cache_for_display (gdk_surface_get_display (surface), self->atlases);
   self->icon_cache = get_icon_cache_for_display (gdk_surface_get_display (surface), self->atlases);
   gsk_gl_shadow_cache_init (&self->shadow_cache);
+  gsk_gl_op_cache_init (&self->op_cache);
+  self->use_op_cache = g_getenv ("GSK_CACHE_RENDER_OPS") != NULL;
+  self->use_parallel_ops = g_getenv ("GSK_PARALLEL_RENDER_OPS") != NULL &&
+                           gdk_parallel_task_get_max_tasks () > 1;
+  self->use_draw_merging = g_getenv ("GSK_MERGE_DRAWS") != NULL;
 
   gdk_profiler_end_mark (before, "gl renderer realize", NULL);
 
@@ -3596,6 +3624,7 @@ gsk_gl_renderer_unrealize (GskRenderer *renderer)
   ops_reset (&self->op_builder);
   self->op_builder.programs = NULL;
 
+  gsk_gl_op_cache_free (&self->op_cache);
   g_clear_pointer (&self->programs, gsk_gl_renderer_programs_unref);
   g_clear_pointer (&self->glyph_cache, gsk_gl_glyph_cache_unref);
   g_clear_pointer (&self->icon_cache, gsk_gl_icon_cache_unref);
@@ -3605,6 +3634,8 @@ gsk_gl_renderer_unrealize (GskRenderer *renderer)
   g_clear_object (&self->gl_profiler);
   g_clear_object (&self->gl_driver);
 
+  gdk_gl_context_free_upload_buffer (self->gl_context);
+
   if (self->gl_context == gdk_gl_context_get_current ())
     gdk_gl_context_clear_current ();
 
@@ -3696,11 +3727,23 @@ gsk_gl_renderer_add_render_ops (GskGLRenderer   *self,
       {
         guint i, p;
 
+        if (self->use_parallel_ops &&
+            !self->op_cache_active &&
+            builder == &self->op_builder &&
+            gsk_container_node_get_n_children (node) >= MIN_PARALLEL_CHILDREN)
+          {
+            add_container_ops_parallel (self, node, builder);
+            break;
+          }
+
         for (i = 0, p = gsk_container_node_get_n_children (node); i < p; i ++)
           {
             GskRenderNode *child = gsk_container_node_get_child (node, i);
 
-            gsk_gl_renderer_add_render_ops (self, child, builder);
+            if (self->op_cache_active)
+              add_cached_render_ops (self, child, i, builder);
+            else
+              gsk_gl_renderer_add_render_ops (self, child, builder);
           }
       }
     break;
@@ -3815,6 +3858,218 @@ gsk_gl_renderer_add_render_ops (GskGLRenderer   *self,
     }
 }
 
+/* Like gsk_gl_renderer_add_render_ops(), but reuses the ops recorded
+ * in the last frame if @node did not change. Used for the root node
+ * and the children of container nodes. */
+static void
+add_cached_render_ops (GskGLRenderer   *self,
+                       GskRenderNode   *node,
+                       guint            child_index,
+                       RenderOpBuilder *builder)
+{
+  GskGLOpCacheRecording recording;
+  guint parent_path;
+
+  parent_path = gsk_gl_op_cache_enter (&self->op_cache, child_index);
+
+  if (!gsk_gl_op_cache_replay (&self->op_cache, builder, node, self->atlases, &recording))
+    {
+      gsk_gl_renderer_add_render_ops (self, node, builder);
+      gsk_gl_op_cache_commit (&self->op_cache, builder, node, self->atlases, &recording);
+    }
+
+  gsk_gl_op_cache_leave (&self->op_cache, parent_path);
+}
+
+/* Whether the ops for @node can be recorded with a detached builder on
+ * a different thread. That's the case for nodes that only use builtin
+ * programs and don't need textures, offscreens or any of the caches. */
+static gboolean
+node_can_record_detached (GskRenderNode *node)
+{
+  switch (gsk_render_node_get_node_type (node))
+    {
+    case GSK_COLOR_NODE:
+    case GSK_BORDER_NODE:
+      return TRUE;
+
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+      return gsk_linear_gradient_node_get_n_color_stops (node) < GL_MAX_GRADIENT_STOPS;
+
+    case GSK_RADIAL_GRADIENT_NODE:
+    case GSK_REPEATING_RADIAL_GRADIENT_NODE:
+      return gsk_radial_gradient_node_get_n_color_stops (node) < GL_MAX_GRADIENT_STOPS;
+
+    case GSK_CONIC_GRADIENT_NODE:
+      return gsk_conic_gradient_node_get_n_color_stops (node) < GL_MAX_GRADIENT_STOPS;
+
+    case GSK_INSET_SHADOW_NODE:
+      return gsk_inset_shadow_node_get_blur_radius (node) == 0;
+
+    case GSK_OUTSET_SHADOW_NODE:
+      return gsk_outset_shadow_node_get_blur_radius (node) == 0;
+
+    case GSK_DEBUG_NODE:
+      return node_can_record_detached (gsk_debug_node_get_child (node));
+
+    case GSK_TRANSFORM_NODE:
+      return gsk_transform_get_category (gsk_transform_node_get_transform (node)) >= GSK_TRANSFORM_CATEGORY_2D_AFFINE &&
+             node_can_record_detached (gsk_transform_node_get_child (node));
+
+    case GSK_CONTAINER_NODE:
+      {
+        guint i, p;
+
+        for (i = 0, p = gsk_container_node_get_n_children (node); i < p; i ++)
+          {
+            if (!node_can_record_detached (gsk_container_node_get_child (node, i)))
+              return FALSE;
+          }
+      }
+      return TRUE;
+
+    case GSK_NOT_A_RENDER_NODE:
+    case GSK_CAIRO_NODE:
+    case GSK_TEXTURE_NODE:
+    case GSK_TEXT_NODE:
+    case GSK_CLIP_NODE:
+    case GSK_ROUNDED_CLIP_NODE:
+    case GSK_OPACITY_NODE:
+    case GSK_COLOR_MATRIX_NODE:
+    case GSK_REPEAT_NODE:
+    case GSK_SHADOW_NODE:
+    case GSK_BLEND_NODE:
+    case GSK_CROSS_FADE_NODE:
+    case GSK_BLUR_NODE:
+    case GSK_GL_SHADER_NODE:
+    default:
+      return FALSE;
+    }
+}
+
+typedef struct
+{
+  guint first_child;
+  guint n_children;
+  RenderOpBuilder builder;
+} DetachedChunk;
+
+typedef struct
+{
+  GskGLRenderer *self;
+  GskRenderNode *container;
+  const RenderOpBuilder *parent;
+  DetachedChunk *chunks;
+  guint n_chunks;
+  int next_chunk;
+} ParallelOps;
+
+static void
+record_detached_chunks (gpointer data)
+{
+  ParallelOps *parallel = data;
+  int c;
+
+  while ((c = g_atomic_int_add (&parallel->next_chunk, 1)) < (int)parallel->n_chunks)
+    {
+      DetachedChunk *chunk = &parallel->chunks[c];
+      guint i;
+
+      ops_init_detached (&chunk->builder, parallel->parent);
+
+      for (i = chunk->first_child; i < chunk->first_child + chunk->n_children; i ++)
+        gsk_gl_renderer_add_render_ops (parallel->self,
+                                        gsk_container_node_get_child (parallel->container, i),
+                                        &chunk->builder);
+
+      ops_pop_clip (&chunk->builder);
+      ops_pop_modelview (&chunk->builder);
+      ops_finish (&chunk->builder);
+    }
+}
+
+/* Records the ops for runs of children that node_can_record_detached()
+ * on worker threads, and the remaining ones on this thread afterwards.
+ * The ops are added to @builder in the order of the children. */
+static void
+add_container_ops_parallel (GskGLRenderer   *self,
+                            GskRenderNode   *node,
+                            RenderOpBuilder *builder)
+{
+  const guint n_children = gsk_container_node_get_n_children (node);
+  GArray *chunks;
+  ParallelOps parallel;
+  guint i, c;
+
+  chunks = g_array_new (FALSE, TRUE, sizeof (DetachedChunk));
+
+  for (i = 0; i < n_children; )
+    {
+      guint run_end = i;
+
+      while (run_end < n_children &&
+             node_can_record_detached (gsk_container_node_get_child (node, run_end)))
+        run_end ++;
+
+      if (run_end - i >= MIN_DETACHED_RUN)
+        {
+          while (i < run_end)
+            {
+              DetachedChunk chunk = { 0, };
+
+              chunk.first_child = i;
+              chunk.n_children = MIN (DETACHED_CHUNK_SIZE, run_end - i);
+              g_array_append_val (chunks, chunk);
+
+              i += chunk.n_children;
+            }
+        }
+
+      /* Skip the child that stopped the run */
+      i = run_end + 1;
+    }
+
+  if (chunks->len > 0)
+    {
+      parallel.self = self;
+      parallel.container = node;
+      parallel.parent = builder;
+      parallel.chunks = (DetachedChunk *)chunks->data;
+      parallel.n_chunks = chunks->len;
+      parallel.next_chunk = 0;
+
+      gdk_parallel_task_run (record_detached_chunks,
+                             &parallel,
+                             MIN (chunks->len, gdk_parallel_task_get_max_tasks ()));
+    }
+
+  for (i = 0, c = 0; i < n_children; )
+    {
+      if (c < chunks->len &&
+          g_array_index (chunks, DetachedChunk, c).first_child == i)
+        {
+          DetachedChunk *chunk = &g_array_index (chunks, DetachedChunk, c);
+
+          ops_append (builder,
+                      ops_get_buffer (&chunk->builder),
+                      (const GskQuadVertex *)chunk->builder.vertices->data,
+                      chunk->builder.vertices->len);
+          ops_free (&chunk->builder);
+
+          i += chunk->n_children;
+          c ++;
+        }
+      else
+        {
+          gsk_gl_renderer_add_render_ops (self, gsk_container_node_get_child (node, i), builder);
+          i ++;
+        }
+    }
+
+  g_array_free (chunks, TRUE);
+}
+
 static gboolean
 add_offscreen_ops (GskGLRenderer         *self,
                    RenderOpBuilder       *builder,
@@ -4223,6 +4478,7 @@ gsk_gl_renderer_do_render (GskRenderer           *renderer,
   gsk_gl_texture_atlases_begin_frame (self->atlases, removed);
   gsk_gl_glyph_cache_begin_frame (self->glyph_cache, self->gl_driver, removed);
   gsk_gl_icon_cache_begin_frame (self->icon_cache, removed);
+  gsk_gl_texture_atlases_free_retired (self->atlases);
   gsk_gl_shadow_cache_begin_frame (&self->shadow_cache, self->gl_driver);
   g_ptr_array_unref (removed);
 
@@ -4264,8 +4520,16 @@ gsk_gl_renderer_do_render (GskRenderer           *renderer,
   if (fbo_id != 0)
     ops_set_render_target (&self->op_builder, fbo_id);
 
+  /* Merging draws needs to know the modelview and projection of every
+   * draw, so don't rely on what the programs had in the last frame */
+  if (self->use_draw_merging)
+    ops_invalidate_state (&self->op_builder);
+
   gdk_gl_context_push_debug_group (self->gl_context, "Adding render ops");
-  gsk_gl_renderer_add_render_ops (self, root, &self->op_builder);
+  if (self->op_cache_active)
+    add_cached_render_ops (self, root, 0, &self->op_builder);
+  else
+    gsk_gl_renderer_add_render_ops (self, root, &self->op_builder);
   gdk_gl_context_pop_debug_group (self->gl_context);
 
   /* We correctly reset the state everywhere */
@@ -4274,6 +4538,19 @@ gsk_gl_renderer_do_render (GskRenderer           *renderer,
   ops_pop_clip (&self->op_builder);
   ops_finish (&self->op_builder);
 
+  /* Rasterize the glyphs that were missing while adding the ops */
+  gsk_gl_glyph_cache_upload_pending (self->glyph_cache);
+
+  if (self->use_draw_merging)
+    {
+      guint merged_draws G_GNUC_UNUSED;
+
+      merged_draws = ops_merge_draws (&self->op_builder);
+#ifdef G_ENABLE_DEBUG
+      gsk_profiler_counter_add (profiler, self->profile_counters.merged_draws, merged_draws);
+#endif
+    }
+
   /*g_message ("Ops: %u", self->render_ops->len);*/
 
   /* Now actually draw things... */
@@ -4499,7 +4776,17 @@ gsk_gl_renderer_render (GskRenderer          *renderer,
   viewport.size.height = whole_surface.height;
 
   gsk_gl_driver_begin_frame (self->gl_driver);
+  if (self->use_op_cache)
+    {
+      self->op_cache_active = TRUE;
+      gsk_gl_op_cache_begin_frame (&self->op_cache);
+    }
   gsk_gl_renderer_do_render (renderer, root, &viewport, 0, self->scale_factor);
+  if (self->op_cache_active)
+    {
+      gsk_gl_op_cache_end_frame (&self->op_cache);
+      self->op_cache_active = FALSE;
+    }
   gsk_gl_driver_end_frame (self->gl_driver);
 
   gsk_gl_renderer_clear_tree (self);
@@ -4539,6 +4826,7 @@ gsk_gl_renderer_init (GskGLRenderer *self)
     GskProfiler *profiler = gsk_renderer_get_profiler (GSK_RENDERER (self));
 
     self->profile_counters.frames = gsk_profiler_add_counter (profiler, "frames", "Frames", FALSE);
+    self->profile_counters.merged_draws = gsk_profiler_add_counter (profiler, "merged-draws", "Merged draw calls", TRUE);
 
     self->profile_timers.cpu_time = gsk_profiler_add_timer (profiler, "cpu-time", "CPU time", FALSE, TRUE);
     self->profile_timers.gpu_time = gsk_profiler_add_timer (profiler, "gpu-time", "GPU time", FALSE, TRUE);
@@ -4559,3 +4847,31 @@ gsk_gl_renderer_new (void)
 {
   return g_object_new (GSK_TYPE_GL_RENDERER, NULL);
 }
+
+/*
+ * gsk_gl_renderer_prewarm_glyphs:
+ * @renderer: a realized #GskGLRenderer
+ * @font: the font of the glyphs
+ * @text: the text to take the glyphs from
+ * @scale: the scale the glyphs will be drawn at
+ *
+ * Rasterizes the glyphs that @font uses for @text in a thread, so
+ * text using them can later be drawn without waiting for it.
+ *
+ * This is useful after startup or after changing fonts, with the
+ * characters that are likely to be drawn soon.
+ */
+void
+gsk_gl_renderer_prewarm_glyphs (GskGLRenderer *renderer,
+                                PangoFont     *font,
+                                const char    *text,
+                                double         scale)
+{
+  g_return_if_fail (GSK_IS_GL_RENDERER (renderer));
+  g_return_if_fail (PANGO_IS_FONT (font));
+  g_return_if_fail (text != NULL);
+  g_return_if_fail (scale > 0);
+  g_return_if_fail (renderer->glyph_cache != NULL);
+
+  gsk_gl_glyph_cache_prewarm (renderer->glyph_cache, font, text, (guint) (scale * 1024));
+}
@@ -9,6 +9,11 @@ gboolean gsk_gl_renderer_try_compile_gl_shader (GskGLRenderer    *self,
                                                 GskGLShader      *shader,
                                                 GError          **error);
 
+void     gsk_gl_renderer_prewarm_glyphs        (GskGLRenderer    *renderer,
+                                                PangoFont        *font,
+                                                const char       *text,
+                                                double            scale);
+
 G_END_DECLS
 
 #endif /* __GSK_GL_RENDERER_PRIVATE_H__ */
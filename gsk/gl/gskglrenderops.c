@@ -61,6 +61,12 @@ get_current_program_state (RenderOpBuilder *builder)
   if (!builder->current_program)
     return NULL;
 
+  if (builder->program_states != NULL)
+    {
+      g_assert (builder->current_program->index >= 0);
+      return &builder->program_states[builder->current_program->index];
+    }
+
   return &builder->current_program->state;
 }
 
@@ -89,6 +95,44 @@ ops_finish (RenderOpBuilder *builder)
   builder->current_viewport = GRAPHENE_RECT_INIT (0, 0, 0, 0);
 }
 
+static void
+program_state_invalidate (ProgramState *state)
+{
+  g_clear_pointer (&state->modelview, gsk_transform_unref);
+
+  /* All-ones bytes are NaN for every float in here, and NaN never
+   * compares equal, so every value gets sent again on the next draw. */
+  memset (state, 0xff, sizeof (ProgramState));
+  state->modelview = NULL;
+}
+
+/* Forget everything we know about the uniform state of all programs
+ * and the currently bound program, e.g. because a range of ops we
+ * did not track was added to the buffer. */
+void
+ops_invalidate_state (RenderOpBuilder *builder)
+{
+  GHashTableIter iter;
+  gpointer value;
+  guint i;
+
+  builder->current_program = NULL;
+
+  if (builder->program_states != NULL)
+    {
+      for (i = 0; i < GL_N_PROGRAMS; i ++)
+        program_state_invalidate (&builder->program_states[i]);
+      return;
+    }
+
+  for (i = 0; i < GL_N_PROGRAMS; i ++)
+    program_state_invalidate (&builder->programs->programs[i].state);
+
+  g_hash_table_iter_init (&iter, builder->programs->custom_programs);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    program_state_invalidate (&((Program *)value)->state);
+}
+
 /* Debugging only! */
 void
 ops_dump_framebuffer (RenderOpBuilder *builder,
@@ -200,9 +244,56 @@ ops_init (RenderOpBuilder *builder)
   builder->vertices = g_array_new (FALSE, TRUE, sizeof (GskQuadVertex));
 }
 
+/* Sets up @builder to record ops at the point in the node tree
+ * @parent is currently at. The ops only depend on the state of
+ * @parent, not on the ops recorded into it before, so they can be
+ * added to it later using ops_append().
+ *
+ * @builder keeps its own program state, so it can be used on a
+ * different thread than @parent, as long as it only uses the
+ * builtin programs and no textures.
+ */
+void
+ops_init_detached (RenderOpBuilder       *builder,
+                   const RenderOpBuilder *parent)
+{
+  ops_init (builder);
+
+  builder->programs = parent->programs;
+  builder->renderer = parent->renderer;
+  builder->program_states = g_new0 (ProgramState, GL_N_PROGRAMS);
+  ops_invalidate_state (builder);
+
+  builder->current_render_target = parent->current_render_target;
+  builder->current_projection = parent->current_projection;
+  builder->current_viewport = parent->current_viewport;
+  builder->current_opacity = parent->current_opacity;
+
+  ops_set_modelview (builder, gsk_transform_ref (parent->current_modelview));
+  builder->dx = parent->dx;
+  builder->dy = parent->dy;
+  ops_push_clip (builder, parent->current_clip);
+}
+
 void
 ops_free (RenderOpBuilder *builder)
 {
+  if (builder->program_states != NULL)
+    {
+      guint i;
+
+      for (i = 0; i < GL_N_PROGRAMS; i ++)
+        gsk_transform_unref (builder->program_states[i].modelview);
+
+      g_clear_pointer (&builder->program_states, g_free);
+    }
+
+  if (builder->merged_vertices != NULL)
+    {
+      g_array_unref (builder->merged_vertices);
+      op_buffer_destroy (&builder->merged_ops);
+    }
+
   g_array_unref (builder->vertices);
   op_buffer_destroy (&builder->render_ops);
 }
@@ -708,6 +799,632 @@ ops_offset (RenderOpBuilder *builder,
   builder->dy += y;
 }
 
+/* Adds ops recorded somewhere else, e.g. by a detached builder.
+ * The vao offsets of the draw ops in @ops are relative to @vertices.
+ */
+void
+ops_append (RenderOpBuilder     *builder,
+            const OpBuffer      *ops,
+            const GskQuadVertex *vertices,
+            guint                n_vertices)
+{
+  OpBuffer *buffer = &builder->render_ops;
+  const guint first_op = buffer->index->len;
+  const guint first_vertex = builder->vertices->len;
+  guint i;
+
+  g_array_append_vals (builder->vertices, vertices, n_vertices);
+  op_buffer_append_range (buffer, ops, 1, ops->index->len - 1);
+
+  for (i = first_op; i < buffer->index->len; i++)
+    {
+      const OpBufferEntry *entry = &g_array_index (buffer->index, OpBufferEntry, i);
+
+      if (entry->kind == OP_DRAW)
+        ((OpDraw *)&buffer->buf[entry->pos])->vao_offset += first_vertex;
+    }
+
+  /* We have no idea what the ops did to the program state */
+  ops_invalidate_state (builder);
+}
+
+/* Draw merging
+ *
+ * ops_merge_draws() rewrites the ops of a frame so that draws with the
+ * same program, uniforms and source texture end up in a single OP_DRAW.
+ *
+ * Only the color, coloring and blit programs take part, since all their
+ * state is set by ops that carry the complete value (unlike e.g. the
+ * shadow ops, which only contain what changed). Runs of ops that only
+ * touch that state form a segment. Inside a segment, a draw can join an
+ * earlier group of draws with the same state if it does not overlap any
+ * of the draws that would end up being drawn after it instead of before
+ * it. Everything else (render target changes, viewports, other programs,
+ * ...) ends the segment and is copied unchanged.
+ *
+ * The groups of a segment are then added in the order of their first
+ * draw, with only the ops needed to get from one group's state to the
+ * next. At the end of a segment, the state the original ops left the
+ * programs in is restored, so the ops after it, and the program state
+ * tracked for the next frame, stay valid.
+ */
+
+/* A group only accepts new draws for this many draws after its first */
+#define MERGE_WINDOW 64
+
+typedef struct
+{
+  /* Pointers to the ops that last set the uniform, or NULL if unknown */
+  const OpOpacity *opacity;
+  const OpMatrix *projection;
+  const OpMatrix *modelview;
+  const OpClip *clip;
+  const OpColor *color;
+} MergeUniforms;
+
+typedef struct
+{
+  const Program *program;
+  const OpTexture *texture; /* Not per program */
+  MergeUniforms uniforms[GL_N_PROGRAMS];
+} MergeState;
+
+typedef struct
+{
+  const OpDraw *op;
+  graphene_rect_t bounds;
+  guint group;
+  guint next; /* Next draw of the same group, or G_MAXUINT */
+  guint has_bounds : 1;
+} MergeDraw;
+
+typedef struct
+{
+  const Program *program;
+  const OpTexture *texture;
+  MergeUniforms uniforms;
+  guint first_draw;
+  guint last_draw;
+} MergeGroup;
+
+typedef struct
+{
+  const GskGLRendererPrograms *programs;
+  const GskQuadVertex *vertices;
+
+  OpBuffer *out_ops;
+  GArray *out_vertices;
+  guint n_out_draws;
+
+  MergeState state;   /* Like the original ops left it */
+  MergeState emitted; /* Like the ops in out_ops left it */
+
+  GArray *draws;  /* MergeDraw of the current segment */
+  GArray *groups; /* MergeGroup of the current segment */
+} DrawMerger;
+
+static inline gboolean
+program_uses_color (const DrawMerger *merger,
+                    const Program    *program)
+{
+  return program == &merger->programs->color_program ||
+         program == &merger->programs->coloring_program;
+}
+
+static inline gboolean
+program_uses_texture (const DrawMerger *merger,
+                      const Program    *program)
+{
+  return program == &merger->programs->coloring_program ||
+         program == &merger->programs->blit_program;
+}
+
+static inline gboolean
+program_is_mergeable (const DrawMerger *merger,
+                      const Program    *program)
+{
+  return program_uses_color (merger, program) ||
+         program_uses_texture (merger, program);
+}
+
+static inline gboolean
+op_is_mergeable (OpKind kind)
+{
+  switch (kind)
+    {
+    case OP_CHANGE_OPACITY:
+    case OP_CHANGE_COLOR:
+    case OP_CHANGE_PROJECTION:
+    case OP_CHANGE_MODELVIEW:
+    case OP_CHANGE_CLIP:
+    case OP_CHANGE_SOURCE_TEXTURE:
+    case OP_DRAW:
+      return TRUE;
+
+    default:
+      return FALSE;
+    }
+}
+
+static inline gboolean
+opacity_equal (const OpOpacity *a,
+               const OpOpacity *b)
+{
+  if (a == b)
+    return TRUE;
+
+  if (a == NULL || b == NULL)
+    return FALSE;
+
+  return a->opacity == b->opacity;
+}
+
+static inline gboolean
+matrix_equal (const OpMatrix *a,
+              const OpMatrix *b)
+{
+  if (a == b)
+    return TRUE;
+
+  if (a == NULL || b == NULL)
+    return FALSE;
+
+  return memcmp (&a->matrix, &b->matrix, sizeof (graphene_matrix_t)) == 0;
+}
+
+static inline gboolean
+clip_equal (const OpClip *a,
+            const OpClip *b)
+{
+  if (a == b)
+    return TRUE;
+
+  if (a == NULL || b == NULL)
+    return FALSE;
+
+  return rounded_rect_equal (&a->clip, &b->clip);
+}
+
+static inline gboolean
+color_equal (const OpColor *a,
+             const OpColor *b)
+{
+  if (a == b)
+    return TRUE;
+
+  if (a == NULL || b == NULL)
+    return FALSE;
+
+  return gdk_rgba_equal (a->rgba, b->rgba);
+}
+
+static inline gboolean
+texture_equal (const OpTexture *a,
+               const OpTexture *b)
+{
+  if (a == b)
+    return TRUE;
+
+  if (a == NULL || b == NULL)
+    return FALSE;
+
+  return a->texture_id == b->texture_id;
+}
+
+static void
+merge_state_apply (MergeState    *state,
+                   OpKind         kind,
+                   gconstpointer  op)
+{
+  MergeUniforms *uniforms;
+
+  if (kind == OP_CHANGE_PROGRAM)
+    {
+      state->program = ((const OpProgram *)op)->program;
+      return;
+    }
+
+  /* Ops are ignored until there is a program, see gsk_gl_renderer_render_ops() */
+  if (state->program == NULL)
+    return;
+
+  if (kind == OP_CHANGE_SOURCE_TEXTURE)
+    {
+      state->texture = op;
+      return;
+    }
+
+  if (state->program->index < 0)
+    return;
+
+  uniforms = &state->uniforms[state->program->index];
+
+  switch (kind)
+    {
+    case OP_CHANGE_OPACITY:
+      uniforms->opacity = op;
+      break;
+
+    case OP_CHANGE_PROJECTION:
+      uniforms->projection = op;
+      break;
+
+    case OP_CHANGE_MODELVIEW:
+      uniforms->modelview = op;
+      break;
+
+    case OP_CHANGE_CLIP:
+      uniforms->clip = op;
+      break;
+
+    case OP_CHANGE_COLOR:
+      uniforms->color = op;
+      break;
+
+    default:
+      break;
+    }
+}
+
+static void
+emit_program (DrawMerger    *merger,
+              const Program *program)
+{
+  OpProgram *op;
+
+  if (merger->emitted.program == program)
+    return;
+
+  op = op_buffer_add (merger->out_ops, OP_CHANGE_PROGRAM);
+  op->program = program;
+  merger->emitted.program = program;
+}
+
+static void
+emit_uniforms (DrawMerger          *merger,
+               const Program       *program,
+               const MergeUniforms *uniforms,
+               gboolean             with_color)
+{
+  MergeUniforms *emitted = &merger->emitted.uniforms[program->index];
+
+  /* Uniforms we don't know can only be needed before they are first set */
+  if (!opacity_equal (emitted->opacity, uniforms->opacity))
+    {
+      g_assert (uniforms->opacity != NULL);
+      emit_program (merger, program);
+      *(OpOpacity *)op_buffer_add (merger->out_ops, OP_CHANGE_OPACITY) = *uniforms->opacity;
+      emitted->opacity = uniforms->opacity;
+    }
+
+  if (!matrix_equal (emitted->projection, uniforms->projection))
+    {
+      g_assert (uniforms->projection != NULL);
+      emit_program (merger, program);
+      *(OpMatrix *)op_buffer_add (merger->out_ops, OP_CHANGE_PROJECTION) = *uniforms->projection;
+      emitted->projection = uniforms->projection;
+    }
+
+  if (!matrix_equal (emitted->modelview, uniforms->modelview))
+    {
+      g_assert (uniforms->modelview != NULL);
+      emit_program (merger, program);
+      *(OpMatrix *)op_buffer_add (merger->out_ops, OP_CHANGE_MODELVIEW) = *uniforms->modelview;
+      emitted->modelview = uniforms->modelview;
+    }
+
+  if (!clip_equal (emitted->clip, uniforms->clip))
+    {
+      OpClip *op;
+
+      g_assert (uniforms->clip != NULL);
+      emit_program (merger, program);
+      op = op_buffer_add (merger->out_ops, OP_CHANGE_CLIP);
+      *op = *uniforms->clip;
+      /* The corners the original op relied on might not be set */
+      op->send_corners = TRUE;
+      emitted->clip = uniforms->clip;
+    }
+
+  if (with_color && !color_equal (emitted->color, uniforms->color))
+    {
+      g_assert (uniforms->color != NULL);
+      emit_program (merger, program);
+      *(OpColor *)op_buffer_add (merger->out_ops, OP_CHANGE_COLOR) = *uniforms->color;
+      emitted->color = uniforms->color;
+    }
+}
+
+static void
+emit_texture (DrawMerger      *merger,
+              const OpTexture *texture)
+{
+  if (texture_equal (merger->emitted.texture, texture))
+    return;
+
+  g_assert (texture != NULL);
+  *(OpTexture *)op_buffer_add (merger->out_ops, OP_CHANGE_SOURCE_TEXTURE) = *texture;
+  merger->emitted.texture = texture;
+}
+
+static void
+emit_draw (DrawMerger   *merger,
+           const OpDraw *draw)
+{
+  OpDraw *op;
+
+  op = op_buffer_add (merger->out_ops, OP_DRAW);
+  op->vao_offset = merger->out_vertices->len;
+  op->vao_size = draw->vao_size;
+  g_array_append_vals (merger->out_vertices,
+                       &merger->vertices[draw->vao_offset],
+                       draw->vao_size);
+  merger->n_out_draws++;
+}
+
+static gboolean
+get_draw_bounds (const DrawMerger *merger,
+                 const OpDraw     *draw,
+                 graphene_rect_t  *bounds)
+{
+  const MergeUniforms *uniforms = &merger->state.uniforms[merger->state.program->index];
+  graphene_matrix_t mvp;
+  float min_x, min_y, max_x, max_y;
+  gsize i;
+
+  if (uniforms->projection == NULL || uniforms->modelview == NULL)
+    return FALSE;
+
+  min_x = max_x = merger->vertices[draw->vao_offset].position[0];
+  min_y = max_y = merger->vertices[draw->vao_offset].position[1];
+
+  for (i = draw->vao_offset + 1; i < draw->vao_offset + draw->vao_size; i++)
+    {
+      const GskQuadVertex *v = &merger->vertices[i];
+
+      min_x = MIN (min_x, v->position[0]);
+      min_y = MIN (min_y, v->position[1]);
+      max_x = MAX (max_x, v->position[0]);
+      max_y = MAX (max_y, v->position[1]);
+    }
+
+  /* Like u_projection * u_modelview in the shaders */
+  graphene_matrix_multiply (&uniforms->modelview->matrix, &uniforms->projection->matrix, &mvp);
+  graphene_matrix_transform_bounds (&mvp,
+                                    &GRAPHENE_RECT_INIT (min_x, min_y, max_x - min_x, max_y - min_y),
+                                    bounds);
+
+  return TRUE;
+}
+
+/* Whether @draw can be drawn together with group @g, i.e. whether it
+ * does not overlap any draw between the group's first draw and @draw
+ * that will end up being drawn after the group. */
+static gboolean
+can_join_group (const DrawMerger *merger,
+                const MergeDraw  *draw,
+                guint             g)
+{
+  const MergeGroup *group = &g_array_index (merger->groups, MergeGroup, g);
+  guint i;
+
+  for (i = group->first_draw + 1; i < merger->draws->len; i++)
+    {
+      const MergeDraw *other = &g_array_index (merger->draws, MergeDraw, i);
+
+      /* Groups are added in the order they were created in */
+      if (other->group <= g)
+        continue;
+
+      if (!draw->has_bounds || !other->has_bounds ||
+          graphene_rect_intersection (&draw->bounds, &other->bounds, NULL))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static void
+add_draw (DrawMerger   *merger,
+          const OpDraw *op)
+{
+  const Program *program = merger->state.program;
+  const gboolean uses_color = program_uses_color (merger, program);
+  const gboolean uses_texture = program_uses_texture (merger, program);
+  MergeUniforms uniforms = merger->state.uniforms[program->index];
+  const OpTexture *texture = uses_texture ? merger->state.texture : NULL;
+  MergeDraw draw;
+  MergeGroup *group;
+  guint g;
+
+  if (!uses_color)
+    uniforms.color = NULL;
+
+  draw.op = op;
+  draw.next = G_MAXUINT;
+  draw.has_bounds = get_draw_bounds (merger, op, &draw.bounds);
+
+  for (g = merger->groups->len; g > 0; g--)
+    {
+      group = &g_array_index (merger->groups, MergeGroup, g - 1);
+
+      if (group->first_draw + MERGE_WINDOW < merger->draws->len)
+        break;
+
+      if (group->program != program ||
+          !texture_equal (group->texture, texture) ||
+          !opacity_equal (group->uniforms.opacity, uniforms.opacity) ||
+          !matrix_equal (group->uniforms.projection, uniforms.projection) ||
+          !matrix_equal (group->uniforms.modelview, uniforms.modelview) ||
+          !clip_equal (group->uniforms.clip, uniforms.clip) ||
+          !color_equal (group->uniforms.color, uniforms.color))
+        continue;
+
+      if (!can_join_group (merger, &draw, g - 1))
+        continue;
+
+      draw.group = g - 1;
+      g_array_index (merger->draws, MergeDraw, group->last_draw).next = merger->draws->len;
+      group->last_draw = merger->draws->len;
+      g_array_append_val (merger->draws, draw);
+      return;
+    }
+
+  draw.group = merger->groups->len;
+  g_array_set_size (merger->groups, merger->groups->len + 1);
+  group = &g_array_index (merger->groups, MergeGroup, merger->groups->len - 1);
+  group->program = program;
+  group->texture = texture;
+  group->uniforms = uniforms;
+  group->first_draw = merger->draws->len;
+  group->last_draw = merger->draws->len;
+  g_array_append_val (merger->draws, draw);
+}
+
+static void
+flush_segment (DrawMerger *merger)
+{
+  const Program *mergeable_programs[] = {
+    &merger->programs->color_program,
+    &merger->programs->coloring_program,
+    &merger->programs->blit_program,
+  };
+  guint g, i;
+
+  for (g = 0; g < merger->groups->len; g++)
+    {
+      const MergeGroup *group = &g_array_index (merger->groups, MergeGroup, g);
+      OpDraw *op;
+
+      emit_program (merger, group->program);
+      emit_uniforms (merger, group->program, &group->uniforms,
+                     program_uses_color (merger, group->program));
+      if (program_uses_texture (merger, group->program))
+        emit_texture (merger, group->texture);
+
+      op = op_buffer_add (merger->out_ops, OP_DRAW);
+      op->vao_offset = merger->out_vertices->len;
+      op->vao_size = 0;
+
+      for (i = group->first_draw; i != G_MAXUINT; i = g_array_index (merger->draws, MergeDraw, i).next)
+        {
+          const OpDraw *draw = g_array_index (merger->draws, MergeDraw, i).op;
+
+          g_array_append_vals (merger->out_vertices,
+                               &merger->vertices[draw->vao_offset],
+                               draw->vao_size);
+          op->vao_size += draw->vao_size;
+        }
+
+      merger->n_out_draws++;
+    }
+
+  /* Leave everything like the original ops did */
+  for (i = 0; i < G_N_ELEMENTS (mergeable_programs); i++)
+    {
+      if (mergeable_programs[i] != merger->state.program)
+        emit_uniforms (merger, mergeable_programs[i],
+                       &merger->state.uniforms[mergeable_programs[i]->index],
+                       TRUE);
+    }
+
+  emit_uniforms (merger, merger->state.program,
+                 &merger->state.uniforms[merger->state.program->index],
+                 TRUE);
+  emit_texture (merger, merger->state.texture);
+  emit_program (merger, merger->state.program);
+
+  g_array_set_size (merger->draws, 0);
+  g_array_set_size (merger->groups, 0);
+}
+
+/* Merges compatible draws of the ops recorded so far, see above.
+ * Returns the number of draws that were saved. */
+guint
+ops_merge_draws (RenderOpBuilder *builder)
+{
+  OpBuffer *buffer = &builder->render_ops;
+  DrawMerger merger = { 0, };
+  gboolean in_segment = FALSE;
+  guint n_draws = 0;
+  GArray *vertices;
+  OpBuffer tmp;
+  guint i;
+
+  if (builder->merged_vertices == NULL)
+    {
+      op_buffer_init (&builder->merged_ops);
+      builder->merged_vertices = g_array_new (FALSE, FALSE, sizeof (GskQuadVertex));
+    }
+
+  op_buffer_clear (&builder->merged_ops);
+  g_array_set_size (builder->merged_vertices, 0);
+
+  merger.programs = builder->programs;
+  merger.vertices = (const GskQuadVertex *)builder->vertices->data;
+  merger.out_ops = &builder->merged_ops;
+  merger.out_vertices = builder->merged_vertices;
+  merger.draws = g_array_new (FALSE, FALSE, sizeof (MergeDraw));
+  merger.groups = g_array_new (FALSE, FALSE, sizeof (MergeGroup));
+
+  for (i = 1; i < buffer->index->len; i++)
+    {
+      const OpBufferEntry *entry = &g_array_index (buffer->index, OpBufferEntry, i);
+      gconstpointer op = &buffer->buf[entry->pos];
+      gboolean mergeable;
+
+      if (entry->kind == OP_DRAW)
+        n_draws++;
+
+      if (entry->kind == OP_CHANGE_PROGRAM)
+        mergeable = program_is_mergeable (&merger, ((const OpProgram *)op)->program);
+      else
+        mergeable = merger.state.program != NULL &&
+                    program_is_mergeable (&merger, merger.state.program) &&
+                    op_is_mergeable (entry->kind);
+
+      if (mergeable)
+        {
+          in_segment = TRUE;
+          merge_state_apply (&merger.state, entry->kind, op);
+
+          if (entry->kind == OP_DRAW)
+            add_draw (&merger, op);
+        }
+      else
+        {
+          if (in_segment)
+            flush_segment (&merger);
+          in_segment = FALSE;
+
+          merge_state_apply (&merger.state, entry->kind, op);
+          merge_state_apply (&merger.emitted, entry->kind, op);
+
+          if (entry->kind == OP_DRAW)
+            emit_draw (&merger, op);
+          else
+            op_buffer_append_range (merger.out_ops, buffer, i, 1);
+        }
+    }
+
+  if (in_segment)
+    flush_segment (&merger);
+
+  g_array_unref (merger.draws);
+  g_array_unref (merger.groups);
+
+  /* Keep the old ops around for the next frame */
+  tmp = builder->render_ops;
+  builder->render_ops = builder->merged_ops;
+  builder->merged_ops = tmp;
+
+  vertices = builder->vertices;
+  builder->vertices = builder->merged_vertices;
+  builder->merged_vertices = vertices;
+
+  return n_draws - merger.n_out_draws;
+}
+
 gpointer
 ops_begin (RenderOpBuilder *builder,
            OpKind           kind)
@@ -209,6 +209,8 @@ typedef struct {
 typedef struct
 {
   GskGLRendererPrograms *programs;
+  /* If set, used instead of the state stored in the programs */
+  ProgramState *program_states;
   Program *current_program;
   int current_render_target;
   int current_texture;
@@ -222,6 +224,10 @@ typedef struct
   OpBuffer render_ops;
   GArray *vertices;
 
+  /* Scratch space for ops_merge_draws() */
+  OpBuffer merged_ops;
+  GArray *merged_vertices;
+
   GskGLRenderer *renderer;
 
   /* Stack of modelview matrices */
@@ -241,6 +247,8 @@ void              ops_dump_framebuffer   (RenderOpBuilder         *builder,
                                           int                      width,
                                           int                      height);
 void              ops_init               (RenderOpBuilder         *builder);
+void              ops_init_detached      (RenderOpBuilder         *builder,
+                                          const RenderOpBuilder   *parent);
 void              ops_free               (RenderOpBuilder         *builder);
 void              ops_reset              (RenderOpBuilder         *builder);
 void              ops_push_debug_group    (RenderOpBuilder         *builder,
@@ -248,6 +256,7 @@ void              ops_push_debug_group    (RenderOpBuilder         *builder,
 void              ops_pop_debug_group     (RenderOpBuilder         *builder);
 
 void              ops_finish             (RenderOpBuilder         *builder);
+void              ops_invalidate_state   (RenderOpBuilder         *builder);
 void              ops_push_modelview     (RenderOpBuilder         *builder,
                                           GskTransform            *transform);
 void              ops_set_modelview      (RenderOpBuilder         *builder,
@@ -346,6 +355,13 @@ void              ops_offset             (RenderOpBuilder        *builder,
                                           float                   x,
                                           float                   y);
 
+void              ops_append             (RenderOpBuilder        *builder,
+                                          const OpBuffer         *ops,
+                                          const GskQuadVertex    *vertices,
+                                          guint                   n_vertices);
+
+guint             ops_merge_draws        (RenderOpBuilder        *builder);
+
 gpointer          ops_begin              (RenderOpBuilder        *builder,
                                           OpKind                  kind);
 OpBuffer         *ops_get_buffer         (RenderOpBuilder        *builder);
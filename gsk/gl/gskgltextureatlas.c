@@ -6,8 +6,26 @@
 #include <epoxy/gl.h>
 
 #define ATLAS_SIZE (512)
+#define MAX_ATLAS_SIZE (4096)
 #define MAX_OLD_RATIO 0.5
 
+/* Atlas management
+ *
+ * The first atlas is ATLAS_SIZE pixels wide. Whenever nothing fits
+ * into the existing atlases anymore, the new atlas is twice as big as
+ * the biggest one, up to MAX_ATLAS_SIZE or GL_MAX_TEXTURE_SIZE. Apps
+ * that use lots of glyphs and icons thus end up with a few big atlases
+ * instead of dozens of small ones.
+ *
+ * When too much of an atlas is taken up by items that have not been
+ * used in a while, we retire it. The caches move the items that are
+ * still in use to other atlases with
+ * gsk_gl_texture_atlases_relocate(), which copies them on the GPU,
+ * and drop the rest. Then gsk_gl_texture_atlases_free_retired() frees
+ * the atlas. If the GL version can't copy between textures, the atlas
+ * is dropped right away with all of its items.
+ */
+
 static void
 free_atlas (gpointer v)
 {
@@ -25,6 +43,12 @@ gsk_gl_texture_atlases_new (void)
 
   self = g_new (GskGLTextureAtlases, 1);
   self->atlases = g_ptr_array_new_with_free_func (free_atlas);
+  self->retired = g_ptr_array_new_with_free_func (free_atlas);
+  self->max_size = 0;
+  self->copy_framebuffer = 0;
+  self->copy_source = 0;
+  self->can_copy = FALSE;
+  self->generation = 0;
 
   self->ref_count = 1;
 
@@ -47,6 +71,7 @@ gsk_gl_texture_atlases_unref (GskGLTextureAtlases *self)
   if (self->ref_count == 1)
     {
       g_ptr_array_unref (self->atlases);
+      g_ptr_array_unref (self->retired);
       g_free (self);
       return;
     }
@@ -77,14 +102,32 @@ void
 gsk_gl_texture_atlases_begin_frame (GskGLTextureAtlases *self,
                                     GPtrArray           *removed)
 {
+  GdkGLContext *context = gdk_gl_context_get_current ();
+  int major, minor;
   int i;
 
+  gdk_gl_context_get_version (context, &major, &minor);
+  self->can_copy = major >= 3;
+
   for (i = self->atlases->len - 1; i >= 0; i--)
     {
       GskGLTextureAtlas *atlas = g_ptr_array_index (self->atlases, i);
 
       if (gsk_gl_texture_atlas_get_unused_ratio (atlas) > MAX_OLD_RATIO)
         {
+          g_ptr_array_add (removed, atlas);
+          self->generation++;
+
+          if (self->can_copy)
+            {
+              GSK_NOTE(GLYPH_CACHE,
+                       g_message ("Compacting atlas %d (%g.2%% old)", i,
+                                  100.0 * gsk_gl_texture_atlas_get_unused_ratio (atlas)));
+
+              g_ptr_array_add (self->retired, g_ptr_array_steal_index (self->atlases, i));
+              continue;
+            }
+
           GSK_NOTE(GLYPH_CACHE,
                    g_message ("Dropping atlas %d (%g.2%% old)", i,
                               100.0 * gsk_gl_texture_atlas_get_unused_ratio (atlas)));
@@ -95,7 +138,6 @@ gsk_gl_texture_atlases_begin_frame (GskGLTextureAtlases *self,
               atlas->texture_id = 0;
             }
 
-          g_ptr_array_add (removed, atlas);
           g_ptr_array_remove_index (self->atlases, i);
        }
     }
@@ -130,6 +172,33 @@ gsk_gl_texture_atlases_begin_frame (GskGLTextureAtlases *self,
 #endif
 }
 
+static int
+get_new_atlas_size (GskGLTextureAtlases *self,
+                    int                  width,
+                    int                  height)
+{
+  int size = ATLAS_SIZE;
+  guint i;
+
+  if (self->max_size == 0)
+    {
+      glGetIntegerv (GL_MAX_TEXTURE_SIZE, &self->max_size);
+      self->max_size = CLAMP (self->max_size, ATLAS_SIZE, MAX_ATLAS_SIZE);
+    }
+
+  for (i = 0; i < self->atlases->len; i++)
+    {
+      const GskGLTextureAtlas *atlas = g_ptr_array_index (self->atlases, i);
+
+      size = MAX (size, 2 * atlas->width);
+    }
+
+  while (size < width || size < height)
+    size *= 2;
+
+  return MIN (size, self->max_size);
+}
+
 gboolean
 gsk_gl_texture_atlases_pack (GskGLTextureAtlases *self,
                              int                  width,
@@ -142,9 +211,6 @@ gsk_gl_texture_atlases_pack (GskGLTextureAtlases *self,
   int x, y;
   int i;
 
-  g_assert (width  < ATLAS_SIZE);
-  g_assert (height < ATLAS_SIZE);
-
   atlas = NULL;
 
   for (i = 0; i < self->atlases->len; i++)
@@ -159,9 +225,14 @@ gsk_gl_texture_atlases_pack (GskGLTextureAtlases *self,
 
   if (atlas == NULL)
     {
+      int size = get_new_atlas_size (self, width, height);
+
+      g_assert (width  < size);
+      g_assert (height < size);
+
       /* No atlas has enough space, so create a new one... */
       atlas = g_malloc (sizeof (GskGLTextureAtlas));
-      gsk_gl_texture_atlas_init (atlas, ATLAS_SIZE, ATLAS_SIZE);
+      gsk_gl_texture_atlas_init (atlas, size, size);
       gsk_gl_texture_atlas_realize (atlas);
       g_ptr_array_add (self->atlases, atlas);
 
@@ -169,7 +240,7 @@ gsk_gl_texture_atlases_pack (GskGLTextureAtlases *self,
       if (!gsk_gl_texture_atlas_pack (atlas, width, height, &x, &y))
         g_assert_not_reached ();
 
-      GSK_NOTE(GLYPH_CACHE, g_message ("adding new atlas"));
+      GSK_NOTE(GLYPH_CACHE, g_message ("adding new %dx%d atlas", size, size));
     }
 
   *atlas_out = atlas;
@@ -179,6 +250,93 @@ gsk_gl_texture_atlases_pack (GskGLTextureAtlases *self,
   return TRUE;
 }
 
+/**
+ * gsk_gl_texture_atlases_is_retired:
+ * @self: the atlases
+ * @atlas: an atlas from the removed array of this frame
+ *
+ * Checks whether the items on @atlas can be moved to another atlas
+ * with gsk_gl_texture_atlases_relocate(). Otherwise, @atlas has been
+ * dropped already and must not be used anymore.
+ *
+ * Returns: %TRUE if @atlas is being compacted
+ */
+gboolean
+gsk_gl_texture_atlases_is_retired (GskGLTextureAtlases *self,
+                                   GskGLTextureAtlas   *atlas)
+{
+  return g_ptr_array_find (self->retired, atlas, NULL);
+}
+
+/**
+ * gsk_gl_texture_atlases_relocate:
+ * @self: the atlases
+ * @atlas: a retired atlas
+ * @x: the x position of the item on @atlas
+ * @y: the y position of the item on @atlas
+ * @width: the width of the item, including padding
+ * @height: the height of the item, including padding
+ * @atlas_out: (out): return location for the new atlas
+ * @out_x: (out): return location for the new x position
+ * @out_y: (out): return location for the new y position
+ *
+ * Packs an item of a retired atlas onto another atlas and copies
+ * its pixels there.
+ */
+void
+gsk_gl_texture_atlases_relocate (GskGLTextureAtlases *self,
+                                 GskGLTextureAtlas   *atlas,
+                                 int                  x,
+                                 int                  y,
+                                 int                  width,
+                                 int                  height,
+                                 GskGLTextureAtlas  **atlas_out,
+                                 int                 *out_x,
+                                 int                 *out_y)
+{
+  int prev_framebuffer;
+
+  g_assert (gsk_gl_texture_atlases_is_retired (self, atlas));
+
+  gsk_gl_texture_atlases_pack (self, width, height, atlas_out, out_x, out_y);
+
+  if (self->copy_framebuffer == 0)
+    glGenFramebuffers (1, &self->copy_framebuffer);
+
+  glGetIntegerv (GL_READ_FRAMEBUFFER_BINDING, &prev_framebuffer);
+  glBindFramebuffer (GL_READ_FRAMEBUFFER, self->copy_framebuffer);
+
+  if (self->copy_source != atlas->texture_id)
+    {
+      glFramebufferTexture2D (GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_TEXTURE_2D, atlas->texture_id, 0);
+      self->copy_source = atlas->texture_id;
+    }
+
+  glBindTexture (GL_TEXTURE_2D, (*atlas_out)->texture_id);
+  glCopyTexSubImage2D (GL_TEXTURE_2D, 0, *out_x, *out_y, x, y, width, height);
+  glBindTexture (GL_TEXTURE_2D, 0);
+
+  glBindFramebuffer (GL_READ_FRAMEBUFFER, prev_framebuffer);
+}
+
+/* Called once the caches are done moving items off the atlases
+ * retired in begin_frame(). The framebuffer is not kept around,
+ * since the next frame might be drawn with a different context.
+ */
+void
+gsk_gl_texture_atlases_free_retired (GskGLTextureAtlases *self)
+{
+  g_ptr_array_set_size (self->retired, 0);
+
+  if (self->copy_framebuffer != 0)
+    {
+      glDeleteFramebuffers (1, &self->copy_framebuffer);
+      self->copy_framebuffer = 0;
+      self->copy_source = 0;
+    }
+}
+
 void
 gsk_gl_texture_atlas_init (GskGLTextureAtlas *self,
                            int                width,
@@ -28,6 +28,18 @@ struct _GskGLTextureAtlases
   int ref_count;
 
   GPtrArray *atlases;
+
+  /* Fragmented atlases whose live items are being moved to other
+   * atlases, see gsk_gl_texture_atlases_free_retired() */
+  GPtrArray *retired;
+
+  int max_size; /* The size of the largest atlas we create */
+
+  guint copy_framebuffer;
+  guint copy_source; /* The texture attached to copy_framebuffer */
+  guint can_copy : 1;
+
+  guint generation; /* Bumped whenever an atlas gets dropped or retired */
 };
 typedef struct _GskGLTextureAtlases GskGLTextureAtlases;
 
@@ -43,6 +55,18 @@ gboolean             gsk_gl_texture_atlases_pack        (GskGLTextureAtlases *at
                                                          GskGLTextureAtlas  **atlas_out,
                                                          int                 *out_x,
                                                          int                 *out_y);
+gboolean             gsk_gl_texture_atlases_is_retired  (GskGLTextureAtlases *atlases,
+                                                         GskGLTextureAtlas   *atlas);
+void                 gsk_gl_texture_atlases_relocate    (GskGLTextureAtlases *atlases,
+                                                         GskGLTextureAtlas   *atlas,
+                                                         int                  x,
+                                                         int                  y,
+                                                         int                  width,
+                                                         int                  height,
+                                                         GskGLTextureAtlas  **atlas_out,
+                                                         int                 *out_x,
+                                                         int                 *out_y);
+void                 gsk_gl_texture_atlases_free_retired (GskGLTextureAtlases *atlases);
 
 void        gsk_gl_texture_atlas_init              (GskGLTextureAtlas       *self,
                                                     int                      width,
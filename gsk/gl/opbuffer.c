@@ -135,3 +135,27 @@ op_buffer_add (OpBuffer *buffer,
 
   return &buffer->buf[entry.pos];
 }
+
+/* Copies @n_ops ops starting at index @first_op of @source to the
+ * end of @buffer. Both are index positions, so the first real op of
+ * a buffer is at 1.
+ */
+void
+op_buffer_append_range (OpBuffer       *buffer,
+                        const OpBuffer *source,
+                        guint           first_op,
+                        guint           n_ops)
+{
+  guint i;
+
+  g_assert (buffer != source);
+  g_assert (first_op + n_ops <= source->index->len);
+
+  for (i = first_op; i < first_op + n_ops; i++)
+    {
+      const OpBufferEntry *entry = &g_array_index (source->index, OpBufferEntry, i);
+      gpointer op = op_buffer_add (buffer, entry->kind);
+
+      memcpy (op, &source->buf[entry->pos], op_sizes[entry->kind]);
+    }
+}
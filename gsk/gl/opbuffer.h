@@ -230,6 +230,10 @@ void     op_buffer_destroy         (OpBuffer *buffer);
 void     op_buffer_clear           (OpBuffer *buffer);
 gpointer op_buffer_add             (OpBuffer *buffer,
                                     OpKind    kind);
+void     op_buffer_append_range    (OpBuffer       *buffer,
+                                    const OpBuffer *source,
+                                    guint           first_op,
+                                    guint           n_ops);
 
 typedef struct
 {
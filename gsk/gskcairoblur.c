@@ -22,9 +22,23 @@
 
 #include "gskcairoblurprivate.h"
 
+#include "gdk/gdkparalleltaskprivate.h"
+
 #include <math.h>
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define HAVE_SSE2_BLUR 1
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#include <immintrin.h>
+#define HAVE_AVX2_BLUR 1
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAVE_NEON_BLUR 1
+#endif
+
 /*
  * Gets the size for a single box blur.
  *
@@ -185,16 +199,494 @@ flip_buffer (guchar *dst_buffer,
 #undef BLOCK_SIZE
 }
 
+/* Vectorized blurring
+ *
+ * The SIMD code blurs columns instead of rows: it runs the same sliding
+ * window as blur_xspan() down 16 or 32 adjacent columns at once, so it
+ * only needs loads and stores of whole vectors. Blurring in x direction
+ * flips the buffer first, just like the scalar code does for y.
+ *
+ * The division is done in float. (sum + d / 2 + 0.5) / d is at least
+ * 0.5 / d away from the next integer and the float error is below
+ * 2^-15 for the values we get, so truncating gives the same result as
+ * the integer division for d up to MAX_SIMD_BOX_SIZE.
+ *
+ * Since columns don't depend on each other, large buffers are split
+ * into bands of columns that are blurred on separate threads.
+ */
+
+#define MAX_SIMD_BOX_SIZE 4096
+
+/* Buffers with fewer pixels are blurred on the calling thread only */
+#define MIN_PARALLEL_PIXELS (512 * 512)
+
+/* Multiple of the widest vector, and of the cache line size */
+#define BAND_WIDTH 128
+
+typedef void (* BlurColumnsFunc) (const guchar *src,
+                                  guchar       *dst,
+                                  int           stride,
+                                  int           x_start,
+                                  int           x_end,
+                                  int           height,
+                                  int           d,
+                                  int           offset);
+
+/* Same as blur_xspan(), but for column @x and not in place */
+static void
+blur_column (const guchar *src,
+             guchar       *dst,
+             int           stride,
+             int           x,
+             int           height,
+             int           d,
+             int           offset)
+{
+  int sum = 0;
+  int i;
+
+  for (i = -d + offset; i < height + offset; i++)
+    {
+      if (i >= 0 && i < height)
+        sum += src[i * stride + x];
+
+      if (i >= offset)
+        {
+          if (i >= d)
+            sum -= src[(i - d) * stride + x];
+
+          dst[(i - offset) * stride + x] = (sum + d / 2) / d;
+        }
+    }
+}
+
+#ifdef HAVE_SSE2_BLUR
 static void
-_boxblur (guchar      *buffer,
-          int          width,
-          int          height,
-          int          radius,
-          GskBlurFlags flags)
+blur_columns_sse2 (const guchar *src,
+                   guchar       *dst,
+                   int           stride,
+                   int           x_start,
+                   int           x_end,
+                   int           height,
+                   int           d,
+                   int           offset)
+{
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128 bias = _mm_set1_ps (d / 2 + 0.5f);
+  const __m128 inv = _mm_set1_ps (1.0f / d);
+  int x, i;
+
+#define DIVIDE(s) _mm_cvttps_epi32 (_mm_mul_ps (_mm_add_ps (_mm_cvtepi32_ps (s), bias), inv))
+
+  for (x = x_start; x + 16 <= x_end; x += 16)
+    {
+      __m128i s0 = zero, s1 = zero, s2 = zero, s3 = zero;
+
+      for (i = -d + offset; i < height + offset; i++)
+        {
+          if (i >= 0 && i < height)
+            {
+              __m128i p = _mm_loadu_si128 ((const __m128i *) (src + i * stride + x));
+              __m128i lo = _mm_unpacklo_epi8 (p, zero);
+              __m128i hi = _mm_unpackhi_epi8 (p, zero);
+
+              s0 = _mm_add_epi32 (s0, _mm_unpacklo_epi16 (lo, zero));
+              s1 = _mm_add_epi32 (s1, _mm_unpackhi_epi16 (lo, zero));
+              s2 = _mm_add_epi32 (s2, _mm_unpacklo_epi16 (hi, zero));
+              s3 = _mm_add_epi32 (s3, _mm_unpackhi_epi16 (hi, zero));
+            }
+
+          if (i >= offset)
+            {
+              __m128i q01, q23;
+
+              if (i >= d)
+                {
+                  __m128i p = _mm_loadu_si128 ((const __m128i *) (src + (i - d) * stride + x));
+                  __m128i lo = _mm_unpacklo_epi8 (p, zero);
+                  __m128i hi = _mm_unpackhi_epi8 (p, zero);
+
+                  s0 = _mm_sub_epi32 (s0, _mm_unpacklo_epi16 (lo, zero));
+                  s1 = _mm_sub_epi32 (s1, _mm_unpackhi_epi16 (lo, zero));
+                  s2 = _mm_sub_epi32 (s2, _mm_unpacklo_epi16 (hi, zero));
+                  s3 = _mm_sub_epi32 (s3, _mm_unpackhi_epi16 (hi, zero));
+                }
+
+              q01 = _mm_packs_epi32 (DIVIDE (s0), DIVIDE (s1));
+              q23 = _mm_packs_epi32 (DIVIDE (s2), DIVIDE (s3));
+              _mm_storeu_si128 ((__m128i *) (dst + (i - offset) * stride + x),
+                                _mm_packus_epi16 (q01, q23));
+            }
+        }
+    }
+
+#undef DIVIDE
+
+  for (; x < x_end; x++)
+    blur_column (src, dst, stride, x, height, d, offset);
+}
+#endif
+
+#ifdef HAVE_AVX2_BLUR
+__attribute__((target ("avx2")))
+static void
+blur_columns_avx2 (const guchar *src,
+                   guchar       *dst,
+                   int           stride,
+                   int           x_start,
+                   int           x_end,
+                   int           height,
+                   int           d,
+                   int           offset)
+{
+  const __m256i zero = _mm256_setzero_si256 ();
+  const __m256i order = _mm256_setr_epi32 (0, 4, 1, 5, 2, 6, 3, 7);
+  const __m256 bias = _mm256_set1_ps (d / 2 + 0.5f);
+  const __m256 inv = _mm256_set1_ps (1.0f / d);
+  int x, i;
+
+#define LOAD(p, n) _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i *) ((p) + 8 * (n))))
+#define DIVIDE(s) _mm256_cvttps_epi32 (_mm256_mul_ps (_mm256_add_ps (_mm256_cvtepi32_ps (s), bias), inv))
+
+  for (x = x_start; x + 32 <= x_end; x += 32)
+    {
+      __m256i s0 = zero, s1 = zero, s2 = zero, s3 = zero;
+
+      for (i = -d + offset; i < height + offset; i++)
+        {
+          if (i >= 0 && i < height)
+            {
+              const guchar *p = src + i * stride + x;
+
+              s0 = _mm256_add_epi32 (s0, LOAD (p, 0));
+              s1 = _mm256_add_epi32 (s1, LOAD (p, 1));
+              s2 = _mm256_add_epi32 (s2, LOAD (p, 2));
+              s3 = _mm256_add_epi32 (s3, LOAD (p, 3));
+            }
+
+          if (i >= offset)
+            {
+              __m256i q01, q23, q;
+
+              if (i >= d)
+                {
+                  const guchar *p = src + (i - d) * stride + x;
+
+                  s0 = _mm256_sub_epi32 (s0, LOAD (p, 0));
+                  s1 = _mm256_sub_epi32 (s1, LOAD (p, 1));
+                  s2 = _mm256_sub_epi32 (s2, LOAD (p, 2));
+                  s3 = _mm256_sub_epi32 (s3, LOAD (p, 3));
+                }
+
+              /* The packs work per 128-bit lane, so fix up the order after */
+              q01 = _mm256_packs_epi32 (DIVIDE (s0), DIVIDE (s1));
+              q23 = _mm256_packs_epi32 (DIVIDE (s2), DIVIDE (s3));
+              q = _mm256_permutevar8x32_epi32 (_mm256_packus_epi16 (q01, q23), order);
+              _mm256_storeu_si256 ((__m256i *) (dst + (i - offset) * stride + x), q);
+            }
+        }
+    }
+
+#undef LOAD
+#undef DIVIDE
+
+  blur_columns_sse2 (src, dst, stride, x, x_end, height, d, offset);
+}
+#endif
+
+#ifdef HAVE_NEON_BLUR
+static void
+blur_columns_neon (const guchar *src,
+                   guchar       *dst,
+                   int           stride,
+                   int           x_start,
+                   int           x_end,
+                   int           height,
+                   int           d,
+                   int           offset)
+{
+  const uint32x4_t zero = vdupq_n_u32 (0);
+  const float32x4_t bias = vdupq_n_f32 (d / 2 + 0.5f);
+  const float32x4_t inv = vdupq_n_f32 (1.0f / d);
+  int x, i;
+
+#define DIVIDE(s) vmovn_u32 (vcvtq_u32_f32 (vmulq_f32 (vaddq_f32 (vcvtq_f32_u32 (s), bias), inv)))
+
+  for (x = x_start; x + 16 <= x_end; x += 16)
+    {
+      uint32x4_t s0 = zero, s1 = zero, s2 = zero, s3 = zero;
+
+      for (i = -d + offset; i < height + offset; i++)
+        {
+          if (i >= 0 && i < height)
+            {
+              uint8x16_t p = vld1q_u8 (src + i * stride + x);
+              uint16x8_t lo = vmovl_u8 (vget_low_u8 (p));
+              uint16x8_t hi = vmovl_u8 (vget_high_u8 (p));
+
+              s0 = vaddw_u16 (s0, vget_low_u16 (lo));
+              s1 = vaddw_u16 (s1, vget_high_u16 (lo));
+              s2 = vaddw_u16 (s2, vget_low_u16 (hi));
+              s3 = vaddw_u16 (s3, vget_high_u16 (hi));
+            }
+
+          if (i >= offset)
+            {
+              uint16x8_t q01, q23;
+
+              if (i >= d)
+                {
+                  uint8x16_t p = vld1q_u8 (src + (i - d) * stride + x);
+                  uint16x8_t lo = vmovl_u8 (vget_low_u8 (p));
+                  uint16x8_t hi = vmovl_u8 (vget_high_u8 (p));
+
+                  s0 = vsubw_u16 (s0, vget_low_u16 (lo));
+                  s1 = vsubw_u16 (s1, vget_high_u16 (lo));
+                  s2 = vsubw_u16 (s2, vget_low_u16 (hi));
+                  s3 = vsubw_u16 (s3, vget_high_u16 (hi));
+                }
+
+              q01 = vcombine_u16 (DIVIDE (s0), DIVIDE (s1));
+              q23 = vcombine_u16 (DIVIDE (s2), DIVIDE (s3));
+              vst1q_u8 (dst + (i - offset) * stride + x,
+                        vcombine_u8 (vmovn_u16 (q01), vmovn_u16 (q23)));
+            }
+        }
+    }
+
+#undef DIVIDE
+
+  for (; x < x_end; x++)
+    blur_column (src, dst, stride, x, height, d, offset);
+}
+#endif
+
+static BlurColumnsFunc
+get_blur_columns_func (void)
+{
+  static gsize initialized = FALSE;
+  static BlurColumnsFunc func = NULL;
+
+  if (g_once_init_enter (&initialized))
+    {
+#if defined(HAVE_AVX2_BLUR)
+      if (__builtin_cpu_supports ("avx2"))
+        func = blur_columns_avx2;
+      else
+        func = blur_columns_sse2;
+#elif defined(HAVE_SSE2_BLUR)
+      func = blur_columns_sse2;
+#elif defined(HAVE_NEON_BLUR)
+      func = blur_columns_neon;
+#endif
+
+      g_once_init_leave (&initialized, TRUE);
+    }
+
+  return func;
+}
+
+typedef struct
+{
+  BlurColumnsFunc blur_columns;
+  guchar *buffer;
+  guchar *tmp_buffer;
+  int width;
+  int height;
+  int d;
+  int n_bands;
+  int next_band;
+} BlurBands;
+
+/* Blurs the columns of each band of buffer with the three passes
+ * blur_rows() uses, using the same part of tmp_buffer in between */
+static void
+blur_bands (gpointer data)
+{
+  BlurBands *bands = data;
+  const int width = bands->width;
+  const int height = bands->height;
+  const int d = bands->d;
+  int band;
+
+  while ((band = g_atomic_int_add (&bands->next_band, 1)) < bands->n_bands)
+    {
+      const int x_start = band * BAND_WIDTH;
+      const int x_end = MIN (x_start + BAND_WIDTH, width);
+      int y;
+
+      if (d % 2 == 1)
+        {
+          bands->blur_columns (bands->buffer, bands->tmp_buffer, width, x_start, x_end, height, d, d / 2);
+          bands->blur_columns (bands->tmp_buffer, bands->buffer, width, x_start, x_end, height, d, d / 2);
+          bands->blur_columns (bands->buffer, bands->tmp_buffer, width, x_start, x_end, height, d, d / 2);
+        }
+      else
+        {
+          bands->blur_columns (bands->buffer, bands->tmp_buffer, width, x_start, x_end, height, d, (d - 1) / 2);
+          bands->blur_columns (bands->tmp_buffer, bands->buffer, width, x_start, x_end, height, d, (d + 1) / 2);
+          bands->blur_columns (bands->buffer, bands->tmp_buffer, width, x_start, x_end, height, d + 1, (d + 1) / 2);
+        }
+
+      for (y = 0; y < height; y++)
+        memcpy (bands->buffer + y * width + x_start,
+                bands->tmp_buffer + y * width + x_start,
+                x_end - x_start);
+    }
+}
+
+typedef struct
+{
+  guchar *dst_buffer;
+  const guchar *src_buffer;
+  int width;
+  int height;
+  int n_bands;
+  int next_band;
+} FlipBands;
+
+static void
+flip_bands (gpointer data)
+{
+  FlipBands *bands = data;
+  int band;
+
+  while ((band = g_atomic_int_add (&bands->next_band, 1)) < bands->n_bands)
+    {
+      const int i_start = band * BAND_WIDTH;
+      const int i_end = MIN (i_start + BAND_WIDTH, bands->width);
+      int i0, j0;
+
+      /* Like flip_buffer(), for source columns i_start to i_end */
+      for (i0 = i_start; i0 < i_end; i0 += 16)
+        for (j0 = 0; j0 < bands->height; j0 += 16)
+          {
+            int max_j = MIN (j0 + 16, bands->height);
+            int max_i = MIN (i0 + 16, i_end);
+            int i, j;
+
+            for (i = i0; i < max_i; i++)
+              for (j = j0; j < max_j; j++)
+                bands->dst_buffer[i * bands->height + j] = bands->src_buffer[j * bands->width + i];
+          }
+    }
+}
+
+static void
+flip_buffer_parallel (guchar       *dst_buffer,
+                      const guchar *src_buffer,
+                      int           width,
+                      int           height,
+                      guint         n_tasks)
+{
+  FlipBands bands;
+
+  bands.dst_buffer = dst_buffer;
+  bands.src_buffer = src_buffer;
+  bands.width = width;
+  bands.height = height;
+  bands.n_bands = (width + BAND_WIDTH - 1) / BAND_WIDTH;
+  bands.next_band = 0;
+
+  gdk_parallel_task_run (flip_bands, &bands, MIN (n_tasks, (guint) bands.n_bands));
+}
+
+static void
+blur_columns_parallel (BlurColumnsFunc  blur_columns,
+                       guchar          *buffer,
+                       guchar          *tmp_buffer,
+                       int              width,
+                       int              height,
+                       int              d,
+                       guint            n_tasks)
+{
+  BlurBands bands;
+
+  bands.blur_columns = blur_columns;
+  bands.buffer = buffer;
+  bands.tmp_buffer = tmp_buffer;
+  bands.width = width;
+  bands.height = height;
+  bands.d = d;
+  bands.n_bands = (width + BAND_WIDTH - 1) / BAND_WIDTH;
+  bands.next_band = 0;
+
+  gdk_parallel_task_run (blur_bands, &bands, MIN (n_tasks, (guint) bands.n_bands));
+}
+
+static BlurColumnsFunc
+get_blur_columns_func_for_impl (GskCairoBlurImpl impl)
+{
+  switch (impl)
+    {
+#ifdef HAVE_SSE2_BLUR
+    case GSK_CAIRO_BLUR_SSE2:
+      return blur_columns_sse2;
+#endif
+#ifdef HAVE_AVX2_BLUR
+    case GSK_CAIRO_BLUR_AVX2:
+      return __builtin_cpu_supports ("avx2") ? blur_columns_avx2 : NULL;
+#endif
+#ifdef HAVE_NEON_BLUR
+    case GSK_CAIRO_BLUR_NEON:
+      return blur_columns_neon;
+#endif
+    case GSK_CAIRO_BLUR_SCALAR:
+    default:
+      return NULL;
+    }
+}
+
+static gboolean
+_boxblur_simd (BlurColumnsFunc blur_columns,
+               guchar         *buffer,
+               int             width,
+               int             height,
+               int             d,
+               GskBlurFlags    flags)
+{
+  guchar *flipped_buffer;
+  guint n_tasks;
+
+  if (blur_columns == NULL || d + 1 > MAX_SIMD_BOX_SIZE)
+    return FALSE;
+
+  if (width * height >= MIN_PARALLEL_PIXELS)
+    n_tasks = gdk_parallel_task_get_max_tasks ();
+  else
+    n_tasks = 1;
+
+  flipped_buffer = g_malloc (width * height);
+
+  if (flags & GSK_BLUR_Y)
+    blur_columns_parallel (blur_columns, buffer, flipped_buffer, width, height, d, n_tasks);
+
+  if (flags & GSK_BLUR_X)
+    {
+      flip_buffer_parallel (flipped_buffer, buffer, width, height, n_tasks);
+      blur_columns_parallel (blur_columns, flipped_buffer, buffer, height, width, d, n_tasks);
+      flip_buffer_parallel (buffer, flipped_buffer, height, width, n_tasks);
+    }
+
+  g_free (flipped_buffer);
+
+  return TRUE;
+}
+
+static void
+_boxblur (BlurColumnsFunc blur_columns,
+          guchar         *buffer,
+          int             width,
+          int             height,
+          int             radius,
+          GskBlurFlags    flags)
 {
   guchar *flipped_buffer;
   int d = get_box_filter_size (radius);
 
+  if (_boxblur_simd (blur_columns, buffer, width, height, d, flags))
+    return;
+
   flipped_buffer = g_malloc (width * height);
 
   if (flags & GSK_BLUR_Y)
@@ -218,24 +710,14 @@ _boxblur (guchar      *buffer,
   g_free (flipped_buffer);
 }
 
-/*
- * _gsk_cairo_blur_surface:
- * @surface: a cairo image surface.
- * @radius: the blur radius.
- *
- * Blurs the cairo image surface at the given radius.
- */
-void
-gsk_cairo_blur_surface (cairo_surface_t* surface,
-                        double           radius_d,
-                        GskBlurFlags     flags)
+static void
+blur_surface (BlurColumnsFunc  blur_columns,
+              cairo_surface_t *surface,
+              double           radius_d,
+              GskBlurFlags     flags)
 {
   int radius = radius_d;
 
-  g_return_if_fail (surface != NULL);
-  g_return_if_fail (cairo_surface_get_type (surface) == CAIRO_SURFACE_TYPE_IMAGE);
-  g_return_if_fail (cairo_image_surface_get_format (surface) == CAIRO_FORMAT_A8);
-
   /* The code doesn't actually do any blurring for radius 1, as it
    * ends up with box filter size 1 */
   if (radius <= 1)
@@ -247,7 +729,8 @@ gsk_cairo_blur_surface (cairo_surface_t* surface,
   /* Before we mess with the surface, execute any pending drawing. */
   cairo_surface_flush (surface);
 
-  _boxblur (cairo_image_surface_get_data (surface),
+  _boxblur (blur_columns,
+            cairo_image_surface_get_data (surface),
             cairo_image_surface_get_stride (surface),
             cairo_image_surface_get_height (surface),
             radius, flags);
@@ -256,6 +739,56 @@ gsk_cairo_blur_surface (cairo_surface_t* surface,
   cairo_surface_mark_dirty (surface);
 }
 
+/*
+ * _gsk_cairo_blur_surface:
+ * @surface: a cairo image surface.
+ * @radius: the blur radius.
+ *
+ * Blurs the cairo image surface at the given radius.
+ */
+void
+gsk_cairo_blur_surface (cairo_surface_t* surface,
+                        double           radius_d,
+                        GskBlurFlags     flags)
+{
+  g_return_if_fail (surface != NULL);
+  g_return_if_fail (cairo_surface_get_type (surface) == CAIRO_SURFACE_TYPE_IMAGE);
+  g_return_if_fail (cairo_image_surface_get_format (surface) == CAIRO_FORMAT_A8);
+
+  blur_surface (get_blur_columns_func (), surface, radius_d, flags);
+}
+
+/*<private>
+ * gsk_cairo_blur_surface_with_impl:
+ * @impl: the column blurring to use
+ *
+ * Like gsk_cairo_blur_surface(), but uses @impl instead of the best
+ * column blurring for the CPU, so tests can compare them.
+ *
+ * Returns: %FALSE if @impl isn't available on this CPU and nothing
+ *   was blurred
+ */
+gboolean
+gsk_cairo_blur_surface_with_impl (GskCairoBlurImpl  impl,
+                                  cairo_surface_t  *surface,
+                                  double            radius_d,
+                                  GskBlurFlags      flags)
+{
+  BlurColumnsFunc blur_columns;
+
+  g_return_val_if_fail (surface != NULL, FALSE);
+  g_return_val_if_fail (cairo_surface_get_type (surface) == CAIRO_SURFACE_TYPE_IMAGE, FALSE);
+  g_return_val_if_fail (cairo_image_surface_get_format (surface) == CAIRO_FORMAT_A8, FALSE);
+
+  blur_columns = get_blur_columns_func_for_impl (impl);
+  if (blur_columns == NULL && impl != GSK_CAIRO_BLUR_SCALAR)
+    return FALSE;
+
+  blur_surface (blur_columns, surface, radius_d, flags);
+
+  return TRUE;
+}
+
 /*<private>
  * gsk_cairo_blur_compute_pixels:
  * @radius: the radius to compute the pixels for
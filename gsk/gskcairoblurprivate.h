@@ -36,9 +36,21 @@ typedef enum {
   GSK_BLUR_REPEAT = 1<<2
 } GskBlurFlags;
 
+typedef enum {
+  GSK_CAIRO_BLUR_SCALAR,
+  GSK_CAIRO_BLUR_SSE2,
+  GSK_CAIRO_BLUR_AVX2,
+  GSK_CAIRO_BLUR_NEON,
+  GSK_CAIRO_BLUR_N_IMPLS
+} GskCairoBlurImpl;
+
 void            gsk_cairo_blur_surface          (cairo_surface_t *surface,
                                                  double           radius,
 						 GskBlurFlags     flags);
+gboolean        gsk_cairo_blur_surface_with_impl (GskCairoBlurImpl impl,
+                                                  cairo_surface_t *surface,
+                                                  double           radius,
+                                                  GskBlurFlags     flags);
 int             gsk_cairo_blur_compute_pixels   (double           radius);
 
 cairo_t *       gsk_cairo_blur_start_drawing    (cairo_t         *cr,
@@ -25,8 +25,17 @@
 #include "gskdebugprivate.h"
 #include "gskrendererprivate.h"
 #include "gskrendernodeprivate.h"
+#include "gdk/gdkgltextureprivate.h"
+#include "gdk/gdkparalleltaskprivate.h"
 #include "gdk/gdktextureprivate.h"
 
+#include <math.h>
+#include <pango/pangocairo.h>
+
+/* Size of the tiles, in application pixels, rendered on separate
+ * threads when GSK_CAIRO_TILED is set */
+#define TILE_SIZE 256
+
 #ifdef G_ENABLE_DEBUG
 typedef struct {
   GQuark cpu_time;
@@ -40,6 +49,8 @@ struct _GskCairoRenderer
 
   GdkCairoContext *cairo_context;
 
+  gboolean use_tiles;
+
 #ifdef G_ENABLE_DEBUG
   ProfileTimers profile_timers;
 #endif
@@ -72,13 +83,262 @@ gsk_cairo_renderer_unrealize (GskRenderer *renderer)
   g_clear_object (&self->cairo_context);
 }
 
+/* Whether @node can be drawn on multiple threads at the same time
+ * and looks the same no matter how it is split up into tiles.
+ * Also makes sure lazily created font data exists. */
+static gboolean
+node_can_draw_tiled (GskRenderNode *node)
+{
+  switch (gsk_render_node_get_node_type (node))
+    {
+    case GSK_CONTAINER_NODE:
+      {
+        guint i;
+
+        for (i = 0; i < gsk_container_node_get_n_children (node); i++)
+          {
+            if (!node_can_draw_tiled (gsk_container_node_get_child (node, i)))
+              return FALSE;
+          }
+      }
+      return TRUE;
+
+    case GSK_TRANSFORM_NODE:
+      return node_can_draw_tiled (gsk_transform_node_get_child (node));
+
+    case GSK_OPACITY_NODE:
+      return node_can_draw_tiled (gsk_opacity_node_get_child (node));
+
+    case GSK_COLOR_MATRIX_NODE:
+      return node_can_draw_tiled (gsk_color_matrix_node_get_child (node));
+
+    case GSK_REPEAT_NODE:
+      return node_can_draw_tiled (gsk_repeat_node_get_child (node));
+
+    case GSK_CLIP_NODE:
+      return node_can_draw_tiled (gsk_clip_node_get_child (node));
+
+    case GSK_ROUNDED_CLIP_NODE:
+      return node_can_draw_tiled (gsk_rounded_clip_node_get_child (node));
+
+    case GSK_SHADOW_NODE:
+      return node_can_draw_tiled (gsk_shadow_node_get_child (node));
+
+    case GSK_DEBUG_NODE:
+      return node_can_draw_tiled (gsk_debug_node_get_child (node));
+
+    case GSK_BLEND_NODE:
+      return node_can_draw_tiled (gsk_blend_node_get_bottom_child (node)) &&
+             node_can_draw_tiled (gsk_blend_node_get_top_child (node));
+
+    case GSK_CROSS_FADE_NODE:
+      return node_can_draw_tiled (gsk_cross_fade_node_get_start_child (node)) &&
+             node_can_draw_tiled (gsk_cross_fade_node_get_end_child (node));
+
+    case GSK_TEXT_NODE:
+      {
+        PangoFont *font = gsk_text_node_get_font (node);
+        const PangoGlyphInfo *glyphs;
+        guint i, n_glyphs;
+
+        /* pango isn't thread-safe and creates what it needs to draw
+         * hex boxes on first use, so those are drawn untiled */
+        glyphs = gsk_text_node_get_glyphs (node, &n_glyphs);
+        for (i = 0; i < n_glyphs; i++)
+          {
+            if (glyphs[i].glyph & PANGO_GLYPH_UNKNOWN_FLAG)
+              return FALSE;
+          }
+
+        /* Pango creates the scaled font on first use */
+        if (PANGO_IS_CAIRO_FONT (font))
+          pango_cairo_font_get_scaled_font (PANGO_CAIRO_FONT (font));
+      }
+      return TRUE;
+
+    case GSK_TEXTURE_NODE:
+      /* Downloading needs the GL context */
+      return !GDK_IS_GL_TEXTURE (gsk_texture_node_get_texture (node));
+
+    case GSK_BLUR_NODE:
+      /* Only blurs what is inside the clip, so tiles would have seams */
+      return FALSE;
+
+    case GSK_NOT_A_RENDER_NODE:
+    case GSK_CAIRO_NODE:
+    case GSK_COLOR_NODE:
+    case GSK_LINEAR_GRADIENT_NODE:
+    case GSK_REPEATING_LINEAR_GRADIENT_NODE:
+    case GSK_RADIAL_GRADIENT_NODE:
+    case GSK_REPEATING_RADIAL_GRADIENT_NODE:
+    case GSK_CONIC_GRADIENT_NODE:
+    case GSK_BORDER_NODE:
+    case GSK_INSET_SHADOW_NODE:
+    case GSK_OUTSET_SHADOW_NODE:
+    case GSK_GL_SHADER_NODE:
+    default:
+      return TRUE;
+    }
+}
+
+typedef struct
+{
+  cairo_rectangle_int_t area; /* in user space */
+  cairo_surface_t *surface;
+} Tile;
+
+typedef struct
+{
+  GskRenderNode *root;
+  cairo_matrix_t matrix;
+  double x_scale;
+  double y_scale;
+  Tile *tiles;
+  guint n_tiles;
+  int next_tile;
+} TiledRender;
+
+static void
+draw_tiles (gpointer data)
+{
+  TiledRender *render = data;
+  int i;
+
+  while ((i = g_atomic_int_add (&render->next_tile, 1)) < (int) render->n_tiles)
+    {
+      Tile *tile = &render->tiles[i];
+      cairo_t *cr;
+
+      tile->surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
+                                                  tile->area.width * render->x_scale,
+                                                  tile->area.height * render->y_scale);
+      cairo_surface_set_device_scale (tile->surface, render->x_scale, render->y_scale);
+      cairo_surface_set_device_offset (tile->surface,
+                                       - (tile->area.x + render->matrix.x0) * render->x_scale,
+                                       - (tile->area.y + render->matrix.y0) * render->y_scale);
+
+      cr = cairo_create (tile->surface);
+      cairo_set_matrix (cr, &render->matrix);
+      cairo_rectangle (cr, tile->area.x, tile->area.y, tile->area.width, tile->area.height);
+      cairo_clip (cr);
+
+      gsk_render_node_draw (render->root, cr);
+
+      cairo_destroy (cr);
+    }
+}
+
+static void
+add_tiles (GArray                      *tiles,
+           const cairo_rectangle_int_t *area)
+{
+  int x, y;
+
+  for (y = area->y; y < area->y + area->height; y += TILE_SIZE)
+    for (x = area->x; x < area->x + area->width; x += TILE_SIZE)
+      {
+        Tile tile;
+
+        tile.area.x = x;
+        tile.area.y = y;
+        tile.area.width = MIN (TILE_SIZE, area->x + area->width - x);
+        tile.area.height = MIN (TILE_SIZE, area->y + area->height - y);
+        tile.surface = NULL;
+
+        g_array_append_val (tiles, tile);
+      }
+}
+
+/* Splits the clip of @cr into tiles, draws @root into each of them on
+ * its own thread and then paints the tiles to @cr. Returns %FALSE if
+ * that isn't possible and @root should be drawn directly. */
+static gboolean
+gsk_cairo_renderer_do_render_tiled (cairo_t       *cr,
+                                    GskRenderNode *root)
+{
+  cairo_rectangle_list_t *rects;
+  TiledRender render;
+  GArray *tiles;
+  guint i;
+
+  /* Tiles need to line up with the pixels of the target */
+  cairo_get_matrix (cr, &render.matrix);
+  if (render.matrix.xx != 1 || render.matrix.yy != 1 ||
+      render.matrix.xy != 0 || render.matrix.yx != 0 ||
+      render.matrix.x0 != floor (render.matrix.x0) ||
+      render.matrix.y0 != floor (render.matrix.y0))
+    return FALSE;
+
+  cairo_surface_get_device_scale (cairo_get_target (cr), &render.x_scale, &render.y_scale);
+  if (render.x_scale != floor (render.x_scale) ||
+      render.y_scale != floor (render.y_scale))
+    return FALSE;
+
+  tiles = g_array_new (FALSE, FALSE, sizeof (Tile));
+
+  rects = cairo_copy_clip_rectangle_list (cr);
+  if (rects->status == CAIRO_STATUS_SUCCESS)
+    {
+      int r;
+
+      for (r = 0; r < rects->num_rectangles; r++)
+        {
+          const cairo_rectangle_t *rect = &rects->rectangles[r];
+          cairo_rectangle_int_t area;
+
+          area.x = floor (rect->x);
+          area.y = floor (rect->y);
+          area.width = ceil (rect->x + rect->width) - area.x;
+          area.height = ceil (rect->y + rect->height) - area.y;
+
+          add_tiles (tiles, &area);
+        }
+    }
+  cairo_rectangle_list_destroy (rects);
+
+  if (tiles->len < 2 || !node_can_draw_tiled (root))
+    {
+      g_array_free (tiles, TRUE);
+      return FALSE;
+    }
+
+  render.root = root;
+  render.tiles = (Tile *) tiles->data;
+  render.n_tiles = tiles->len;
+  render.next_tile = 0;
+
+  gdk_parallel_task_run (draw_tiles,
+                         &render,
+                         MIN (tiles->len, gdk_parallel_task_get_max_tasks ()));
+
+  cairo_save (cr);
+
+  for (i = 0; i < tiles->len; i++)
+    {
+      Tile *tile = &g_array_index (tiles, Tile, i);
+
+      cairo_surface_set_device_offset (tile->surface, 0, 0);
+      cairo_set_source_surface (cr, tile->surface, tile->area.x, tile->area.y);
+      cairo_rectangle (cr, tile->area.x, tile->area.y, tile->area.width, tile->area.height);
+      cairo_fill (cr);
+
+      cairo_surface_destroy (tile->surface);
+    }
+
+  cairo_restore (cr);
+
+  g_array_free (tiles, TRUE);
+
+  return TRUE;
+}
+
 static void
 gsk_cairo_renderer_do_render (GskRenderer   *renderer,
                               cairo_t       *cr,
                               GskRenderNode *root)
 {
-#ifdef G_ENABLE_DEBUG
   GskCairoRenderer *self = GSK_CAIRO_RENDERER (renderer);
+#ifdef G_ENABLE_DEBUG
   GskProfiler *profiler;
   gint64 cpu_time;
 #endif
@@ -88,7 +348,9 @@ gsk_cairo_renderer_do_render (GskRenderer   *renderer,
   gsk_profiler_timer_begin (profiler, self->profile_timers.cpu_time);
 #endif
 
-  gsk_render_node_draw (root, cr);
+  if (!self->use_tiles ||
+      !gsk_cairo_renderer_do_render_tiled (cr, root))
+    gsk_render_node_draw (root, cr);
 
 #ifdef G_ENABLE_DEBUG
   cpu_time = gsk_profiler_timer_end (profiler, self->profile_timers.cpu_time);
@@ -173,6 +435,9 @@ gsk_cairo_renderer_class_init (GskCairoRendererClass *klass)
 static void
 gsk_cairo_renderer_init (GskCairoRenderer *self)
 {
+  self->use_tiles = g_getenv ("GSK_CAIRO_TILED") != NULL &&
+                    gdk_parallel_task_get_max_tasks () > 1;
+
 #ifdef G_ENABLE_DEBUG
   GskProfiler *profiler = gsk_renderer_get_profiler (GSK_RENDERER (self));
 
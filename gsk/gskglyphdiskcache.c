@@ -0,0 +1,849 @@
+/*
+ * Copyright © 2020 GNOME Foundation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "gskglyphdiskcacheprivate.h"
+
+#include "gskdebugprivate.h"
+
+#include <gio/gio.h>
+#include <pango/pangocairo.h>
+#include <string.h>
+
+/* On-disk glyph cache
+ *
+ * Rasterized glyphs are stored in one file per font instance, in
+ * $XDG_CACHE_HOME/gtk-4.0/glyphs. The file name is a hash of the font
+ * file, the face index, the variation coordinates, the font description,
+ * the font matrix and options and the scale, so a changed font or
+ * different rendering settings simply end up in a different file.
+ *
+ * The file is mapped the first time a font is used, and glyphs are
+ * looked up there before rasterizing them. New glyphs are kept in memory
+ * and every now and then gsk_glyph_disk_cache_save() writes out a new
+ * file with the old and new glyphs in a thread. The mapping of the old
+ * file stays valid, since the new file replaces it with a rename. Once
+ * the file is written, it is mapped instead of the old one and the new
+ * glyphs it contains are dropped from memory.
+ *
+ * The files of a font are forgotten when the font is freed.
+ *
+ * The cache is only used if GSK_GLYPH_DISK_CACHE is set.
+ *
+ * The file starts with a FileHeader, followed by a FileGlyph for every
+ * glyph, sorted by sort_key, followed by the pixels of the glyphs.
+ * The pixels are premultiplied ARGB32 in native endianness, without
+ * any padding between rows.
+ */
+
+#define GLYPH_CACHE_MAGIC "GSKGLYPH"
+#define GLYPH_CACHE_VERSION 1
+#define MAX_GLYPHS_PER_FILE 4096
+#define MAX_HASHED_FONT_DATA (64 * 1024) /* from each end of the font file */
+
+typedef struct
+{
+  char magic[8];
+  guint32 version;
+  guint32 n_glyphs;
+  guint64 font_key;
+} FileHeader;
+
+typedef struct
+{
+  guint64 sort_key;
+  guint32 offset;
+  guint16 width;
+  guint16 height;
+} FileGlyph;
+
+typedef struct
+{
+  guint64 sort_key;
+  int width;
+  int height;
+  guchar *data;
+} NewGlyph;
+
+typedef struct
+{
+  int ref_count;
+
+  char *path;
+  guint64 font_key;
+
+  GMappedFile *mapped; /* NULL if there was no valid file */
+  const FileGlyph *glyphs;
+  guint n_glyphs;
+
+  GHashTable *new_glyphs; /* sort_key -> NewGlyph */
+  guint dirty : 1;
+  guint saving : 1;
+} FontFile;
+
+typedef struct
+{
+  GskGlyphDiskCache *cache;
+  PangoFont *font; /* weak */
+  guint scale;
+} FontFileKey;
+
+struct _GskGlyphDiskCache
+{
+  char *dir;
+  GHashTable *files; /* FontFileKey -> FontFile, or NULL for fonts we can't identify */
+};
+
+static inline guint64
+make_sort_key (PangoGlyph glyph,
+               guint      xshift,
+               guint      yshift)
+{
+  return ((guint64) glyph << 16) | (xshift << 8) | yshift;
+}
+
+/* FNV-1a */
+#define HASH_INIT G_GUINT64_CONSTANT (14695981039346656037)
+
+static guint64
+hash_data (guint64       hash,
+           gconstpointer data,
+           gsize         size)
+{
+  const guchar *p = data;
+  gsize i;
+
+  for (i = 0; i < size; i++)
+    {
+      hash ^= p[i];
+      hash *= G_GUINT64_CONSTANT (1099511628211);
+    }
+
+  return hash;
+}
+
+static gboolean
+compute_font_key (PangoFont *font,
+                  guint      scale,
+                  guint64   *key_out)
+{
+#ifdef HAVE_HARFBUZZ
+  cairo_scaled_font_t *scaled_font;
+  cairo_font_options_t *options;
+  cairo_matrix_t matrix;
+  PangoFontDescription *desc;
+  hb_font_t *hb_font;
+  hb_face_t *hb_face;
+  hb_blob_t *blob;
+  const char *data;
+  const int *coords;
+  unsigned int length, n_coords;
+  guint64 hash = HASH_INIT;
+  guint32 value;
+
+  if (!PANGO_IS_CAIRO_FONT (font))
+    return FALSE;
+
+  scaled_font = pango_cairo_font_get_scaled_font (PANGO_CAIRO_FONT (font));
+  if (scaled_font == NULL || cairo_scaled_font_status (scaled_font) != CAIRO_STATUS_SUCCESS)
+    return FALSE;
+
+  hb_font = pango_font_get_hb_font (font);
+  if (hb_font == NULL)
+    return FALSE;
+
+  hb_face = hb_font_get_face (hb_font);
+  blob = hb_face_reference_blob (hb_face);
+  data = hb_blob_get_data (blob, &length);
+  if (length == 0)
+    {
+      hb_blob_destroy (blob);
+      return FALSE;
+    }
+
+  /* Hashing all of a big CJK font would take longer than rasterizing
+   * the glyphs we're trying to avoid, so only hash both ends of it */
+  hash = hash_data (hash, &length, sizeof (length));
+  hash = hash_data (hash, data, MIN (length, MAX_HASHED_FONT_DATA));
+  if (length > MAX_HASHED_FONT_DATA)
+    hash = hash_data (hash, data + length - MAX_HASHED_FONT_DATA, MAX_HASHED_FONT_DATA);
+  hb_blob_destroy (blob);
+
+  value = hb_face_get_index (hb_face);
+  hash = hash_data (hash, &value, sizeof (value));
+
+  coords = hb_font_get_var_coords_normalized (hb_font, &n_coords);
+  hash = hash_data (hash, coords, n_coords * sizeof (int));
+
+  desc = pango_font_describe_with_absolute_size (font);
+  value = pango_font_description_hash (desc);
+  hash = hash_data (hash, &value, sizeof (value));
+  pango_font_description_free (desc);
+
+  cairo_scaled_font_get_font_matrix (scaled_font, &matrix);
+  hash = hash_data (hash, &matrix, sizeof (matrix));
+  cairo_scaled_font_get_ctm (scaled_font, &matrix);
+  hash = hash_data (hash, &matrix, sizeof (matrix));
+
+  options = cairo_font_options_create ();
+  cairo_scaled_font_get_font_options (scaled_font, options);
+  value = cairo_font_options_hash (options);
+  hash = hash_data (hash, &value, sizeof (value));
+  cairo_font_options_destroy (options);
+
+  hash = hash_data (hash, &scale, sizeof (scale));
+
+  *key_out = hash;
+
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+static void font_file_save (FontFile *file);
+
+static gboolean
+font_file_load (FontFile    *file,
+                GMappedFile *mapped)
+{
+  const char *contents = g_mapped_file_get_contents (mapped);
+  gsize size = g_mapped_file_get_length (mapped);
+  const FileHeader *header = (const FileHeader *) contents;
+  const FileGlyph *glyphs;
+  guint i;
+
+  if (size < sizeof (FileHeader) ||
+      memcmp (header->magic, GLYPH_CACHE_MAGIC, sizeof (header->magic)) != 0 ||
+      header->version != GLYPH_CACHE_VERSION ||
+      header->font_key != file->font_key ||
+      header->n_glyphs > MAX_GLYPHS_PER_FILE ||
+      size < sizeof (FileHeader) + header->n_glyphs * sizeof (FileGlyph))
+    return FALSE;
+
+  glyphs = (const FileGlyph *) (contents + sizeof (FileHeader));
+
+  for (i = 0; i < header->n_glyphs; i++)
+    {
+      if (i > 0 && glyphs[i].sort_key <= glyphs[i - 1].sort_key)
+        return FALSE;
+
+      if (glyphs[i].offset % 4 != 0 ||
+          glyphs[i].offset > size ||
+          (gsize) glyphs[i].width * glyphs[i].height * 4 > size - glyphs[i].offset)
+        return FALSE;
+    }
+
+  file->glyphs = glyphs;
+  file->n_glyphs = header->n_glyphs;
+
+  return TRUE;
+}
+
+static void
+new_glyph_free (gpointer data)
+{
+  NewGlyph *glyph = data;
+
+  g_free (glyph->data);
+  g_free (glyph);
+}
+
+static FontFile *
+font_file_new (GskGlyphDiskCache *cache,
+               guint64            font_key)
+{
+  FontFile *file;
+  char *basename;
+
+  file = g_new0 (FontFile, 1);
+  file->ref_count = 1;
+  file->font_key = font_key;
+  file->new_glyphs = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, new_glyph_free);
+
+  basename = g_strdup_printf ("%016" G_GINT64_MODIFIER "x.glyphs", font_key);
+  file->path = g_build_filename (cache->dir, basename, NULL);
+  g_free (basename);
+
+  file->mapped = g_mapped_file_new (file->path, FALSE, NULL);
+  if (file->mapped != NULL && !font_file_load (file, file->mapped))
+    {
+      GSK_NOTE (GLYPH_CACHE, g_message ("Ignoring invalid glyph cache %s", file->path));
+      g_clear_pointer (&file->mapped, g_mapped_file_unref);
+    }
+
+  GSK_NOTE (GLYPH_CACHE, if (file->mapped) g_message ("Mapped %u glyphs from %s", file->n_glyphs, file->path));
+
+  return file;
+}
+
+static FontFile *
+font_file_ref (FontFile *file)
+{
+  file->ref_count++;
+
+  return file;
+}
+
+static void
+font_file_unref (gpointer data)
+{
+  FontFile *file = data;
+
+  /* The files of fonts we can't identify are NULL */
+  if (file == NULL)
+    return;
+
+  g_assert (file->ref_count > 0);
+
+  file->ref_count--;
+  if (file->ref_count > 0)
+    return;
+
+  g_free (file->path);
+  g_clear_pointer (&file->mapped, g_mapped_file_unref);
+  g_hash_table_unref (file->new_glyphs);
+  g_free (file);
+}
+
+static const FileGlyph *
+font_file_find (FontFile *file,
+                guint64   sort_key)
+{
+  guint lo, hi;
+
+  lo = 0;
+  hi = file->n_glyphs;
+  while (lo < hi)
+    {
+      const guint mid = (lo + hi) / 2;
+
+      if (file->glyphs[mid].sort_key < sort_key)
+        lo = mid + 1;
+      else if (file->glyphs[mid].sort_key > sort_key)
+        hi = mid;
+      else
+        return &file->glyphs[mid];
+    }
+
+  return NULL;
+}
+
+static guint
+font_file_key_hash (gconstpointer v)
+{
+  const FontFileKey *key = v;
+
+  return g_direct_hash (key->font) ^ key->scale;
+}
+
+static gboolean
+font_file_key_equal (gconstpointer v1,
+                     gconstpointer v2)
+{
+  const FontFileKey *key1 = v1;
+  const FontFileKey *key2 = v2;
+
+  return key1->font == key2->font && key1->scale == key2->scale;
+}
+
+static void
+font_file_key_font_gone (gpointer  data,
+                         GObject  *where_the_object_was)
+{
+  FontFileKey *key = data;
+  FontFile *file;
+
+  if (!g_hash_table_steal_extended (key->cache->files, key, NULL, (gpointer *)&file))
+    g_assert_not_reached ();
+
+  /* Nobody is going to look for the glyphs anymore, but the next
+   * process might */
+  if (file != NULL && file->dirty && !file->saving)
+    font_file_save (file);
+
+  font_file_unref (file);
+  g_free (key);
+}
+
+static void
+font_file_key_free (gpointer data)
+{
+  FontFileKey *key = data;
+
+  g_object_weak_unref (G_OBJECT (key->font), font_file_key_font_gone, key);
+  g_free (key);
+}
+
+/**
+ * gsk_glyph_disk_cache_new:
+ * @dir: the directory to keep the files in
+ *
+ * Creates a glyph cache that uses the files in @dir.
+ *
+ * Returns: (nullable): the new cache, or %NULL if @dir
+ *   can't be created
+ */
+GskGlyphDiskCache *
+gsk_glyph_disk_cache_new (const char *dir)
+{
+  GskGlyphDiskCache *cache;
+
+  if (g_mkdir_with_parents (dir, 0700) != 0)
+    {
+      g_warning ("Failed to create glyph cache directory %s", dir);
+      return NULL;
+    }
+
+  cache = g_new0 (GskGlyphDiskCache, 1);
+  cache->dir = g_strdup (dir);
+  cache->files = g_hash_table_new_full (font_file_key_hash, font_file_key_equal,
+                                        font_file_key_free, font_file_unref);
+
+  return cache;
+}
+
+/**
+ * gsk_glyph_disk_cache_free:
+ * @self: the cache
+ *
+ * Frees the cache. Glyphs that haven't been saved yet are lost,
+ * files that are being saved still get written.
+ */
+void
+gsk_glyph_disk_cache_free (GskGlyphDiskCache *self)
+{
+  g_hash_table_unref (self->files);
+  g_free (self->dir);
+  g_free (self);
+}
+
+/**
+ * gsk_glyph_disk_cache_get_default:
+ *
+ * Gets the glyph cache shared by all renderers, if the on-disk
+ * cache is enabled. This function may only be called on the main
+ * thread.
+ *
+ * Returns: (nullable): the cache
+ */
+GskGlyphDiskCache *
+gsk_glyph_disk_cache_get_default (void)
+{
+  static GskGlyphDiskCache *cache = NULL;
+  static gboolean initialized = FALSE;
+  const char *env;
+#ifdef HAVE_HARFBUZZ
+  char *dir;
+#endif
+
+  if (initialized)
+    return cache;
+
+  initialized = TRUE;
+
+  env = g_getenv ("GSK_GLYPH_DISK_CACHE");
+  if (env == NULL || env[0] == '\0' || strcmp (env, "0") == 0)
+    return NULL;
+
+#ifndef HAVE_HARFBUZZ
+  /* We need HarfBuzz to identify font files */
+  return NULL;
+#else
+  dir = g_build_filename (g_get_user_cache_dir (), "gtk-4.0", "glyphs", NULL);
+  cache = gsk_glyph_disk_cache_new (dir);
+  g_free (dir);
+
+  return cache;
+#endif
+}
+
+static FontFile *
+get_font_file (GskGlyphDiskCache *self,
+               PangoFont         *font,
+               guint              scale)
+{
+  FontFileKey lookup = { self, font, scale };
+  FontFileKey *key;
+  FontFile *file;
+  guint64 font_key;
+
+  if (g_hash_table_lookup_extended (self->files, &lookup, NULL, (gpointer *)&file))
+    return file;
+
+  key = g_new (FontFileKey, 1);
+  key->cache = self;
+  key->font = font;
+  key->scale = scale;
+  g_object_weak_ref (G_OBJECT (font), font_file_key_font_gone, key);
+
+  if (compute_font_key (font, scale, &font_key))
+    file = font_file_new (self, font_key);
+  else
+    file = NULL;
+
+  g_hash_table_insert (self->files, key, file);
+
+  return file;
+}
+
+/**
+ * gsk_glyph_disk_cache_lookup:
+ * @self: the cache
+ * @font: the font
+ * @scale: the scale of the glyph, times 1024
+ * @glyph: the glyph
+ * @xshift: the horizontal subpixel position
+ * @yshift: the vertical subpixel position
+ * @width: the width of the rasterized glyph
+ * @height: the height of the rasterized glyph
+ *
+ * Looks for a glyph that was rasterized before.
+ *
+ * Returns: (nullable): the pixels of the glyph with a stride of
+ *   4 * @width. They stay valid until control returns to the
+ *   main loop.
+ */
+const guchar *
+gsk_glyph_disk_cache_lookup (GskGlyphDiskCache *self,
+                             PangoFont         *font,
+                             guint              scale,
+                             PangoGlyph         glyph,
+                             guint              xshift,
+                             guint              yshift,
+                             int                width,
+                             int                height)
+{
+  const guint64 sort_key = make_sort_key (glyph, xshift, yshift);
+  const FileGlyph *file_glyph;
+  FontFile *file;
+  NewGlyph *new_glyph;
+
+  file = get_font_file (self, font, scale);
+  if (file == NULL)
+    return NULL;
+
+  file_glyph = font_file_find (file, sort_key);
+  if (file_glyph != NULL)
+    {
+      if (file_glyph->width == width && file_glyph->height == height)
+        return (const guchar *) g_mapped_file_get_contents (file->mapped) + file_glyph->offset;
+      else
+        return NULL;
+    }
+
+  new_glyph = g_hash_table_lookup (file->new_glyphs, &sort_key);
+  if (new_glyph != NULL && new_glyph->width == width && new_glyph->height == height)
+    return new_glyph->data;
+
+  return NULL;
+}
+
+/**
+ * gsk_glyph_disk_cache_add:
+ * @self: the cache
+ * @font: the font
+ * @scale: the scale of the glyph, times 1024
+ * @glyph: the glyph
+ * @xshift: the horizontal subpixel position
+ * @yshift: the vertical subpixel position
+ * @width: the width of the rasterized glyph
+ * @height: the height of the rasterized glyph
+ * @data: the premultiplied ARGB32 pixels of the glyph
+ * @stride: the stride of @data
+ *
+ * Adds a rasterized glyph to the cache. It gets written to disk
+ * with the next gsk_glyph_disk_cache_save().
+ */
+void
+gsk_glyph_disk_cache_add (GskGlyphDiskCache *self,
+                          PangoFont         *font,
+                          guint              scale,
+                          PangoGlyph         glyph,
+                          guint              xshift,
+                          guint              yshift,
+                          int                width,
+                          int                height,
+                          const guchar      *data,
+                          int                stride)
+{
+  FontFile *file;
+  NewGlyph *new_glyph;
+  int y;
+
+  if (width <= 0 || height <= 0 || width > G_MAXUINT16 || height > G_MAXUINT16)
+    return;
+
+  file = get_font_file (self, font, scale);
+  if (file == NULL)
+    return;
+
+  if (file->n_glyphs + g_hash_table_size (file->new_glyphs) >= MAX_GLYPHS_PER_FILE)
+    return;
+
+  if (gsk_glyph_disk_cache_lookup (self, font, scale, glyph, xshift, yshift, width, height))
+    return;
+
+  new_glyph = g_new (NewGlyph, 1);
+  new_glyph->sort_key = make_sort_key (glyph, xshift, yshift);
+  new_glyph->width = width;
+  new_glyph->height = height;
+  new_glyph->data = g_malloc (width * height * 4);
+  for (y = 0; y < height; y++)
+    memcpy (new_glyph->data + y * width * 4, data + y * stride, width * 4);
+
+  g_hash_table_replace (file->new_glyphs, &new_glyph->sort_key, new_glyph);
+  file->dirty = TRUE;
+}
+
+typedef struct
+{
+  guint64 sort_key;
+  int width;
+  int height;
+  const guchar *data;
+} SaveGlyph;
+
+typedef struct
+{
+  char *path;
+  guint64 font_key;
+  GMappedFile *mapped;
+  GArray *glyphs; /* SaveGlyph, pointing into mapped or new_data */
+  GPtrArray *new_data;
+  FontFile *file; /* only touched on the main thread */
+} SaveJob;
+
+static void
+save_job_free (gpointer data)
+{
+  SaveJob *job = data;
+
+  g_free (job->path);
+  g_clear_pointer (&job->mapped, g_mapped_file_unref);
+  g_array_unref (job->glyphs);
+  g_ptr_array_unref (job->new_data);
+  g_free (job);
+}
+
+static int
+compare_save_glyphs (gconstpointer a,
+                     gconstpointer b)
+{
+  const SaveGlyph *glyph_a = a;
+  const SaveGlyph *glyph_b = b;
+
+  if (glyph_a->sort_key < glyph_b->sort_key)
+    return -1;
+  else if (glyph_a->sort_key > glyph_b->sort_key)
+    return 1;
+  else
+    return 0;
+}
+
+static void
+save_thread (GTask        *task,
+             gpointer      source_object,
+             gpointer      task_data,
+             GCancellable *cancellable)
+{
+  SaveJob *job = task_data;
+  FileHeader *header;
+  FileGlyph *file_glyphs;
+  GError *error = NULL;
+  char *contents;
+  gsize size, offset;
+  guint i;
+
+  g_array_sort (job->glyphs, compare_save_glyphs);
+
+  size = sizeof (FileHeader) + job->glyphs->len * sizeof (FileGlyph);
+  for (i = 0; i < job->glyphs->len; i++)
+    {
+      const SaveGlyph *glyph = &g_array_index (job->glyphs, SaveGlyph, i);
+
+      size += glyph->width * glyph->height * 4;
+    }
+
+  contents = g_malloc0 (size);
+  header = (FileHeader *) contents;
+  memcpy (header->magic, GLYPH_CACHE_MAGIC, sizeof (header->magic));
+  header->version = GLYPH_CACHE_VERSION;
+  header->n_glyphs = job->glyphs->len;
+  header->font_key = job->font_key;
+
+  file_glyphs = (FileGlyph *) (contents + sizeof (FileHeader));
+  offset = sizeof (FileHeader) + job->glyphs->len * sizeof (FileGlyph);
+  for (i = 0; i < job->glyphs->len; i++)
+    {
+      const SaveGlyph *glyph = &g_array_index (job->glyphs, SaveGlyph, i);
+      const gsize glyph_size = glyph->width * glyph->height * 4;
+
+      file_glyphs[i].sort_key = glyph->sort_key;
+      file_glyphs[i].offset = offset;
+      file_glyphs[i].width = glyph->width;
+      file_glyphs[i].height = glyph->height;
+      memcpy (contents + offset, glyph->data, glyph_size);
+      offset += glyph_size;
+    }
+
+  if (g_file_set_contents (job->path, contents, size, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+
+  g_free (contents);
+}
+
+/* Runs on the main thread */
+static void
+save_done (GObject      *source_object,
+           GAsyncResult *result,
+           gpointer      user_data)
+{
+  SaveJob *job = g_task_get_task_data (G_TASK (result));
+  FontFile *file = g_steal_pointer (&job->file);
+  GHashTableIter iter;
+  NewGlyph *new_glyph;
+  GMappedFile *mapped;
+  GError *error = NULL;
+
+  file->saving = FALSE;
+
+  if (!g_task_propagate_boolean (G_TASK (result), &error))
+    {
+      GSK_NOTE (GLYPH_CACHE, g_message ("Failed to write glyph cache: %s", error->message));
+      g_error_free (error);
+      /* Try again with the next save */
+      file->dirty = TRUE;
+      font_file_unref (file);
+      return;
+    }
+
+  /* Use the new file, so we don't need to keep the glyphs in it
+   * in memory anymore. Glyphs that were added while saving stay */
+  mapped = g_mapped_file_new (file->path, FALSE, NULL);
+  if (mapped != NULL && font_file_load (file, mapped))
+    {
+      g_clear_pointer (&file->mapped, g_mapped_file_unref);
+      file->mapped = mapped;
+
+      g_hash_table_iter_init (&iter, file->new_glyphs);
+      while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&new_glyph))
+        {
+          const FileGlyph *file_glyph = font_file_find (file, new_glyph->sort_key);
+
+          if (file_glyph != NULL &&
+              file_glyph->width == new_glyph->width &&
+              file_glyph->height == new_glyph->height)
+            g_hash_table_iter_remove (&iter);
+        }
+    }
+  else
+    g_clear_pointer (&mapped, g_mapped_file_unref);
+
+  font_file_unref (file);
+}
+
+static void
+font_file_save (FontFile *file)
+{
+  GHashTableIter iter;
+  NewGlyph *new_glyph;
+  SaveJob *job;
+  GTask *task;
+  guint i;
+
+  job = g_new0 (SaveJob, 1);
+  job->path = g_strdup (file->path);
+  job->font_key = file->font_key;
+  job->glyphs = g_array_new (FALSE, FALSE, sizeof (SaveGlyph));
+  job->new_data = g_ptr_array_new_with_free_func (g_free);
+  job->file = font_file_ref (file);
+
+  /* The mapped file stays around, but the new glyphs might be
+   * added to while we're saving, so copy them */
+  g_hash_table_iter_init (&iter, file->new_glyphs);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&new_glyph))
+    {
+      SaveGlyph glyph = {
+        new_glyph->sort_key,
+        new_glyph->width,
+        new_glyph->height,
+        g_memdup (new_glyph->data, new_glyph->width * new_glyph->height * 4)
+      };
+
+      g_ptr_array_add (job->new_data, (gpointer) glyph.data);
+      g_array_append_val (job->glyphs, glyph);
+    }
+
+  if (file->mapped != NULL)
+    {
+      const char *contents = g_mapped_file_get_contents (file->mapped);
+
+      job->mapped = g_mapped_file_ref (file->mapped);
+
+      for (i = 0; i < file->n_glyphs; i++)
+        {
+          const FileGlyph *file_glyph = &file->glyphs[i];
+          SaveGlyph glyph = {
+            file_glyph->sort_key,
+            file_glyph->width,
+            file_glyph->height,
+            (const guchar *) contents + file_glyph->offset
+          };
+
+          if (g_hash_table_contains (file->new_glyphs, &file_glyph->sort_key))
+            continue;
+
+          g_array_append_val (job->glyphs, glyph);
+        }
+    }
+
+  file->dirty = FALSE;
+  file->saving = TRUE;
+
+  task = g_task_new (NULL, NULL, save_done, NULL);
+  g_task_set_source_tag (task, font_file_save);
+  g_task_set_task_data (task, job, save_job_free);
+  g_task_run_in_thread (task, save_thread);
+  g_object_unref (task);
+}
+
+/**
+ * gsk_glyph_disk_cache_save:
+ * @self: the cache
+ *
+ * Writes the glyphs added since the last call to disk. The files
+ * are written in a thread.
+ */
+void
+gsk_glyph_disk_cache_save (GskGlyphDiskCache *self)
+{
+  GHashTableIter iter;
+  FontFile *file;
+
+  g_hash_table_iter_init (&iter, self->files);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *)&file))
+    {
+      if (file == NULL || !file->dirty || file->saving)
+        continue;
+
+      font_file_save (file);
+    }
+}
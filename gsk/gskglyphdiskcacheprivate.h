@@ -0,0 +1,36 @@
+#ifndef __GSK_GLYPH_DISK_CACHE_PRIVATE_H__
+#define __GSK_GLYPH_DISK_CACHE_PRIVATE_H__
+
+#include <pango/pango.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GskGlyphDiskCache GskGlyphDiskCache;
+
+GskGlyphDiskCache *     gsk_glyph_disk_cache_get_default        (void);
+GskGlyphDiskCache *     gsk_glyph_disk_cache_new                (const char        *dir);
+void                    gsk_glyph_disk_cache_free               (GskGlyphDiskCache *self);
+
+const guchar *          gsk_glyph_disk_cache_lookup             (GskGlyphDiskCache *self,
+                                                                 PangoFont         *font,
+                                                                 guint              scale,
+                                                                 PangoGlyph         glyph,
+                                                                 guint              xshift,
+                                                                 guint              yshift,
+                                                                 int                width,
+                                                                 int                height);
+void                    gsk_glyph_disk_cache_add                (GskGlyphDiskCache *self,
+                                                                 PangoFont         *font,
+                                                                 guint              scale,
+                                                                 PangoGlyph         glyph,
+                                                                 guint              xshift,
+                                                                 guint              yshift,
+                                                                 int                width,
+                                                                 int                height,
+                                                                 const guchar      *data,
+                                                                 int                stride);
+void                    gsk_glyph_disk_cache_save               (GskGlyphDiskCache *self);
+
+G_END_DECLS
+
+#endif /* __GSK_GLYPH_DISK_CACHE_PRIVATE_H__ */
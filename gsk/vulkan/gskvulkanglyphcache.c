@@ -7,6 +7,8 @@
 #include "gskprivate.h"
 #include "gskrendererprivate.h"
 
+#include "gdk/gdkparalleltaskprivate.h"
+
 #include <graphene.h>
 
 /* Parameters for our cache eviction strategy.
@@ -22,6 +24,10 @@
 #define CHECK_INTERVAL 10
 #define MAX_OLD 0.333
 
+/* Dirty glyphs are rasterized in parallel when uploading them,
+ * with at least this many glyphs per task */
+#define MIN_PARALLEL_GLYPHS 4
+
 
 typedef struct {
   GskVulkanImage *image;
@@ -160,6 +166,7 @@ typedef struct {
   GlyphCacheKey *key;
   GskVulkanCachedGlyph *value;
   cairo_surface_t *surface;
+  cairo_scaled_font_t *scaled_font; /* NULL if the glyph needs pango to draw it */
 } DirtyGlyph;
 
 static void
@@ -221,7 +228,7 @@ add_to_cache (GskVulkanGlyphCache  *cache,
 
   value->texture_index = i;
 
-  dirty = g_new (DirtyGlyph, 1);
+  dirty = g_new0 (DirtyGlyph, 1);
   dirty->key = key;
   dirty->value = value;
   atlas->dirty_glyphs = g_list_prepend (atlas->dirty_glyphs, dirty);
@@ -248,6 +255,8 @@ add_to_cache (GskVulkanGlyphCache  *cache,
 #endif
 }
 
+/* Glyphs with a scaled font are drawn with just cairo, which
+ * is thread-safe, so they can be rendered in a thread */
 static void
 render_glyph (Atlas          *atlas,
               DirtyGlyph     *glyph,
@@ -257,8 +266,6 @@ render_glyph (Atlas          *atlas,
   GskVulkanCachedGlyph *value = glyph->value;
   cairo_surface_t *surface;
   cairo_t *cr;
-  PangoGlyphString glyphs;
-  PangoGlyphInfo gi;
 
   surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32,
                                         value->draw_width * key->scale / 1024,
@@ -268,20 +275,38 @@ render_glyph (Atlas          *atlas,
   cr = cairo_create (surface);
   cairo_set_source_rgba (cr, 1, 1, 1, 1);
 
-  gi.glyph = key->glyph;
-  gi.geometry.width = value->draw_width * 1024;
-  if (key->glyph & PANGO_GLYPH_UNKNOWN_FLAG)
-    gi.geometry.x_offset = key->xshift * 256;
+  if (glyph->scaled_font)
+    {
+      cairo_glyph_t cg;
+
+      cg.index = key->glyph;
+      cg.x = (double)(key->xshift * 256 - value->draw_x * 1024) / PANGO_SCALE;
+      cg.y = (double)(key->yshift * 256 - value->draw_y * 1024) / PANGO_SCALE;
+
+      cairo_set_scaled_font (cr, glyph->scaled_font);
+      cairo_show_glyphs (cr, &cg, 1);
+    }
   else
-    gi.geometry.x_offset = key->xshift * 256 - value->draw_x * 1024;
-  gi.geometry.y_offset = key->yshift * 256 - value->draw_y * 1024;
+    {
+      PangoGlyphString glyphs;
+      PangoGlyphInfo gi;
 
-  glyphs.num_glyphs = 1;
-  glyphs.glyphs = &gi;
+      gi.glyph = key->glyph;
+      gi.geometry.width = value->draw_width * 1024;
+      if (key->glyph & PANGO_GLYPH_UNKNOWN_FLAG)
+        gi.geometry.x_offset = key->xshift * 256;
+      else
+        gi.geometry.x_offset = key->xshift * 256 - value->draw_x * 1024;
+      gi.geometry.y_offset = key->yshift * 256 - value->draw_y * 1024;
 
-  pango_cairo_show_glyph_string (cr, key->font, &glyphs);
+      glyphs.num_glyphs = 1;
+      glyphs.glyphs = &gi;
+
+      pango_cairo_show_glyph_string (cr, key->font, &glyphs);
+    }
 
   cairo_destroy (cr);
+  cairo_surface_flush (surface);
 
   glyph->surface = surface;
 
@@ -293,29 +318,84 @@ render_glyph (Atlas          *atlas,
   region->y = (gsize)(value->ty * atlas->height);
 }
 
+typedef struct {
+  Atlas *atlas;
+  DirtyGlyph **glyphs;
+  GskImageRegion *regions;
+  guint n_glyphs;
+  int next_glyph;
+} Rasterization;
+
+static void
+render_glyphs_in_thread (gpointer data)
+{
+  Rasterization *rasterization = data;
+  int i;
+
+  while ((i = g_atomic_int_add (&rasterization->next_glyph, 1)) < (int)rasterization->n_glyphs)
+    {
+      if (rasterization->glyphs[i]->scaled_font != NULL)
+        render_glyph (rasterization->atlas, rasterization->glyphs[i], &rasterization->regions[i]);
+    }
+}
+
 static void
 upload_dirty_glyphs (GskVulkanGlyphCache *cache,
                      Atlas               *atlas,
                      GskVulkanUploader   *uploader)
 {
+  Rasterization rasterization;
   GList *l;
   guint num_regions;
+  guint n_tasks;
   GskImageRegion *regions;
+  DirtyGlyph **glyphs;
   int i;
 
   num_regions = g_list_length (atlas->dirty_glyphs);
-  regions = alloca (sizeof (GskImageRegion) * num_regions);
+  regions = g_new (GskImageRegion, num_regions);
+  glyphs = g_new (DirtyGlyph *, num_regions);
 
   for (l = atlas->dirty_glyphs, i = 0; l; l = l->next, i++)
-    render_glyph (atlas, (DirtyGlyph *)l->data, &regions[i]);
+    {
+      DirtyGlyph *glyph = l->data;
+      cairo_scaled_font_t *scaled_font;
+
+      glyphs[i] = glyph;
+
+      if (glyph->key->glyph & PANGO_GLYPH_UNKNOWN_FLAG)
+        continue;
+
+      scaled_font = pango_cairo_font_get_scaled_font ((PangoCairoFont *)glyph->key->font);
+      if (scaled_font && cairo_scaled_font_status (scaled_font) == CAIRO_STATUS_SUCCESS)
+        glyph->scaled_font = scaled_font;
+    }
+
+  rasterization.atlas = atlas;
+  rasterization.glyphs = glyphs;
+  rasterization.regions = regions;
+  rasterization.n_glyphs = num_regions;
+  rasterization.next_glyph = 0;
+
+  n_tasks = MAX (1, MIN (num_regions / MIN_PARALLEL_GLYPHS, gdk_parallel_task_get_max_tasks ()));
+  gdk_parallel_task_run (render_glyphs_in_thread, &rasterization, n_tasks);
+
+  /* pango isn't thread-safe, so hex boxes are drawn here */
+  for (i = 0; i < num_regions; i++)
+    {
+      if (glyphs[i]->scaled_font == NULL)
+        render_glyph (atlas, glyphs[i], &regions[i]);
+    }
 
   GSK_RENDERER_NOTE (cache->renderer, GLYPH_CACHE,
-            g_message ("uploading %d glyphs to cache", num_regions));
+            g_message ("uploading %d glyphs to cache in %u tasks", num_regions, n_tasks));
 
   gsk_vulkan_image_upload_regions (atlas->image, uploader, num_regions, regions);
 
   g_list_free_full (atlas->dirty_glyphs, dirty_glyph_free);
   atlas->dirty_glyphs = NULL;
+  g_free (glyphs);
+  g_free (regions);
 }
 
 GskVulkanGlyphCache *
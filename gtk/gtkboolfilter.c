@@ -21,6 +21,7 @@
 
 #include "gtkboolfilter.h"
 
+#include "gtkfilterprivate.h"
 #include "gtkintl.h"
 #include "gtktypebuiltins.h"
 
@@ -39,6 +40,8 @@ struct _GtkBoolFilter
 
   gboolean invert;
   GtkExpression *expression;
+
+  guint states[2]; /* for both values of invert, 0 if not created yet */
 };
 
 enum {
@@ -52,6 +55,22 @@ G_DEFINE_TYPE (GtkBoolFilter, gtk_bool_filter, GTK_TYPE_FILTER)
 
 static GParamSpec *properties[NUM_PROPERTIES] = { NULL, };
 
+static guint
+gtk_bool_filter_get_state (GtkBoolFilter *self)
+{
+  if (self->states[self->invert] == 0)
+    self->states[self->invert] = gtk_filter_new_state ();
+
+  return self->states[self->invert];
+}
+
+static void
+gtk_bool_filter_changed (GtkBoolFilter   *self,
+                         GtkFilterChange  change)
+{
+  gtk_filter_changed_with_state (GTK_FILTER (self), change, gtk_bool_filter_get_state (self), 0);
+}
+
 static gboolean
 gtk_bool_filter_match (GtkFilter *filter,
                        gpointer   item)
@@ -73,6 +92,55 @@ gtk_bool_filter_match (GtkFilter *filter,
   return result;
 }
 
+/* Evaluating the expression needs the items, so that is all done
+ * when creating the snapshot */
+typedef struct
+{
+  GtkFilterSnapshot snapshot;
+
+  guint8 *results;
+} GtkBoolFilterSnapshot;
+
+static void
+gtk_bool_filter_snapshot_free (GtkFilterSnapshot *snapshot)
+{
+  GtkBoolFilterSnapshot *self = (GtkBoolFilterSnapshot *) snapshot;
+
+  g_free (self->results);
+}
+
+static gboolean
+gtk_bool_filter_snapshot_match (GtkFilterSnapshot *snapshot,
+                                guint              i)
+{
+  GtkBoolFilterSnapshot *self = (GtkBoolFilterSnapshot *) snapshot;
+
+  return self->results[i];
+}
+
+static const GtkFilterSnapshotClass GTK_BOOL_FILTER_SNAPSHOT_CLASS =
+{
+  gtk_bool_filter_snapshot_free,
+  gtk_bool_filter_snapshot_match,
+};
+
+static GtkFilterSnapshot *
+gtk_bool_filter_snapshot (GtkFilter *filter,
+                          gpointer  *items,
+                          guint      n_items)
+{
+  GtkBoolFilterSnapshot *result;
+  guint i;
+
+  result = gtk_filter_snapshot_new (GtkBoolFilterSnapshot, &GTK_BOOL_FILTER_SNAPSHOT_CLASS);
+  result->results = g_new (guint8, n_items);
+
+  for (i = 0; i < n_items; i++)
+    result->results[i] = gtk_bool_filter_match (filter, items[i]);
+
+  return (GtkFilterSnapshot *) result;
+}
+
 static GtkFilterMatch
 gtk_bool_filter_get_strictness (GtkFilter *filter)
 {
@@ -150,6 +218,7 @@ gtk_bool_filter_class_init (GtkBoolFilterClass *class)
 
   filter_class->match = gtk_bool_filter_match;
   filter_class->get_strictness = gtk_bool_filter_get_strictness;
+  gtk_filter_class_set_snapshot_func (filter_class, gtk_bool_filter_snapshot);
 
   object_class->get_property = gtk_bool_filter_get_property;
   object_class->set_property = gtk_bool_filter_set_property;
@@ -184,6 +253,7 @@ gtk_bool_filter_class_init (GtkBoolFilterClass *class)
 static void
 gtk_bool_filter_init (GtkBoolFilter *self)
 {
+  gtk_filter_set_state (GTK_FILTER (self), gtk_bool_filter_get_state (self), 0);
 }
 
 /**
@@ -249,7 +319,9 @@ gtk_bool_filter_set_expression (GtkBoolFilter *self,
   if (expression)
     self->expression = gtk_expression_ref (expression);
 
-  gtk_filter_changed (GTK_FILTER (self), GTK_FILTER_CHANGE_DIFFERENT);
+  self->states[FALSE] = 0;
+  self->states[TRUE] = 0;
+  gtk_bool_filter_changed (self, GTK_FILTER_CHANGE_DIFFERENT);
 
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_EXPRESSION]);
 }
@@ -288,7 +360,7 @@ gtk_bool_filter_set_invert (GtkBoolFilter *self,
 
   self->invert = invert;
 
-  gtk_filter_changed (GTK_FILTER (self), GTK_FILTER_CHANGE_DIFFERENT);
+  gtk_bool_filter_changed (self, GTK_FILTER_CHANGE_DIFFERENT);
 
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_INVERT]);
 }
@@ -97,6 +97,27 @@ gtk_css_value_array_equal (const GtkCssValue *value1,
   return TRUE;
 }
 
+static guint
+gtk_css_value_array_hash (const GtkCssValue *value)
+{
+  guint hash, i;
+
+  hash = value->n_values;
+
+  for (i = 0; i < value->n_values; i++)
+    {
+      guint value_hash = gtk_css_value_hash (value->values[i]);
+
+      /* Only intern arrays of values that can be interned */
+      if (value_hash == 0)
+        return 0;
+
+      hash = hash * 31 + value_hash;
+    }
+
+  return hash ? hash : 1;
+}
+
 static guint
 gcd (guint a, guint b)
 {
@@ -372,7 +393,8 @@ static const GtkCssValueClass GTK_CSS_VALUE_ARRAY = {
   gtk_css_value_array_transition,
   gtk_css_value_array_is_dynamic,
   gtk_css_value_array_get_dynamic_value,
-  gtk_css_value_array_print
+  gtk_css_value_array_print,
+  gtk_css_value_array_hash
 };
 
 GtkCssValue *
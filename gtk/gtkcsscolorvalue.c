@@ -211,6 +211,34 @@ gtk_css_value_color_equal (const GtkCssValue *value1,
     }
 }
 
+static guint
+gtk_css_value_color_hash (const GtkCssValue *value)
+{
+  guint hash;
+
+  switch (value->type)
+    {
+    case COLOR_TYPE_LITERAL:
+      hash = gdk_rgba_hash (&value->sym_col.rgba);
+      break;
+    case COLOR_TYPE_NAME:
+      hash = g_str_hash (value->sym_col.name);
+      break;
+    case COLOR_TYPE_SHADE:
+    case COLOR_TYPE_ALPHA:
+      /* Symbolic colors resolve to literals when computed,
+       * there's no point in interning them */
+    case COLOR_TYPE_MIX:
+    case COLOR_TYPE_CURRENT_COLOR:
+      return 0;
+    default:
+      g_assert_not_reached ();
+      return 0;
+    }
+
+  return hash ? hash : 1;
+}
+
 static GtkCssValue *
 gtk_css_value_color_transition (GtkCssValue *start,
                                 GtkCssValue *end,
@@ -291,7 +319,8 @@ static const GtkCssValueClass GTK_CSS_VALUE_COLOR = {
   gtk_css_value_color_transition,
   NULL,
   NULL,
-  gtk_css_value_color_print
+  gtk_css_value_color_print,
+  gtk_css_value_color_hash
 };
 
 static void
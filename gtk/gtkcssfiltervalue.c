@@ -57,7 +57,6 @@ struct _GtkCssValue {
 };
 
 static GtkCssValue *    gtk_css_filter_value_alloc           (guint                  n_values);
-static gboolean         gtk_css_filter_value_is_none         (const GtkCssValue     *value);
 
 static void
 gtk_css_filter_clear (GtkCssFilter *filter)
@@ -742,7 +741,7 @@ gtk_css_filter_value_new_none (void)
   return _gtk_css_value_ref (&filter_none_singleton);
 }
 
-static gboolean
+gboolean
 gtk_css_filter_value_is_none (const GtkCssValue *value)
 {
   return value->n_filters == 0;
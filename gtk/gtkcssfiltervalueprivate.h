@@ -30,6 +30,8 @@ G_BEGIN_DECLS
 GtkCssValue *   gtk_css_filter_value_new_none           (void);
 GtkCssValue *   gtk_css_filter_value_parse              (GtkCssParser           *parser);
 
+gboolean        gtk_css_filter_value_is_none            (const GtkCssValue      *filter);
+
 void            gtk_css_filter_value_push_snapshot      (const GtkCssValue      *filter,
                                                          GtkSnapshot            *snapshot);
 void            gtk_css_filter_value_pop_snapshot       (const GtkCssValue      *filter,
@@ -21,13 +21,18 @@
 
 #include "gtkcssstaticstyleprivate.h"
 #include "gtkcssanimatedstyleprivate.h"
+#include "gtkcsslookupprivate.h"
+#include "gtkcssselectorprivate.h"
+#include "gtkcsssharedstylesprivate.h"
 #include "gtkcssstylepropertyprivate.h"
 #include "gtkintl.h"
 #include "gtkmarshalers.h"
 #include "gtksettingsprivate.h"
+#include "gtkstyleproviderprivate.h"
 #include "gtktypebuiltins.h"
 #include "gtkprivate.h"
 #include "gdkprofilerprivate.h"
+#include "gdk/gdkparalleltaskprivate.h"
 
 /*
  * CSS nodes are the backbone of the GtkStyleContext implementation and
@@ -126,8 +131,32 @@ gtk_css_node_get_style_provider_or_null (GtkCssNode *cssnode)
 
 static int invalidated_nodes;
 static int created_styles;
+static int shared_style_hits;
+static int shared_style_misses;
 static guint invalidated_nodes_counter;
 static guint created_styles_counter;
+static guint shared_style_hits_counter;
+static guint shared_style_misses_counter;
+static GtkCssNodeStats stats;
+
+/* The result of a lookup that was done for a node before its style
+ * gets computed, see gtk_css_node_match_children().
+ */
+struct _GtkCssNodeMatch
+{
+  GtkCssNode       *node;
+  GtkStyleProvider *provider;
+  GtkCssChange      requested_change;   /* the change the style will be computed with */
+  GtkCssChange      change;             /* the change flags from the lookup if requested_change is 0 */
+  GtkCssLookup      lookup;
+};
+
+static void
+gtk_css_node_match_free (GtkCssNodeMatch *match)
+{
+  _gtk_css_lookup_destroy (&match->lookup);
+  g_free (match);
+}
 
 static void
 gtk_css_node_set_invalid (GtkCssNode *node,
@@ -139,7 +168,10 @@ gtk_css_node_set_invalid (GtkCssNode *node,
   node->invalid = invalid;
 
   if (invalid)
-    invalidated_nodes++;
+    {
+      invalidated_nodes++;
+      stats.invalidated_nodes++;
+    }
 
   if (node->visible)
     {
@@ -241,6 +273,7 @@ gtk_css_node_dispose (GObject *object)
   gtk_css_node_set_invalid (cssnode, FALSE);
   
   g_clear_pointer (&cssnode->cache, gtk_css_node_style_cache_unref);
+  g_clear_pointer (&cssnode->match, gtk_css_node_match_free);
 
   G_OBJECT_CLASS (gtk_css_node_parent_class)->dispose (object);
 }
@@ -361,14 +394,24 @@ gtk_css_node_create_style (GtkCssNode                   *cssnode,
                            GtkCssChange                  change)
 {
   const GtkCssNodeDeclaration *decl;
+  GtkStyleProvider *provider;
+  GtkCssStyle *parent_style;
+  GtkCssNodeMatch *match;
+  GtkCssLookup node_lookup;
+  GtkCssLookup *lookup;
   GtkCssStyle *style;
   GtkCssChange style_change;
 
   decl = gtk_css_node_get_declaration (cssnode);
 
+  stats.style_lookups++;
+
   style = lookup_in_global_parent_cache (cssnode, decl);
   if (style)
-    return g_object_ref (style);
+    {
+      stats.style_cache_hits++;
+      return g_object_ref (style);
+    }
 
   created_styles++;
 
@@ -382,10 +425,49 @@ gtk_css_node_create_style (GtkCssNode                   *cssnode,
       style_change = gtk_css_static_style_get_change (gtk_css_style_get_static_style (cssnode->style));
     }
 
-  style = gtk_css_static_style_new_compute (gtk_css_node_get_style_provider (cssnode),
-                                            filter,
-                                            cssnode,
-                                            style_change);
+  provider = gtk_css_node_get_style_provider (cssnode);
+  parent_style = cssnode->parent ? gtk_css_node_get_style (cssnode->parent) : NULL;
+  match = g_steal_pointer (&cssnode->match);
+
+  if (match &&
+      match->provider == provider &&
+      match->requested_change == style_change)
+    {
+      lookup = &match->lookup;
+      style_change = match->change;
+    }
+  else
+    {
+      g_clear_pointer (&match, gtk_css_node_match_free);
+
+      _gtk_css_lookup_init (&node_lookup);
+      gtk_style_provider_lookup (provider,
+                                 filter,
+                                 cssnode,
+                                 &node_lookup,
+                                 style_change == 0 ? &style_change : NULL);
+      lookup = &node_lookup;
+    }
+
+  style = gtk_css_shared_styles_lookup (provider, parent_style, lookup, style_change);
+  if (style)
+    {
+      shared_style_hits++;
+      stats.shared_style_hits++;
+      g_object_ref (style);
+    }
+  else
+    {
+      shared_style_misses++;
+      stats.computed_styles++;
+      style = gtk_css_static_style_new_resolve (provider, cssnode, lookup, style_change);
+      gtk_css_shared_styles_insert (provider, parent_style, lookup, style_change, style);
+    }
+
+  if (match)
+    gtk_css_node_match_free (match);
+  else
+    _gtk_css_lookup_destroy (&node_lookup);
 
   store_in_global_parent_cache (cssnode, decl, style);
 
@@ -631,6 +713,8 @@ gtk_css_node_class_init (GtkCssNodeClass *klass)
     {
       invalidated_nodes_counter = gdk_profiler_define_int_counter ("invalidated-nodes", "CSS Node Invalidations");
       created_styles_counter = gdk_profiler_define_int_counter ("created-styles", "CSS Style Creations");
+      shared_style_hits_counter = gdk_profiler_define_int_counter ("shared-style-hits", "CSS Styles Shared Between Nodes");
+      shared_style_misses_counter = gdk_profiler_define_int_counter ("shared-style-misses", "CSS Styles Computed");
     }
 }
 
@@ -1016,9 +1100,18 @@ gtk_css_node_get_style (GtkCssNode *cssnode)
 {
   if (gtk_css_node_needs_new_style (cssnode))
     {
+      GtkCountingBloomFilter filter = GTK_COUNTING_BLOOM_FILTER_INIT;
       gint64 timestamp = gtk_css_node_get_timestamp (cssnode);
+      GtkCssNode *ancestor;
+
+      /* The filter contains all ancestors of @cssnode, which is more
+       * than the ancestors of the parents and siblings that get their
+       * styles ensured, too. That's fine, the filter only rules out
+       * selectors that can't match. */
+      for (ancestor = cssnode->parent; ancestor; ancestor = ancestor->parent)
+        gtk_css_node_declaration_add_bloom_hashes (ancestor->decl, &filter);
 
-      gtk_css_node_ensure_style (cssnode, NULL, timestamp);
+      gtk_css_node_ensure_style (cssnode, &filter, timestamp);
     }
 
   return cssnode->style;
@@ -1271,6 +1364,85 @@ gtk_css_node_invalidate_style_provider (GtkCssNode *cssnode)
     }
 }
 
+static gboolean
+gtk_css_node_invalidate_rules_internal (GtkCssNode               *cssnode,
+                                        const GtkCssSelectorTree *rules,
+                                        GtkCountingBloomFilter   *filter)
+{
+  GtkCssSelectorMatches matches;
+  gboolean invalidated;
+  GtkCssNode *child;
+
+  /* Rules that don't match now may match after a state change, and
+   * the change flags of the current style don't know about them. */
+  gtk_css_selector_matches_init (&matches);
+  _gtk_css_selector_tree_match_all (rules, filter, cssnode, &matches);
+  invalidated = gtk_css_selector_matches_get_size (&matches) > 0 ||
+                gtk_css_selector_tree_get_change_all (rules, filter, cssnode) != 0;
+  gtk_css_selector_matches_clear (&matches);
+
+  if (invalidated)
+    gtk_css_node_invalidate (cssnode, GTK_CSS_CHANGE_SOURCE);
+
+  if (cssnode->first_child)
+    {
+      gtk_css_node_declaration_add_bloom_hashes (cssnode->decl, filter);
+
+      for (child = cssnode->first_child;
+           child;
+           child = child->next_sibling)
+        {
+          if (gtk_css_node_get_style_provider_or_null (child) == NULL)
+            invalidated |= gtk_css_node_invalidate_rules_internal (child, rules, filter);
+        }
+
+      gtk_css_node_declaration_remove_bloom_hashes (cssnode->decl, filter);
+    }
+
+  return invalidated;
+}
+
+static void
+gtk_css_node_clear_style_caches (GtkCssNode *cssnode)
+{
+  GtkCssNode *child;
+
+  g_clear_pointer (&cssnode->cache, gtk_css_node_style_cache_unref);
+
+  for (child = cssnode->first_child;
+       child;
+       child = child->next_sibling)
+    {
+      if (gtk_css_node_get_style_provider_or_null (child) == NULL)
+        gtk_css_node_clear_style_caches (child);
+    }
+}
+
+/*
+ * gtk_css_node_invalidate_style_rules:
+ * @cssnode: the root of the nodes using the provider that changed
+ * @rules: the selectors of the rules that changed
+ *
+ * Like gtk_css_node_invalidate_style_provider(), but only invalidates
+ * the nodes that one of @rules could apply to, now or after a change
+ * of their state.
+ */
+void
+gtk_css_node_invalidate_style_rules (GtkCssNode               *cssnode,
+                                     const GtkCssSelectorTree *rules)
+{
+  GtkCountingBloomFilter filter = GTK_COUNTING_BLOOM_FILTER_INIT;
+  GtkCssNode *ancestor;
+
+  for (ancestor = cssnode->parent; ancestor; ancestor = ancestor->parent)
+    gtk_css_node_declaration_add_bloom_hashes (ancestor->decl, &filter);
+
+  /* The style caches are shared between nodes with the same ancestors
+   * and may contain styles for the old rules, so drop all of them. */
+  if (gtk_css_node_invalidate_rules_internal (cssnode, rules, &filter))
+    gtk_css_node_clear_style_caches (cssnode);
+}
+
 static void
 gtk_css_node_invalidate_timestamp (GtkCssNode *cssnode)
 {
@@ -1314,11 +1486,174 @@ gtk_css_node_invalidate (GtkCssNode   *cssnode,
 
   cssnode->pending_changes |= change;
 
+  /* The node or its siblings changed since the lookup */
+  g_clear_pointer (&cssnode->match, gtk_css_node_match_free);
+
   if (cssnode->parent)
     cssnode->parent->needs_propagation = TRUE;
   gtk_css_node_invalidate_style (cssnode);
 }
 
+/* Children that need a new style with fewer siblings than this are
+ * not worth sending to other threads.
+ */
+#define MIN_PARALLEL_MATCHES 16
+
+typedef struct {
+  const GtkCountingBloomFilter *filter;
+  GtkCssNodeMatch **matches;
+  guint n_matches;
+  int next_match;
+} MatchChildren;
+
+static void
+match_children_in_thread (gpointer data)
+{
+  MatchChildren *match_children = data;
+  int i;
+
+  while ((i = g_atomic_int_add (&match_children->next_match, 1)) < (int)match_children->n_matches)
+    {
+      GtkCssNodeMatch *match = match_children->matches[i];
+
+      gtk_style_provider_lookup (match->provider,
+                                 match_children->filter,
+                                 match->node,
+                                 &match->lookup,
+                                 match->change == 0 ? &match->change : NULL);
+    }
+}
+
+static gboolean
+gtk_css_node_needs_match (GtkCssNode *child)
+{
+  GtkCssStyle *static_style;
+
+  if (!child->visible || !child->invalid || !child->style_is_invalid)
+    return FALSE;
+
+  /* Other kinds of nodes don't compute their styles from a lookup */
+  if (GTK_CSS_NODE_GET_CLASS (child)->update_style != gtk_css_node_real_update_style)
+    return FALSE;
+
+  static_style = GTK_CSS_STYLE (gtk_css_style_get_static_style (child->style));
+
+  return gtk_css_style_needs_recreation (static_style, child->pending_changes);
+}
+
+/*
+ * gtk_css_node_match_children:
+ * @cssnode: a node with a valid style
+ * @filter: the bloom filter for the children of @cssnode
+ *
+ * Does the lookups for all the children of @cssnode that will need
+ * a new static style in parallel. Matching selectors against a node
+ * only depends on the node tree, so it can be done before the styles
+ * of the previous siblings are computed. Computing the styles from
+ * the lookups still happens one after another when the children get
+ * validated.
+ *
+ * Children that will find their style in the style cache of @cssnode
+ * because a previous sibling has the same declaration are skipped.
+ * Nothing is done while a style provider can't do lookups in other
+ * threads.
+ */
+static void
+gtk_css_node_match_children (GtkCssNode                   *cssnode,
+                             const GtkCountingBloomFilter *filter)
+{
+  MatchChildren match_children;
+  GtkCssNodeMatch **matches;
+  GHashTable *declarations;
+  GPtrArray *children;
+  GtkCssNode *child;
+  guint n_tasks;
+  guint i;
+
+  declarations = NULL;
+  children = NULL;
+
+  for (child = cssnode->first_child; child; child = child->next_sibling)
+    {
+      if (!gtk_css_node_needs_match (child))
+        continue;
+
+      if (may_use_global_parent_cache (child) &&
+          !gtk_css_node_is_first_child (child) &&
+          !gtk_css_node_is_last_child (child))
+        {
+          if (declarations == NULL)
+            declarations = g_hash_table_new (gtk_css_node_declaration_hash, gtk_css_node_declaration_equal);
+
+          if (!g_hash_table_add (declarations, child->decl))
+            continue;
+        }
+
+      if (children == NULL)
+        children = g_ptr_array_new ();
+
+      g_ptr_array_add (children, child);
+    }
+
+  g_clear_pointer (&declarations, g_hash_table_unref);
+
+  /* Not worth it, do the lookups when computing the styles */
+  if (children == NULL || children->len < MIN_PARALLEL_MATCHES)
+    {
+      g_clear_pointer (&children, g_ptr_array_unref);
+      return;
+    }
+
+  for (i = 0; i < children->len; i++)
+    {
+      child = g_ptr_array_index (children, i);
+
+      if (!gtk_style_provider_lookup_is_threadsafe (gtk_css_node_get_style_provider (child)))
+        {
+          g_ptr_array_unref (children);
+          return;
+        }
+    }
+
+  matches = g_new (GtkCssNodeMatch *, children->len);
+
+  for (i = 0; i < children->len; i++)
+    {
+      GtkCssNodeMatch *match;
+      GtkCssChange change;
+
+      child = g_ptr_array_index (children, i);
+
+      if (child->pending_changes & GTK_CSS_CHANGE_NEEDS_RECOMPUTE)
+        change = 0;
+      else
+        change = gtk_css_static_style_get_change (gtk_css_style_get_static_style (child->style));
+
+      match = g_new (GtkCssNodeMatch, 1);
+      match->node = child;
+      match->provider = gtk_css_node_get_style_provider (child);
+      match->requested_change = change;
+      match->change = change;
+      _gtk_css_lookup_init (&match->lookup);
+
+      g_clear_pointer (&child->match, gtk_css_node_match_free);
+      child->match = match;
+      matches[i] = match;
+    }
+
+  match_children.filter = filter;
+  match_children.matches = matches;
+  match_children.n_matches = children->len;
+  match_children.next_match = 0;
+
+  n_tasks = MIN (children->len / MIN_PARALLEL_MATCHES, gdk_parallel_task_get_max_tasks ());
+
+  gdk_parallel_task_run (match_children_in_thread, &match_children, n_tasks);
+
+  g_free (matches);
+  g_ptr_array_unref (children);
+}
+
 static void
 gtk_css_node_validate_internal (GtkCssNode             *cssnode,
                                 GtkCountingBloomFilter *filter,
@@ -1349,6 +1684,7 @@ gtk_css_node_validate_internal (GtkCssNode             *cssnode,
       if (!bloomed)
         {
           gtk_css_node_declaration_add_bloom_hashes (cssnode->decl, filter);
+          gtk_css_node_match_children (cssnode, filter);
           bloomed = TRUE;
         }
 
@@ -1356,7 +1692,16 @@ gtk_css_node_validate_internal (GtkCssNode             *cssnode,
     }
 
   if (bloomed)
-    gtk_css_node_declaration_remove_bloom_hashes (cssnode->decl, filter);
+    {
+      /* Drop the lookups that were not needed, e.g. because the
+       * style was found in the style cache */
+      for (child = gtk_css_node_get_first_child (cssnode);
+           child;
+           child = gtk_css_node_get_next_sibling (child))
+        g_clear_pointer (&child->match, gtk_css_node_match_free);
+
+      gtk_css_node_declaration_remove_bloom_hashes (cssnode->decl, filter);
+    }
 }
 
 void
@@ -1379,8 +1724,13 @@ gtk_css_node_validate (GtkCssNode *cssnode)
       gdk_profiler_end_mark (before,  "css validation", "");
       gdk_profiler_set_int_counter (invalidated_nodes_counter, invalidated_nodes);
       gdk_profiler_set_int_counter (created_styles_counter, created_styles);
+      gdk_profiler_set_int_counter (shared_style_hits_counter, shared_style_hits);
+      gdk_profiler_set_int_counter (shared_style_misses_counter, shared_style_misses);
+      gtk_css_selector_tree_report_costs ();
       invalidated_nodes = 0;
       created_styles = 0;
+      shared_style_hits = 0;
+      shared_style_misses = 0;
     }
 }
 
@@ -1443,3 +1793,22 @@ gtk_css_node_print (GtkCssNode                *cssnode,
         gtk_css_node_print (node, flags, string, indent + 2);
     }
 }
+
+/*
+ * gtk_css_node_get_stats:
+ * @stats: (out caller-allocates): return location for the stats
+ *
+ * Gets how many nodes were invalidated and how their styles were
+ * found since the last call to gtk_css_node_reset_stats().
+ */
+void
+gtk_css_node_get_stats (GtkCssNodeStats *stats_out)
+{
+  *stats_out = stats;
+}
+
+void
+gtk_css_node_reset_stats (void)
+{
+  memset (&stats, 0, sizeof (stats));
+}
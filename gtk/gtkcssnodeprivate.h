@@ -21,6 +21,7 @@
 #include "gtkcountingbloomfilterprivate.h"
 #include "gtkcssnodedeclarationprivate.h"
 #include "gtkcssnodestylecacheprivate.h"
+#include "gtkcssselectorprivate.h"
 #include "gtkcssstylechangeprivate.h"
 #include "gtkbitmaskprivate.h"
 #include "gtkcsstypesprivate.h"
@@ -36,6 +37,8 @@ G_BEGIN_DECLS
 #define GTK_CSS_NODE_GET_CLASS(obj) (G_TYPE_INSTANCE_GET_CLASS ((obj), GTK_TYPE_CSS_NODE, GtkCssNodeClass))
 
 typedef struct _GtkCssNodeClass         GtkCssNodeClass;
+typedef struct _GtkCssNodeMatch         GtkCssNodeMatch;
+typedef struct _GtkCssNodeStats         GtkCssNodeStats;
 
 struct _GtkCssNode
 {
@@ -50,6 +53,7 @@ struct _GtkCssNode
   GtkCssNodeDeclaration *decl;
   GtkCssStyle           *style;
   GtkCssNodeStyleCache  *cache;                 /* cache for children to look up styles */
+  GtkCssNodeMatch       *match;                 /* lookup done ahead of time, see gtk_css_node_match_children() */
 
   GtkCssChange           pending_changes;       /* changes that accumulated since the style was last computed */
 
@@ -92,6 +96,16 @@ struct _GtkCssNodeClass
   void                  (* validate)                    (GtkCssNode            *node);
 };
 
+/* Totals since the last gtk_css_node_reset_stats(), for benchmarks */
+struct _GtkCssNodeStats
+{
+  guint invalidated_nodes;
+  guint style_lookups;         /* styles that were needed for a node */
+  guint style_cache_hits;      /* ...and found in the parent's style cache */
+  guint shared_style_hits;     /* ...or shared with an unrelated node */
+  guint computed_styles;       /* ...or computed from scratch */
+};
+
 GType                   gtk_css_node_get_type           (void) G_GNUC_CONST;
 
 GtkCssNode *            gtk_css_node_new                (void);
@@ -143,6 +157,9 @@ GtkCssStyle *           gtk_css_node_get_style          (GtkCssNode            *
 
 void                    gtk_css_node_invalidate_style_provider
                                                         (GtkCssNode            *cssnode);
+void                    gtk_css_node_invalidate_style_rules
+                                                        (GtkCssNode            *cssnode,
+                                                         const GtkCssSelectorTree *rules);
 void                    gtk_css_node_invalidate_frame_clock
                                                         (GtkCssNode            *cssnode,
                                                          gboolean               just_timestamp);
@@ -157,6 +174,9 @@ void                    gtk_css_node_print              (GtkCssNode
                                                          GString                   *string,
                                                          guint                      indent);
 
+void                    gtk_css_node_get_stats          (GtkCssNodeStats       *stats);
+void                    gtk_css_node_reset_stats        (void);
+
 G_END_DECLS
 
 #endif /* __GTK_CSS_NODE_PRIVATE_H__ */
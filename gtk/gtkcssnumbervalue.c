@@ -233,6 +233,38 @@ gtk_css_value_number_equal (const GtkCssValue *val1,
   return TRUE;
 }
 
+static guint
+gtk_css_value_number_hash (const GtkCssValue *value)
+{
+  guint hash, i;
+
+  if (G_LIKELY (value->type == TYPE_DIMENSION))
+    {
+      double number = value->dimension.value;
+
+      /* -0 and 0 are equal, but their bits aren't */
+      if (number == 0)
+        number = 0;
+
+      hash = g_double_hash (&number) * 31 + value->dimension.unit;
+    }
+  else
+    {
+      hash = value->calc.n_terms;
+      for (i = 0; i < value->calc.n_terms; i++)
+        {
+          guint term_hash = gtk_css_value_hash (value->calc.terms[i]);
+
+          if (term_hash == 0)
+            return 0;
+
+          hash = hash * 31 + term_hash;
+        }
+    }
+
+  return hash ? hash : 1;
+}
+
 static void
 gtk_css_value_number_print (const GtkCssValue *value,
                             GString           *string)
@@ -329,7 +361,8 @@ static const GtkCssValueClass GTK_CSS_VALUE_NUMBER = {
   gtk_css_value_number_transition,
   NULL,
   NULL,
-  gtk_css_value_number_print
+  gtk_css_value_number_print,
+  gtk_css_value_number_hash
 };
 
 static gsize
@@ -25,6 +25,7 @@
 #include "gtkbitmaskprivate.h"
 #include "gtkcssarrayvalueprivate.h"
 #include "gtkcsscolorvalueprivate.h"
+#include "gtkcssinitialvalueprivate.h"
 #include "gtkcsskeyframesprivate.h"
 #include "gtkcssselectorprivate.h"
 #include "gtkcssshorthandpropertyprivate.h"
@@ -93,14 +94,17 @@ struct _GtkCssProviderClass
 
 typedef struct GtkCssRuleset GtkCssRuleset;
 typedef struct _GtkCssScanner GtkCssScanner;
+typedef struct _GtkCssCompiler GtkCssCompiler;
 typedef struct _PropertyValue PropertyValue;
+typedef struct _CompiledDeclaration CompiledDeclaration;
 typedef enum ParserScope ParserScope;
 typedef enum ParserSymbol ParserSymbol;
 
 struct _PropertyValue {
-  GtkCssStyleProperty *property;
-  GtkCssValue         *value;
-  GtkCssSection       *section;
+  GtkCssStyleProperty       *property;
+  GtkCssValue               *value; /* NULL until parsed if compiled != NULL */
+  GtkCssSection             *section;
+  const CompiledDeclaration *compiled;
 };
 
 struct GtkCssRuleset
@@ -117,6 +121,7 @@ struct _GtkCssScanner
   GtkCssProvider *provider;
   GtkCssParser *parser;
   GtkCssScanner *parent;
+  guint source; /* index into the compiler's sources */
 };
 
 struct _GtkCssProviderPrivate
@@ -130,6 +135,133 @@ struct _GtkCssProviderPrivate
   GtkCssSelectorTree *tree;
   GResource *resource;
   char *path;
+
+  GtkCssCompiler *compiler; /* while loading a file that gets compiled */
+  GMappedFile *compiled; /* if loaded from a compiled file */
+  GPtrArray *compiled_files; /* GFile for each source of the compiled file */
+  guint n_unparsed; /* number of compiled values that haven't been parsed */
+
+  guint load_generation; /* incremented whenever a load starts */
+  GTask *async_parse; /* the async load that is parsing, if any */
+  guint async_parse_id;
+};
+
+/* Compiled providers
+ *
+ * Parsing a big theme takes a measurable part of the startup time of
+ * an application. So if GTK_CSS_CACHE is set, loading a file also
+ * writes a compiled form of it to $XDG_CACHE_HOME/gtk-4.0/css, and
+ * later loads of the same file use that instead, as long as the file
+ * and the files it imports are unchanged.
+ *
+ * The compiled form contains the rulesets in the order they were
+ * parsed, with their selectors and the text and location of their
+ * declared values, as well as the text of symbolic colors and
+ * keyframes. Loading it skips tokenizing the stylesheet and its
+ * imports, and declared values are only parsed once they are looked
+ * up. Most rules of a big theme never match anything in a given
+ * application.
+ *
+ * Files that cause errors or warnings are not compiled, so those are
+ * emitted every time the file is loaded.
+ *
+ * The file starts with a CompiledHeader, followed by the arrays of
+ * CompiledSource, CompiledDefinition for colors and for keyframes,
+ * CompiledDeclaration and CompiledRuleset, followed by the string
+ * table that all the strings are offsets into.
+ */
+
+#define COMPILED_MAGIC "GTKCSSC"
+#define COMPILED_VERSION 2
+
+typedef struct
+{
+  char magic[8];
+  guint32 version;
+  guint32 n_sources;
+  guint32 n_colors;
+  guint32 n_keyframes;
+  guint32 n_declarations;
+  guint32 n_rulesets;
+  guint32 strings_size;
+  guint32 padding;
+} CompiledHeader;
+
+typedef struct
+{
+  guint32 uri;
+  guint32 checksum;
+} CompiledSource;
+
+typedef struct
+{
+  guint32 name;
+  guint32 text;
+  guint32 source;
+} CompiledDefinition;
+
+typedef struct
+{
+  guint32 bytes;
+  guint32 chars;
+  guint32 lines;
+  guint32 line_bytes;
+  guint32 line_chars;
+} CompiledLocation;
+
+struct _CompiledDeclaration
+{
+  guint32 property; /* the style property that is set */
+  guint32 declared; /* the property in the stylesheet, may be a shorthand */
+  guint32 text;
+  guint16 source;
+  guint16 sub; /* index of property in declared */
+  CompiledLocation start; /* of the section */
+  CompiledLocation end;
+};
+
+typedef struct
+{
+  guint32 selector;
+  guint32 first_declaration;
+  guint32 n_declarations;
+} CompiledRuleset;
+
+typedef struct
+{
+  GFile *file;
+  GBytes *bytes;
+} CompilerSource;
+
+typedef struct
+{
+  GtkCssStyleProperty *property;
+  GtkStyleProperty *declared;
+  guint sub;
+  guint source;
+  gsize start;
+  gsize end;
+  GtkCssLocation section_start;
+  GtkCssLocation section_end;
+} CompilerDeclaration;
+
+typedef struct
+{
+  char *name;
+  guint source;
+  gsize start;
+  gsize end;
+} CompilerDefinition;
+
+struct _GtkCssCompiler
+{
+  GArray *sources; /* CompilerSource */
+  GArray *block; /* CompilerDeclaration for each style of the ruleset being parsed */
+  GArray *declarations; /* CompilerDeclaration */
+  GArray *ruleset_styles; /* guint, the first declaration of each ruleset */
+  GArray *colors; /* CompilerDefinition */
+  GArray *keyframes; /* CompilerDefinition */
+  gboolean failed;
 };
 
 enum {
@@ -152,6 +284,15 @@ gtk_css_provider_load_internal (GtkCssProvider *css_provider,
                                 GtkCssScanner  *scanner,
                                 GFile          *file,
                                 GBytes         *bytes);
+static GtkCssValue *gtk_css_provider_parse_compiled (GtkCssProvider *self,
+                                                     GtkCssRuleset  *ruleset,
+                                                     guint           index);
+static void gtk_css_ruleset_print (const GtkCssRuleset *ruleset,
+                                   GString             *str);
+static void gtk_css_provider_print_colors (GHashTable *colors,
+                                           GString    *str);
+static void gtk_css_provider_print_keyframes (GHashTable *keyframes,
+                                              GString    *str);
 
 G_DEFINE_TYPE_EXTENDED (GtkCssProvider, gtk_css_provider, G_TYPE_OBJECT, 0,
                         G_ADD_PRIVATE (GtkCssProvider)
@@ -268,7 +409,8 @@ gtk_css_ruleset_clear (GtkCssRuleset *ruleset)
   memset (ruleset, 0, sizeof (GtkCssRuleset));
 }
 
-static void
+/* Returns the index of the style */
+static guint
 gtk_css_ruleset_add (GtkCssRuleset       *ruleset,
                      GtkCssStyleProperty *property,
                      GtkCssValue         *value,
@@ -276,7 +418,7 @@ gtk_css_ruleset_add (GtkCssRuleset       *ruleset,
 {
   guint i;
 
-  g_return_if_fail (ruleset->owns_styles || ruleset->n_styles == 0);
+  g_return_val_if_fail (ruleset->owns_styles || ruleset->n_styles == 0, 0);
 
   ruleset->owns_styles = TRUE;
 
@@ -300,10 +442,13 @@ gtk_css_ruleset_add (GtkCssRuleset       *ruleset,
     }
 
   ruleset->styles[i].value = value;
+  ruleset->styles[i].compiled = NULL;
   if (gtk_keep_css_sections)
     ruleset->styles[i].section = gtk_css_section_ref (section);
   else
     ruleset->styles[i].section = NULL;
+
+  return i;
 }
 
 static void
@@ -331,8 +476,12 @@ gtk_css_scanner_parser_error (GtkCssParser         *parser,
                               gpointer              user_data)
 {
   GtkCssScanner *scanner = user_data;
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (scanner->provider);
   GtkCssSection *section;
 
+  if (priv->compiler)
+    priv->compiler->failed = TRUE;
+
   section = gtk_css_section_new (gtk_css_parser_get_file (parser),
                                  start,
                                  end);
@@ -348,6 +497,7 @@ gtk_css_scanner_new (GtkCssProvider *provider,
                      GFile          *file,
                      GBytes         *bytes)
 {
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (provider);
   GtkCssScanner *scanner;
 
   scanner = g_slice_new0 (GtkCssScanner);
@@ -356,6 +506,16 @@ gtk_css_scanner_new (GtkCssProvider *provider,
   scanner->provider = provider;
   scanner->parent = parent;
 
+  if (priv->compiler)
+    {
+      CompilerSource source;
+
+      source.file = g_object_ref (file);
+      source.bytes = g_bytes_ref (bytes);
+      scanner->source = priv->compiler->sources->len;
+      g_array_append_val (priv->compiler->sources, source);
+    }
+
   scanner->parser = gtk_css_parser_new_for_bytes (bytes,
                                                   file,
                                                   NULL,
@@ -489,14 +649,19 @@ gtk_css_style_provider_lookup (GtkStyleProvider             *provider,
             {
               GtkCssStyleProperty *prop = ruleset->styles[j].property;
               guint id = _gtk_css_style_property_get_id (prop);
+              GtkCssValue *value;
 
               if (!_gtk_css_lookup_is_missing (lookup, id))
                 continue;
 
+              value = g_atomic_pointer_get (&ruleset->styles[j].value);
+              if (G_UNLIKELY (value == NULL))
+                value = gtk_css_provider_parse_compiled (css_provider, ruleset, j);
+
               _gtk_css_lookup_set (lookup,
                                    id,
                                    ruleset->styles[j].section,
-                                   ruleset->styles[j].value);
+                                   value);
             }
         }
     }
@@ -506,12 +671,25 @@ gtk_css_style_provider_lookup (GtkStyleProvider             *provider,
     *change = gtk_css_selector_tree_get_change_all (priv->tree, filter, node);
 }
 
+/* Parsing values creates and refs values whose reference counts
+ * aren't atomic and may emit errors, so that can't happen in other
+ * threads */
+static gboolean
+gtk_css_style_provider_lookup_is_threadsafe (GtkStyleProvider *provider)
+{
+  GtkCssProvider *css_provider = GTK_CSS_PROVIDER (provider);
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (css_provider);
+
+  return priv->n_unparsed == 0;
+}
+
 static void
 gtk_css_style_provider_iface_init (GtkStyleProviderInterface *iface)
 {
   iface->get_color = gtk_css_style_provider_get_color;
   iface->get_keyframes = gtk_css_style_provider_get_keyframes;
   iface->lookup = gtk_css_style_provider_lookup;
+  iface->lookup_is_threadsafe = gtk_css_style_provider_lookup_is_threadsafe;
   iface->emit_error = gtk_css_style_provider_emit_error;
 }
 
@@ -531,6 +709,9 @@ gtk_css_provider_finalize (GObject *object)
   g_hash_table_destroy (priv->symbolic_colors);
   g_hash_table_destroy (priv->keyframes);
 
+  g_clear_pointer (&priv->compiled, g_mapped_file_unref);
+  g_clear_pointer (&priv->compiled_files, g_ptr_array_unref);
+
   if (priv->resource)
     {
       g_resources_unregister (priv->resource);
@@ -571,6 +752,19 @@ css_provider_commit (GtkCssProvider  *css_provider,
       return;
     }
 
+  if (priv->compiler)
+    {
+      guint first = priv->compiler->declarations->len;
+
+      g_assert (priv->compiler->block->len == ruleset->n_styles);
+      g_array_append_vals (priv->compiler->declarations,
+                           priv->compiler->block->data,
+                           priv->compiler->block->len);
+
+      for (i = 0; i < gtk_css_selectors_get_size (selectors); i++)
+        g_array_append_val (priv->compiler->ruleset_styles, first);
+    }
+
   for (i = 0; i < gtk_css_selectors_get_size (selectors); i++)
     {
       GtkCssRuleset *new;
@@ -609,6 +803,101 @@ gtk_css_provider_reset (GtkCssProvider *css_provider)
   g_array_set_size (priv->rulesets, 0);
   _gtk_css_selector_tree_free (priv->tree);
   priv->tree = NULL;
+
+  g_clear_pointer (&priv->compiled, g_mapped_file_unref);
+  g_clear_pointer (&priv->compiled_files, g_ptr_array_unref);
+  priv->n_unparsed = 0;
+}
+
+static void
+gtk_css_compiler_free (GtkCssCompiler *compiler)
+{
+  guint i;
+
+  for (i = 0; i < compiler->sources->len; i++)
+    {
+      CompilerSource *source = &g_array_index (compiler->sources, CompilerSource, i);
+
+      g_object_unref (source->file);
+      g_bytes_unref (source->bytes);
+    }
+  for (i = 0; i < compiler->colors->len; i++)
+    g_free (g_array_index (compiler->colors, CompilerDefinition, i).name);
+  for (i = 0; i < compiler->keyframes->len; i++)
+    g_free (g_array_index (compiler->keyframes, CompilerDefinition, i).name);
+
+  g_array_unref (compiler->sources);
+  g_array_unref (compiler->block);
+  g_array_unref (compiler->declarations);
+  g_array_unref (compiler->ruleset_styles);
+  g_array_unref (compiler->colors);
+  g_array_unref (compiler->keyframes);
+  g_free (compiler);
+}
+
+static GtkCssCompiler *
+gtk_css_compiler_new (void)
+{
+  GtkCssCompiler *compiler;
+
+  compiler = g_new0 (GtkCssCompiler, 1);
+  compiler->sources = g_array_new (FALSE, FALSE, sizeof (CompilerSource));
+  compiler->block = g_array_new (FALSE, TRUE, sizeof (CompilerDeclaration));
+  compiler->declarations = g_array_new (FALSE, FALSE, sizeof (CompilerDeclaration));
+  compiler->ruleset_styles = g_array_new (FALSE, FALSE, sizeof (guint));
+  compiler->colors = g_array_new (FALSE, FALSE, sizeof (CompilerDefinition));
+  compiler->keyframes = g_array_new (FALSE, FALSE, sizeof (CompilerDefinition));
+
+  return compiler;
+}
+
+static void
+gtk_css_compiler_add_definition (GArray     *definitions,
+                                 const char *name,
+                                 guint       source,
+                                 gsize       start,
+                                 gsize       end)
+{
+  CompilerDefinition definition = { g_strdup (name), source, start, end };
+
+  g_array_append_val (definitions, definition);
+}
+
+static void
+gtk_css_compiler_set_declaration (GtkCssCompiler       *compiler,
+                                  guint                 index,
+                                  GtkCssStyleProperty  *property,
+                                  GtkStyleProperty     *declared,
+                                  guint                 sub,
+                                  guint                 source,
+                                  gsize                 start,
+                                  gsize                 end,
+                                  const GtkCssLocation *section_start,
+                                  const GtkCssLocation *section_end)
+{
+  CompilerDeclaration *declaration;
+
+  if (index >= compiler->block->len)
+    g_array_set_size (compiler->block, index + 1);
+
+  declaration = &g_array_index (compiler->block, CompilerDeclaration, index);
+  declaration->property = property;
+  declaration->declared = declared;
+  declaration->sub = sub;
+  declaration->source = source;
+  declaration->start = start;
+  declaration->end = end;
+  declaration->section_start = *section_start;
+  declaration->section_end = *section_end;
+}
+
+/* Returns the offset of the next token in the source */
+static gsize
+gtk_css_scanner_get_offset (GtkCssScanner *scanner)
+{
+  gtk_css_parser_get_token (scanner->parser);
+
+  return gtk_css_parser_get_start_location (scanner->parser)->bytes;
 }
 
 static gboolean
@@ -688,6 +977,7 @@ parse_color_definition (GtkCssScanner *scanner)
   GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (scanner->provider);
   GtkCssValue *color;
   char *name;
+  gsize start = 0;
 
   if (!gtk_css_parser_try_at_keyword (scanner->parser, "define-color"))
     return FALSE;
@@ -696,6 +986,9 @@ parse_color_definition (GtkCssScanner *scanner)
   if (name == NULL)
     return TRUE;
 
+  if (priv->compiler)
+    start = gtk_css_scanner_get_offset (scanner);
+
   color = _gtk_css_color_value_parse (scanner->parser);
   if (color == NULL)
     {
@@ -712,6 +1005,11 @@ parse_color_definition (GtkCssScanner *scanner)
       return TRUE;
     }
 
+  if (priv->compiler)
+    gtk_css_compiler_add_definition (priv->compiler->colors, name,
+                                     scanner->source, start,
+                                     gtk_css_scanner_get_offset (scanner));
+
   g_hash_table_insert (priv->symbolic_colors, name, color);
 
   return TRUE;
@@ -723,6 +1021,7 @@ parse_keyframes (GtkCssScanner *scanner)
   GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (scanner->provider);
   GtkCssKeyframes *keyframes;
   char *name;
+  gsize start = 0;
 
   if (!gtk_css_parser_try_at_keyword (scanner->parser, "keyframes"))
     return FALSE;
@@ -739,9 +1038,19 @@ parse_keyframes (GtkCssScanner *scanner)
 
   gtk_css_parser_end_block_prelude (scanner->parser);
 
+  if (priv->compiler)
+    start = gtk_css_scanner_get_offset (scanner);
+
   keyframes = _gtk_css_keyframes_parse (scanner->parser);
   if (keyframes != NULL)
-    g_hash_table_insert (priv->keyframes, name, keyframes);
+    {
+      if (priv->compiler)
+        gtk_css_compiler_add_definition (priv->compiler->keyframes, name,
+                                         scanner->source, start,
+                                         gtk_css_scanner_get_offset (scanner));
+
+      g_hash_table_insert (priv->keyframes, name, keyframes);
+    }
 
   if (!gtk_css_parser_has_token (scanner->parser, GTK_CSS_TOKEN_EOF))
     gtk_css_parser_error_syntax (scanner->parser, "Expected '}' after declarations");
@@ -788,6 +1097,7 @@ static void
 parse_declaration (GtkCssScanner *scanner,
                    GtkCssRuleset *ruleset)
 {
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (scanner->provider);
   GtkStyleProperty *property;
   char *name;
 
@@ -812,6 +1122,7 @@ parse_declaration (GtkCssScanner *scanner,
     {
       GtkCssSection *section;
       GtkCssValue *value;
+      gsize start = 0, end = 0;
 
       if (!gtk_css_parser_try_token (scanner->parser, GTK_CSS_TOKEN_COLON))
         {
@@ -819,6 +1130,9 @@ parse_declaration (GtkCssScanner *scanner,
           goto out;
         }
 
+      if (priv->compiler)
+        start = gtk_css_scanner_get_offset (scanner);
+
       value = _gtk_style_property_parse_value (property, scanner->parser);
 
       if (value == NULL)
@@ -830,6 +1144,9 @@ parse_declaration (GtkCssScanner *scanner,
           goto out;
         }
 
+      if (priv->compiler)
+        end = gtk_css_scanner_get_offset (scanner);
+
       if (gtk_keep_css_sections)
         {
           section = gtk_css_section_new (gtk_css_parser_get_file (scanner->parser),
@@ -848,16 +1165,31 @@ parse_declaration (GtkCssScanner *scanner,
             {
               GtkCssStyleProperty *child = _gtk_css_shorthand_property_get_subproperty (shorthand, i);
               GtkCssValue *sub = _gtk_css_array_value_get_nth (value, i);
-              
-              gtk_css_ruleset_add (ruleset, child, _gtk_css_value_ref (sub), section);
+              guint index;
+
+              index = gtk_css_ruleset_add (ruleset, child, _gtk_css_value_ref (sub), section);
+
+              if (priv->compiler)
+                gtk_css_compiler_set_declaration (priv->compiler, index, child, property, i,
+                                                  scanner->source, start, end,
+                                                  gtk_css_parser_get_block_location (scanner->parser),
+                                                  gtk_css_parser_get_end_location (scanner->parser));
             }
           
             _gtk_css_value_unref (value);
         }
       else if (GTK_IS_CSS_STYLE_PROPERTY (property))
         {
+          guint index;
+
+          index = gtk_css_ruleset_add (ruleset, GTK_CSS_STYLE_PROPERTY (property), value, section);
 
-          gtk_css_ruleset_add (ruleset, GTK_CSS_STYLE_PROPERTY (property), value, section);
+          if (priv->compiler)
+            gtk_css_compiler_set_declaration (priv->compiler, index,
+                                              GTK_CSS_STYLE_PROPERTY (property), property, 0,
+                                              scanner->source, start, end,
+                                              gtk_css_parser_get_block_location (scanner->parser),
+                                              gtk_css_parser_get_end_location (scanner->parser));
         }
       else
         {
@@ -891,11 +1223,15 @@ parse_declarations (GtkCssScanner *scanner,
 static void
 parse_ruleset (GtkCssScanner *scanner)
 {
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (scanner->provider);
   GtkCssSelectors selectors;
   GtkCssRuleset ruleset = { 0, };
 
   gtk_css_selectors_init (&selectors);
 
+  if (priv->compiler)
+    g_array_set_size (priv->compiler->block, 0);
+
   parse_selector_list (scanner, &selectors);
   if (gtk_css_selectors_get_size (&selectors) == 0)
     {
@@ -937,8 +1273,11 @@ parse_statement (GtkCssScanner *scanner)
     parse_ruleset (scanner);
 }
 
-static void
-parse_stylesheet (GtkCssScanner *scanner)
+/* Parses statements until the end of the stylesheet or until the
+ * monotonic time passed @deadline. Returns %TRUE at the end. */
+static gboolean
+parse_stylesheet_until (GtkCssScanner *scanner,
+                        gint64         deadline)
 {
   while (!gtk_css_parser_has_token (scanner->parser, GTK_CSS_TOKEN_EOF))
     {
@@ -950,7 +1289,18 @@ parse_stylesheet (GtkCssScanner *scanner)
         }
 
       parse_statement (scanner);
+
+      if (deadline < G_MAXINT64 && g_get_monotonic_time () >= deadline)
+        return gtk_css_parser_has_token (scanner->parser, GTK_CSS_TOKEN_EOF);
     }
+
+  return TRUE;
+}
+
+static void
+parse_stylesheet (GtkCssScanner *scanner)
+{
+  parse_stylesheet_until (scanner, G_MAXINT64);
 }
 
 static int
@@ -1011,154 +1361,1424 @@ gtk_css_provider_postprocess (GtkCssProvider *css_provider)
   gdk_profiler_end_mark (before, "create selector tree", NULL);
 }
 
-static void
-gtk_css_provider_load_internal (GtkCssProvider *self,
-                                GtkCssScanner  *parent,
-                                GFile          *file,
-                                GBytes         *bytes)
+static gboolean
+gtk_css_provider_should_compile (void)
 {
-  gint64 before G_GNUC_UNUSED;
-
-  before = GDK_PROFILER_CURRENT_TIME;
+  static int compile = -1;
 
-  if (bytes == NULL)
+  if (compile < 0)
     {
-      GError *load_error = NULL;
-
-      bytes = g_file_load_bytes (file, NULL, NULL, &load_error);
-
-      if (bytes == NULL)
-        {
-          if (parent == NULL)
-            {
-              GtkCssLocation empty = { 0, };
-              GtkCssSection *section = gtk_css_section_new (file, &empty, &empty);
+      const char *env = g_getenv ("GTK_CSS_CACHE");
 
-              gtk_css_style_provider_emit_error (GTK_STYLE_PROVIDER (self), section, load_error);
-              gtk_css_section_unref (section);
-            }
-          else
-            {
-              gtk_css_parser_error (parent->parser, 
-                                    GTK_CSS_PARSER_ERROR_IMPORT,
-                                    gtk_css_parser_get_block_location (parent->parser),
-                                    gtk_css_parser_get_end_location (parent->parser),
-                                    "Failed to import: %s",
-                                    load_error->message);
-            }
-        }
+      compile = env != NULL && env[0] != '\0' && strcmp (env, "0") != 0;
     }
 
-  if (bytes)
-    {
-      GtkCssScanner *scanner;
+  return compile;
+}
 
-      scanner = gtk_css_scanner_new (self,
-                                     parent,
-                                     file,
-                                     bytes);
+static char *
+gtk_css_provider_get_compiled_path (GFile *file)
+{
+  char *uri, *key, *checksum, *basename, *path;
+
+  uri = g_file_get_uri (file);
+  key = g_strdup_printf ("%d.%d.%d %s",
+                         GTK_MAJOR_VERSION, GTK_MINOR_VERSION, GTK_MICRO_VERSION,
+                         uri);
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+  basename = g_strconcat (checksum, ".compiled", NULL);
+  path = g_build_filename (g_get_user_cache_dir (), "gtk-4.0", "css", basename, NULL);
+
+  g_free (basename);
+  g_free (checksum);
+  g_free (key);
+  g_free (uri);
 
-      parse_stylesheet (scanner);
+  return path;
+}
 
-      gtk_css_scanner_destroy (scanner);
+static guint32
+add_string (GString    *strings,
+            const char *str,
+            gssize      len)
+{
+  guint32 offset = strings->len;
 
-      if (parent == NULL)
-        gtk_css_provider_postprocess (self);
+  if (len < 0)
+    len = strlen (str);
 
-      g_bytes_unref (bytes);
-    }
+  g_string_append_len (strings, str, len);
+  g_string_append_c (strings, '\0');
 
-  if (GDK_PROFILER_IS_RUNNING)
-    {
-      char *uri = g_file_get_uri (file);
-      gdk_profiler_end_mark (before, "theme load", uri);
-      g_free (uri);
-    }
+  return offset;
 }
 
-/**
- * gtk_css_provider_load_from_data:
- * @css_provider: a #GtkCssProvider
- * @data: (array length=length) (element-type guint8): CSS data loaded in memory
- * @length: the length of @data in bytes, or -1 for NUL terminated strings. If
- *   @length is not -1, the code will assume it is not NUL terminated and will
- *   potentially do a copy.
- *
- * Loads @data into @css_provider, and by doing so clears any previously loaded
- * information.
- **/
-void
-gtk_css_provider_load_from_data (GtkCssProvider  *css_provider,
-                                 const char      *data,
-                                 gssize           length)
+static guint32
+add_source_text (GString        *strings,
+                 GtkCssCompiler *compiler,
+                 guint           source,
+                 gsize           start,
+                 gsize           end)
 {
-  GBytes *bytes;
+  GBytes *bytes = g_array_index (compiler->sources, CompilerSource, source).bytes;
+  const char *data = g_bytes_get_data (bytes, NULL);
 
-  g_return_if_fail (GTK_IS_CSS_PROVIDER (css_provider));
-  g_return_if_fail (data != NULL);
+  g_assert (start <= end && end <= g_bytes_get_size (bytes));
 
-  if (length < 0)
-    length = strlen (data);
+  return add_string (strings, data + start, end - start);
+}
 
-  bytes = g_bytes_new_static (data, length);
+static void
+compile_location (CompiledLocation     *compiled,
+                  const GtkCssLocation *location)
+{
+  compiled->bytes = location->bytes;
+  compiled->chars = location->chars;
+  compiled->lines = location->lines;
+  compiled->line_bytes = location->line_bytes;
+  compiled->line_chars = location->line_chars;
+}
 
-  gtk_css_provider_reset (css_provider);
+static void
+add_definitions (GArray         *compiled,
+                 GString        *strings,
+                 GtkCssCompiler *compiler,
+                 GArray         *definitions)
+{
+  guint i;
 
-  g_bytes_ref (bytes);
-  gtk_css_provider_load_internal (css_provider, NULL, NULL, bytes);
-  g_bytes_unref (bytes);
+  for (i = 0; i < definitions->len; i++)
+    {
+      const CompilerDefinition *definition = &g_array_index (definitions, CompilerDefinition, i);
+      CompiledDefinition d;
 
-  gtk_style_provider_changed (GTK_STYLE_PROVIDER (css_provider));
+      d.name = add_string (strings, definition->name, -1);
+      d.text = add_source_text (strings, compiler, definition->source, definition->start, definition->end);
+      d.source = definition->source;
+      g_array_append_val (compiled, d);
+    }
 }
 
-/**
- * gtk_css_provider_load_from_file:
- * @css_provider: a #GtkCssProvider
- * @file: #GFile pointing to a file to load
- *
- * Loads the data contained in @file into @css_provider, making it
- * clear any previously loaded information.
- **/
-void
-gtk_css_provider_load_from_file (GtkCssProvider  *css_provider,
-                                 GFile           *file)
+/* Must be called before the selectors are freed by
+ * gtk_css_provider_postprocess() */
+static void
+gtk_css_provider_write_compiled (GtkCssProvider *self,
+                                 GFile          *file)
 {
-  g_return_if_fail (GTK_IS_CSS_PROVIDER (css_provider));
-  g_return_if_fail (G_IS_FILE (file));
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (self);
+  GtkCssCompiler *compiler = priv->compiler;
+  CompiledHeader header = { COMPILED_MAGIC, COMPILED_VERSION, };
+  GArray *sources, *colors, *keyframes, *declarations, *rulesets;
+  GHashTable *texts;
+  GString *strings, *contents;
+  char *path, *dir;
+  guint i;
 
-  gtk_css_provider_reset (css_provider);
+  if (compiler->sources->len > G_MAXUINT16)
+    return;
 
-  gtk_css_provider_load_internal (css_provider, NULL, file, NULL);
+  g_assert (compiler->ruleset_styles->len == priv->rulesets->len);
 
-  gtk_style_provider_changed (GTK_STYLE_PROVIDER (css_provider));
-}
+  strings = g_string_new (NULL);
+  sources = g_array_new (FALSE, FALSE, sizeof (CompiledSource));
+  colors = g_array_new (FALSE, FALSE, sizeof (CompiledDefinition));
+  keyframes = g_array_new (FALSE, FALSE, sizeof (CompiledDefinition));
+  declarations = g_array_new (FALSE, FALSE, sizeof (CompiledDeclaration));
+  rulesets = g_array_new (FALSE, FALSE, sizeof (CompiledRuleset));
 
-/**
- * gtk_css_provider_load_from_path:
- * @css_provider: a #GtkCssProvider
- * @path: the path of a filename to load, in the GLib filename encoding
- *
- * Loads the data contained in @path into @css_provider, making it clear
- * any previously loaded information.
- **/
-void
-gtk_css_provider_load_from_path (GtkCssProvider  *css_provider,
-                                 const char      *path)
-{
-  GFile *file;
+  for (i = 0; i < compiler->sources->len; i++)
+    {
+      const CompilerSource *source = &g_array_index (compiler->sources, CompilerSource, i);
+      CompiledSource s;
+      char *uri, *checksum;
+
+      uri = g_file_get_uri (source->file);
+      checksum = g_compute_checksum_for_bytes (G_CHECKSUM_SHA1, source->bytes);
+      s.uri = add_string (strings, uri, -1);
+      s.checksum = add_string (strings, checksum, -1);
+      g_array_append_val (sources, s);
+      g_free (checksum);
+      g_free (uri);
+    }
 
-  g_return_if_fail (GTK_IS_CSS_PROVIDER (css_provider));
-  g_return_if_fail (path != NULL);
+  add_definitions (colors, strings, compiler, compiler->colors);
+  add_definitions (keyframes, strings, compiler, compiler->keyframes);
 
-  file = g_file_new_for_path (path);
-  
-  gtk_css_provider_load_from_file (css_provider, file);
+  /* The subproperties of a shorthand share its text, so
+   * gtk_css_provider_parse_compiled() can set them all at once */
+  texts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+  for (i = 0; i < compiler->declarations->len; i++)
+    {
+      const CompilerDeclaration *declaration = &g_array_index (compiler->declarations, CompilerDeclaration, i);
+      CompiledDeclaration d;
+      gpointer text;
+      char *key;
+
+      d.property = add_string (strings, _gtk_style_property_get_name (GTK_STYLE_PROPERTY (declaration->property)), -1);
+      d.declared = add_string (strings, _gtk_style_property_get_name (declaration->declared), -1);
+      key = g_strdup_printf ("%u %" G_GSIZE_FORMAT " %" G_GSIZE_FORMAT,
+                             declaration->source, declaration->start, declaration->end);
+      if (g_hash_table_lookup_extended (texts, key, NULL, &text))
+        {
+          d.text = GPOINTER_TO_UINT (text);
+          g_free (key);
+        }
+      else
+        {
+          d.text = add_source_text (strings, compiler, declaration->source, declaration->start, declaration->end);
+          g_hash_table_insert (texts, key, GUINT_TO_POINTER (d.text));
+        }
+      d.source = declaration->source;
+      d.sub = declaration->sub;
+      compile_location (&d.start, &declaration->section_start);
+      compile_location (&d.end, &declaration->section_end);
+      g_array_append_val (declarations, d);
+    }
+  g_hash_table_unref (texts);
 
-  g_object_unref (file);
-}
+  for (i = 0; i < priv->rulesets->len; i++)
+    {
+      const GtkCssRuleset *ruleset = &g_array_index (priv->rulesets, GtkCssRuleset, i);
+      CompiledRuleset r;
+      char *selector;
+
+      selector = _gtk_css_selector_to_string (ruleset->selector);
+      r.selector = add_string (strings, selector, -1);
+      r.first_declaration = g_array_index (compiler->ruleset_styles, guint, i);
+      r.n_declarations = ruleset->n_styles;
+      g_array_append_val (rulesets, r);
+      g_free (selector);
+    }
 
-/**
- * gtk_css_provider_load_from_resource:
+  header.n_sources = sources->len;
+  header.n_colors = colors->len;
+  header.n_keyframes = keyframes->len;
+  header.n_declarations = declarations->len;
+  header.n_rulesets = rulesets->len;
+  header.strings_size = strings->len;
+
+  contents = g_string_new (NULL);
+  g_string_append_len (contents, (const char *) &header, sizeof (header));
+  g_string_append_len (contents, sources->data, sources->len * sizeof (CompiledSource));
+  g_string_append_len (contents, colors->data, colors->len * sizeof (CompiledDefinition));
+  g_string_append_len (contents, keyframes->data, keyframes->len * sizeof (CompiledDefinition));
+  g_string_append_len (contents, declarations->data, declarations->len * sizeof (CompiledDeclaration));
+  g_string_append_len (contents, rulesets->data, rulesets->len * sizeof (CompiledRuleset));
+  g_string_append_len (contents, strings->str, strings->len);
+
+  path = gtk_css_provider_get_compiled_path (file);
+  dir = g_path_get_dirname (path);
+
+  if (g_mkdir_with_parents (dir, 0700) == 0)
+    g_file_set_contents (path, contents->str, contents->len, NULL);
+
+  g_free (dir);
+  g_free (path);
+  g_string_free (contents, TRUE);
+  g_string_free (strings, TRUE);
+  g_array_unref (sources);
+  g_array_unref (colors);
+  g_array_unref (keyframes);
+  g_array_unref (declarations);
+  g_array_unref (rulesets);
+}
+
+static void
+gtk_css_provider_compiled_error (GtkCssParser         *parser,
+                                 const GtkCssLocation *start,
+                                 const GtkCssLocation *end,
+                                 const GError         *error,
+                                 gpointer              user_data)
+{
+  gboolean *failed = user_data;
+
+  *failed = TRUE;
+}
+
+static GtkCssParser *
+gtk_css_provider_new_compiled_parser (const char            *text,
+                                      GFile                 *file,
+                                      GtkCssParserErrorFunc  error_func,
+                                      gpointer               user_data)
+{
+  GtkCssParser *parser;
+  GBytes *bytes;
+
+  /* The parser has to be freed before the mapped file */
+  bytes = g_bytes_new_static (text, strlen (text));
+  parser = gtk_css_parser_new_for_bytes (bytes, file, NULL, error_func, user_data, NULL);
+  g_bytes_unref (bytes);
+
+  return parser;
+}
+
+static const char *
+get_compiled_string (const char *strings,
+                     guint32     strings_size,
+                     guint32     offset)
+{
+  /* The string table ends with a nul byte */
+  if (offset >= strings_size)
+    return NULL;
+
+  return strings + offset;
+}
+
+static gboolean
+compiled_declaration_is_valid (const CompiledDeclaration *declaration,
+                               const char                *strings,
+                               guint32                    strings_size,
+                               guint                      n_sources)
+{
+  const char *property_name, *declared_name;
+  GtkStyleProperty *property, *declared;
+
+  property_name = get_compiled_string (strings, strings_size, declaration->property);
+  declared_name = get_compiled_string (strings, strings_size, declaration->declared);
+  if (property_name == NULL || declared_name == NULL ||
+      get_compiled_string (strings, strings_size, declaration->text) == NULL ||
+      declaration->source >= n_sources)
+    return FALSE;
+
+  property = _gtk_style_property_lookup (property_name);
+  declared = _gtk_style_property_lookup (declared_name);
+  if (!GTK_IS_CSS_STYLE_PROPERTY (property) || declared == NULL)
+    return FALSE;
+
+  if (GTK_IS_CSS_SHORTHAND_PROPERTY (declared))
+    {
+      GtkCssShorthandProperty *shorthand = GTK_CSS_SHORTHAND_PROPERTY (declared);
+
+      return declaration->sub < _gtk_css_shorthand_property_get_n_subproperties (shorthand) &&
+             _gtk_css_shorthand_property_get_subproperty (shorthand, declaration->sub) == GTK_CSS_STYLE_PROPERTY (property);
+    }
+
+  return declared == property && declaration->sub == 0;
+}
+
+static void
+load_location (GtkCssLocation         *location,
+               const CompiledLocation *compiled)
+{
+  location->bytes = compiled->bytes;
+  location->chars = compiled->chars;
+  location->lines = compiled->lines;
+  location->line_bytes = compiled->line_bytes;
+  location->line_chars = compiled->line_chars;
+}
+
+static gboolean
+gtk_css_provider_load_compiled (GtkCssProvider *self,
+                                GFile          *file)
+{
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (self);
+  const CompiledHeader *header;
+  const CompiledSource *sources;
+  const CompiledDefinition *colors, *keyframes;
+  const CompiledDeclaration *declarations;
+  const CompiledRuleset *rulesets;
+  GMappedFile *mapped;
+  GPtrArray *files;
+  const char *contents, *strings;
+  gsize size, records_size;
+  gboolean failed = FALSE;
+  gint64 before G_GNUC_UNUSED;
+  char *path;
+  guint i, j;
+
+  before = GDK_PROFILER_CURRENT_TIME;
+
+  path = gtk_css_provider_get_compiled_path (file);
+  mapped = g_mapped_file_new (path, FALSE, NULL);
+  g_free (path);
+  if (mapped == NULL)
+    return FALSE;
+
+  contents = g_mapped_file_get_contents (mapped);
+  size = g_mapped_file_get_length (mapped);
+  header = (const CompiledHeader *) contents;
+
+  if (size < sizeof (CompiledHeader) ||
+      memcmp (header->magic, COMPILED_MAGIC, sizeof (header->magic)) != 0 ||
+      header->version != COMPILED_VERSION ||
+      header->n_sources > size ||
+      header->n_colors > size ||
+      header->n_keyframes > size ||
+      header->n_declarations > size ||
+      header->n_rulesets > size ||
+      header->strings_size == 0)
+    {
+      g_mapped_file_unref (mapped);
+      return FALSE;
+    }
+
+  records_size = (gsize) header->n_sources * sizeof (CompiledSource) +
+                 ((gsize) header->n_colors + header->n_keyframes) * sizeof (CompiledDefinition) +
+                 (gsize) header->n_declarations * sizeof (CompiledDeclaration) +
+                 (gsize) header->n_rulesets * sizeof (CompiledRuleset);
+
+  if (size != sizeof (CompiledHeader) + records_size + header->strings_size ||
+      contents[size - 1] != '\0')
+    {
+      g_mapped_file_unref (mapped);
+      return FALSE;
+    }
+
+  sources = (const CompiledSource *) (contents + sizeof (CompiledHeader));
+  colors = (const CompiledDefinition *) (sources + header->n_sources);
+  keyframes = colors + header->n_colors;
+  declarations = (const CompiledDeclaration *) (keyframes + header->n_keyframes);
+  rulesets = (const CompiledRuleset *) (declarations + header->n_declarations);
+  strings = (const char *) (rulesets + header->n_rulesets);
+
+  /* Check that the stylesheets are unchanged */
+  files = g_ptr_array_new_with_free_func (g_object_unref);
+  for (i = 0; i < header->n_sources && !failed; i++)
+    {
+      const char *uri = get_compiled_string (strings, header->strings_size, sources[i].uri);
+      const char *checksum = get_compiled_string (strings, header->strings_size, sources[i].checksum);
+      GFile *source;
+      GBytes *bytes;
+      char *actual;
+
+      if (uri == NULL || checksum == NULL)
+        {
+          failed = TRUE;
+          break;
+        }
+
+      source = g_file_new_for_uri (uri);
+      g_ptr_array_add (files, source);
+
+      bytes = g_file_load_bytes (source, NULL, NULL, NULL);
+      if (bytes == NULL)
+        {
+          failed = TRUE;
+          break;
+        }
+
+      actual = g_compute_checksum_for_bytes (G_CHECKSUM_SHA1, bytes);
+      failed = strcmp (actual, checksum) != 0;
+      g_free (actual);
+      g_bytes_unref (bytes);
+    }
+
+  for (i = 0; i < header->n_colors && !failed; i++)
+    {
+      const char *name = get_compiled_string (strings, header->strings_size, colors[i].name);
+      const char *text = get_compiled_string (strings, header->strings_size, colors[i].text);
+      GtkCssParser *parser;
+      GtkCssValue *color;
+
+      if (name == NULL || text == NULL || colors[i].source >= header->n_sources)
+        {
+          failed = TRUE;
+          break;
+        }
+
+      parser = gtk_css_provider_new_compiled_parser (text, g_ptr_array_index (files, colors[i].source),
+                                                     gtk_css_provider_compiled_error, &failed);
+      color = _gtk_css_color_value_parse (parser);
+      gtk_css_parser_unref (parser);
+
+      if (color == NULL)
+        failed = TRUE;
+      else
+        g_hash_table_insert (priv->symbolic_colors, g_strdup (name), color);
+    }
+
+  for (i = 0; i < header->n_keyframes && !failed; i++)
+    {
+      const char *name = get_compiled_string (strings, header->strings_size, keyframes[i].name);
+      const char *text = get_compiled_string (strings, header->strings_size, keyframes[i].text);
+      GtkCssParser *parser;
+      GtkCssKeyframes *parsed;
+
+      if (name == NULL || text == NULL || keyframes[i].source >= header->n_sources)
+        {
+          failed = TRUE;
+          break;
+        }
+
+      parser = gtk_css_provider_new_compiled_parser (text, g_ptr_array_index (files, keyframes[i].source),
+                                                     gtk_css_provider_compiled_error, &failed);
+      parsed = _gtk_css_keyframes_parse (parser);
+      gtk_css_parser_unref (parser);
+
+      if (parsed == NULL)
+        failed = TRUE;
+      else
+        g_hash_table_insert (priv->keyframes, g_strdup (name), parsed);
+    }
+
+  for (i = 0; i < header->n_rulesets && !failed; i++)
+    {
+      const CompiledRuleset *compiled = &rulesets[i];
+      const char *text = get_compiled_string (strings, header->strings_size, compiled->selector);
+      GtkCssRuleset *ruleset;
+      GtkCssParser *parser;
+      GtkCssSelector *selector;
+
+      if (text == NULL ||
+          compiled->n_declarations == 0 ||
+          compiled->first_declaration > header->n_declarations ||
+          compiled->n_declarations > header->n_declarations - compiled->first_declaration)
+        {
+          failed = TRUE;
+          break;
+        }
+
+      parser = gtk_css_provider_new_compiled_parser (text, NULL,
+                                                     gtk_css_provider_compiled_error, &failed);
+      selector = _gtk_css_selector_parse (parser);
+      gtk_css_parser_unref (parser);
+
+      if (selector == NULL)
+        {
+          failed = TRUE;
+          break;
+        }
+
+      g_array_set_size (priv->rulesets, priv->rulesets->len + 1);
+      ruleset = &g_array_index (priv->rulesets, GtkCssRuleset, priv->rulesets->len - 1);
+      memset (ruleset, 0, sizeof (GtkCssRuleset));
+      ruleset->selector = selector;
+
+      /* Rulesets with several selectors share their styles */
+      if (i > 0 &&
+          rulesets[i - 1].first_declaration == compiled->first_declaration &&
+          rulesets[i - 1].n_declarations == compiled->n_declarations)
+        {
+          const GtkCssRuleset *previous = ruleset - 1;
+
+          ruleset->styles = previous->styles;
+          ruleset->n_styles = previous->n_styles;
+          continue;
+        }
+
+      ruleset->styles = g_new0 (PropertyValue, compiled->n_declarations);
+      ruleset->n_styles = compiled->n_declarations;
+      ruleset->owns_styles = TRUE;
+
+      for (j = 0; j < compiled->n_declarations; j++)
+        {
+          const CompiledDeclaration *declaration = &declarations[compiled->first_declaration + j];
+
+          if (!compiled_declaration_is_valid (declaration, strings, header->strings_size, header->n_sources))
+            {
+              failed = TRUE;
+              break;
+            }
+
+          ruleset->styles[j].property = GTK_CSS_STYLE_PROPERTY (_gtk_style_property_lookup (strings + declaration->property));
+          ruleset->styles[j].compiled = declaration;
+          if (gtk_keep_css_sections)
+            {
+              GtkCssLocation start, end;
+
+              load_location (&start, &declaration->start);
+              load_location (&end, &declaration->end);
+              ruleset->styles[j].section = gtk_css_section_new (g_ptr_array_index (files, declaration->source),
+                                                                &start, &end);
+            }
+          priv->n_unparsed++;
+        }
+    }
+
+  if (failed)
+    {
+      gtk_css_provider_reset (self);
+      g_ptr_array_unref (files);
+      g_mapped_file_unref (mapped);
+      return FALSE;
+    }
+
+  priv->compiled = mapped;
+  priv->compiled_files = files;
+
+  gtk_css_provider_postprocess (self);
+
+  if (GDK_PROFILER_IS_RUNNING)
+    {
+      char *uri = g_file_get_uri (file);
+      gdk_profiler_end_mark (before, "compiled theme load", uri);
+      g_free (uri);
+    }
+
+  return TRUE;
+}
+
+static void
+gtk_css_provider_value_error (GtkCssParser         *parser,
+                              const GtkCssLocation *start,
+                              const GtkCssLocation *end,
+                              const GError         *error,
+                              gpointer              user_data)
+{
+  GtkCssProvider *self = user_data;
+  GtkCssSection *section;
+
+  section = gtk_css_section_new (gtk_css_parser_get_file (parser), start, end);
+  gtk_css_style_provider_emit_error (GTK_STYLE_PROVIDER (self), section, error);
+  gtk_css_section_unref (section);
+}
+
+/* Parses the value of a style of a compiled provider. Shorthands
+ * set the values of all the styles they declared at once.
+ *
+ * This must only happen on the main thread: lookups run in worker
+ * threads only once all values are parsed, see
+ * gtk_css_style_provider_lookup_is_threadsafe(). */
+static GtkCssValue *
+gtk_css_provider_parse_compiled (GtkCssProvider *self,
+                                 GtkCssRuleset  *ruleset,
+                                 guint           index)
+{
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (self);
+  const CompiledDeclaration *compiled = ruleset->styles[index].compiled;
+  const CompiledHeader *header = (const CompiledHeader *) g_mapped_file_get_contents (priv->compiled);
+  const char *strings;
+  GtkStyleProperty *declared;
+  GtkCssParser *parser;
+  GtkCssValue *value;
+  guint i;
+
+  g_assert (compiled != NULL);
+
+  if (ruleset->styles[index].value != NULL)
+    goto out;
+
+  strings = (const char *) header + g_mapped_file_get_length (priv->compiled) - header->strings_size;
+  declared = _gtk_style_property_lookup (strings + compiled->declared);
+
+  parser = gtk_css_provider_new_compiled_parser (strings + compiled->text,
+                                                 g_ptr_array_index (priv->compiled_files, compiled->source),
+                                                 gtk_css_provider_value_error, self);
+  value = _gtk_style_property_parse_value (declared, parser);
+  gtk_css_parser_unref (parser);
+
+  if (!GTK_IS_CSS_SHORTHAND_PROPERTY (declared))
+    {
+      g_atomic_pointer_set (&ruleset->styles[index].value,
+                            value ? value : _gtk_css_initial_value_new ());
+      priv->n_unparsed--;
+      goto out;
+    }
+
+  for (i = 0; i < ruleset->n_styles; i++)
+    {
+      PropertyValue *style = &ruleset->styles[i];
+
+      if (style->value != NULL ||
+          style->compiled == NULL ||
+          style->compiled->text != compiled->text)
+        continue;
+
+      if (value)
+        g_atomic_pointer_set (&style->value,
+                              _gtk_css_value_ref (_gtk_css_array_value_get_nth (value, style->compiled->sub)));
+      else
+        g_atomic_pointer_set (&style->value, _gtk_css_initial_value_new ());
+      priv->n_unparsed--;
+    }
+
+  g_clear_pointer (&value, _gtk_css_value_unref);
+
+out:
+  return ruleset->styles[index].value;
+}
+
+static void
+gtk_css_provider_load_internal (GtkCssProvider *self,
+                                GtkCssScanner  *parent,
+                                GFile          *file,
+                                GBytes         *bytes)
+{
+  gint64 before G_GNUC_UNUSED;
+
+  before = GDK_PROFILER_CURRENT_TIME;
+
+  if (bytes == NULL)
+    {
+      GError *load_error = NULL;
+
+      bytes = g_file_load_bytes (file, NULL, NULL, &load_error);
+
+      if (bytes == NULL)
+        {
+          if (parent == NULL)
+            {
+              GtkCssLocation empty = { 0, };
+              GtkCssSection *section = gtk_css_section_new (file, &empty, &empty);
+
+              gtk_css_style_provider_emit_error (GTK_STYLE_PROVIDER (self), section, load_error);
+              gtk_css_section_unref (section);
+            }
+          else
+            {
+              gtk_css_parser_error (parent->parser, 
+                                    GTK_CSS_PARSER_ERROR_IMPORT,
+                                    gtk_css_parser_get_block_location (parent->parser),
+                                    gtk_css_parser_get_end_location (parent->parser),
+                                    "Failed to import: %s",
+                                    load_error->message);
+            }
+        }
+    }
+
+  if (bytes)
+    {
+      GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (self);
+      GtkCssScanner *scanner;
+
+      if (parent == NULL && file != NULL && gtk_css_provider_should_compile ())
+        priv->compiler = gtk_css_compiler_new ();
+
+      scanner = gtk_css_scanner_new (self,
+                                     parent,
+                                     file,
+                                     bytes);
+
+      parse_stylesheet (scanner);
+
+      gtk_css_scanner_destroy (scanner);
+
+      if (parent == NULL)
+        {
+          if (priv->compiler)
+            {
+              if (!priv->compiler->failed)
+                gtk_css_provider_write_compiled (self, file);
+              g_clear_pointer (&priv->compiler, gtk_css_compiler_free);
+            }
+
+          gtk_css_provider_postprocess (self);
+        }
+
+      g_bytes_unref (bytes);
+    }
+
+  if (GDK_PROFILER_IS_RUNNING)
+    {
+      char *uri = g_file_get_uri (file);
+      gdk_profiler_end_mark (before, "theme load", uri);
+      g_free (uri);
+    }
+}
+
+/* Incremental changes
+ *
+ * When a provider is loaded again, most of its rulesets are often the
+ * same as before, like when editing a theme live. So before the old
+ * stylesheet is dropped, we remember how its rulesets print. After
+ * loading, the rulesets that are only in one of the stylesheets are
+ * the ones that changed, and a selector tree of just those goes along
+ * with the change, see gtk_style_provider_changed_rules(). Only the
+ * nodes that these selectors could apply to get restyled.
+ *
+ * The order of rulesets with the same specificity decides which one
+ * wins, so rulesets that are in both stylesheets but moved relative to
+ * each other count as changed, too.
+ *
+ * Values of compiled providers that haven't been parsed yet are
+ * printed as their source text, so the diff doesn't parse them.
+ *
+ * Colors and keyframes can be used by any rule, so if those differ,
+ * or if a big part of the rulesets changed, everything gets restyled.
+ */
+
+/* More changed rulesets than 1 in this many restyle everything */
+#define MAX_CHANGED_RULESETS_FRACTION 4
+
+typedef struct
+{
+  GPtrArray *rulesets; /* printed rulesets, in order */
+  char *definitions; /* printed colors and keyframes */
+} StylesheetContents;
+
+static char *
+gtk_css_provider_print_definitions (GtkCssProvider *self)
+{
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (self);
+  GString *str;
+
+  str = g_string_new ("");
+  gtk_css_provider_print_colors (priv->symbolic_colors, str);
+  gtk_css_provider_print_keyframes (priv->keyframes, str);
+
+  return g_string_free (str, FALSE);
+}
+
+static char *
+gtk_css_provider_print_ruleset (GtkCssProvider *self,
+                                GtkCssRuleset  *ruleset)
+{
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (self);
+  const char *strings = NULL;
+  GString *str;
+  guint i;
+
+  if (priv->compiled)
+    {
+      const CompiledHeader *header = (const CompiledHeader *) g_mapped_file_get_contents (priv->compiled);
+
+      strings = (const char *) header + g_mapped_file_get_length (priv->compiled) - header->strings_size;
+    }
+
+  str = g_string_new ("");
+  _gtk_css_selector_tree_match_print (ruleset->selector_match, str);
+  g_string_append (str, " {\n");
+
+  for (i = 0; i < ruleset->n_styles; i++)
+    {
+      PropertyValue *prop = &ruleset->styles[i];
+
+      g_string_append (str, "  ");
+      g_string_append (str, _gtk_style_property_get_name (GTK_STYLE_PROPERTY (prop->property)));
+      g_string_append (str, ": ");
+      if (prop->compiled)
+        {
+          /* Can't be confused with a printed value */
+          g_string_append_printf (str, "compiled(%s %u) %s",
+                                  strings + prop->compiled->declared,
+                                  prop->compiled->sub,
+                                  strings + prop->compiled->text);
+        }
+      else
+        {
+          _gtk_css_value_print (prop->value, str);
+        }
+      g_string_append (str, ";\n");
+    }
+
+  g_string_append (str, "}\n");
+
+  return g_string_free (str, FALSE);
+}
+
+static void
+stylesheet_contents_free (StylesheetContents *contents)
+{
+  g_ptr_array_unref (contents->rulesets);
+  g_free (contents->definitions);
+  g_free (contents);
+}
+
+/* Returns %NULL if there is nothing to compare to */
+static StylesheetContents *
+stylesheet_contents_new (GtkCssProvider *self)
+{
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (self);
+  StylesheetContents *contents;
+  guint i;
+
+  /* The sections of unchanged rulesets may have moved */
+  if (priv->rulesets->len == 0 || gtk_keep_css_sections)
+    return NULL;
+
+  contents = g_new (StylesheetContents, 1);
+  contents->rulesets = g_ptr_array_new_full (priv->rulesets->len, g_free);
+  contents->definitions = gtk_css_provider_print_definitions (self);
+
+  for (i = 0; i < priv->rulesets->len; i++)
+    g_ptr_array_add (contents->rulesets,
+                     gtk_css_provider_print_ruleset (self, &g_array_index (priv->rulesets, GtkCssRuleset, i)));
+
+  return contents;
+}
+
+static GtkCssSelector *
+parse_printed_selector (const char *printed)
+{
+  GtkCssSelector *selector;
+  GtkCssParser *parser;
+  const char *end;
+  GBytes *bytes;
+
+  end = strstr (printed, " {\n");
+  g_assert (end != NULL);
+
+  bytes = g_bytes_new (printed, end - printed);
+  parser = gtk_css_parser_new_for_bytes (bytes, NULL, NULL, NULL, NULL, NULL);
+  selector = _gtk_css_selector_parse (parser);
+  gtk_css_parser_unref (parser);
+  g_bytes_unref (bytes);
+
+  return selector;
+}
+
+static gboolean
+add_changed_selector (GPtrArray  *selectors,
+                      const char *printed,
+                      guint       max_changed)
+{
+  GtkCssSelector *selector;
+
+  selector = parse_printed_selector (printed);
+  if (selector == NULL)
+    return FALSE;
+
+  g_ptr_array_add (selectors, selector);
+
+  return selectors->len <= max_changed;
+}
+
+/* Decrements the count of @printed in @counts, returns %FALSE if
+ * it was 0 already */
+static gboolean
+take_count (GHashTable *counts,
+            const char *printed)
+{
+  guint count = GPOINTER_TO_UINT (g_hash_table_lookup (counts, printed));
+
+  if (count == 0)
+    return FALSE;
+
+  g_hash_table_insert (counts, (gpointer) printed, GUINT_TO_POINTER (count - 1));
+
+  return TRUE;
+}
+
+static void
+add_count (GHashTable *counts,
+           const char *printed)
+{
+  guint count = GPOINTER_TO_UINT (g_hash_table_lookup (counts, printed));
+
+  g_hash_table_insert (counts, (gpointer) printed, GUINT_TO_POINTER (count + 1));
+}
+
+/* Returns the selectors of the rulesets that are only in one of @old
+ * and the current stylesheet or that moved, or %NULL if everything
+ * needs to be restyled or, if @unchanged is set, nothing does. */
+static GtkCssSelectorTree *
+gtk_css_provider_diff (GtkCssProvider     *self,
+                       StylesheetContents *old,
+                       gboolean           *unchanged)
+{
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (self);
+  GtkCssSelectorTreeBuilder *builder;
+  GtkCssSelectorTree *tree = NULL;
+  GPtrArray *printed, *kept_old, *kept_new;
+  GHashTable *old_counts, *kept_counts;
+  GPtrArray *selectors;
+  char *definitions;
+  guint max_changed;
+  guint i, start, end;
+
+  *unchanged = FALSE;
+
+  definitions = gtk_css_provider_print_definitions (self);
+  if (!g_str_equal (definitions, old->definitions))
+    {
+      g_free (definitions);
+      return NULL;
+    }
+  g_free (definitions);
+
+  max_changed = (old->rulesets->len + priv->rulesets->len) / MAX_CHANGED_RULESETS_FRACTION;
+  selectors = g_ptr_array_new_with_free_func ((GDestroyNotify) _gtk_css_selector_free);
+  printed = g_ptr_array_new_full (priv->rulesets->len, g_free);
+  kept_old = g_ptr_array_new ();
+  kept_new = g_ptr_array_new ();
+  old_counts = g_hash_table_new (g_str_hash, g_str_equal);
+  kept_counts = g_hash_table_new (g_str_hash, g_str_equal);
+
+  for (i = 0; i < old->rulesets->len; i++)
+    add_count (old_counts, g_ptr_array_index (old->rulesets, i));
+
+  /* Added rulesets */
+  for (i = 0; i < priv->rulesets->len; i++)
+    {
+      char *ruleset = gtk_css_provider_print_ruleset (self, &g_array_index (priv->rulesets, GtkCssRuleset, i));
+
+      g_ptr_array_add (printed, ruleset);
+
+      if (take_count (old_counts, ruleset))
+        {
+          g_ptr_array_add (kept_new, ruleset);
+          add_count (kept_counts, ruleset);
+        }
+      else if (!add_changed_selector (selectors, ruleset, max_changed))
+        goto out;
+    }
+
+  /* Removed rulesets */
+  for (i = 0; i < old->rulesets->len; i++)
+    {
+      const char *ruleset = g_ptr_array_index (old->rulesets, i);
+
+      if (take_count (kept_counts, ruleset))
+        g_ptr_array_add (kept_old, (gpointer) ruleset);
+      else if (!add_changed_selector (selectors, ruleset, max_changed))
+        goto out;
+    }
+
+  /* Moved rulesets: all pairs of rulesets that changed their order
+   * are between the common start and end of both stylesheets */
+  g_assert (kept_old->len == kept_new->len);
+  for (start = 0; start < kept_new->len; start++)
+    {
+      if (!g_str_equal (g_ptr_array_index (kept_old, start), g_ptr_array_index (kept_new, start)))
+        break;
+    }
+  for (end = kept_new->len; end > start; end--)
+    {
+      if (!g_str_equal (g_ptr_array_index (kept_old, end - 1), g_ptr_array_index (kept_new, end - 1)))
+        break;
+    }
+  for (i = start; i < end; i++)
+    {
+      if (!add_changed_selector (selectors, g_ptr_array_index (kept_new, i), max_changed))
+        goto out;
+    }
+
+  if (selectors->len == 0)
+    {
+      *unchanged = TRUE;
+      goto out;
+    }
+
+  builder = _gtk_css_selector_tree_builder_new ();
+  for (i = 0; i < selectors->len; i++)
+    _gtk_css_selector_tree_builder_add (builder, g_ptr_array_index (selectors, i), NULL, GUINT_TO_POINTER (i + 1));
+  tree = _gtk_css_selector_tree_builder_build (builder);
+  _gtk_css_selector_tree_builder_free (builder);
+
+out:
+  g_hash_table_unref (kept_counts);
+  g_hash_table_unref (old_counts);
+  g_ptr_array_unref (kept_new);
+  g_ptr_array_unref (kept_old);
+  g_ptr_array_unref (printed);
+  g_ptr_array_unref (selectors);
+
+  return tree;
+}
+
+/* Emits the change from the stylesheet in @old, which is freed */
+static void
+gtk_css_provider_changed_from (GtkCssProvider     *self,
+                               StylesheetContents *old)
+{
+  GtkCssSelectorTree *rules;
+  gboolean unchanged;
+
+  if (old == NULL)
+    {
+      gtk_style_provider_changed (GTK_STYLE_PROVIDER (self));
+      return;
+    }
+
+  rules = gtk_css_provider_diff (self, old, &unchanged);
+  stylesheet_contents_free (old);
+
+  if (rules)
+    {
+      gtk_style_provider_changed_rules (GTK_STYLE_PROVIDER (self), rules);
+      _gtk_css_selector_tree_free (rules);
+    }
+  else if (!unchanged)
+    {
+      gtk_style_provider_changed (GTK_STYLE_PROVIDER (self));
+    }
+}
+
+/* Makes the async load that is in progress, if any, lose against
+ * the load that is starting */
+static void
+gtk_css_provider_start_load (GtkCssProvider *self)
+{
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (self);
+  GTask *task;
+
+  priv->load_generation++;
+
+  if (priv->async_parse_id == 0)
+    return;
+
+  task = g_steal_pointer (&priv->async_parse);
+  g_clear_handle_id (&priv->async_parse_id, g_source_remove);
+
+  g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                           "Superseded by another load");
+  g_object_unref (task);
+}
+
+/**
+ * gtk_css_provider_load_from_data:
+ * @css_provider: a #GtkCssProvider
+ * @data: (array length=length) (element-type guint8): CSS data loaded in memory
+ * @length: the length of @data in bytes, or -1 for NUL terminated strings. If
+ *   @length is not -1, the code will assume it is not NUL terminated and will
+ *   potentially do a copy.
+ *
+ * Loads @data into @css_provider, and by doing so clears any previously loaded
+ * information.
+ **/
+void
+gtk_css_provider_load_from_data (GtkCssProvider  *css_provider,
+                                 const char      *data,
+                                 gssize           length)
+{
+  StylesheetContents *old;
+  GBytes *bytes;
+
+  g_return_if_fail (GTK_IS_CSS_PROVIDER (css_provider));
+  g_return_if_fail (data != NULL);
+
+  if (length < 0)
+    length = strlen (data);
+
+  bytes = g_bytes_new_static (data, length);
+
+  gtk_css_provider_start_load (css_provider);
+
+  old = stylesheet_contents_new (css_provider);
+  gtk_css_provider_reset (css_provider);
+
+  g_bytes_ref (bytes);
+  gtk_css_provider_load_internal (css_provider, NULL, NULL, bytes);
+  g_bytes_unref (bytes);
+
+  gtk_css_provider_changed_from (css_provider, old);
+}
+
+/**
+ * gtk_css_provider_load_from_file:
+ * @css_provider: a #GtkCssProvider
+ * @file: #GFile pointing to a file to load
+ *
+ * Loads the data contained in @file into @css_provider, making it
+ * clear any previously loaded information.
+ **/
+void
+gtk_css_provider_load_from_file (GtkCssProvider  *css_provider,
+                                 GFile           *file)
+{
+  StylesheetContents *old;
+
+  g_return_if_fail (GTK_IS_CSS_PROVIDER (css_provider));
+  g_return_if_fail (G_IS_FILE (file));
+
+  gtk_css_provider_start_load (css_provider);
+
+  old = stylesheet_contents_new (css_provider);
+  gtk_css_provider_reset (css_provider);
+
+  if (!gtk_css_provider_should_compile () ||
+      !gtk_css_provider_load_compiled (css_provider, file))
+    gtk_css_provider_load_internal (css_provider, NULL, file, NULL);
+
+  gtk_css_provider_changed_from (css_provider, old);
+}
+
+/* Async loading
+ *
+ * The file is read asynchronously and then parsed in slices from an
+ * idle handler into a separate provider, so the main loop keeps
+ * running while a big theme loads. Once the stylesheet is complete,
+ * its rulesets and selector tree are moved over to the provider in
+ * one go and a single change is emitted.
+ *
+ * Parsing can't move to a thread: the values it creates share their
+ * singletons with the values used for styling, and their reference
+ * counts are not atomic. Imports are still loaded synchronously.
+ *
+ * Every load that starts makes the loads that are still in progress
+ * fail, so an older load can't replace the data of a newer one.
+ */
+
+#define ASYNC_PARSE_SLICE_USEC 4000
+
+typedef struct
+{
+  GFile *file;
+  GtkCssProvider *loader;
+  GtkCssScanner *scanner;
+  guint generation;
+  gint64 before;
+} AsyncLoad;
+
+static void
+async_load_free (gpointer data)
+{
+  AsyncLoad *load = data;
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (load->loader);
+
+  g_clear_pointer (&load->scanner, gtk_css_scanner_destroy);
+  g_clear_pointer (&priv->compiler, gtk_css_compiler_free);
+  g_object_unref (load->loader);
+  g_object_unref (load->file);
+  g_free (load);
+}
+
+static void
+forward_parsing_error (GtkCssProvider *loader,
+                       GtkCssSection  *section,
+                       const GError   *error,
+                       GtkCssProvider *self)
+{
+  gtk_css_style_provider_emit_error (GTK_STYLE_PROVIDER (self), section, error);
+}
+
+/* Moves the stylesheet that @loader parsed into @self */
+static void
+gtk_css_provider_take_stylesheet (GtkCssProvider *self,
+                                  GtkCssProvider *loader)
+{
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (self);
+  GtkCssProviderPrivate *loader_priv = gtk_css_provider_get_instance_private (loader);
+  GHashTable *table;
+  GArray *rulesets;
+
+  gtk_css_provider_reset (self);
+
+  /* The selector tree points to the rulesets, so the array has to move */
+  rulesets = priv->rulesets;
+  priv->rulesets = loader_priv->rulesets;
+  loader_priv->rulesets = rulesets;
+
+  table = priv->symbolic_colors;
+  priv->symbolic_colors = loader_priv->symbolic_colors;
+  loader_priv->symbolic_colors = table;
+
+  table = priv->keyframes;
+  priv->keyframes = loader_priv->keyframes;
+  loader_priv->keyframes = table;
+
+  priv->tree = g_steal_pointer (&loader_priv->tree);
+  priv->compiled = g_steal_pointer (&loader_priv->compiled);
+  priv->compiled_files = g_steal_pointer (&loader_priv->compiled_files);
+  priv->n_unparsed = loader_priv->n_unparsed;
+  loader_priv->n_unparsed = 0;
+}
+
+static void
+async_load_finish (GTask *task)
+{
+  GtkCssProvider *self = g_task_get_source_object (task);
+  AsyncLoad *load = g_task_get_task_data (task);
+  StylesheetContents *old;
+
+  old = stylesheet_contents_new (self);
+  gtk_css_provider_take_stylesheet (self, load->loader);
+  gtk_css_provider_changed_from (self, old);
+
+  if (GDK_PROFILER_IS_RUNNING)
+    {
+      char *uri = g_file_get_uri (load->file);
+      gdk_profiler_end_mark (load->before, "async theme load", uri);
+      g_free (uri);
+    }
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static gboolean
+async_load_parse (gpointer data)
+{
+  GTask *task = data;
+  GtkCssProvider *self = g_task_get_source_object (task);
+  GtkCssProviderPrivate *self_priv = gtk_css_provider_get_instance_private (self);
+  AsyncLoad *load = g_task_get_task_data (task);
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (load->loader);
+
+  if (g_task_return_error_if_cancelled (task))
+    {
+      self_priv->async_parse = NULL;
+      self_priv->async_parse_id = 0;
+      g_object_unref (task);
+      return G_SOURCE_REMOVE;
+    }
+
+  if (!parse_stylesheet_until (load->scanner, g_get_monotonic_time () + ASYNC_PARSE_SLICE_USEC))
+    return G_SOURCE_CONTINUE;
+
+  self_priv->async_parse = NULL;
+  self_priv->async_parse_id = 0;
+
+  g_clear_pointer (&load->scanner, gtk_css_scanner_destroy);
+
+  if (priv->compiler)
+    {
+      if (!priv->compiler->failed)
+        gtk_css_provider_write_compiled (load->loader, load->file);
+      g_clear_pointer (&priv->compiler, gtk_css_compiler_free);
+    }
+
+  gtk_css_provider_postprocess (load->loader);
+
+  async_load_finish (task);
+  g_object_unref (task);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+async_load_file_loaded (GObject      *source,
+                        GAsyncResult *result,
+                        gpointer      data)
+{
+  GTask *task = data;
+  GtkCssProvider *self = g_task_get_source_object (task);
+  GtkCssProviderPrivate *self_priv = gtk_css_provider_get_instance_private (self);
+  AsyncLoad *load = g_task_get_task_data (task);
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (load->loader);
+  GError *error = NULL;
+  GBytes *bytes;
+
+  bytes = g_file_load_bytes_finish (G_FILE (source), result, NULL, &error);
+  if (bytes == NULL)
+    {
+      g_task_return_error (task, error);
+      g_object_unref (task);
+      return;
+    }
+
+  if (load->generation != self_priv->load_generation)
+    {
+      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_CANCELLED,
+                               "Superseded by another load");
+      g_bytes_unref (bytes);
+      g_object_unref (task);
+      return;
+    }
+
+  if (gtk_css_provider_should_compile ())
+    priv->compiler = gtk_css_compiler_new ();
+
+  load->scanner = gtk_css_scanner_new (load->loader, NULL, load->file, bytes);
+  g_bytes_unref (bytes);
+
+  /* Below redrawing, so the application stays responsive */
+  self_priv->async_parse = task;
+  self_priv->async_parse_id = g_idle_add_full (G_PRIORITY_DEFAULT_IDLE, async_load_parse, task, NULL);
+  g_source_set_name_by_id (self_priv->async_parse_id, "[gtk] async_load_parse");
+}
+
+/**
+ * gtk_css_provider_load_from_file_async:
+ * @css_provider: a #GtkCssProvider
+ * @file: #GFile pointing to a file to load
+ * @cancellable: (nullable): a #GCancellable
+ * @callback: (scope async): callback to call when the file is loaded
+ * @user_data: (closure): data to pass to @callback
+ *
+ * Asynchronously loads the data contained in @file into @css_provider,
+ * like gtk_css_provider_load_from_file().
+ *
+ * The file is read and parsed without blocking the main loop for long.
+ * The previously loaded information stays in use until the new data
+ * is completely parsed, and is then replaced at once. If the file
+ * can't be read, the previously loaded information is kept.
+ *
+ * If another load of @css_provider starts before this one is finished,
+ * this one fails with %G_IO_ERROR_CANCELLED and doesn't change
+ * @css_provider.
+ *
+ * Parsing errors are reported via #GtkCssProvider::parsing-error while
+ * the data is parsed.
+ *
+ * When the operation is finished, @callback will be called. You can
+ * then call gtk_css_provider_load_from_file_finish() to get the result
+ * of the operation.
+ *
+ * Since: 4.2
+ */
+void
+gtk_css_provider_load_from_file_async (GtkCssProvider      *css_provider,
+                                       GFile               *file,
+                                       GCancellable        *cancellable,
+                                       GAsyncReadyCallback  callback,
+                                       gpointer             user_data)
+{
+  GtkCssProviderPrivate *priv = gtk_css_provider_get_instance_private (css_provider);
+  AsyncLoad *load;
+  GTask *task;
+
+  g_return_if_fail (GTK_IS_CSS_PROVIDER (css_provider));
+  g_return_if_fail (G_IS_FILE (file));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  gtk_css_provider_start_load (css_provider);
+
+  task = g_task_new (css_provider, cancellable, callback, user_data);
+  g_task_set_source_tag (task, gtk_css_provider_load_from_file_async);
+
+  load = g_new0 (AsyncLoad, 1);
+  load->file = g_object_ref (file);
+  load->generation = priv->load_generation;
+  load->loader = gtk_css_provider_new ();
+  load->before = GDK_PROFILER_CURRENT_TIME;
+  g_signal_connect_object (load->loader, "parsing-error",
+                           G_CALLBACK (forward_parsing_error), css_provider, 0);
+  g_task_set_task_data (task, load, async_load_free);
+
+  /* Loading the compiled file is fast enough to do right away */
+  if (gtk_css_provider_should_compile () &&
+      gtk_css_provider_load_compiled (load->loader, file))
+    {
+      async_load_finish (task);
+      g_object_unref (task);
+      return;
+    }
+
+  g_file_load_bytes_async (file, cancellable, async_load_file_loaded, task);
+}
+
+/**
+ * gtk_css_provider_load_from_file_finish:
+ * @css_provider: a #GtkCssProvider
+ * @result: a #GAsyncResult
+ * @error: return location for an error
+ *
+ * Finishes an asynchronous load started with
+ * gtk_css_provider_load_from_file_async().
+ *
+ * Returns: %TRUE if the file was loaded, %FALSE if it could not be
+ *   read or the operation was cancelled
+ *
+ * Since: 4.2
+ */
+gboolean
+gtk_css_provider_load_from_file_finish (GtkCssProvider  *css_provider,
+                                        GAsyncResult    *result,
+                                        GError         **error)
+{
+  g_return_val_if_fail (GTK_IS_CSS_PROVIDER (css_provider), FALSE);
+  g_return_val_if_fail (g_task_is_valid (result, css_provider), FALSE);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) == gtk_css_provider_load_from_file_async, FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/**
+ * gtk_css_provider_load_from_path:
+ * @css_provider: a #GtkCssProvider
+ * @path: the path of a filename to load, in the GLib filename encoding
+ *
+ * Loads the data contained in @path into @css_provider, making it clear
+ * any previously loaded information.
+ **/
+void
+gtk_css_provider_load_from_path (GtkCssProvider  *css_provider,
+                                 const char      *path)
+{
+  GFile *file;
+
+  g_return_if_fail (GTK_IS_CSS_PROVIDER (css_provider));
+  g_return_if_fail (path != NULL);
+
+  file = g_file_new_for_path (path);
+  
+  gtk_css_provider_load_from_file (css_provider, file);
+
+  g_object_unref (file);
+}
+
+/**
+ * gtk_css_provider_load_from_resource:
  * @css_provider: a #GtkCssProvider
  * @resource_path: a #GResource resource path
  *
@@ -1518,9 +3138,18 @@ gtk_css_provider_to_string (GtkCssProvider *provider)
 
   for (i = 0; i < priv->rulesets->len; i++)
     {
+      GtkCssRuleset *ruleset = &g_array_index (priv->rulesets, GtkCssRuleset, i);
+      guint j;
+
+      for (j = 0; j < ruleset->n_styles; j++)
+        {
+          if (ruleset->styles[j].value == NULL)
+            gtk_css_provider_parse_compiled (provider, ruleset, j);
+        }
+
       if (str->len != 0)
         g_string_append (str, "\n");
-      gtk_css_ruleset_print (&g_array_index (priv->rulesets, GtkCssRuleset, i), str);
+      gtk_css_ruleset_print (ruleset, str);
     }
 
   return g_string_free (str, FALSE);
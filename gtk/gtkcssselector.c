@@ -24,6 +24,7 @@
 
 #include "gtkcssprovider.h"
 #include "gtkstylecontextprivate.h"
+#include "gdk/gdkprofilerprivate.h"
 
 #include <errno.h>
 #if defined(_MSC_VER) && _MSC_VER >= 1500
@@ -1886,21 +1887,151 @@ gtk_css_selector_tree_found_match (const GtkCssSelectorTree  *tree,
     gtk_css_selector_matches_insert_sorted (results, matches[i]);
 }
 
+/* Selector costs
+ *
+ * While the profiler is running, we count how often each node of the
+ * tree gets matched against a CSS node and how often that succeeded.
+ * Nodes that get checked a lot but rarely match are the expensive
+ * parts of a stylesheet. The counts are reported as profiler marks by
+ * gtk_css_selector_tree_report_costs().
+ *
+ * Matching can happen in threads, so the checks are collected per
+ * call to _gtk_css_selector_tree_match_all() and only merged into the
+ * shared table at the end.
+ */
+#define MAX_REPORTED_SELECTORS 10
+
+typedef struct {
+  const GtkCssSelectorTree *tree;
+  gboolean                  matched;
+} GtkCssSelectorCheck;
+
+typedef struct {
+  const GtkCssSelectorTree *tree;
+  guint                     checks;
+  guint                     matches;
+} GtkCssSelectorCost;
+
+static GHashTable *selector_costs;
+G_LOCK_DEFINE_STATIC (selector_costs);
+
+static void
+gtk_css_selector_tree_add_checks (GArray *checks)
+{
+  guint i;
+
+  G_LOCK (selector_costs);
+
+  if (selector_costs == NULL)
+    selector_costs = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+
+  for (i = 0; i < checks->len; i++)
+    {
+      const GtkCssSelectorCheck *check = &g_array_index (checks, GtkCssSelectorCheck, i);
+      GtkCssSelectorCost *cost;
+
+      cost = g_hash_table_lookup (selector_costs, check->tree);
+      if (cost == NULL)
+        {
+          cost = g_new0 (GtkCssSelectorCost, 1);
+          cost->tree = check->tree;
+          g_hash_table_insert (selector_costs, (gpointer) check->tree, cost);
+        }
+
+      cost->checks++;
+      if (check->matched)
+        cost->matches++;
+    }
+
+  G_UNLOCK (selector_costs);
+}
+
+static int
+compare_cost (gconstpointer a,
+              gconstpointer b)
+{
+  const GtkCssSelectorCost *cost_a = *(const GtkCssSelectorCost **) a;
+  const GtkCssSelectorCost *cost_b = *(const GtkCssSelectorCost **) b;
+
+  if (cost_a->checks != cost_b->checks)
+    return cost_a->checks < cost_b->checks ? 1 : -1;
+
+  return cost_a->matches < cost_b->matches ? -1 : (cost_a->matches > cost_b->matches);
+}
+
+/*
+ * gtk_css_selector_tree_report_costs:
+ *
+ * Adds a profiler mark for each of the selectors that were checked
+ * most often since the last report and resets the counts.
+ */
+void
+gtk_css_selector_tree_report_costs (void)
+{
+  GPtrArray *costs;
+  GHashTableIter iter;
+  gpointer cost;
+  GString *str;
+  guint i;
+
+  G_LOCK (selector_costs);
+
+  if (selector_costs == NULL || g_hash_table_size (selector_costs) == 0)
+    {
+      G_UNLOCK (selector_costs);
+      return;
+    }
+
+  costs = g_ptr_array_sized_new (g_hash_table_size (selector_costs));
+  g_hash_table_iter_init (&iter, selector_costs);
+  while (g_hash_table_iter_next (&iter, NULL, &cost))
+    g_ptr_array_add (costs, cost);
+
+  g_ptr_array_sort (costs, compare_cost);
+
+  str = g_string_new (NULL);
+  for (i = 0; i < MIN (costs->len, MAX_REPORTED_SELECTORS); i++)
+    {
+      const GtkCssSelectorCost *c = g_ptr_array_index (costs, i);
+
+      g_string_set_size (str, 0);
+      _gtk_css_selector_tree_match_print (c->tree, str);
+      gdk_profiler_add_markf (GDK_PROFILER_CURRENT_TIME, 0, "css selector cost",
+                              "%s: %u checks, %u matches", str->str, c->checks, c->matches);
+    }
+  g_string_free (str, TRUE);
+
+  g_ptr_array_unref (costs);
+  g_hash_table_remove_all (selector_costs);
+
+  G_UNLOCK (selector_costs);
+}
+
 static gboolean
 gtk_css_selector_tree_match (const GtkCssSelectorTree      *tree,
                              const GtkCountingBloomFilter  *filter,
                              gboolean                       match_filter,
                              GtkCssNode                    *node,
-                             GtkCssSelectorMatches         *results)
+                             GtkCssSelectorMatches         *results,
+                             GArray                        *checks)
 {
   const GtkCssSelectorTree *prev;
   GtkCssNode *child;
+  gboolean matched;
 
   if (match_filter && tree->selector.class->category == GTK_CSS_SELECTOR_CATEGORY_SIMPLE_RADICAL &&
       !gtk_counting_bloom_filter_may_contain (filter, gtk_css_selector_hash_one (&tree->selector)))
     return FALSE;
 
-  if (!gtk_css_selector_match_one (&tree->selector, node))
+  matched = gtk_css_selector_match_one (&tree->selector, node);
+
+  if (G_UNLIKELY (checks != NULL))
+    {
+      GtkCssSelectorCheck check = { tree, matched };
+      g_array_append_val (checks, check);
+    }
+
+  if (!matched)
     return TRUE;
 
   gtk_css_selector_tree_found_match (tree, results);
@@ -1916,7 +2047,7 @@ gtk_css_selector_tree_match (const GtkCssSelectorTree      *tree,
            child;
            child = gtk_css_selector_iterator (&tree->selector, node, child))
         {
-          if (!gtk_css_selector_tree_match (prev, filter, match_filter, child, results))
+          if (!gtk_css_selector_tree_match (prev, filter, match_filter, child, results, checks))
             break;
         }
     }
@@ -1931,12 +2062,22 @@ _gtk_css_selector_tree_match_all (const GtkCssSelectorTree     *tree,
                                   GtkCssSelectorMatches        *out_tree_rules)
 {
   const GtkCssSelectorTree *iter;
+  GArray *checks = NULL;
+
+  if (GDK_PROFILER_IS_RUNNING)
+    checks = g_array_new (FALSE, FALSE, sizeof (GtkCssSelectorCheck));
 
   for (iter = tree;
        iter != NULL;
        iter = gtk_css_selector_tree_get_sibling (iter))
     {
-      gtk_css_selector_tree_match (iter, filter, FALSE, node, out_tree_rules);
+      gtk_css_selector_tree_match (iter, filter, FALSE, node, out_tree_rules, checks);
+    }
+
+  if (checks)
+    {
+      gtk_css_selector_tree_add_checks (checks);
+      g_array_unref (checks);
     }
 }
 
@@ -2070,6 +2211,12 @@ _gtk_css_selector_tree_free (GtkCssSelectorTree *tree)
   if (tree == NULL)
     return;
 
+  /* The costs point into the tree */
+  G_LOCK (selector_costs);
+  if (selector_costs)
+    g_hash_table_remove_all (selector_costs);
+  G_UNLOCK (selector_costs);
+
   g_free (tree);
 }
 
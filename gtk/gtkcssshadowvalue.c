@@ -144,7 +144,8 @@ gtk_css_value_shadow_equal (const GtkCssValue *value1,
 {
   guint i;
 
-  if (value1->n_shadows != value2->n_shadows)
+  if (value1->n_shadows != value2->n_shadows ||
+      value1->is_filter != value2->is_filter)
     return FALSE;
 
   for (i = 0; i < value1->n_shadows; i++)
@@ -164,6 +165,35 @@ gtk_css_value_shadow_equal (const GtkCssValue *value1,
   return TRUE;
 }
 
+static guint
+gtk_css_value_shadow_hash (const GtkCssValue *value)
+{
+  guint hash, i;
+
+  hash = value->n_shadows * 2 + value->is_filter;
+
+  for (i = 0; i < value->n_shadows; i++)
+    {
+      const ShadowValue *shadow = &value->shadows[i];
+      GtkCssValue *values[] = { shadow->hoffset, shadow->voffset, shadow->radius, shadow->spread, shadow->color };
+      guint j;
+
+      hash = hash * 31 + shadow->inset;
+
+      for (j = 0; j < G_N_ELEMENTS (values); j++)
+        {
+          guint value_hash = gtk_css_value_hash (values[j]);
+
+          if (value_hash == 0)
+            return 0;
+
+          hash = hash * 31 + value_hash;
+        }
+    }
+
+  return hash ? hash : 1;
+}
+
 static GtkCssValue *
 gtk_css_value_shadow_transition (GtkCssValue *start,
                                  GtkCssValue *end,
@@ -283,7 +313,8 @@ static const GtkCssValueClass GTK_CSS_VALUE_SHADOW = {
   gtk_css_value_shadow_transition,
   NULL,
   NULL,
-  gtk_css_value_shadow_print
+  gtk_css_value_shadow_print,
+  gtk_css_value_shadow_hash
 };
 
 static GtkCssValue shadow_none_singleton = { &GTK_CSS_VALUE_SHADOW, 1, TRUE, FALSE, 0 };
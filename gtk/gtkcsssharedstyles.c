@@ -0,0 +1,280 @@
+/* GTK - The GIMP Toolkit
+ * Copyright 2020 GNOME Foundation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "gtkcsssharedstylesprivate.h"
+
+#include "gtkcssstaticstyleprivate.h"
+#include "gtkdebug.h"
+
+#include <string.h>
+
+/* Shared styles
+ *
+ * A static style is computed from the values found by the style
+ * provider lookup, the parent style and the provider (for things like
+ * the settings and symbolic colors). So nodes for which all of these
+ * are the same can share the style, no matter where they are in the
+ * tree. This catches a lot more than the per-parent style cache: rows
+ * in different lists, widgets in different windows, and the children
+ * of parents that ended up sharing a style.
+ *
+ * The values and sections of the lookup are compared by pointer. The
+ * entries keep references to everything they are compared by, so the
+ * pointers can't be reused for something else while they are in the
+ * table. The table is bounded and drops the least recently used
+ * styles first.
+ *
+ * Styles also depend on things that are not part of the key, like the
+ * settings, so the table is cleared whenever any provider changes.
+ */
+
+#define MAX_SHARED_STYLES 1024
+
+typedef struct {
+  guint          id;
+  GtkCssValue   *value;
+  GtkCssSection *section;
+} SharedValue;
+
+typedef struct {
+  GList             link;        /* in the LRU list */
+  guint             hash;
+  GtkStyleProvider *provider;
+  GtkCssStyle      *parent_style;
+  GtkCssChange      change;
+  guint             n_values;
+  SharedValue      *values;
+  GtkCssStyle      *style;
+} SharedStyle;
+
+static GHashTable *shared_styles;
+static GQueue lru = G_QUEUE_INIT;
+
+static guint
+shared_style_hash (gconstpointer item)
+{
+  const SharedStyle *shared = item;
+
+  return shared->hash;
+}
+
+static gboolean
+shared_style_equal (gconstpointer item1,
+                    gconstpointer item2)
+{
+  const SharedStyle *shared1 = item1;
+  const SharedStyle *shared2 = item2;
+
+  return shared1->hash == shared2->hash &&
+         shared1->provider == shared2->provider &&
+         shared1->parent_style == shared2->parent_style &&
+         shared1->change == shared2->change &&
+         shared1->n_values == shared2->n_values &&
+         memcmp (shared1->values, shared2->values, sizeof (SharedValue) * shared1->n_values) == 0;
+}
+
+static void
+shared_style_free (gpointer item)
+{
+  SharedStyle *shared = item;
+  guint i;
+
+  for (i = 0; i < shared->n_values; i++)
+    {
+      _gtk_css_value_unref (shared->values[i].value);
+      if (shared->values[i].section)
+        gtk_css_section_unref (shared->values[i].section);
+    }
+
+  g_object_unref (shared->provider);
+  g_clear_object (&shared->parent_style);
+  g_object_unref (shared->style);
+  g_free (shared->values);
+  g_slice_free (SharedStyle, shared);
+}
+
+static gboolean
+may_share_style (GtkCssStyle *parent_style)
+{
+  /* See may_be_stored_in_cache() in gtkcssnodestylecache.c */
+#ifdef G_ENABLE_DEBUG
+  if (GTK_DEBUG_CHECK (NO_CSS_CACHE))
+    return FALSE;
+#endif
+
+  /* Animated styles change all the time */
+  if (parent_style != NULL && !GTK_IS_CSS_STATIC_STYLE (parent_style))
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Fills in @key for the lookup, without taking references. @values
+ * needs to have space for all properties. */
+static void
+shared_style_init_key (SharedStyle        *key,
+                       GtkStyleProvider   *provider,
+                       GtkCssStyle        *parent_style,
+                       const GtkCssLookup *lookup,
+                       GtkCssChange        change,
+                       SharedValue        *values)
+{
+  guint hash;
+  guint id;
+
+  key->provider = provider;
+  key->parent_style = parent_style;
+  key->change = change;
+  key->values = values;
+  key->n_values = 0;
+
+  hash = g_direct_hash (provider) ^ g_direct_hash (parent_style);
+  hash = hash * 31 + (guint) change;
+
+  for (id = 0; id < GTK_CSS_PROPERTY_N_PROPERTIES; id++)
+    {
+      SharedValue *value;
+
+      if (lookup->values[id].value == NULL)
+        continue;
+
+      value = &values[key->n_values++];
+      /* Avoid comparing padding */
+      memset (value, 0, sizeof (SharedValue));
+      value->id = id;
+      value->value = lookup->values[id].value;
+      value->section = lookup->values[id].section;
+
+      hash = hash * 31 + id;
+      hash = hash * 31 + g_direct_hash (value->value);
+    }
+
+  key->hash = hash;
+}
+
+/*
+ * gtk_css_shared_styles_lookup:
+ * @provider: the style provider
+ * @parent_style: (allow-none): the style of the parent node
+ * @lookup: the values found for the node
+ * @change: the change flags of the style
+ *
+ * Finds a style that was computed for another node with the same
+ * @lookup, @parent_style and @provider.
+ *
+ * Returns: (transfer none) (nullable): the style to share
+ */
+GtkCssStyle *
+gtk_css_shared_styles_lookup (GtkStyleProvider   *provider,
+                              GtkCssStyle        *parent_style,
+                              const GtkCssLookup *lookup,
+                              GtkCssChange        change)
+{
+  SharedValue values[GTK_CSS_PROPERTY_N_PROPERTIES];
+  SharedStyle key;
+  SharedStyle *shared;
+
+  if (shared_styles == NULL || !may_share_style (parent_style))
+    return NULL;
+
+  shared_style_init_key (&key, provider, parent_style, lookup, change, values);
+
+  shared = g_hash_table_lookup (shared_styles, &key);
+  if (shared == NULL)
+    return NULL;
+
+  g_queue_unlink (&lru, &shared->link);
+  g_queue_push_head_link (&lru, &shared->link);
+
+  return shared->style;
+}
+
+/*
+ * gtk_css_shared_styles_insert:
+ * @provider: the style provider
+ * @parent_style: (allow-none): the style of the parent node
+ * @lookup: the values found for the node
+ * @change: the change flags of the style
+ * @style: the static style computed from @lookup
+ *
+ * Makes @style available to other nodes, see gtk_css_shared_styles_lookup().
+ */
+void
+gtk_css_shared_styles_insert (GtkStyleProvider   *provider,
+                              GtkCssStyle        *parent_style,
+                              const GtkCssLookup *lookup,
+                              GtkCssChange        change,
+                              GtkCssStyle        *style)
+{
+  SharedValue values[GTK_CSS_PROPERTY_N_PROPERTIES];
+  SharedStyle *shared;
+  guint i;
+
+  g_return_if_fail (GTK_IS_CSS_STATIC_STYLE (style));
+
+  if (!may_share_style (parent_style))
+    return;
+
+  if (shared_styles == NULL)
+    shared_styles = g_hash_table_new_full (shared_style_hash, shared_style_equal, shared_style_free, NULL);
+
+  shared = g_slice_new0 (SharedStyle);
+  shared->link.data = shared;
+  shared_style_init_key (shared, provider, parent_style, lookup, change, values);
+
+  if (g_hash_table_contains (shared_styles, shared))
+    {
+      g_slice_free (SharedStyle, shared);
+      return;
+    }
+
+  shared->values = g_new (SharedValue, shared->n_values);
+  memcpy (shared->values, values, sizeof (SharedValue) * shared->n_values);
+  for (i = 0; i < shared->n_values; i++)
+    {
+      _gtk_css_value_ref (shared->values[i].value);
+      if (shared->values[i].section)
+        gtk_css_section_ref (shared->values[i].section);
+    }
+
+  g_object_ref (shared->provider);
+  if (shared->parent_style)
+    g_object_ref (shared->parent_style);
+  shared->style = g_object_ref (style);
+
+  g_hash_table_add (shared_styles, shared);
+  g_queue_push_head_link (&lru, &shared->link);
+
+  while (lru.length > MAX_SHARED_STYLES)
+    {
+      GList *last = g_queue_pop_tail_link (&lru);
+
+      g_hash_table_remove (shared_styles, last->data);
+    }
+}
+
+void
+gtk_css_shared_styles_clear (void)
+{
+  if (shared_styles == NULL)
+    return;
+
+  g_queue_init (&lru);
+  g_hash_table_remove_all (shared_styles);
+}
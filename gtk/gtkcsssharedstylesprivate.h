@@ -0,0 +1,39 @@
+/* GTK - The GIMP Toolkit
+ * Copyright 2020 GNOME Foundation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GTK_CSS_SHARED_STYLES_PRIVATE_H__
+#define __GTK_CSS_SHARED_STYLES_PRIVATE_H__
+
+#include "gtkcsslookupprivate.h"
+#include "gtkstyleproviderprivate.h"
+
+G_BEGIN_DECLS
+
+GtkCssStyle *           gtk_css_shared_styles_lookup            (GtkStyleProvider       *provider,
+                                                                 GtkCssStyle            *parent_style,
+                                                                 const GtkCssLookup     *lookup,
+                                                                 GtkCssChange            change);
+void                    gtk_css_shared_styles_insert            (GtkStyleProvider       *provider,
+                                                                 GtkCssStyle            *parent_style,
+                                                                 const GtkCssLookup     *lookup,
+                                                                 GtkCssChange            change,
+                                                                 GtkCssStyle            *style);
+void                    gtk_css_shared_styles_clear             (void);
+
+G_END_DECLS
+
+#endif /* __GTK_CSS_SHARED_STYLES_PRIVATE_H__ */
@@ -214,6 +214,8 @@ gtk_css_ ## NAME ## _values_new_compute (GtkCssStaticStyle *sstyle, \
                                           lookup->values[id].value, \
                                           lookup->values[id].section); \
     } \
+\
+  style->NAME = (GtkCss ## TYPE ## Values *)gtk_css_values_share ((GtkCssValues *)style->NAME); \
 } \
 static GtkBitmask * gtk_css_ ## NAME ## _values_mask; \
 static GtkCssValues * gtk_css_ ## NAME ## _initial_values; \
@@ -993,9 +995,8 @@ gtk_css_static_style_new_compute (GtkStyleProvider             *provider,
                                   GtkCssNode                   *node,
                                   GtkCssChange                  change)
 {
-  GtkCssStaticStyle *result;
+  GtkCssStyle *result;
   GtkCssLookup lookup;
-  GtkCssNode *parent;
 
   _gtk_css_lookup_init (&lookup);
 
@@ -1006,6 +1007,35 @@ gtk_css_static_style_new_compute (GtkStyleProvider             *provider,
                                &lookup,
                                change == 0 ? &change : NULL);
 
+  result = gtk_css_static_style_new_resolve (provider, node, &lookup, change);
+
+  _gtk_css_lookup_destroy (&lookup);
+
+  return result;
+}
+
+/*
+ * gtk_css_static_style_new_resolve:
+ * @provider: the provider the @lookup was done with
+ * @node: (allow-none): the node the @lookup was done for
+ * @lookup: the values found by gtk_style_provider_lookup()
+ * @change: the change flags of the new style
+ *
+ * Computes a new style from the result of a lookup that was done
+ * earlier. This is the second half of gtk_css_static_style_new_compute(),
+ * it allows doing the lookups for several nodes up front.
+ *
+ * Returns: the new style
+ */
+GtkCssStyle *
+gtk_css_static_style_new_resolve (GtkStyleProvider *provider,
+                                  GtkCssNode       *node,
+                                  GtkCssLookup     *lookup,
+                                  GtkCssChange      change)
+{
+  GtkCssStaticStyle *result;
+  GtkCssNode *parent;
+
   result = g_object_new (GTK_TYPE_CSS_STATIC_STYLE, NULL);
 
   result->change = change;
@@ -1015,13 +1045,11 @@ gtk_css_static_style_new_compute (GtkStyleProvider             *provider,
   else
     parent = NULL;
 
-  gtk_css_lookup_resolve (&lookup,
+  gtk_css_lookup_resolve (lookup,
                           provider,
                           result,
                           parent ? gtk_css_node_get_style (parent) : NULL);
 
-  _gtk_css_lookup_destroy (&lookup);
-
   return GTK_CSS_STYLE (result);
 }
 
@@ -57,6 +57,10 @@ GtkCssStyle *           gtk_css_static_style_new_compute        (GtkStyleProvide
                                                                  const GtkCountingBloomFilter   *filter,
                                                                  GtkCssNode                     *node,
                                                                  GtkCssChange                    change);
+GtkCssStyle *           gtk_css_static_style_new_resolve        (GtkStyleProvider               *provider,
+                                                                 GtkCssNode                     *node,
+                                                                 GtkCssLookup                   *lookup,
+                                                                 GtkCssChange                    change);
 GtkCssChange            gtk_css_static_style_get_change         (GtkCssStaticStyle              *style);
 
 G_END_DECLS
@@ -717,6 +717,148 @@ static const int values_size[] = {
 
 #define GET_VALUES(v) (GtkCssValue **)((guint8 *)(v) + sizeof (GtkCssValues))
 
+/* Shared value structs
+ *
+ * Most styles only set a few properties of the core, font, size and
+ * border groups, so lots of nodes end up with groups containing the
+ * same values. gtk_css_values_share() replaces those with a single
+ * instance, which is what most of the style memory of big windows
+ * is made of.
+ *
+ * Values are compared by pointer, or with _gtk_css_value_equal() if
+ * they can be hashed, see gtk_css_value_hash(). The table does not
+ * hold references, structs remove themselves from it when they are
+ * freed.
+ *
+ * The structs keep holding GtkCssValue pointers rather than plain
+ * numbers and colors. Widgets, snapshots and animations read those
+ * pointers directly in hundreds of places, and with sharing, the
+ * memory that unboxed values would save is mostly gone anyway.
+ *
+ * Shared structs must not be changed. GtkCssAnimatedStyle copies a
+ * struct of its base style before setting animated values in it.
+ */
+static GHashTable *shared_values;
+
+static gboolean
+gtk_css_values_can_share (GtkCssValuesType type)
+{
+  switch ((int) type)
+    {
+    case GTK_CSS_CORE_VALUES:
+    case GTK_CSS_FONT_VALUES:
+    case GTK_CSS_SIZE_VALUES:
+    case GTK_CSS_BORDER_VALUES:
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+static guint
+gtk_css_values_hash (gconstpointer data)
+{
+  const GtkCssValues *values = data;
+  GtkCssValue **v = GET_VALUES (values);
+  guint hash = values->type;
+  int i;
+
+  for (i = 0; i < N_VALUES (values->type); i++)
+    {
+      guint value_hash;
+
+      if (v[i] == NULL)
+        value_hash = 0;
+      else
+        {
+          value_hash = gtk_css_value_hash (v[i]);
+          if (value_hash == 0)
+            value_hash = g_direct_hash (v[i]);
+        }
+
+      hash = hash * 31 + value_hash;
+    }
+
+  return hash;
+}
+
+static gboolean
+gtk_css_values_equal (gconstpointer data1,
+                      gconstpointer data2)
+{
+  const GtkCssValues *values1 = data1;
+  const GtkCssValues *values2 = data2;
+  GtkCssValue **v1 = GET_VALUES (values1);
+  GtkCssValue **v2 = GET_VALUES (values2);
+  int i;
+
+  if (values1->type != values2->type)
+    return FALSE;
+
+  for (i = 0; i < N_VALUES (values1->type); i++)
+    {
+      if (v1[i] == v2[i])
+        continue;
+
+      if (v1[i] == NULL || v2[i] == NULL ||
+          gtk_css_value_hash (v1[i]) == 0 ||
+          !_gtk_css_value_equal (v1[i], v2[i]))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/*
+ * gtk_css_values_share:
+ * @values: (transfer full): a value struct that was just computed
+ *
+ * Finds a struct with the same values as @values that is still in
+ * use, so styles can share it. @values must not be changed afterwards.
+ *
+ * Returns: (transfer full): the struct to use instead of @values
+ */
+GtkCssValues *
+gtk_css_values_share (GtkCssValues *values)
+{
+  GtkCssValues *shared;
+
+  if (!gtk_css_values_can_share (values->type))
+    return values;
+
+  if (shared_values == NULL)
+    shared_values = g_hash_table_new (gtk_css_values_hash, gtk_css_values_equal);
+
+  shared = g_hash_table_lookup (shared_values, values);
+  if (shared == NULL)
+    {
+      g_hash_table_add (shared_values, values);
+      return values;
+    }
+
+  if (shared != values)
+    {
+      gtk_css_values_ref (shared);
+      gtk_css_values_unref (values);
+    }
+
+  return shared;
+}
+
+static void
+gtk_css_values_forget (GtkCssValues *values)
+{
+  gpointer shared;
+
+  if (shared_values == NULL ||
+      !gtk_css_values_can_share (values->type))
+    return;
+
+  if (g_hash_table_lookup_extended (shared_values, values, &shared, NULL) &&
+      shared == values)
+    g_hash_table_remove (shared_values, values);
+}
+
 GtkCssValues *gtk_css_values_ref (GtkCssValues *values)
 {
   values->ref_count++;
@@ -730,6 +872,9 @@ gtk_css_values_free (GtkCssValues *values)
   int i;
   GtkCssValue **v = GET_VALUES (values);
 
+  /* Needs the values to find it */
+  gtk_css_values_forget (values);
+
   for (i = 0; i < N_VALUES (values->type); i++)
     {
       if (v[i])
@@ -23,6 +23,8 @@
 #include "gtkcssstyleprivate.h"
 #include "gtkstyleproviderprivate.h"
 
+#include <string.h>
+
 struct _GtkCssValue {
   GTK_CSS_VALUE_BASE
 };
@@ -136,6 +138,88 @@ get_accounting_data (const char *class)
 }
 #endif
 
+/* Interning
+ *
+ * With GTK_CSS_INTERN set, computed values that are equal to a value
+ * that is still alive are replaced with that value, so equal values
+ * are shared between styles and mostly compare equal by pointer.
+ *
+ * Only the classes that implement hash() take part. The table does not
+ * hold references, values remove themselves from it when they are
+ * freed.
+ */
+static GHashTable *interned_values;
+
+static gboolean
+gtk_css_value_should_intern (void)
+{
+  static int intern = -1;
+
+  if (intern < 0)
+    {
+      const char *env = g_getenv ("GTK_CSS_INTERN");
+
+      intern = env != NULL && env[0] != '\0' && strcmp (env, "0") != 0;
+    }
+
+  return intern;
+}
+
+static guint
+interned_value_hash (gconstpointer value)
+{
+  return gtk_css_value_hash (value);
+}
+
+static gboolean
+interned_value_equal (gconstpointer value1,
+                      gconstpointer value2)
+{
+  return _gtk_css_value_equal (value1, value2);
+}
+
+/* Takes ownership of @value */
+static GtkCssValue *
+gtk_css_value_intern (GtkCssValue *value)
+{
+  GtkCssValue *interned;
+
+  if (gtk_css_value_hash (value) == 0)
+    return value;
+
+  if (interned_values == NULL)
+    interned_values = g_hash_table_new (interned_value_hash, interned_value_equal);
+
+  interned = g_hash_table_lookup (interned_values, value);
+  if (interned == NULL)
+    {
+      g_hash_table_add (interned_values, value);
+      return value;
+    }
+
+  if (interned != value)
+    {
+      gtk_css_value_ref (interned);
+      gtk_css_value_unref (value);
+    }
+
+  return interned;
+}
+
+static void
+gtk_css_value_forget (GtkCssValue *value)
+{
+  gpointer interned;
+
+  if (interned_values == NULL ||
+      value->class->hash == NULL)
+    return;
+
+  if (g_hash_table_lookup_extended (interned_values, value, &interned, NULL) &&
+      interned == value)
+    g_hash_table_remove (interned_values, value);
+}
+
 GtkCssValue *
 _gtk_css_value_alloc (const GtkCssValueClass *klass,
                       gsize                   size)
@@ -189,6 +273,8 @@ gtk_css_value_unref (GtkCssValue *value)
   }
 #endif
 
+  gtk_css_value_forget (value);
+
   value->class->free (value);
 }
 
@@ -214,6 +300,8 @@ _gtk_css_value_compute (GtkCssValue      *value,
                         GtkCssStyle      *style,
                         GtkCssStyle      *parent_style)
 {
+  GtkCssValue *result;
+
   if (gtk_css_value_is_computed (value))
     return _gtk_css_value_ref (value);
 
@@ -221,7 +309,12 @@ _gtk_css_value_compute (GtkCssValue      *value,
   get_accounting_data (value->class->type_name)->computed++;
 #endif
 
-  return value->class->compute (value, property_id, provider, style, parent_style);
+  result = value->class->compute (value, property_id, provider, style, parent_style);
+
+  if (result != value && gtk_css_value_should_intern ())
+    result = gtk_css_value_intern (result);
+
+  return result;
 }
 
 gboolean
@@ -254,6 +347,26 @@ _gtk_css_value_equal0 (const GtkCssValue *value1,
   return _gtk_css_value_equal (value1, value2);
 }
 
+/**
+ * gtk_css_value_hash:
+ * @value: a #GtkCssValue
+ *
+ * Computes a hash for @value that is the same for all values that
+ * are equal according to _gtk_css_value_equal().
+ *
+ * Returns: the hash, or 0 if the value has none and can't be interned
+ **/
+guint
+gtk_css_value_hash (const GtkCssValue *value)
+{
+  gtk_internal_return_val_if_fail (value != NULL, 0);
+
+  if (value->class->hash == NULL)
+    return 0;
+
+  return value->class->hash (value);
+}
+
 GtkCssValue *
 _gtk_css_value_transition (GtkCssValue *start,
                            GtkCssValue *end,
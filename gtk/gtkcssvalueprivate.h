@@ -60,6 +60,8 @@ struct _GtkCssValueClass {
                                                        gint64                      monotonic_time);
   void          (* print)                             (const GtkCssValue          *value,
                                                        GString                    *string);
+  /* optional, 0 if the value can't be interned. Must agree with equal() */
+  guint         (* hash)                              (const GtkCssValue          *value);
 };
 
 GType        _gtk_css_value_get_type                  (void) G_GNUC_CONST;
@@ -82,6 +84,7 @@ gboolean     _gtk_css_value_equal                     (const GtkCssValue
                                                        const GtkCssValue          *value2) G_GNUC_PURE;
 gboolean     _gtk_css_value_equal0                    (const GtkCssValue          *value1,
                                                        const GtkCssValue          *value2) G_GNUC_PURE;
+guint           gtk_css_value_hash                    (const GtkCssValue          *value) G_GNUC_PURE;
 GtkCssValue *_gtk_css_value_transition                (GtkCssValue                *start,
                                                        GtkCssValue                *end,
                                                        guint                       property_id,
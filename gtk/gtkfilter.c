@@ -19,11 +19,21 @@
 
 #include "config.h"
 
-#include "gtkfilter.h"
+#include "gtkfilterprivate.h"
 
 #include "gtkintl.h"
+#include "gtklistmodelprivate.h"
 #include "gtktypebuiltins.h"
 
+#include "gdk/gdkparalleltaskprivate.h"
+
+/* The amount of items a thread matches at once in
+ * gtk_filter_match_range(), and the minimum amount of items per
+ * thread. Below this, starting the threads costs more than matching
+ * on one.
+ */
+#define GTK_FILTER_PARALLEL_CHUNK_SIZE (4 * 1024)
+
 /**
  * SECTION:gtkfilter
  * @Title: GtkFilter
@@ -55,9 +65,18 @@ enum {
   LAST_SIGNAL
 };
 
-G_DEFINE_TYPE (GtkFilter, gtk_filter, G_TYPE_OBJECT)
+typedef struct _GtkFilterPrivate GtkFilterPrivate;
+
+struct _GtkFilterPrivate
+{
+  guint state;
+  guint base_state;
+};
+
+G_DEFINE_TYPE_WITH_PRIVATE (GtkFilter, gtk_filter, G_TYPE_OBJECT)
 
 static guint signals[LAST_SIGNAL] = { 0 };
+static GQuark quark_snapshot_func;
 
 static gboolean
 gtk_filter_default_match (GtkFilter *self,
@@ -107,6 +126,8 @@ gtk_filter_class_init (GtkFilterClass *class)
   g_signal_set_va_marshaller (signals[CHANGED],
                               G_TYPE_FROM_CLASS (gobject_class),
                               g_cclosure_marshal_VOID__ENUMv);
+
+  quark_snapshot_func = g_quark_from_static_string ("gtk-filter-snapshot-func");
 }
 
 static void
@@ -175,8 +196,289 @@ void
 gtk_filter_changed (GtkFilter       *self,
                     GtkFilterChange  change)
 {
+  GtkFilterPrivate *priv = gtk_filter_get_instance_private (self);
+
   g_return_if_fail (GTK_IS_FILTER (self));
 
+  priv->state = 0;
+  priv->base_state = 0;
+
   g_signal_emit (self, signals[CHANGED], 0, change);
 }
 
+/*<private>
+ * gtk_filter_new_state:
+ *
+ * Creates a state for gtk_filter_changed_with_state() that is
+ * different from all states created before.
+ *
+ * Returns: the new state
+ */
+guint
+gtk_filter_new_state (void)
+{
+  static guint last_state;
+
+  last_state++;
+  if (last_state == 0)
+    last_state++;
+
+  return last_state;
+}
+
+/*<private>
+ * gtk_filter_changed_with_state:
+ * @self: a #GtkFilter
+ * @change: How the filter changed
+ * @state: the new state of @self, or 0 if unknown
+ * @base_state: a state that @self is more strict than, or 0 if unknown
+ *
+ * Like gtk_filter_changed(), but also describes the new state of the
+ * filter. When @self returns to a @state it had before, it matches the
+ * same items as back then, so users of the filter can keep the
+ * results for a few states and reuse them. All items @self matches
+ * now were also matched in @base_state.
+ *
+ * States are created with gtk_filter_new_state() and must not be
+ * reused once the items a state matches may have changed.
+ * gtk_filter_changed() makes the state unknown.
+ *
+ * Use gtk_filter_set_state() to initialize the state of your filter
+ * in your_filter_init().
+ */
+void
+gtk_filter_changed_with_state (GtkFilter       *self,
+                               GtkFilterChange  change,
+                               guint            state,
+                               guint            base_state)
+{
+  g_return_if_fail (GTK_IS_FILTER (self));
+
+  gtk_filter_set_state (self, state, base_state);
+
+  g_signal_emit (self, signals[CHANGED], 0, change);
+}
+
+/*<private>
+ * gtk_filter_set_state:
+ * @self: a #GtkFilter
+ * @state: the state of @self, or 0 if unknown
+ * @base_state: a state that @self is more strict than, or 0 if unknown
+ *
+ * Sets the state like gtk_filter_changed_with_state(), but without
+ * emitting #GtkFilter::changed. This is meant for initializing the
+ * state while the filter is constructed.
+ */
+void
+gtk_filter_set_state (GtkFilter *self,
+                      guint      state,
+                      guint      base_state)
+{
+  GtkFilterPrivate *priv = gtk_filter_get_instance_private (self);
+
+  priv->state = state;
+  priv->base_state = state ? base_state : 0;
+}
+
+/*<private>
+ * gtk_filter_get_state:
+ * @self: a #GtkFilter
+ *
+ * Gets the state set by the last gtk_filter_changed_with_state().
+ *
+ * Returns: the state, or 0 if unknown
+ */
+guint
+gtk_filter_get_state (GtkFilter *self)
+{
+  GtkFilterPrivate *priv = gtk_filter_get_instance_private (self);
+
+  return priv->state;
+}
+
+/*<private>
+ * gtk_filter_get_base_state:
+ * @self: a #GtkFilter
+ *
+ * Gets the base state set by the last gtk_filter_changed_with_state().
+ *
+ * Returns: the base state, or 0 if unknown
+ */
+guint
+gtk_filter_get_base_state (GtkFilter *self)
+{
+  GtkFilterPrivate *priv = gtk_filter_get_instance_private (self);
+
+  return priv->base_state;
+}
+
+
+/*<private>
+ * gtk_filter_class_set_snapshot_func:
+ * @class: the class of a #GtkFilter implementation
+ * @func: the function to create snapshots with
+ *
+ * Makes filters of exactly this class use @func in
+ * gtk_filter_snapshot(). Subclasses need to set it themselves,
+ * they might match items differently.
+ */
+void
+gtk_filter_class_set_snapshot_func (GtkFilterClass        *class,
+                                    GtkFilterSnapshotFunc  func)
+{
+  g_return_if_fail (GTK_IS_FILTER_CLASS (class));
+
+  g_type_set_qdata (G_TYPE_FROM_CLASS (class), quark_snapshot_func, func);
+}
+
+GtkFilterSnapshot *
+gtk_filter_snapshot_alloc (const GtkFilterSnapshotClass *klass,
+                           gsize                         size)
+{
+  GtkFilterSnapshot *self;
+
+  self = g_malloc0 (size);
+  self->klass = klass;
+
+  return self;
+}
+
+void
+gtk_filter_snapshot_free (GtkFilterSnapshot *self)
+{
+  if (self->klass->free)
+    self->klass->free (self);
+
+  g_free (self);
+}
+
+/*<private>
+ * gtk_filter_snapshot:
+ * @self: a #GtkFilter
+ * @items: (array length=n_items): the items to match
+ * @n_items: the number of items
+ *
+ * Captures everything needed to match @items with the current state
+ * of @self. Unlike gtk_filter_match(), the snapshot does not touch
+ * the items or the filter, so it can be matched on other threads.
+ *
+ * Returns: (nullable): the snapshot, or %NULL if @self does not
+ *     support snapshots
+ **/
+GtkFilterSnapshot *
+gtk_filter_snapshot (GtkFilter *self,
+                     gpointer  *items,
+                     guint      n_items)
+{
+  GtkFilterSnapshotFunc func;
+
+  g_return_val_if_fail (GTK_IS_FILTER (self), NULL);
+
+  func = g_type_get_qdata (G_OBJECT_TYPE (self), quark_snapshot_func);
+  if (func == NULL)
+    return NULL;
+
+  return func (self, items, n_items);
+}
+
+typedef struct
+{
+  GtkFilterSnapshot *snapshot;
+  guint n_items;
+  guint8 *results;
+  int next;
+} ParallelMatch;
+
+static void
+match_in_thread (gpointer data)
+{
+  ParallelMatch *match = data;
+  guint n_chunks = (match->n_items + GTK_FILTER_PARALLEL_CHUNK_SIZE - 1) / GTK_FILTER_PARALLEL_CHUNK_SIZE;
+  guint chunk, i, end;
+
+  while ((chunk = g_atomic_int_add (&match->next, 1)) < n_chunks)
+    {
+      end = MIN (match->n_items, (chunk + 1) * GTK_FILTER_PARALLEL_CHUNK_SIZE);
+
+      for (i = chunk * GTK_FILTER_PARALLEL_CHUNK_SIZE; i < end; i++)
+        match->results[i] = gtk_filter_snapshot_match (match->snapshot, i);
+    }
+}
+
+/*<private>
+ * gtk_filter_match_range:
+ * @self: a #GtkFilter
+ * @model: the model containing the items
+ * @items: the positions of the items in @model to match
+ * @matches: the set to add the positions of matching items to
+ *
+ * Matches all @items at once. This gives the same result as calling
+ * gtk_filter_match() for each of them, but the items are looked up as
+ * ranges if @model can lend them, and for many items it takes a snapshot
+ * of them and matches that on the worker threads.
+ **/
+void
+gtk_filter_match_range (GtkFilter  *self,
+                        GListModel *model,
+                        GtkBitset  *items,
+                        GtkBitset  *matches)
+{
+  GtkFilterSnapshot *snapshot;
+  ParallelMatch match;
+  GtkBitsetIter iter;
+  gpointer *objects;
+  guint *positions;
+  guint i, n_items, pos;
+
+  g_return_if_fail (GTK_IS_FILTER (self));
+  g_return_if_fail (G_IS_LIST_MODEL (model));
+
+  n_items = gtk_bitset_get_size (items);
+  if (n_items == 0)
+    return;
+
+  positions = g_new (guint, n_items);
+  objects = g_new (gpointer, n_items);
+
+  for (i = 0, gtk_bitset_iter_init_first (&iter, items, &pos);
+       gtk_bitset_iter_is_valid (&iter);
+       i++, gtk_bitset_iter_next (&iter, &pos))
+    positions[i] = pos;
+
+  gtk_list_model_get_items (model, positions, n_items, objects);
+
+  match.results = g_new (guint8, n_items);
+
+  if (n_items >= 2 * GTK_FILTER_PARALLEL_CHUNK_SIZE &&
+      gdk_parallel_task_get_max_tasks () > 1)
+    snapshot = gtk_filter_snapshot (self, objects, n_items);
+  else
+    snapshot = NULL;
+
+  if (snapshot)
+    {
+      match.snapshot = snapshot;
+      match.n_items = n_items;
+      match.next = 0;
+      gdk_parallel_task_run (match_in_thread,
+                             &match,
+                             MIN (gdk_parallel_task_get_max_tasks (), n_items / GTK_FILTER_PARALLEL_CHUNK_SIZE));
+      gtk_filter_snapshot_free (snapshot);
+    }
+  else
+    {
+      for (i = 0; i < n_items; i++)
+        match.results[i] = gtk_filter_match (self, objects[i]);
+    }
+
+  for (i = 0; i < n_items; i++)
+    {
+      if (match.results[i])
+        gtk_bitset_add (matches, positions[i]);
+    }
+
+  gtk_list_model_release_items (objects, n_items);
+  g_free (match.results);
+  g_free (objects);
+  g_free (positions);
+}
@@ -22,9 +22,13 @@
 #include "gtkfilterlistmodel.h"
 
 #include "gtkbitset.h"
+#include "gtkfilterprivate.h"
 #include "gtkintl.h"
+#include "gtklistmodelprivate.h"
 #include "gtkprivate.h"
 
+#include <string.h>
+
 /**
  * SECTION:gtkfilterlistmodel
  * @title: GtkFilterListModel
@@ -41,6 +45,22 @@
  * gtk_filter_list_model_set_incremental() for details.
  */
 
+/* The number of filter states to keep the matches of
+ *
+ * Filters that describe their state with gtk_filter_changed_with_state()
+ * let us reuse the matches when they go back to a previous state, like
+ * when deleting the last typed character of a search. As the matches
+ * are only valid for the items they were found in, they are dropped
+ * when the items change.
+ */
+#define MAX_CACHED_MATCHES 8
+
+typedef struct
+{
+  guint state;
+  GtkBitset *matches;
+} CachedMatches;
+
 enum {
   PROP_0,
   PROP_FILTER,
@@ -62,6 +82,10 @@ struct _GtkFilterListModel
   GtkBitset *matches; /* NULL if strictness != GTK_FILTER_MATCH_SOME */
   GtkBitset *pending; /* not yet filtered items or NULL if all filtered */
   guint pending_cb; /* idle callback handle */
+
+  guint filter_state; /* state of the filter the matches are for or 0 */
+  CachedMatches cached[MAX_CACHED_MATCHES]; /* most recent first */
+  guint n_cached;
 };
 
 struct _GtkFilterListModelClass
@@ -128,6 +152,59 @@ gtk_filter_list_model_get_item (GListModel *list,
   return g_list_model_get_item (self->model, unfiltered);
 }
 
+static gboolean
+gtk_filter_list_model_peek_items (GListModel *list,
+                                  guint       position,
+                                  guint       n_items,
+                                  gpointer   *items)
+{
+  GtkFilterListModel *self = GTK_FILTER_LIST_MODEL (list);
+  GtkListModelPeekFunc peek_func;
+  GtkBitsetIter iter;
+  guint64 n_matches;
+  guint i, n, start, pos;
+
+  switch (self->strictness)
+    {
+    case GTK_FILTER_MATCH_NONE:
+      return FALSE;
+
+    case GTK_FILTER_MATCH_ALL:
+      return gtk_list_model_peek_items (self->model, position, n_items, items);
+
+    case GTK_FILTER_MATCH_SOME:
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+
+  n_matches = gtk_bitset_get_size (self->matches);
+  if (position > n_matches || n_items > n_matches - position)
+    return FALSE;
+
+  peek_func = gtk_list_model_get_peek_func (self->model);
+  if (peek_func == NULL)
+    return FALSE;
+
+  /* Lend consecutive matches as one range */
+  gtk_bitset_iter_init_at (&iter, self->matches, gtk_bitset_get_nth (self->matches, position), &pos);
+  for (i = 0; i < n_items; i += n)
+    {
+      start = pos;
+      n = 1;
+      while (i + n < n_items &&
+             gtk_bitset_iter_next (&iter, &pos) &&
+             pos == start + n)
+        n++;
+
+      if (!peek_func (self->model, start, n, items + i))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 static void
 gtk_filter_list_model_model_init (GListModelInterface *iface)
 {
@@ -139,51 +216,106 @@ gtk_filter_list_model_model_init (GListModelInterface *iface)
 G_DEFINE_TYPE_WITH_CODE (GtkFilterListModel, gtk_filter_list_model, G_TYPE_OBJECT,
                          G_IMPLEMENT_INTERFACE (G_TYPE_LIST_MODEL, gtk_filter_list_model_model_init))
 
-static gboolean
-gtk_filter_list_model_run_filter_on_item (GtkFilterListModel *self,
-                                          guint               position)
+static void
+gtk_filter_list_model_clear_cached (GtkFilterListModel *self)
 {
-  gpointer item;
-  gboolean visible;
+  guint i;
 
-  /* all other cases should have beeen optimized away */
-  g_assert (self->strictness == GTK_FILTER_MATCH_SOME);
+  for (i = 0; i < self->n_cached; i++)
+    gtk_bitset_unref (self->cached[i].matches);
+  self->n_cached = 0;
+}
+
+static GtkBitset *
+gtk_filter_list_model_lookup_cached (GtkFilterListModel *self,
+                                     guint               state)
+{
+  guint i;
+
+  if (state == 0)
+    return NULL;
+
+  for (i = 0; i < self->n_cached; i++)
+    {
+      if (self->cached[i].state == state)
+        return self->cached[i].matches;
+    }
+
+  return NULL;
+}
+
+/* Call when all items have been filtered */
+static void
+gtk_filter_list_model_cache_matches (GtkFilterListModel *self)
+{
+  CachedMatches entry;
+  guint i;
+
+  if (self->filter_state == 0 ||
+      self->strictness != GTK_FILTER_MATCH_SOME ||
+      self->pending != NULL)
+    return;
 
-  item = g_list_model_get_item (self->model, position);
-  visible = gtk_filter_match (self->filter, item);
-  g_object_unref (item);
+  for (i = 0; i < self->n_cached; i++)
+    {
+      if (self->cached[i].state == self->filter_state)
+        break;
+    }
 
-  return visible;
+  if (i < self->n_cached)
+    {
+      gtk_bitset_unref (self->cached[i].matches);
+    }
+  else if (self->n_cached == MAX_CACHED_MATCHES)
+    {
+      i = MAX_CACHED_MATCHES - 1;
+      gtk_bitset_unref (self->cached[i].matches);
+    }
+  else
+    {
+      i = self->n_cached++;
+    }
+
+  entry.state = self->filter_state;
+  entry.matches = gtk_bitset_copy (self->matches);
+  memmove (&self->cached[1], &self->cached[0], i * sizeof (CachedMatches));
+  self->cached[0] = entry;
 }
 
 static void
 gtk_filter_list_model_run_filter (GtkFilterListModel *self,
                                   guint               n_steps)
 {
-  GtkBitsetIter iter;
-  guint i, pos;
-  gboolean more;
-
   g_return_if_fail (GTK_IS_FILTER_LIST_MODEL (self));
-  
+  g_return_if_fail (n_steps > 0);
+
   if (self->pending == NULL)
     return;
 
-  for (i = 0, more = gtk_bitset_iter_init_first (&iter, self->pending, &pos);
-       i < n_steps && more;
-       i++, more = gtk_bitset_iter_next (&iter, &pos))
+  /* all other cases should have beeen optimized away */
+  g_assert (self->strictness == GTK_FILTER_MATCH_SOME);
+
+  if (n_steps >= gtk_bitset_get_size (self->pending))
     {
-      if (gtk_filter_list_model_run_filter_on_item (self, pos))
-        gtk_bitset_add (self->matches, pos);
+      gtk_filter_match_range (self->filter, self->model, self->pending, self->matches);
+      g_clear_pointer (&self->pending, gtk_bitset_unref);
+      gtk_filter_list_model_cache_matches (self);
     }
-
-  if (more)
-    gtk_bitset_remove_range_closed (self->pending, 0, pos - 1);
   else
-    g_clear_pointer (&self->pending, gtk_bitset_unref);
-  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PENDING]);
+    {
+      guint last = gtk_bitset_get_nth (self->pending, n_steps - 1);
+      GtkBitset *batch;
 
-  return;
+      /* There are more items after @last, so it isn't G_MAXUINT */
+      batch = gtk_bitset_copy (self->pending);
+      gtk_bitset_remove_range_closed (batch, last + 1, G_MAXUINT);
+      gtk_filter_match_range (self->filter, self->model, batch, self->matches);
+      gtk_bitset_unref (batch);
+
+      gtk_bitset_remove_range_closed (self->pending, 0, last);
+    }
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PENDING]);
 }
 
 static void
@@ -221,14 +353,42 @@ gtk_filter_list_model_emit_items_changed_for_changes (GtkFilterListModel *self,
   gtk_bitset_unref (old);
 }
 
+/* How long one idle step of incremental filtering may take, and how
+ * many items it matches before it knows how fast the filter is */
+#define INCREMENTAL_STEP_TIME (G_USEC_PER_SEC / 200)
+#define INCREMENTAL_MIN_BATCH 512
+
 static gboolean
 gtk_filter_list_model_run_filter_cb (gpointer data)
 {
   GtkFilterListModel *self = data;
   GtkBitset *old;
+  gint64 start, elapsed;
+  guint64 n_steps, n_matched;
 
   old = gtk_bitset_copy (self->matches);
-  gtk_filter_list_model_run_filter (self, 512);
+
+  /* Batches go through gtk_filter_match_range(), so fast filters get
+   * big batches that can be matched on the worker threads */
+  start = g_get_monotonic_time ();
+  n_steps = INCREMENTAL_MIN_BATCH;
+  n_matched = 0;
+  while (TRUE)
+    {
+      gtk_filter_list_model_run_filter (self, n_steps);
+      n_matched += n_steps;
+
+      if (self->pending == NULL)
+        break;
+
+      elapsed = g_get_monotonic_time () - start;
+      if (elapsed >= INCREMENTAL_STEP_TIME)
+        break;
+
+      /* Fill the rest of the step at the speed we had so far */
+      n_steps = (INCREMENTAL_STEP_TIME - elapsed) * n_matched / MAX (elapsed, 1);
+      n_steps = CLAMP (n_steps, INCREMENTAL_MIN_BATCH, G_MAXUINT);
+    }
 
   if (self->pending == NULL)
     gtk_filter_list_model_stop_filtering (self);
@@ -281,6 +441,8 @@ gtk_filter_list_model_items_changed_cb (GListModel         *model,
 {
   guint filter_removed, filter_added;
 
+  gtk_filter_list_model_clear_cached (self);
+
   switch (self->strictness)
     {
     case GTK_FILTER_MATCH_NONE:
@@ -391,6 +553,7 @@ gtk_filter_list_model_clear_model (GtkFilterListModel *self)
   g_clear_object (&self->model);
   if (self->matches)
     gtk_bitset_remove_all (self->matches);
+  gtk_filter_list_model_clear_cached (self);
 }
 
 static void
@@ -476,7 +639,8 @@ gtk_filter_list_model_refilter (GtkFilterListModel *self,
 
     case GTK_FILTER_MATCH_SOME:
       {
-        GtkBitset *old, *pending;
+        GtkBitset *old, *pending, *cached, *base;
+        guint state;
       
         if (self->matches == NULL)
           {
@@ -490,6 +654,24 @@ gtk_filter_list_model_refilter (GtkFilterListModel *self,
             old = self->matches;
           }
         self->strictness = new_strictness;
+
+        state = gtk_filter_get_state (self->filter);
+        if (state == 0)
+          gtk_filter_list_model_clear_cached (self);
+        self->filter_state = state;
+
+        cached = gtk_filter_list_model_lookup_cached (self, state);
+        if (cached)
+          {
+            gtk_filter_list_model_stop_filtering (self);
+            self->matches = gtk_bitset_copy (cached);
+            gtk_filter_list_model_emit_items_changed_for_changes (self, old);
+            break;
+          }
+
+        /* The filter doesn't match anything outside of the matches of the base */
+        base = gtk_filter_list_model_lookup_cached (self, gtk_filter_get_base_state (self->filter));
+
         switch (change)
           {
           default:
@@ -497,19 +679,28 @@ gtk_filter_list_model_refilter (GtkFilterListModel *self,
             /* fall thru */
           case GTK_FILTER_CHANGE_DIFFERENT:
             self->matches = gtk_bitset_new_empty ();
-            pending = gtk_bitset_new_range (0, g_list_model_get_n_items (self->model));
+            if (base)
+              pending = gtk_bitset_copy (base);
+            else
+              pending = gtk_bitset_new_range (0, g_list_model_get_n_items (self->model));
             break;
           case GTK_FILTER_CHANGE_LESS_STRICT:
             self->matches = gtk_bitset_copy (old);
-            pending = gtk_bitset_new_range (0, g_list_model_get_n_items (self->model));
+            if (base)
+              pending = gtk_bitset_copy (base);
+            else
+              pending = gtk_bitset_new_range (0, g_list_model_get_n_items (self->model));
             gtk_bitset_subtract (pending, self->matches);
             break;
           case GTK_FILTER_CHANGE_MORE_STRICT:
             self->matches = gtk_bitset_new_empty ();
             pending = gtk_bitset_copy (old);
+            if (base)
+              gtk_bitset_intersect (pending, base);
             break;
           }
         gtk_filter_list_model_start_filtering (self, pending);
+        gtk_filter_list_model_cache_matches (self);
 
         gtk_filter_list_model_emit_items_changed_for_changes (self, old);
       }
@@ -532,6 +723,8 @@ gtk_filter_list_model_clear_filter (GtkFilterListModel *self)
 
   g_signal_handlers_disconnect_by_func (self->filter, gtk_filter_list_model_filter_changed_cb, self);
   g_clear_object (&self->filter);
+  gtk_filter_list_model_clear_cached (self);
+  self->filter_state = 0;
 }
 
 static void
@@ -555,6 +748,8 @@ gtk_filter_list_model_class_init (GtkFilterListModelClass *class)
   gobject_class->get_property = gtk_filter_list_model_get_property;
   gobject_class->dispose = gtk_filter_list_model_dispose;
 
+  gtk_list_model_set_peek_func (G_TYPE_FROM_CLASS (class), gtk_filter_list_model_peek_items);
+
   /**
    * GtkFilterListModel:filter:
    *
@@ -779,7 +974,8 @@ gtk_filter_list_model_get_model (GtkFilterListModel *self)
  * run filters immediately, but will instead queue an idle handler that
  * incrementally filters the items and adds them to the list. This of course
  * means that items are not instantly added to the list, but only appear
- * incrementally.
+ * incrementally. Every step of it filters as many items as it can in a few
+ * milliseconds.
  *
  * When your filter blocks the UI while filtering, you might consider
  * turning this on. Depending on your model and filters, this may become
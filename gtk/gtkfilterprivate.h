@@ -0,0 +1,84 @@
+/*
+ * Copyright © 2020 Benjamin Otte
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GTK_FILTER_PRIVATE_H__
+#define __GTK_FILTER_PRIVATE_H__
+
+#include <gtk/gtkbitset.h>
+#include <gtk/gtkfilter.h>
+
+typedef struct _GtkFilterSnapshot GtkFilterSnapshot;
+typedef struct _GtkFilterSnapshotClass GtkFilterSnapshotClass;
+
+struct _GtkFilterSnapshot
+{
+  const GtkFilterSnapshotClass *klass;
+};
+
+struct _GtkFilterSnapshotClass
+{
+  /* optional */
+  void                  (* free)                                (GtkFilterSnapshot      *self);
+
+  /* may be called from other threads */
+  gboolean              (* match)                               (GtkFilterSnapshot      *self,
+                                                                 guint                   i);
+};
+
+/* Called on the main thread with the items that will be matched,
+ * returns %NULL if the items can't be matched with a snapshot */
+typedef GtkFilterSnapshot * (* GtkFilterSnapshotFunc)   (GtkFilter              *self,
+                                                         gpointer               *items,
+                                                         guint                   n_items);
+
+guint                   gtk_filter_new_state                    (void);
+void                    gtk_filter_changed_with_state           (GtkFilter              *self,
+                                                                 GtkFilterChange         change,
+                                                                 guint                   state,
+                                                                 guint                   base_state);
+void                    gtk_filter_set_state                    (GtkFilter              *self,
+                                                                 guint                   state,
+                                                                 guint                   base_state);
+guint                   gtk_filter_get_state                    (GtkFilter              *self);
+guint                   gtk_filter_get_base_state               (GtkFilter              *self);
+
+void                    gtk_filter_class_set_snapshot_func      (GtkFilterClass         *class,
+                                                                 GtkFilterSnapshotFunc   func);
+
+GtkFilterSnapshot *     gtk_filter_snapshot_alloc               (const GtkFilterSnapshotClass *klass,
+                                                                 gsize                   size);
+#define gtk_filter_snapshot_new(_name, _klass) \
+    ((_name *) gtk_filter_snapshot_alloc ((_klass), sizeof (_name)))
+void                    gtk_filter_snapshot_free                (GtkFilterSnapshot      *self);
+
+GtkFilterSnapshot *     gtk_filter_snapshot                     (GtkFilter              *self,
+                                                                 gpointer               *items,
+                                                                 guint                   n_items);
+
+void                    gtk_filter_match_range                  (GtkFilter              *self,
+                                                                 GListModel             *model,
+                                                                 GtkBitset              *items,
+                                                                 GtkBitset              *matches);
+
+static inline gboolean
+gtk_filter_snapshot_match (GtkFilterSnapshot *self,
+                           guint              i)
+{
+  return self->klass->match (self, i);
+}
+
+#endif /* __GTK_FILTER_PRIVATE_H__ */
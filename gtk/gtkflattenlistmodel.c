@@ -23,6 +23,7 @@
 
 #include "gtkrbtreeprivate.h"
 #include "gtkintl.h"
+#include "gtklistmodelprivate.h"
 #include "gtkprivate.h"
 
 /**
@@ -194,6 +195,40 @@ gtk_flatten_list_model_get_item (GListModel *list,
   return g_list_model_get_item (node->model, model_pos);
 }
 
+static gboolean
+gtk_flatten_list_model_peek_items (GListModel *list,
+                                   guint       position,
+                                   guint       n_items,
+                                   gpointer   *items)
+{
+  GtkFlattenListModel *self = GTK_FLATTEN_LIST_MODEL (list);
+  FlattenNode *node;
+  guint model_pos, n;
+
+  if (!self->items)
+    return FALSE;
+
+  node = gtk_flatten_list_model_get_nth (self->items, position, &model_pos);
+
+  while (n_items > 0)
+    {
+      if (node == NULL)
+        return FALSE;
+
+      n = MIN (n_items, g_list_model_get_n_items (node->model) - model_pos);
+      if (n > 0 &&
+          !gtk_list_model_peek_items (node->model, model_pos, n, items))
+        return FALSE;
+
+      items += n;
+      n_items -= n;
+      model_pos = 0;
+      node = gtk_rb_tree_node_get_next (node);
+    }
+
+  return TRUE;
+}
+
 static void
 gtk_flatten_list_model_model_init (GListModelInterface *iface)
 {
@@ -403,6 +438,8 @@ gtk_flatten_list_model_class_init (GtkFlattenListModelClass *class)
   gobject_class->get_property = gtk_flatten_list_model_get_property;
   gobject_class->dispose = gtk_flatten_list_model_dispose;
 
+  gtk_list_model_set_peek_func (G_TYPE_FROM_CLASS (class), gtk_flatten_list_model_peek_items);
+
   /**
    * GtkFlattenListModel:model:
    *
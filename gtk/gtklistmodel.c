@@ -0,0 +1,181 @@
+/*
+ * Copyright © 2020 GNOME Foundation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "gtklistmodelprivate.h"
+
+/* Borrowed items
+ *
+ * g_list_model_get_item() returns a new reference, so scanning a big
+ * model with it refs and unrefs every item, and models stacked on top
+ * of each other look up every item again in every layer.
+ *
+ * Models that own their items can lend them instead: they fill in an
+ * array for a whole range of positions without taking references.
+ * Models that wrap another model forward the ranges to it. The items
+ * are only valid until the model changes, so callers must not keep
+ * them and must not run code that could change the model while using
+ * them.
+ *
+ * Filters, sorters and expressions can run application code that
+ * might change the model, so gtk_list_model_get_items() still takes
+ * a reference on every item it got lent before handing them out.
+ * That saves the lookups in every layer, but not the references.
+ *
+ * Models that create their items on demand, like #GtkMapListModel
+ * with a map function, can't lend them and callers fall back to
+ * g_list_model_get_item().
+ */
+
+static G_DEFINE_QUARK (gtk-list-model-peek-func, gtk_list_model_peek_func)
+
+/*
+ * gtk_list_model_set_peek_func:
+ * @type: a type implementing #GListModel
+ * @func: the function lending the items of @type
+ *
+ * Makes @type lend its items with gtk_list_model_peek_items().
+ * This is not inherited by subtypes.
+ */
+void
+gtk_list_model_set_peek_func (GType                type,
+                              GtkListModelPeekFunc func)
+{
+  g_return_if_fail (g_type_is_a (type, G_TYPE_LIST_MODEL));
+
+  g_type_set_qdata (type, gtk_list_model_peek_func_quark (), func);
+}
+
+/*
+ * gtk_list_model_get_peek_func:
+ * @model: a #GListModel
+ *
+ * Gets the function to lend the items of @model, so callers
+ * lending single items in a loop only need to look it up once.
+ *
+ * Returns: (nullable): the function or %NULL if @model can't
+ *     lend its items
+ */
+GtkListModelPeekFunc
+gtk_list_model_get_peek_func (GListModel *model)
+{
+  g_return_val_if_fail (G_IS_LIST_MODEL (model), NULL);
+
+  return g_type_get_qdata (G_OBJECT_TYPE (model), gtk_list_model_peek_func_quark ());
+}
+
+/*
+ * gtk_list_model_peek_items:
+ * @model: a #GListModel
+ * @position: the first position
+ * @n_items: the number of items
+ * @items: (out caller-allocates) (array length=n_items): the items
+ *
+ * Fills @items with the items from @position to @position + @n_items
+ * without taking references. The items must not be used after
+ * @model changes.
+ *
+ * Returns: %TRUE if @items was filled, %FALSE if @model can't lend
+ *     its items or the range is out of bounds
+ */
+gboolean
+gtk_list_model_peek_items (GListModel *model,
+                           guint       position,
+                           guint       n_items,
+                           gpointer   *items)
+{
+  GtkListModelPeekFunc func;
+
+  func = gtk_list_model_get_peek_func (model);
+  if (func == NULL)
+    return FALSE;
+
+  if (n_items == 0)
+    return TRUE;
+
+  return func (model, position, n_items, items);
+}
+
+/*
+ * gtk_list_model_get_items:
+ * @model: a #GListModel
+ * @positions: (array length=n_items): the positions of the items,
+ *     in ascending order
+ * @n_items: the number of items
+ * @items: (out caller-allocates) (array length=n_items): the items
+ *
+ * Fills @items with new references to the items at @positions, like
+ * calling g_list_model_get_item() for each of them. If @model can
+ * lend its items, they are looked up as ranges. Use
+ * gtk_list_model_release_items() when done.
+ */
+void
+gtk_list_model_get_items (GListModel  *model,
+                          const guint *positions,
+                          guint        n_items,
+                          gpointer    *items)
+{
+  GtkListModelPeekFunc func;
+  guint i, start;
+
+  g_return_if_fail (G_IS_LIST_MODEL (model));
+
+  func = gtk_list_model_get_peek_func (model);
+  if (func)
+    {
+      /* Lend consecutive positions as one range */
+      for (start = 0; start < n_items; start = i)
+        {
+          for (i = start + 1; i < n_items; i++)
+            {
+              if (positions[i] != positions[i - 1] + 1)
+                break;
+            }
+
+          if (!func (model, positions[start], i - start, items + start))
+            break;
+        }
+
+      if (start >= n_items)
+        {
+          for (i = 0; i < n_items; i++)
+            g_object_ref (items[i]);
+          return;
+        }
+    }
+
+  for (i = 0; i < n_items; i++)
+    items[i] = g_list_model_get_item (model, positions[i]);
+}
+
+/*
+ * gtk_list_model_release_items:
+ * @items: (array length=n_items): the items from gtk_list_model_get_items()
+ * @n_items: the number of items
+ *
+ * Drops the references gtk_list_model_get_items() took.
+ */
+void
+gtk_list_model_release_items (gpointer *items,
+                              guint     n_items)
+{
+  guint i;
+
+  for (i = 0; i < n_items; i++)
+    g_clear_object (&items[i]);
+}
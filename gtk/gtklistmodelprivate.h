@@ -0,0 +1,49 @@
+/*
+ * Copyright © 2020 GNOME Foundation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GTK_LIST_MODEL_PRIVATE_H__
+#define __GTK_LIST_MODEL_PRIVATE_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* Fills @items with the @n_items items starting at @position without
+ * taking references, returns %FALSE if the model can't lend them */
+typedef gboolean (* GtkListModelPeekFunc)               (GListModel             *model,
+                                                         guint                   position,
+                                                         guint                   n_items,
+                                                         gpointer               *items);
+
+void                    gtk_list_model_set_peek_func            (GType                   type,
+                                                                 GtkListModelPeekFunc    func);
+GtkListModelPeekFunc    gtk_list_model_get_peek_func            (GListModel             *model);
+
+gboolean                gtk_list_model_peek_items               (GListModel             *model,
+                                                                 guint                   position,
+                                                                 guint                   n_items,
+                                                                 gpointer               *items);
+void                    gtk_list_model_get_items                (GListModel             *model,
+                                                                 const guint            *positions,
+                                                                 guint                   n_items,
+                                                                 gpointer               *items);
+void                    gtk_list_model_release_items            (gpointer               *items,
+                                                                 guint                   n_items);
+
+G_END_DECLS
+
+#endif /* __GTK_LIST_MODEL_PRIVATE_H__ */
@@ -23,6 +23,7 @@
 
 #include "gtkrbtreeprivate.h"
 #include "gtkintl.h"
+#include "gtklistmodelprivate.h"
 #include "gtkprivate.h"
 
 /**
@@ -200,6 +201,24 @@ gtk_map_list_model_get_item (GListModel *list,
   return node->item;
 }
 
+static gboolean
+gtk_map_list_model_peek_items (GListModel *list,
+                               guint       position,
+                               guint       n_items,
+                               gpointer   *items)
+{
+  GtkMapListModel *self = GTK_MAP_LIST_MODEL (list);
+
+  if (self->model == NULL)
+    return FALSE;
+
+  /* Mapped items are only kept alive by their users */
+  if (self->items != NULL)
+    return FALSE;
+
+  return gtk_list_model_peek_items (self->model, position, n_items, items);
+}
+
 static void
 gtk_map_list_model_model_init (GListModelInterface *iface)
 {
@@ -353,6 +372,8 @@ gtk_map_list_model_class_init (GtkMapListModelClass *class)
   gobject_class->get_property = gtk_map_list_model_get_property;
   gobject_class->dispose = gtk_map_list_model_dispose;
 
+  gtk_list_model_set_peek_func (G_TYPE_FROM_CLASS (class), gtk_map_list_model_peek_items);
+
   /**
    * GtkMapListModel:has-map:
    *
@@ -22,9 +22,12 @@
 #include "gtkmultifilter.h"
 
 #include "gtkbuildable.h"
+#include "gtkfilterprivate.h"
 #include "gtkintl.h"
 #include "gtktypebuiltins.h"
 
+#include <string.h>
+
 #define GDK_ARRAY_TYPE_NAME GtkFilters
 #define GDK_ARRAY_NAME gtk_filters
 #define GDK_ARRAY_ELEMENT_TYPE GtkFilter *
@@ -48,11 +51,25 @@
  * GtkEveryFilter is a subclass of GtkMultiFilter that matches an item
  * when each of its filters matches.
  */
+/* The number of combinations of the states of the filters to
+ * remember, see gtk_multi_filter_changed() */
+#define MAX_STATE_HISTORY 16
+
+typedef struct
+{
+  guint *child_states;
+  guint n_children;
+  guint state;
+} ChildStates;
+
 struct _GtkMultiFilter
 {
   GtkFilter parent_instance;
 
   GtkFilters filters;
+
+  ChildStates history[MAX_STATE_HISTORY]; /* most recent first */
+  guint n_history;
 };
 
 struct _GtkMultiFilterClass
@@ -123,12 +140,143 @@ G_DEFINE_ABSTRACT_TYPE_WITH_CODE (GtkMultiFilter, gtk_multi_filter, GTK_TYPE_FIL
                                   G_IMPLEMENT_INTERFACE (G_TYPE_LIST_MODEL, gtk_multi_filter_list_model_init)
                                   G_IMPLEMENT_INTERFACE (GTK_TYPE_BUILDABLE, gtk_multi_filter_buildable_init))
 
+static void
+gtk_multi_filter_clear_history (GtkMultiFilter *self)
+{
+  guint i;
+
+  for (i = 0; i < self->n_history; i++)
+    g_free (self->history[i].child_states);
+  self->n_history = 0;
+}
+
+/* Returns the position of @child_states in the history, or
+ * n_history if it isn't there */
+static guint
+gtk_multi_filter_find_history (GtkMultiFilter *self,
+                               const guint    *child_states,
+                               guint           n_children)
+{
+  guint i;
+
+  for (i = 0; i < self->n_history; i++)
+    {
+      if (self->history[i].n_children == n_children &&
+          memcmp (self->history[i].child_states, child_states, n_children * sizeof (guint)) == 0)
+        break;
+    }
+
+  return i;
+}
+
+/* Returns the state for @child_states and moves it to the front */
+static guint
+gtk_multi_filter_lookup_state (GtkMultiFilter *self,
+                               const guint    *child_states,
+                               guint           n_children)
+{
+  ChildStates entry;
+  guint i;
+
+  i = gtk_multi_filter_find_history (self, child_states, n_children);
+  if (i < self->n_history)
+    {
+      entry = self->history[i];
+    }
+  else
+    {
+      if (self->n_history == MAX_STATE_HISTORY)
+        {
+          self->n_history--;
+          g_free (self->history[self->n_history].child_states);
+        }
+
+      entry.child_states = g_memdup (child_states, n_children * sizeof (guint));
+      entry.n_children = n_children;
+      entry.state = gtk_filter_new_state ();
+      i = self->n_history++;
+    }
+
+  memmove (&self->history[1], &self->history[0], i * sizeof (ChildStates));
+  self->history[0] = entry;
+
+  return entry.state;
+}
+
+/* The state of a multi filter is the combination of the states of
+ * its filters. If @child changed to a state that is more strict than
+ * its base state, the multi filter is more strict than the
+ * combination with that base state, for both any and every filters.
+ *
+ * Returns %FALSE if the state of one of the filters is unknown.
+ */
+static gboolean
+gtk_multi_filter_compute_state (GtkMultiFilter *self,
+                                GtkFilter      *child,
+                                guint          *state,
+                                guint          *base_state)
+{
+  guint n_children = gtk_filters_get_size (&self->filters);
+  guint *child_states;
+  guint child_base_state;
+  guint i;
+
+  child_states = g_new (guint, MAX (n_children, 1));
+
+  for (i = 0; i < n_children; i++)
+    {
+      child_states[i] = gtk_filter_get_state (gtk_filters_get (&self->filters, i));
+      if (child_states[i] == 0)
+        break;
+    }
+
+  if (i < n_children)
+    {
+      g_free (child_states);
+      return FALSE;
+    }
+
+  *state = gtk_multi_filter_lookup_state (self, child_states, n_children);
+
+  *base_state = 0;
+  child_base_state = child ? gtk_filter_get_base_state (child) : 0;
+  if (child_base_state != 0)
+    {
+      for (i = 0; i < n_children; i++)
+        {
+          if (gtk_filters_get (&self->filters, i) == child)
+            child_states[i] = child_base_state;
+        }
+
+      i = gtk_multi_filter_find_history (self, child_states, n_children);
+      if (i < self->n_history)
+        *base_state = self->history[i].state;
+    }
+
+  g_free (child_states);
+
+  return TRUE;
+}
+
+static void
+gtk_multi_filter_changed (GtkMultiFilter  *self,
+                          GtkFilterChange  change,
+                          GtkFilter       *child)
+{
+  guint state, base_state;
+
+  if (gtk_multi_filter_compute_state (self, child, &state, &base_state))
+    gtk_filter_changed_with_state (GTK_FILTER (self), change, state, base_state);
+  else
+    gtk_filter_changed (GTK_FILTER (self), change);
+}
+
 static void
 gtk_multi_filter_changed_cb (GtkFilter       *filter,
                              GtkFilterChange  change,
                              GtkMultiFilter  *self)
 {
-  gtk_filter_changed (GTK_FILTER (self), change);
+  gtk_multi_filter_changed (self, change, filter);
 }
 
 static void
@@ -144,6 +292,7 @@ gtk_multi_filter_dispose (GObject *object)
     }
 
   gtk_filters_clear (&self->filters);
+  gtk_multi_filter_clear_history (self);
 
   G_OBJECT_CLASS (gtk_multi_filter_parent_class)->dispose (object);
 }
@@ -159,7 +308,12 @@ gtk_multi_filter_class_init (GtkMultiFilterClass *class)
 static void
 gtk_multi_filter_init (GtkMultiFilter *self)
 {
+  guint state, base_state;
+
   gtk_filters_init (&self->filters);
+
+  if (gtk_multi_filter_compute_state (self, NULL, &state, &base_state))
+    gtk_filter_set_state (GTK_FILTER (self), state, base_state);
 }
 
 /**
@@ -179,8 +333,9 @@ gtk_multi_filter_append (GtkMultiFilter *self,
   g_signal_connect (filter, "changed", G_CALLBACK (gtk_multi_filter_changed_cb), self);
   gtk_filters_append (&self->filters, filter);
 
-  gtk_filter_changed (GTK_FILTER (self),
-                      GTK_MULTI_FILTER_GET_CLASS (self)->addition_change);
+  gtk_multi_filter_changed (self,
+                            GTK_MULTI_FILTER_GET_CLASS (self)->addition_change,
+                            NULL);
 }
 
 /**
@@ -208,8 +363,83 @@ gtk_multi_filter_remove (GtkMultiFilter *self,
   g_signal_handlers_disconnect_by_func (filter, gtk_multi_filter_changed_cb, self);
   gtk_filters_splice (&self->filters, position, 1, FALSE, NULL, 0);
 
-  gtk_filter_changed (GTK_FILTER (self),
-                      GTK_MULTI_FILTER_GET_CLASS (self)->removal_change);
+  gtk_multi_filter_changed (self,
+                            GTK_MULTI_FILTER_GET_CLASS (self)->removal_change,
+                            NULL);
+}
+
+/* Combines snapshots of all the filters, so it only works
+ * if all of them support snapshots */
+typedef struct
+{
+  GtkFilterSnapshot snapshot;
+
+  gboolean any;
+  guint n_children;
+  GtkFilterSnapshot **children;
+} GtkMultiFilterSnapshot;
+
+static void
+gtk_multi_filter_snapshot_free (GtkFilterSnapshot *snapshot)
+{
+  GtkMultiFilterSnapshot *self = (GtkMultiFilterSnapshot *) snapshot;
+  guint i;
+
+  for (i = 0; i < self->n_children; i++)
+    {
+      if (self->children[i])
+        gtk_filter_snapshot_free (self->children[i]);
+    }
+  g_free (self->children);
+}
+
+static gboolean
+gtk_multi_filter_snapshot_match (GtkFilterSnapshot *snapshot,
+                                 guint              i)
+{
+  GtkMultiFilterSnapshot *self = (GtkMultiFilterSnapshot *) snapshot;
+  guint j;
+
+  for (j = 0; j < self->n_children; j++)
+    {
+      if (gtk_filter_snapshot_match (self->children[j], i) == self->any)
+        return self->any;
+    }
+
+  return !self->any;
+}
+
+static const GtkFilterSnapshotClass GTK_MULTI_FILTER_SNAPSHOT_CLASS =
+{
+  gtk_multi_filter_snapshot_free,
+  gtk_multi_filter_snapshot_match,
+};
+
+static GtkFilterSnapshot *
+gtk_multi_filter_snapshot (GtkMultiFilter *self,
+                           gboolean        any,
+                           gpointer       *items,
+                           guint           n_items)
+{
+  GtkMultiFilterSnapshot *result;
+  guint i;
+
+  result = gtk_filter_snapshot_new (GtkMultiFilterSnapshot, &GTK_MULTI_FILTER_SNAPSHOT_CLASS);
+  result->any = any;
+  result->n_children = gtk_filters_get_size (&self->filters);
+  result->children = g_new0 (GtkFilterSnapshot *, result->n_children);
+
+  for (i = 0; i < result->n_children; i++)
+    {
+      result->children[i] = gtk_filter_snapshot (gtk_filters_get (&self->filters, i), items, n_items);
+      if (result->children[i] == NULL)
+        {
+          gtk_filter_snapshot_free ((GtkFilterSnapshot *) result);
+          return NULL;
+        }
+    }
+
+  return (GtkFilterSnapshot *) result;
 }
 
 /*** ANY FILTER ***/
@@ -244,6 +474,14 @@ gtk_any_filter_match (GtkFilter *filter,
   return FALSE;
 }
 
+static GtkFilterSnapshot *
+gtk_any_filter_snapshot (GtkFilter *filter,
+                         gpointer  *items,
+                         guint      n_items)
+{
+  return gtk_multi_filter_snapshot (GTK_MULTI_FILTER (filter), TRUE, items, n_items);
+}
+
 static GtkFilterMatch
 gtk_any_filter_get_strictness (GtkFilter *filter)
 {
@@ -284,6 +522,7 @@ gtk_any_filter_class_init (GtkAnyFilterClass *class)
 
   filter_class->match = gtk_any_filter_match;
   filter_class->get_strictness = gtk_any_filter_get_strictness;
+  gtk_filter_class_set_snapshot_func (filter_class, gtk_any_filter_snapshot);
 }
 
 static void
@@ -342,6 +581,14 @@ gtk_every_filter_match (GtkFilter *filter,
   return TRUE;
 }
 
+static GtkFilterSnapshot *
+gtk_every_filter_snapshot (GtkFilter *filter,
+                           gpointer  *items,
+                           guint      n_items)
+{
+  return gtk_multi_filter_snapshot (GTK_MULTI_FILTER (filter), FALSE, items, n_items);
+}
+
 static GtkFilterMatch
 gtk_every_filter_get_strictness (GtkFilter *filter)
 {
@@ -382,6 +629,7 @@ gtk_every_filter_class_init (GtkEveryFilterClass *class)
 
   filter_class->match = gtk_every_filter_match;
   filter_class->get_strictness = gtk_every_filter_get_strictness;
+  gtk_filter_class_set_snapshot_func (filter_class, gtk_every_filter_snapshot);
 }
 
 static void
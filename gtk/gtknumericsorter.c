@@ -328,6 +328,7 @@ gtk_numeric_sort_keys_new (GtkNumericSorter *self)
       return gtk_sort_keys_new_equal ();
     }
 
+  result->keys.threadsafe = TRUE;
   result->expression = gtk_expression_ref (self->expression);
 
   return (GtkSortKeys *) result;
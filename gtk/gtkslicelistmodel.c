@@ -22,6 +22,7 @@
 #include "gtkslicelistmodel.h"
 
 #include "gtkintl.h"
+#include "gtklistmodelprivate.h"
 #include "gtkprivate.h"
 
 /**
@@ -106,6 +107,23 @@ gtk_slice_list_model_get_item (GListModel *list,
   return g_list_model_get_item (self->model, position + self->offset);
 }
 
+static gboolean
+gtk_slice_list_model_peek_items (GListModel *list,
+                                 guint       position,
+                                 guint       n_items,
+                                 gpointer   *items)
+{
+  GtkSliceListModel *self = GTK_SLICE_LIST_MODEL (list);
+
+  if (self->model == NULL)
+    return FALSE;
+
+  if (position > self->size || n_items > self->size - position)
+    return FALSE;
+
+  return gtk_list_model_peek_items (self->model, position + self->offset, n_items, items);
+}
+
 static void
 gtk_slice_list_model_model_init (GListModelInterface *iface)
 {
@@ -254,6 +272,8 @@ gtk_slice_list_model_class_init (GtkSliceListModelClass *class)
   gobject_class->get_property = gtk_slice_list_model_get_property;
   gobject_class->dispose = gtk_slice_list_model_dispose;
 
+  gtk_list_model_set_peek_func (G_TYPE_FROM_CLASS (class), gtk_slice_list_model_peek_items);
+
   /**
    * GtkSliceListModel:model:
    *
@@ -95,6 +95,14 @@ gtk_sort_keys_needs_clear_key (GtkSortKeys *self)
   return self->klass->clear_key != NULL;
 }
 
+/* Keys can be compared on other threads if they only look at the
+ * key memory, see gtk_sort_list_model_sort_parallel() */
+gboolean
+gtk_sort_keys_is_threadsafe (GtkSortKeys *self)
+{
+  return self->threadsafe;
+}
+
 static void
 gtk_equal_sort_keys_free (GtkSortKeys *keys)
 {
@@ -143,8 +151,13 @@ static const GtkSortKeysClass GTK_EQUAL_SORT_KEYS_CLASS =
 GtkSortKeys *
 gtk_sort_keys_new_equal (void)
 {
-  return gtk_sort_keys_new (GtkSortKeys,
-                            &GTK_EQUAL_SORT_KEYS_CLASS,
-                            0, 1);
+  GtkSortKeys *result;
+
+  result = gtk_sort_keys_new (GtkSortKeys,
+                              &GTK_EQUAL_SORT_KEYS_CLASS,
+                              0, 1);
+  result->threadsafe = TRUE;
+
+  return result;
 }
 
@@ -23,9 +23,13 @@
 
 #include "gtkbitset.h"
 #include "gtkintl.h"
+#include "gtklistmodelprivate.h"
 #include "gtkprivate.h"
 #include "gtksorterprivate.h"
 #include "timsort/gtktimsortprivate.h"
+#include "gdk/gdkparalleltaskprivate.h"
+
+#include <string.h>
 
 /* The maximum amount of items to merge for a single merge step
  *
@@ -52,6 +56,19 @@
  */
 #define GTK_SORT_STEP_TIME_US (1000) /* 1 millisecond */
 
+/* The minimum amount of items per thread when sorting in parallel
+ *
+ * Below this, starting the threads costs more than sorting on one.
+ */
+#define GTK_SORT_MIN_PARALLEL_ITEMS (16 * 1024)
+
+/* The amount of items we create sort keys for at once
+ *
+ * The items are fetched together, which is a lot cheaper when the model
+ * can lend them. We only check the time after every chunk though.
+ */
+#define GTK_SORT_KEYS_CHUNK_SIZE (128)
+
 /**
  * SECTION:gtksortlistmodel
  * @title: GtkSortListModel
@@ -91,6 +108,7 @@ struct _GtkSortListModel
 
   GtkTimSort sort; /* ongoing sort operation */
   guint sort_cb; /* 0 or current ongoing sort callback */
+  gboolean sort_parallel; /* sort everything at once, on the worker threads */
 
   guint n_items;
   GtkSortKeys *sort_keys;
@@ -161,6 +179,38 @@ gtk_sort_list_model_get_item (GListModel *list,
   return g_list_model_get_item (self->model, position);
 }
 
+static gboolean
+gtk_sort_list_model_peek_items (GListModel *list,
+                                guint       position,
+                                guint       n_items,
+                                gpointer   *items)
+{
+  GtkSortListModel *self = GTK_SORT_LIST_MODEL (list);
+  GtkListModelPeekFunc peek_func;
+  guint i;
+
+  if (self->model == NULL)
+    return FALSE;
+
+  if (position > self->n_items || n_items > self->n_items - position)
+    return FALSE;
+
+  if (self->positions == NULL)
+    return gtk_list_model_peek_items (self->model, position, n_items, items);
+
+  peek_func = gtk_list_model_get_peek_func (self->model);
+  if (peek_func == NULL)
+    return FALSE;
+
+  for (i = 0; i < n_items; i++)
+    {
+      if (!peek_func (self->model, pos_from_key (self, self->positions[position + i]), 1, &items[i]))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
 static void
 gtk_sort_list_model_model_init (GListModelInterface *iface)
 {
@@ -182,6 +232,8 @@ static void
 gtk_sort_list_model_stop_sorting (GtkSortListModel *self,
                                   gsize            *runs)
 {
+  self->sort_parallel = FALSE;
+
   if (self->sort_cb == 0)
     {
       if (runs)
@@ -200,6 +252,24 @@ gtk_sort_list_model_stop_sorting (GtkSortListModel *self,
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_PENDING]);
 }
 
+static void
+gtk_sort_list_model_init_keys (GtkSortListModel *self,
+                               const guint      *positions,
+                               guint             n_items)
+{
+  gpointer items[GTK_SORT_KEYS_CHUNK_SIZE];
+  guint i;
+
+  g_assert (n_items <= GTK_SORT_KEYS_CHUNK_SIZE);
+
+  gtk_list_model_get_items (self->model, positions, n_items, items);
+
+  for (i = 0; i < n_items; i++)
+    gtk_sort_keys_init_key (self->sort_keys, items[i], key_from_pos (self, positions[i]));
+
+  gtk_list_model_release_items (items, n_items);
+}
+
 static gboolean
 gtk_sort_list_model_sort_step (GtkSortListModel *self,
                                gboolean          finish,
@@ -215,20 +285,25 @@ gtk_sort_list_model_sort_step (GtkSortListModel *self,
 
   if (!gtk_bitset_is_empty (self->missing_keys))
     {
+      guint positions[GTK_SORT_KEYS_CHUNK_SIZE];
       GtkBitsetIter iter;
-      guint pos;
+      gboolean valid;
+      guint pos, n;
 
-      for (gtk_bitset_iter_init_first (&iter, self->missing_keys, &pos);
-           gtk_bitset_iter_is_valid (&iter);
-           gtk_bitset_iter_next (&iter, &pos))
+      valid = gtk_bitset_iter_init_first (&iter, self->missing_keys, &pos);
+      while (valid)
         {
-          gpointer item = g_list_model_get_item (self->model, pos);
-          gtk_sort_keys_init_key (self->sort_keys, item, key_from_pos (self, pos));
-          g_object_unref (item);
+          for (n = 0; n < GTK_SORT_KEYS_CHUNK_SIZE && valid; n++)
+            {
+              positions[n] = pos;
+              valid = gtk_bitset_iter_next (&iter, &pos);
+            }
+
+          gtk_sort_list_model_init_keys (self, positions, n);
 
           if (g_get_monotonic_time () >= end_time && !finish)
             {
-              gtk_bitset_remove_range_closed (self->missing_keys, 0, pos);
+              gtk_bitset_remove_range_closed (self->missing_keys, 0, positions[n - 1]);
               *out_position = 0;
               *out_n_items = 0;
               return TRUE;
@@ -302,12 +377,219 @@ sort_func (gconstpointer a,
   return *sa < *sb ? -1 : 1;
 }
 
+/* Parallel sorting
+ *
+ * When everything needs to be sorted at once, the positions are split
+ * into one run per thread. The runs are sorted on the worker threads
+ * and then merged pairwise until one run is left. Each merge is split
+ * up further, so all threads keep working when only a few runs are
+ * left: every task merges the items between two items of the first
+ * run, and finds where they go in the second run by binary search.
+ *
+ * Getting items from the model is not threadsafe, so the keys are
+ * still created on the main thread. And only keys that don't look at
+ * anything but the key memory when comparing can be sorted this way.
+ *
+ * sort_func() never considers two positions equal, so the result is
+ * the same as sorting on the main thread.
+ */
+typedef struct
+{
+  GtkSortKeys *sort_keys;
+  gpointer *src;
+  gpointer *dest;
+  guint *bounds; /* n_runs + 1 offsets of the runs in src */
+  guint n_runs;
+  guint n_segments; /* tasks per pair of runs when merging */
+  int next;
+} ParallelSort;
+
+static void
+sort_runs_in_thread (gpointer data)
+{
+  ParallelSort *sort = data;
+  guint i;
+
+  while ((i = g_atomic_int_add (&sort->next, 1)) < sort->n_runs)
+    {
+      gtk_tim_sort (sort->src + sort->bounds[i],
+                    sort->bounds[i + 1] - sort->bounds[i],
+                    sizeof (gpointer),
+                    sort_func,
+                    sort->sort_keys);
+    }
+}
+
+/* Returns the number of items in @run that sort before @key */
+static guint
+find_merge_position (GtkSortKeys *sort_keys,
+                     gpointer    *run,
+                     guint        n_items,
+                     gpointer     key)
+{
+  guint lo = 0, hi = n_items;
+
+  while (lo < hi)
+    {
+      guint mid = (lo + hi) / 2;
+
+      if (sort_func (&run[mid], &key, sort_keys) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+static void
+merge_runs_in_thread (gpointer data)
+{
+  ParallelSort *sort = data;
+  guint n_pairs = (sort->n_runs + 1) / 2;
+  guint i;
+
+  while ((i = g_atomic_int_add (&sort->next, 1)) < n_pairs * sort->n_segments)
+    {
+      guint pair = i / sort->n_segments;
+      guint segment = i % sort->n_segments;
+      guint a_start, a_len, b_start, b_len;
+      gpointer *a, *a_end, *b, *b_end, *out;
+
+      /* An odd run at the end is merged with an empty one */
+      a_start = sort->bounds[2 * pair];
+      b_start = sort->bounds[2 * pair + 1];
+      a_len = b_start - a_start;
+      b_len = 2 * pair + 1 < sort->n_runs ? sort->bounds[2 * pair + 2] - b_start : 0;
+
+      a = sort->src + a_start + (guint64) a_len * segment / sort->n_segments;
+      a_end = sort->src + a_start + (guint64) a_len * (segment + 1) / sort->n_segments;
+
+      b = sort->src + b_start;
+      if (segment > 0)
+        b += find_merge_position (sort->sort_keys, b, b_len, *a);
+      b_end = sort->src + b_start + b_len;
+      if (segment + 1 < sort->n_segments)
+        b_end = sort->src + b_start + find_merge_position (sort->sort_keys, sort->src + b_start, b_len, *a_end);
+
+      out = sort->dest + a_start + (a - sort->src - a_start) + (b - sort->src - b_start);
+
+      while (a < a_end && b < b_end)
+        {
+          if (sort_func (a, b, sort->sort_keys) < 0)
+            *out++ = *a++;
+          else
+            *out++ = *b++;
+        }
+
+      memcpy (out, a, (a_end - a) * sizeof (gpointer));
+      out += a_end - a;
+      memcpy (out, b, (b_end - b) * sizeof (gpointer));
+    }
+}
+
+static gboolean
+gtk_sort_list_model_can_sort_parallel (GtkSortListModel *self)
+{
+  return self->n_items >= 2 * GTK_SORT_MIN_PARALLEL_ITEMS &&
+         gdk_parallel_task_get_max_tasks () > 1 &&
+         gtk_sort_keys_is_threadsafe (self->sort_keys);
+}
+
+static void
+gtk_sort_list_model_sort_parallel (GtkSortListModel *self,
+                                   guint            *out_position,
+                                   guint            *out_n_items)
+{
+  guint positions[GTK_SORT_KEYS_CHUNK_SIZE];
+  ParallelSort sort;
+  GtkBitsetIter iter;
+  gpointer *tmp;
+  gboolean valid;
+  guint max_tasks, n_pairs;
+  guint i, n, start, end;
+
+  valid = gtk_bitset_iter_init_first (&iter, self->missing_keys, &i);
+  while (valid)
+    {
+      for (n = 0; n < GTK_SORT_KEYS_CHUNK_SIZE && valid; n++)
+        {
+          positions[n] = i;
+          valid = gtk_bitset_iter_next (&iter, &i);
+        }
+
+      gtk_sort_list_model_init_keys (self, positions, n);
+    }
+  gtk_bitset_remove_all (self->missing_keys);
+
+  max_tasks = gdk_parallel_task_get_max_tasks ();
+
+  /* Keep the positions to find out what changed */
+  sort.sort_keys = self->sort_keys;
+  sort.src = g_new (gpointer, self->n_items);
+  sort.dest = g_new (gpointer, self->n_items);
+  memcpy (sort.src, self->positions, self->n_items * sizeof (gpointer));
+
+  sort.n_runs = MIN (max_tasks, self->n_items / GTK_SORT_MIN_PARALLEL_ITEMS);
+  sort.bounds = g_new (guint, sort.n_runs + 1);
+  for (i = 0; i <= sort.n_runs; i++)
+    sort.bounds[i] = (guint64) self->n_items * i / sort.n_runs;
+
+  sort.next = 0;
+  gdk_parallel_task_run (sort_runs_in_thread, &sort, sort.n_runs);
+
+  while (sort.n_runs > 1)
+    {
+      n_pairs = (sort.n_runs + 1) / 2;
+      sort.n_segments = MAX (1, max_tasks / n_pairs);
+      sort.n_segments = MIN (sort.n_segments, MAX (1, self->n_items / n_pairs / GTK_SORT_MIN_PARALLEL_ITEMS));
+
+      sort.next = 0;
+      gdk_parallel_task_run (merge_runs_in_thread, &sort, MIN (max_tasks, n_pairs * sort.n_segments));
+
+      for (i = 0; i < n_pairs; i++)
+        sort.bounds[i] = sort.bounds[2 * i];
+      sort.bounds[n_pairs] = self->n_items;
+      sort.n_runs = n_pairs;
+
+      tmp = sort.src;
+      sort.src = sort.dest;
+      sort.dest = tmp;
+    }
+
+  for (start = 0; start < self->n_items; start++)
+    {
+      if (sort.src[start] != self->positions[start])
+        break;
+    }
+  for (end = self->n_items; end > start; end--)
+    {
+      if (sort.src[end - 1] != self->positions[end - 1])
+        break;
+    }
+
+  memcpy (self->positions + start, sort.src + start, (end - start) * sizeof (gpointer));
+
+  *out_position = end > start ? start : 0;
+  *out_n_items = end - start;
+
+  g_free (sort.src);
+  g_free (sort.dest);
+  g_free (sort.bounds);
+}
+
 static gboolean
 gtk_sort_list_model_start_sorting (GtkSortListModel *self,
                                    gsize            *runs)
 {
   g_assert (self->sort_cb == 0);
 
+  /* Only if nothing is sorted yet, merging with the existing runs
+   * is faster than sorting everything again */
+  self->sort_parallel = runs == NULL &&
+                        !self->incremental &&
+                        gtk_sort_list_model_can_sort_parallel (self);
+
   gtk_tim_sort_init (&self->sort,
                      self->positions,
                      self->n_items,
@@ -334,7 +616,10 @@ gtk_sort_list_model_finish_sorting (GtkSortListModel *self,
 {
   gtk_tim_sort_set_max_merge_size (&self->sort, 0);
 
-  gtk_sort_list_model_sort_step (self, TRUE, pos, n_items);
+  if (self->sort_parallel)
+    gtk_sort_list_model_sort_parallel (self, pos, n_items);
+  else
+    gtk_sort_list_model_sort_step (self, TRUE, pos, n_items);
   gtk_tim_sort_finish (&self->sort);
 
   gtk_sort_list_model_stop_sorting (self, NULL);
@@ -774,6 +1059,8 @@ gtk_sort_list_model_class_init (GtkSortListModelClass *class)
   gobject_class->get_property = gtk_sort_list_model_get_property;
   gobject_class->dispose = gtk_sort_list_model_dispose;
 
+  gtk_list_model_set_peek_func (G_TYPE_FROM_CLASS (class), gtk_sort_list_model_peek_items);
+
   /**
    * GtkSortListModel:incremental:
    *
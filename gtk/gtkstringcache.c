@@ -0,0 +1,360 @@
+/*
+ * Copyright © 2020 GNOME Foundation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include "gtkstringcacheprivate.h"
+
+#include <locale.h>
+
+/* String cache
+ *
+ * Filtering and sorting by strings spends most of its time normalizing,
+ * casefolding and creating collation keys for the same strings over and
+ * over: for every keystroke in a search entry and whenever the sort
+ * keys are created again.
+ *
+ * This caches the results by the string they were computed from. So
+ * there is nothing to invalidate when items change: a changed string
+ * is looked up as a different string. Items with the same strings
+ * share the results.
+ *
+ * The cache is shared by all string filters and sorters and their
+ * snapshots and sort keys, and it is freed when the last of them is
+ * gone. Once it holds GTK_STRING_CACHE_MAX_STRINGS strings, the least
+ * recently used ones are dropped. The values are #GRefStrings, so users
+ * can keep them after the cache drops them.
+ *
+ * A pass over more strings than that, like filtering or sorting a big
+ * model, would never find the strings it added before they got
+ * dropped. So after that many misses in a row, gtk_string_cache_get()
+ * stops adding strings until it finds one again. Users that know the
+ * size of their batch, like filter snapshots, don't use the cache at
+ * all for big ones.
+ *
+ * Collation keys depend on LC_COLLATE, so they are dropped when that
+ * changes.
+ *
+ * Only gtk_string_cache_compute() may be used from other threads.
+ */
+
+struct _GtkStringCache
+{
+  int ref_count;
+
+  GHashTable *strings; /* string -> CachedString */
+  GQueue lru; /* CachedString, most recently used first */
+  char *collate_locale; /* the locale of the collation keys */
+  guint n_misses; /* of gtk_string_cache_get() in a row */
+};
+
+typedef struct {
+  GList lru_link;
+  char *string;
+  char *values[GTK_STRING_CACHE_N_KINDS];
+} CachedString;
+
+static GtkStringCache *default_cache;
+
+static void
+cached_string_clear_value (CachedString       *cached,
+                           GtkStringCacheKind  kind)
+{
+  g_clear_pointer (&cached->values[kind], g_ref_string_release);
+}
+
+static void
+cached_string_free (gpointer data)
+{
+  CachedString *cached = data;
+  guint i;
+
+  for (i = 0; i < GTK_STRING_CACHE_N_KINDS; i++)
+    cached_string_clear_value (cached, i);
+
+  g_free (cached->string);
+  g_slice_free (CachedString, cached);
+}
+
+/*
+ * gtk_string_cache_get_default:
+ *
+ * Gets the cache shared by all its users, creating it if necessary.
+ *
+ * Returns: (transfer full): the cache
+ */
+GtkStringCache *
+gtk_string_cache_get_default (void)
+{
+  if (default_cache)
+    {
+      default_cache->ref_count++;
+      return default_cache;
+    }
+
+  default_cache = g_new0 (GtkStringCache, 1);
+  default_cache->ref_count = 1;
+  default_cache->strings = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, cached_string_free);
+  g_queue_init (&default_cache->lru);
+
+  return default_cache;
+}
+
+/*
+ * gtk_string_cache_unref:
+ * @self: the cache
+ *
+ * Drops a reference from gtk_string_cache_get_default(). The cached
+ * strings are freed with the last reference.
+ */
+void
+gtk_string_cache_unref (GtkStringCache *self)
+{
+  g_return_if_fail (self->ref_count > 0);
+
+  self->ref_count--;
+  if (self->ref_count > 0)
+    return;
+
+  if (self == default_cache)
+    default_cache = NULL;
+
+  g_hash_table_unref (self->strings);
+  g_free (self->collate_locale);
+  g_free (self);
+}
+
+static gboolean
+is_collate_key (GtkStringCacheKind kind)
+{
+  return kind == GTK_STRING_CACHE_COLLATE_KEY ||
+         kind == GTK_STRING_CACHE_CASEFOLDED_COLLATE_KEY;
+}
+
+static void
+gtk_string_cache_check_locale (GtkStringCache *self)
+{
+  const char *locale = setlocale (LC_COLLATE, NULL);
+  GList *l;
+
+  if (g_strcmp0 (locale, self->collate_locale) == 0)
+    return;
+
+  /* The keys wouldn't compare correctly with ones of the new locale */
+  for (l = self->lru.head; l; l = l->next)
+    {
+      CachedString *cached = l->data;
+
+      cached_string_clear_value (cached, GTK_STRING_CACHE_COLLATE_KEY);
+      cached_string_clear_value (cached, GTK_STRING_CACHE_CASEFOLDED_COLLATE_KEY);
+    }
+
+  g_free (self->collate_locale);
+  self->collate_locale = g_strdup (locale);
+}
+
+static void
+gtk_string_cache_touch (GtkStringCache *self,
+                        CachedString   *cached)
+{
+  g_queue_unlink (&self->lru, &cached->lru_link);
+  g_queue_push_head_link (&self->lru, &cached->lru_link);
+}
+
+/*
+ * gtk_string_cache_compute:
+ * @string: the string
+ * @kind: what to compute
+ *
+ * Computes the value of @kind for @string without looking at the
+ * cache. This can be called from any thread.
+ *
+ * Returns: (transfer full) (nullable): the value, or %NULL if
+ *     @string is not valid UTF-8
+ */
+char *
+gtk_string_cache_compute (const char         *string,
+                          GtkStringCacheKind  kind)
+{
+  char *tmp, *result;
+
+  switch (kind)
+    {
+    case GTK_STRING_CACHE_NORMALIZED:
+      return g_utf8_normalize (string, -1, G_NORMALIZE_ALL);
+
+    case GTK_STRING_CACHE_CASEFOLDED:
+      tmp = g_utf8_normalize (string, -1, G_NORMALIZE_ALL);
+      if (tmp == NULL)
+        return NULL;
+      result = g_utf8_casefold (tmp, -1);
+      g_free (tmp);
+      return result;
+
+    case GTK_STRING_CACHE_COLLATE_KEY:
+      return g_utf8_collate_key (string, -1);
+
+    case GTK_STRING_CACHE_CASEFOLDED_COLLATE_KEY:
+      tmp = g_utf8_casefold (string, -1);
+      result = g_utf8_collate_key (tmp, -1);
+      g_free (tmp);
+      return result;
+
+    case GTK_STRING_CACHE_N_KINDS:
+    default:
+      g_assert_not_reached ();
+      return NULL;
+    }
+}
+
+/*
+ * gtk_string_cache_lookup:
+ * @self: the cache
+ * @string: the string
+ * @kind: the value to look up
+ *
+ * Looks up a value that was computed before.
+ *
+ * Returns: (transfer full) (nullable): a #GRefString of the value,
+ *     or %NULL if it isn't cached
+ */
+char *
+gtk_string_cache_lookup (GtkStringCache     *self,
+                         const char         *string,
+                         GtkStringCacheKind  kind)
+{
+  CachedString *cached;
+
+  g_return_val_if_fail (string != NULL, NULL);
+
+  if (is_collate_key (kind))
+    gtk_string_cache_check_locale (self);
+
+  cached = g_hash_table_lookup (self->strings, string);
+  if (cached == NULL || cached->values[kind] == NULL)
+    return NULL;
+
+  gtk_string_cache_touch (self, cached);
+
+  return g_ref_string_acquire (cached->values[kind]);
+}
+
+/* Returns the cached GRefString */
+static char *
+gtk_string_cache_add (GtkStringCache     *self,
+                      const char         *string,
+                      GtkStringCacheKind  kind,
+                      const char         *value)
+{
+  CachedString *cached;
+
+  cached = g_hash_table_lookup (self->strings, string);
+  if (cached == NULL)
+    {
+      cached = g_slice_new0 (CachedString);
+      cached->lru_link.data = cached;
+      cached->string = g_strdup (string);
+      g_hash_table_insert (self->strings, cached->string, cached);
+      g_queue_push_head_link (&self->lru, &cached->lru_link);
+
+      while (self->lru.length > GTK_STRING_CACHE_MAX_STRINGS)
+        {
+          CachedString *oldest = g_queue_pop_tail_link (&self->lru)->data;
+
+          g_hash_table_remove (self->strings, oldest->string);
+        }
+    }
+  else if (cached->values[kind] != NULL)
+    {
+      return cached->values[kind];
+    }
+  else
+    {
+      gtk_string_cache_touch (self, cached);
+    }
+
+  cached->values[kind] = g_ref_string_new (value);
+
+  return cached->values[kind];
+}
+
+/*
+ * gtk_string_cache_insert:
+ * @self: the cache
+ * @string: the string
+ * @kind: the value to insert
+ * @value: the value computed with gtk_string_cache_compute()
+ *
+ * Adds a value that was computed elsewhere, like on another thread.
+ */
+void
+gtk_string_cache_insert (GtkStringCache     *self,
+                         const char         *string,
+                         GtkStringCacheKind  kind,
+                         const char         *value)
+{
+  g_return_if_fail (string != NULL);
+  g_return_if_fail (value != NULL);
+
+  gtk_string_cache_add (self, string, kind, value);
+}
+
+/*
+ * gtk_string_cache_get:
+ * @self: the cache
+ * @string: the string
+ * @kind: the value to get
+ *
+ * Looks up the value of @kind for @string, computing and caching it
+ * if necessary. During passes over more strings than the cache can
+ * hold, the value is not cached.
+ *
+ * Returns: (transfer full) (nullable): a #GRefString of the value,
+ *     or %NULL if @string is not valid UTF-8
+ */
+char *
+gtk_string_cache_get (GtkStringCache     *self,
+                      const char         *string,
+                      GtkStringCacheKind  kind)
+{
+  char *value, *result;
+
+  result = gtk_string_cache_lookup (self, string, kind);
+  if (result)
+    {
+      self->n_misses = 0;
+      return result;
+    }
+
+  value = gtk_string_cache_compute (string, kind);
+  if (value == NULL)
+    return NULL;
+
+  if (self->n_misses >= GTK_STRING_CACHE_MAX_STRINGS)
+    {
+      result = g_ref_string_new (value);
+    }
+  else
+    {
+      self->n_misses++;
+      result = g_ref_string_acquire (gtk_string_cache_add (self, string, kind, value));
+    }
+
+  g_free (value);
+
+  return result;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright © 2020 GNOME Foundation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __GTK_STRING_CACHE_PRIVATE_H__
+#define __GTK_STRING_CACHE_PRIVATE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GtkStringCache GtkStringCache;
+
+/* Batches of more strings than this would only evict each other, so
+ * they should be prepared with gtk_string_cache_compute() directly */
+#define GTK_STRING_CACHE_MAX_STRINGS (1 << 16)
+
+typedef enum {
+  GTK_STRING_CACHE_NORMALIZED,
+  GTK_STRING_CACHE_CASEFOLDED,
+  GTK_STRING_CACHE_COLLATE_KEY,
+  GTK_STRING_CACHE_CASEFOLDED_COLLATE_KEY,
+  GTK_STRING_CACHE_N_KINDS
+} GtkStringCacheKind;
+
+GtkStringCache *        gtk_string_cache_get_default            (void);
+void                    gtk_string_cache_unref                  (GtkStringCache         *self);
+
+char *                  gtk_string_cache_compute                (const char             *string,
+                                                                 GtkStringCacheKind      kind);
+
+char *                  gtk_string_cache_get                    (GtkStringCache         *self,
+                                                                 const char             *string,
+                                                                 GtkStringCacheKind      kind);
+char *                  gtk_string_cache_lookup                 (GtkStringCache         *self,
+                                                                 const char             *string,
+                                                                 GtkStringCacheKind      kind);
+void                    gtk_string_cache_insert                 (GtkStringCache         *self,
+                                                                 const char             *string,
+                                                                 GtkStringCacheKind      kind,
+                                                                 const char             *value);
+
+G_END_DECLS
+
+#endif /* __GTK_STRING_CACHE_PRIVATE_H__ */
@@ -21,9 +21,13 @@
 
 #include "gtkstringfilter.h"
 
+#include "gtkfilterprivate.h"
 #include "gtkintl.h"
+#include "gtkstringcacheprivate.h"
 #include "gtktypebuiltins.h"
 
+#include <string.h>
+
 /**
  * SECTION:gtkstringfilter
  * @Title: GtkStringFilter
@@ -37,6 +41,17 @@
  * can match the whole string, just a prefix, or any substring.
  */
 
+/* The number of searches to remember the states of. Going back to
+ * one of them, like when deleting the last typed characters, gets the
+ * same state again, so filter models can reuse their results. */
+#define MAX_SEARCH_HISTORY 16
+
+typedef struct
+{
+  char *search_prepared;
+  guint state;
+} SearchState;
+
 struct _GtkStringFilter
 {
   GtkFilter parent_instance;
@@ -48,6 +63,11 @@ struct _GtkStringFilter
   GtkStringFilterMatchMode match_mode;
 
   GtkExpression *expression;
+
+  GtkStringCache *cache;
+
+  SearchState history[MAX_SEARCH_HISTORY]; /* most recent first */
+  guint n_history;
 };
 
 enum {
@@ -63,25 +83,47 @@ G_DEFINE_TYPE (GtkStringFilter, gtk_string_filter, GTK_TYPE_FILTER)
 
 static GParamSpec *properties[NUM_PROPERTIES] = { NULL, };
 
-static char *
-gtk_string_filter_prepare (GtkStringFilter *self,
-                           const char      *s)
+static GtkStringCacheKind
+get_cache_kind (gboolean ignore_case)
 {
-  char *tmp;
-  char *result;
+  return ignore_case ? GTK_STRING_CACHE_CASEFOLDED : GTK_STRING_CACHE_NORMALIZED;
+}
 
+/* Does not look at the filter, so snapshots can use it on any thread */
+static char *
+prepare_string (const char *s,
+                gboolean    ignore_case)
+{
   if (s == NULL || s[0] == '\0')
     return NULL;
 
-  tmp = g_utf8_normalize (s, -1, G_NORMALIZE_ALL);
-
-  if (!self->ignore_case)
-    return tmp;
+  return gtk_string_cache_compute (s, get_cache_kind (ignore_case));
+}
 
-  result = g_utf8_casefold (tmp, -1);
-  g_free (tmp);
+static char *
+gtk_string_filter_prepare (GtkStringFilter *self,
+                           const char      *s)
+{
+  return prepare_string (s, self->ignore_case);
+}
 
-  return result;
+static gboolean
+match_prepared (GtkStringFilterMatchMode  match_mode,
+                const char               *prepared,
+                const char               *search_prepared)
+{
+  switch (match_mode)
+    {
+    case GTK_STRING_FILTER_MATCH_MODE_EXACT:
+      return strcmp (prepared, search_prepared) == 0;
+    case GTK_STRING_FILTER_MATCH_MODE_SUBSTRING:
+      return strstr (prepared, search_prepared) != NULL;
+    case GTK_STRING_FILTER_MATCH_MODE_PREFIX:
+      return g_str_has_prefix (prepared, search_prepared);
+    default:
+      g_assert_not_reached ();
+      return FALSE;
+    }
 }
 
 /* This is necessary because code just looks at self->search otherwise
@@ -93,6 +135,94 @@ gtk_string_filter_has_search (GtkStringFilter *self)
   return self->search_prepared != NULL;
 }
 
+/* Call when the other settings change, all states are different then */
+static void
+gtk_string_filter_clear_history (GtkStringFilter *self)
+{
+  guint i;
+
+  for (i = 0; i < self->n_history; i++)
+    g_free (self->history[i].search_prepared);
+  self->n_history = 0;
+}
+
+/* Returns the state of the current search and moves it to the front
+ * of the history. Sets @base_state to the state of the most strict
+ * search in the history that the current one is more strict than. */
+static guint
+gtk_string_filter_lookup_state (GtkStringFilter *self,
+                                guint           *base_state)
+{
+  SearchState current = { NULL, 0 };
+  gsize base_len = 0;
+  guint i;
+
+  *base_state = 0;
+
+  for (i = 0; i < self->n_history; i++)
+    {
+      SearchState *entry = &self->history[i];
+
+      if (g_strcmp0 (entry->search_prepared, self->search_prepared) == 0)
+        {
+          current = *entry;
+          memmove (&self->history[1], &self->history[0], i * sizeof (SearchState));
+          self->history[0] = current;
+          return current.state;
+        }
+
+      if (entry->search_prepared == NULL || self->search_prepared == NULL ||
+          strlen (entry->search_prepared) <= base_len)
+        continue;
+
+      switch (self->match_mode)
+        {
+        case GTK_STRING_FILTER_MATCH_MODE_EXACT:
+          break;
+        case GTK_STRING_FILTER_MATCH_MODE_SUBSTRING:
+          if (strstr (self->search_prepared, entry->search_prepared) == NULL)
+            continue;
+          *base_state = entry->state;
+          base_len = strlen (entry->search_prepared);
+          break;
+        case GTK_STRING_FILTER_MATCH_MODE_PREFIX:
+          if (!g_str_has_prefix (self->search_prepared, entry->search_prepared))
+            continue;
+          *base_state = entry->state;
+          base_len = strlen (entry->search_prepared);
+          break;
+        default:
+          g_assert_not_reached ();
+          break;
+        }
+    }
+
+  if (self->n_history == MAX_SEARCH_HISTORY)
+    {
+      self->n_history--;
+      g_free (self->history[self->n_history].search_prepared);
+    }
+
+  current.search_prepared = g_strdup (self->search_prepared);
+  current.state = gtk_filter_new_state ();
+  memmove (&self->history[1], &self->history[0], self->n_history * sizeof (SearchState));
+  self->history[0] = current;
+  self->n_history++;
+
+  return current.state;
+}
+
+static void
+gtk_string_filter_changed (GtkStringFilter *self,
+                           GtkFilterChange  change)
+{
+  guint state, base_state;
+
+  state = gtk_string_filter_lookup_state (self, &base_state);
+
+  gtk_filter_changed_with_state (GTK_FILTER (self), change, state, base_state);
+}
+
 static gboolean
 gtk_string_filter_match (GtkFilter *filter,
                          gpointer   item)
@@ -110,35 +240,154 @@ gtk_string_filter_match (GtkFilter *filter,
       !gtk_expression_evaluate (self->expression, item, &value))
     return FALSE;
   s = g_value_get_string (&value);
-  prepared = gtk_string_filter_prepare (self, s);
+  if (s == NULL || s[0] == '\0')
+    prepared = NULL;
+  else
+    prepared = gtk_string_cache_get (self->cache, s, get_cache_kind (self->ignore_case));
   if (prepared == NULL)
-    return FALSE;
-
-  switch (self->match_mode)
     {
-    case GTK_STRING_FILTER_MATCH_MODE_EXACT:
-      result = strcmp (prepared, self->search_prepared) == 0;
-      break;
-    case GTK_STRING_FILTER_MATCH_MODE_SUBSTRING:
-      result = strstr (prepared, self->search_prepared) != NULL;
-      break;
-    case GTK_STRING_FILTER_MATCH_MODE_PREFIX:
-      result = g_str_has_prefix (prepared, self->search_prepared);
-      break;
-    default:
-      g_assert_not_reached ();
+      g_value_unset (&value);
+      return FALSE;
     }
 
+  result = match_prepared (self->match_mode, prepared, self->search_prepared);
+
 #if 0
   g_print ("%s (%s) %s %s (%s)\n", s, prepared, result ? "==" : "!=", self->search, self->search_prepared);
 #endif
 
-  g_free (prepared);
+  g_ref_string_release (prepared);
   g_value_unset (&value);
 
   return result;
 }
 
+/* The prepared strings of the items that are in the string cache and
+ * the other strings, which are prepared when matching. They are added
+ * to the cache when the snapshot is freed on the main thread.
+ *
+ * Snapshots of more items than the cache can hold don't use it. */
+typedef struct
+{
+  GtkFilterSnapshot snapshot;
+
+  GtkStringCache *cache;
+  char *search_prepared;
+  gboolean ignore_case;
+  GtkStringFilterMatchMode match_mode;
+  gboolean use_cache;
+
+  guint n_items;
+  char **cached; /* GRefStrings from the cache */
+  char **strings; /* set if not in the cache */
+  char **prepared; /* the prepared strings */
+} GtkStringFilterSnapshot;
+
+static void
+gtk_string_filter_snapshot_free (GtkFilterSnapshot *snapshot)
+{
+  GtkStringFilterSnapshot *self = (GtkStringFilterSnapshot *) snapshot;
+  guint i;
+
+  for (i = 0; i < self->n_items; i++)
+    {
+      if (self->cached[i])
+        g_ref_string_release (self->cached[i]);
+      if (self->prepared[i] && self->use_cache)
+        gtk_string_cache_insert (self->cache, self->strings[i], get_cache_kind (self->ignore_case), self->prepared[i]);
+      g_free (self->strings[i]);
+      g_free (self->prepared[i]);
+    }
+  g_free (self->cached);
+  g_free (self->strings);
+  g_free (self->prepared);
+  g_free (self->search_prepared);
+  gtk_string_cache_unref (self->cache);
+}
+
+static gboolean
+gtk_string_filter_snapshot_match (GtkFilterSnapshot *snapshot,
+                                  guint              i)
+{
+  GtkStringFilterSnapshot *self = (GtkStringFilterSnapshot *) snapshot;
+  const char *prepared;
+
+  if (self->search_prepared == NULL)
+    return TRUE;
+
+  if (self->cached[i])
+    {
+      prepared = self->cached[i];
+    }
+  else
+    {
+      self->prepared[i] = prepare_string (self->strings[i], self->ignore_case);
+      prepared = self->prepared[i];
+    }
+
+  if (prepared == NULL)
+    return FALSE;
+
+  return match_prepared (self->match_mode, prepared, self->search_prepared);
+}
+
+static const GtkFilterSnapshotClass GTK_STRING_FILTER_SNAPSHOT_CLASS =
+{
+  gtk_string_filter_snapshot_free,
+  gtk_string_filter_snapshot_match,
+};
+
+static GtkFilterSnapshot *
+gtk_string_filter_snapshot (GtkFilter *filter,
+                            gpointer  *items,
+                            guint      n_items)
+{
+  GtkStringFilter *self = GTK_STRING_FILTER (filter);
+  GtkStringFilterSnapshot *result;
+  guint i;
+
+  result = gtk_filter_snapshot_new (GtkStringFilterSnapshot, &GTK_STRING_FILTER_SNAPSHOT_CLASS);
+  result->cache = gtk_string_cache_get_default ();
+  result->search_prepared = g_strdup (self->search_prepared);
+  result->ignore_case = self->ignore_case;
+  result->match_mode = self->match_mode;
+
+  /* Without a search, the strings aren't looked at */
+  if (!gtk_string_filter_has_search (self))
+    return (GtkFilterSnapshot *) result;
+
+  result->use_cache = n_items <= GTK_STRING_CACHE_MAX_STRINGS;
+  result->n_items = n_items;
+  result->cached = g_new0 (char *, n_items);
+  result->strings = g_new0 (char *, n_items);
+  result->prepared = g_new0 (char *, n_items);
+
+  if (self->expression == NULL)
+    return (GtkFilterSnapshot *) result;
+
+  for (i = 0; i < n_items; i++)
+    {
+      GValue value = G_VALUE_INIT;
+      const char *s;
+
+      if (!gtk_expression_evaluate (self->expression, items[i], &value))
+        continue;
+
+      s = g_value_get_string (&value);
+      if (s != NULL && s[0] != '\0')
+        {
+          if (result->use_cache)
+            result->cached[i] = gtk_string_cache_lookup (result->cache, s, get_cache_kind (self->ignore_case));
+          if (result->cached[i] == NULL)
+            result->strings[i] = g_strdup (s);
+        }
+
+      g_value_unset (&value);
+    }
+
+  return (GtkFilterSnapshot *) result;
+}
+
 static GtkFilterMatch
 gtk_string_filter_get_strictness (GtkFilter *filter)
 {
@@ -225,10 +474,21 @@ gtk_string_filter_dispose (GObject *object)
   g_clear_pointer (&self->search, g_free);
   g_clear_pointer (&self->search_prepared, g_free);
   g_clear_pointer (&self->expression, gtk_expression_unref);
+  gtk_string_filter_clear_history (self);
 
   G_OBJECT_CLASS (gtk_string_filter_parent_class)->dispose (object);
 }
 
+static void
+gtk_string_filter_finalize (GObject *object)
+{
+  GtkStringFilter *self = GTK_STRING_FILTER (object);
+
+  gtk_string_cache_unref (self->cache);
+
+  G_OBJECT_CLASS (gtk_string_filter_parent_class)->finalize (object);
+}
+
 static void
 gtk_string_filter_class_init (GtkStringFilterClass *class)
 {
@@ -237,10 +497,12 @@ gtk_string_filter_class_init (GtkStringFilterClass *class)
 
   filter_class->match = gtk_string_filter_match;
   filter_class->get_strictness = gtk_string_filter_get_strictness;
+  gtk_filter_class_set_snapshot_func (filter_class, gtk_string_filter_snapshot);
 
   object_class->get_property = gtk_string_filter_get_property;
   object_class->set_property = gtk_string_filter_set_property;
   object_class->dispose = gtk_string_filter_dispose;
+  object_class->finalize = gtk_string_filter_finalize;
 
   /**
    * GtkStringFilter:expression: (type GtkExpression)
@@ -297,8 +559,14 @@ gtk_string_filter_class_init (GtkStringFilterClass *class)
 static void
 gtk_string_filter_init (GtkStringFilter *self)
 {
+  guint state, base_state;
+
   self->ignore_case = TRUE;
   self->match_mode = GTK_STRING_FILTER_MATCH_MODE_SUBSTRING;
+  self->cache = gtk_string_cache_get_default ();
+
+  state = gtk_string_filter_lookup_state (self, &base_state);
+  gtk_filter_set_state (GTK_FILTER (self), state, base_state);
 }
 
 /**
@@ -379,7 +647,7 @@ gtk_string_filter_set_search (GtkStringFilter *self,
   self->search = g_strdup (search);
   self->search_prepared = gtk_string_filter_prepare (self, search);
 
-  gtk_filter_changed (GTK_FILTER (self), change);
+  gtk_string_filter_changed (self, change);
 
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_SEARCH]);
 }
@@ -422,9 +690,10 @@ gtk_string_filter_set_expression (GtkStringFilter *self,
 
   g_clear_pointer (&self->expression, gtk_expression_unref);
   self->expression = gtk_expression_ref (expression);
+  gtk_string_filter_clear_history (self);
 
   if (gtk_string_filter_has_search (self))
-    gtk_filter_changed (GTK_FILTER (self), GTK_FILTER_CHANGE_DIFFERENT);
+    gtk_string_filter_changed (self, GTK_FILTER_CHANGE_DIFFERENT);
 
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_EXPRESSION]);
 }
@@ -462,12 +731,13 @@ gtk_string_filter_set_ignore_case (GtkStringFilter *self,
     return;
 
   self->ignore_case = ignore_case;
+  gtk_string_filter_clear_history (self);
 
   if (self->search)
     {
       g_free (self->search_prepared);
       self->search_prepared = gtk_string_filter_prepare (self, self->search);
-      gtk_filter_changed (GTK_FILTER (self), ignore_case ? GTK_FILTER_CHANGE_LESS_STRICT : GTK_FILTER_CHANGE_MORE_STRICT);
+      gtk_string_filter_changed (self, ignore_case ? GTK_FILTER_CHANGE_LESS_STRICT : GTK_FILTER_CHANGE_MORE_STRICT);
     }
 
   g_object_notify_by_pspec (G_OBJECT (self), properties[PROP_IGNORE_CASE]);
@@ -509,24 +779,25 @@ gtk_string_filter_set_match_mode (GtkStringFilter *self,
 
   old_mode = self->match_mode;
   self->match_mode = mode;
+  gtk_string_filter_clear_history (self);
 
   if (self->search_prepared && self->expression)
     {
       switch (old_mode)
         {
         case GTK_STRING_FILTER_MATCH_MODE_EXACT:
-          gtk_filter_changed (GTK_FILTER (self), GTK_FILTER_CHANGE_LESS_STRICT);
+          gtk_string_filter_changed (self, GTK_FILTER_CHANGE_LESS_STRICT);
           break;
 
         case GTK_STRING_FILTER_MATCH_MODE_SUBSTRING:
-          gtk_filter_changed (GTK_FILTER (self), GTK_FILTER_CHANGE_MORE_STRICT);
+          gtk_string_filter_changed (self, GTK_FILTER_CHANGE_MORE_STRICT);
           break;
 
         case GTK_STRING_FILTER_MATCH_MODE_PREFIX:
           if (mode == GTK_STRING_FILTER_MATCH_MODE_SUBSTRING)
-            gtk_filter_changed (GTK_FILTER (self), GTK_FILTER_CHANGE_LESS_STRICT);
+            gtk_string_filter_changed (self, GTK_FILTER_CHANGE_LESS_STRICT);
           else
-            gtk_filter_changed (GTK_FILTER (self), GTK_FILTER_CHANGE_MORE_STRICT);
+            gtk_string_filter_changed (self, GTK_FILTER_CHANGE_MORE_STRICT);
           break;
 
         default:
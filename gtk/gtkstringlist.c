@@ -24,8 +24,11 @@
 #include "gtkbuildable.h"
 #include "gtkbuilderprivate.h"
 #include "gtkintl.h"
+#include "gtklistmodelprivate.h"
 #include "gtkprivate.h"
 
+#include <string.h>
+
 /**
  * SECTION:gtkstringlist
  * @title: GtkStringList
@@ -211,6 +214,23 @@ gtk_string_list_get_item (GListModel *list,
   return g_object_ref (objects_get (&self->items, position));
 }
 
+static gboolean
+gtk_string_list_peek_items (GListModel *list,
+                            guint       position,
+                            guint       n_items,
+                            gpointer   *items)
+{
+  GtkStringList *self = GTK_STRING_LIST (list);
+  gsize size = objects_get_size (&self->items);
+
+  if (position > size || n_items > size - position)
+    return FALSE;
+
+  memcpy (items, objects_index (&self->items, position), n_items * sizeof (gpointer));
+
+  return TRUE;
+}
+
 static void
 gtk_string_list_model_init (GListModelInterface *iface)
 {
@@ -406,6 +426,8 @@ gtk_string_list_class_init (GtkStringListClass *class)
   GObjectClass *gobject_class = G_OBJECT_CLASS (class);
 
   gobject_class->dispose = gtk_string_list_dispose;
+
+  gtk_list_model_set_peek_func (G_TYPE_FROM_CLASS (class), gtk_string_list_peek_items);
 }
 
 static void
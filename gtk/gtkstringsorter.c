@@ -23,6 +23,7 @@
 
 #include "gtkintl.h"
 #include "gtksorterprivate.h"
+#include "gtkstringcacheprivate.h"
 #include "gtktypebuiltins.h"
 
 /**
@@ -46,6 +47,8 @@ struct _GtkStringSorter
   gboolean ignore_case;
 
   GtkExpression *expression;
+
+  GtkStringCache *cache;
 };
 
 enum {
@@ -59,12 +62,15 @@ G_DEFINE_TYPE (GtkStringSorter, gtk_string_sorter, GTK_TYPE_SORTER)
 
 static GParamSpec *properties[NUM_PROPERTIES] = { NULL, };
 
+/* Returns a GRefString from the string cache */
 static char *
-gtk_string_sorter_get_key (GtkExpression *expression,
-                           gboolean       ignore_case,
-                           gpointer       item1)
+gtk_string_sorter_get_key (GtkStringCache *cache,
+                           GtkExpression  *expression,
+                           gboolean        ignore_case,
+                           gpointer        item1)
 {
   GValue value = G_VALUE_INIT;
+  const char *string;
   char *s;
 
   if (expression == NULL)
@@ -74,24 +80,27 @@ gtk_string_sorter_get_key (GtkExpression *expression,
     return NULL;
 
   /* If strings are NULL, order them before "". */
-  if (ignore_case)
-    {
-      char *t;
-
-      t = g_utf8_casefold (g_value_get_string (&value), -1);
-      s = g_utf8_collate_key (t, -1);
-      g_free (t);
-    }
+  string = g_value_get_string (&value);
+  if (string == NULL)
+    s = NULL;
   else
-    {
-      s = g_utf8_collate_key (g_value_get_string (&value), -1);
-    }
+    s = gtk_string_cache_get (cache,
+                              string,
+                              ignore_case ? GTK_STRING_CACHE_CASEFOLDED_COLLATE_KEY
+                                          : GTK_STRING_CACHE_COLLATE_KEY);
 
   g_value_unset (&value);
 
   return s;
 }
 
+static void
+gtk_string_sorter_free_key (char *key)
+{
+  if (key)
+    g_ref_string_release (key);
+}
+
 static GtkOrdering
 gtk_string_sorter_compare (GtkSorter *sorter,
                            gpointer   item1,
@@ -104,13 +113,13 @@ gtk_string_sorter_compare (GtkSorter *sorter,
   if (self->expression == NULL)
     return GTK_ORDERING_EQUAL;
 
-  s1 = gtk_string_sorter_get_key (self->expression, self->ignore_case, item1);
-  s2 = gtk_string_sorter_get_key (self->expression, self->ignore_case, item2);
+  s1 = gtk_string_sorter_get_key (self->cache, self->expression, self->ignore_case, item1);
+  s2 = gtk_string_sorter_get_key (self->cache, self->expression, self->ignore_case, item2);
 
   result = gtk_ordering_from_cmpfunc (g_strcmp0 (s1, s2));
 
-  g_free (s1);
-  g_free (s2);
+  gtk_string_sorter_free_key (s1);
+  gtk_string_sorter_free_key (s2);
 
   return result;
 }
@@ -131,6 +140,7 @@ struct _GtkStringSortKeys
 {
   GtkSortKeys keys;
 
+  GtkStringCache *cache;
   GtkExpression *expression;
   gboolean ignore_case;
 };
@@ -140,6 +150,7 @@ gtk_string_sort_keys_free (GtkSortKeys *keys)
 {
   GtkStringSortKeys *self = (GtkStringSortKeys *) keys;
 
+  gtk_string_cache_unref (self->cache);
   gtk_expression_unref (self->expression);
   g_slice_free (GtkStringSortKeys, self);
 }
@@ -175,7 +186,7 @@ gtk_string_sort_keys_init_key (GtkSortKeys *keys,
   GtkStringSortKeys *self = (GtkStringSortKeys *) keys;
   char **key = (char **) key_memory;
 
-  *key = gtk_string_sorter_get_key (self->expression, self->ignore_case, item);
+  *key = gtk_string_sorter_get_key (self->cache, self->expression, self->ignore_case, item);
 }
 
 static void
@@ -184,7 +195,7 @@ gtk_string_sort_keys_clear_key (GtkSortKeys *keys,
 {
   char **key = (char **) key_memory;
 
-  g_free (*key);
+  gtk_string_sorter_free_key (*key);
 }
 
 static const GtkSortKeysClass GTK_STRING_SORT_KEYS_CLASS =
@@ -209,6 +220,8 @@ gtk_string_sort_keys_new (GtkStringSorter *self)
                               sizeof (char *),
                               sizeof (char *));
 
+  result->keys.threadsafe = TRUE;
+  result->cache = gtk_string_cache_get_default ();
   result->expression = gtk_expression_ref (self->expression);
   result->ignore_case = self->ignore_case;
 
@@ -273,6 +286,16 @@ gtk_string_sorter_dispose (GObject *object)
   G_OBJECT_CLASS (gtk_string_sorter_parent_class)->dispose (object);
 }
 
+static void
+gtk_string_sorter_finalize (GObject *object)
+{
+  GtkStringSorter *self = GTK_STRING_SORTER (object);
+
+  gtk_string_cache_unref (self->cache);
+
+  G_OBJECT_CLASS (gtk_string_sorter_parent_class)->finalize (object);
+}
+
 static void
 gtk_string_sorter_class_init (GtkStringSorterClass *class)
 {
@@ -285,6 +308,7 @@ gtk_string_sorter_class_init (GtkStringSorterClass *class)
   object_class->get_property = gtk_string_sorter_get_property;
   object_class->set_property = gtk_string_sorter_set_property;
   object_class->dispose = gtk_string_sorter_dispose;
+  object_class->finalize = gtk_string_sorter_finalize;
 
   /**
    * GtkStringSorter:expression: (type GtkExpression)
@@ -317,6 +341,7 @@ static void
 gtk_string_sorter_init (GtkStringSorter *self)
 {
   self->ignore_case = TRUE;
+  self->cache = gtk_string_cache_get_default ();
 
   gtk_sorter_changed_with_keys (GTK_SORTER (self),
                                 GTK_SORTER_CHANGE_DIFFERENT,
@@ -202,6 +202,28 @@ gtk_style_cascade_lookup (GtkStyleProvider             *provider,
   gtk_style_cascade_iter_clear (&iter);
 }
 
+static gboolean
+gtk_style_cascade_lookup_is_threadsafe (GtkStyleProvider *provider)
+{
+  GtkStyleCascade *cascade = GTK_STYLE_CASCADE (provider);
+  GtkStyleCascadeIter iter;
+  GtkStyleProvider *item;
+
+  for (item = gtk_style_cascade_iter_init (cascade, &iter);
+       item;
+       item = gtk_style_cascade_iter_next (cascade, &iter))
+    {
+      if (!gtk_style_provider_lookup_is_threadsafe (item))
+        {
+          gtk_style_cascade_iter_clear (&iter);
+          return FALSE;
+        }
+    }
+
+  gtk_style_cascade_iter_clear (&iter);
+  return TRUE;
+}
+
 static void
 gtk_style_cascade_provider_iface_init (GtkStyleProviderInterface *iface)
 {
@@ -210,6 +232,7 @@ gtk_style_cascade_provider_iface_init (GtkStyleProviderInterface *iface)
   iface->get_scale = gtk_style_cascade_get_scale;
   iface->get_keyframes = gtk_style_cascade_get_keyframes;
   iface->lookup = gtk_style_cascade_lookup;
+  iface->lookup_is_threadsafe = gtk_style_cascade_lookup_is_threadsafe;
 }
 
 G_DEFINE_TYPE_EXTENDED (GtkStyleCascade, _gtk_style_cascade, G_TYPE_OBJECT, 0,
@@ -274,14 +297,14 @@ _gtk_style_cascade_set_parent (GtkStyleCascade *cascade,
       g_object_ref (parent);
       g_signal_connect_swapped (parent,
                                 "gtk-private-changed",
-                                G_CALLBACK (gtk_style_provider_changed),
+                                G_CALLBACK (gtk_style_provider_forward_changed),
                                 cascade);
     }
 
   if (cascade->parent)
     {
       g_signal_handlers_disconnect_by_func (cascade->parent, 
-                                            gtk_style_provider_changed,
+                                            gtk_style_provider_forward_changed,
                                             cascade);
       g_object_unref (cascade->parent);
     }
@@ -305,7 +328,7 @@ _gtk_style_cascade_add_provider (GtkStyleCascade  *cascade,
   data.priority = priority;
   data.changed_signal_id = g_signal_connect_swapped (provider,
                                                      "gtk-private-changed",
-                                                     G_CALLBACK (gtk_style_provider_changed),
+                                                     G_CALLBACK (gtk_style_provider_forward_changed),
                                                      cascade);
 
   /* ensure it gets removed first */
@@ -167,7 +167,12 @@ static void
 gtk_style_context_cascade_changed (GtkStyleCascade *cascade,
                                    GtkStyleContext *context)
 {
-  gtk_css_node_invalidate_style_provider (gtk_style_context_get_root (context));
+  const GtkCssSelectorTree *rules = gtk_style_provider_get_changed_rules ();
+
+  if (rules)
+    gtk_css_node_invalidate_style_rules (gtk_style_context_get_root (context), rules);
+  else
+    gtk_css_node_invalidate_style_provider (gtk_style_context_get_root (context));
 }
 
 static void
@@ -19,6 +19,7 @@
 
 #include "gtkstyleproviderprivate.h"
 
+#include "gtkcsssharedstylesprivate.h"
 #include "gtkintl.h"
 #include "gtkprivate.h"
 
@@ -115,12 +116,108 @@ gtk_style_provider_lookup (GtkStyleProvider             *provider,
   iface->lookup (provider, filter, node, lookup, out_change);
 }
 
+/*
+ * gtk_style_provider_lookup_is_threadsafe:
+ * @provider: a #GtkStyleProvider
+ *
+ * Checks if gtk_style_provider_lookup() may currently be called
+ * from other threads, see gtk_css_node_match_children().
+ *
+ * Returns: %TRUE if lookups can run on other threads
+ */
+gboolean
+gtk_style_provider_lookup_is_threadsafe (GtkStyleProvider *provider)
+{
+  GtkStyleProviderInterface *iface;
+
+  gtk_internal_return_val_if_fail (GTK_IS_STYLE_PROVIDER (provider), FALSE);
+
+  iface = GTK_STYLE_PROVIDER_GET_INTERFACE (provider);
+
+  if (!iface->lookup_is_threadsafe)
+    return TRUE;
+
+  return iface->lookup_is_threadsafe (provider);
+}
+
+/* While a change that only affects some rules is emitted, these are
+ * the selectors of the rules, see gtk_style_provider_changed_rules().
+ */
+static const GtkCssSelectorTree *changed_rules;
+
 void
 gtk_style_provider_changed (GtkStyleProvider *provider)
 {
+  const GtkCssSelectorTree *saved_rules;
+
+  gtk_internal_return_if_fail (GTK_IS_STYLE_PROVIDER (provider));
+
+  /* The shared styles may have been computed from the old values */
+  gtk_css_shared_styles_clear ();
+
+  saved_rules = changed_rules;
+  changed_rules = NULL;
+
+  g_signal_emit (provider, signals[CHANGED], 0);
+
+  changed_rules = saved_rules;
+}
+
+/*
+ * gtk_style_provider_changed_rules:
+ * @provider: the provider that changed
+ * @rules: the selectors of the rules that were added, removed or changed
+ *
+ * Like gtk_style_provider_changed(), but only nodes that one of @rules
+ * could apply to need a new style. Handlers of the change can get
+ * @rules with gtk_style_provider_get_changed_rules().
+ */
+void
+gtk_style_provider_changed_rules (GtkStyleProvider         *provider,
+                                  const GtkCssSelectorTree *rules)
+{
+  const GtkCssSelectorTree *saved_rules;
+
   gtk_internal_return_if_fail (GTK_IS_STYLE_PROVIDER (provider));
+  gtk_internal_return_if_fail (rules != NULL);
+
+  gtk_css_shared_styles_clear ();
+
+  saved_rules = changed_rules;
+  changed_rules = rules;
 
   g_signal_emit (provider, signals[CHANGED], 0);
+
+  changed_rules = saved_rules;
+}
+
+/*
+ * gtk_style_provider_forward_changed:
+ * @provider: a provider that uses the provider that changed
+ *
+ * Emits the change of a provider that @provider is made of, like
+ * the providers of a #GtkStyleCascade, keeping the changed rules.
+ */
+void
+gtk_style_provider_forward_changed (GtkStyleProvider *provider)
+{
+  gtk_internal_return_if_fail (GTK_IS_STYLE_PROVIDER (provider));
+
+  g_signal_emit (provider, signals[CHANGED], 0);
+}
+
+/*
+ * gtk_style_provider_get_changed_rules:
+ *
+ * Gets the rules that changed while a change is emitted.
+ *
+ * Returns: (nullable): the selectors of the changed rules, or %NULL
+ *   if all styles need to be recomputed
+ */
+const GtkCssSelectorTree *
+gtk_style_provider_get_changed_rules (void)
+{
+  return changed_rules;
 }
 
 GtkSettings *
@@ -23,6 +23,7 @@
 #include "gtk/gtkcsskeyframesprivate.h"
 #include "gtk/gtkcsslookupprivate.h"
 #include "gtk/gtkcssnodeprivate.h"
+#include "gtk/gtkcssselectorprivate.h"
 #include "gtk/gtkcssvalueprivate.h"
 #include <gtk/gtktypes.h>
 
@@ -47,6 +48,7 @@ struct _GtkStyleProviderInterface
                                                  GtkCssNode              *node,
                                                  GtkCssLookup            *lookup,
                                                  GtkCssChange            *out_change);
+  gboolean              (* lookup_is_threadsafe) (GtkStyleProvider       *provider);
   void                  (* emit_error)          (GtkStyleProvider        *provider,
                                                  GtkCssSection           *section,
                                                  const GError            *error);
@@ -65,8 +67,14 @@ void                    gtk_style_provider_lookup                (GtkStyleProvid
                                                                   GtkCssNode              *node,
                                                                   GtkCssLookup            *lookup,
                                                                   GtkCssChange            *out_change);
+gboolean                gtk_style_provider_lookup_is_threadsafe  (GtkStyleProvider        *provider);
 
 void                    gtk_style_provider_changed               (GtkStyleProvider        *provider);
+void                    gtk_style_provider_changed_rules         (GtkStyleProvider        *provider,
+                                                                  const GtkCssSelectorTree *rules);
+void                    gtk_style_provider_forward_changed       (GtkStyleProvider        *provider);
+const GtkCssSelectorTree *
+                        gtk_style_provider_get_changed_rules     (void);
 
 void                    gtk_style_provider_emit_error            (GtkStyleProvider        *provider,
                                                                   GtkCssSection           *section,
@@ -3814,6 +3814,95 @@ gtk_widget_adjust_size_allocation (GtkWidget     *widget,
                     &allocation->height);
 }
 
+/* Computes the transform from the coordinates of the parent to the
+ * content box of @widget for an allocation of @width x @height at
+ * @transform, and the size of the content box. Takes ownership of
+ * @transform. */
+static GskTransform *
+gtk_widget_transform_allocation (GtkWidget    *widget,
+                                 int           width,
+                                 int           height,
+                                 int          *baseline,
+                                 GskTransform *transform,
+                                 int          *content_width,
+                                 int          *content_height)
+{
+  GtkWidgetPrivate *priv = gtk_widget_get_instance_private (widget);
+  GdkRectangle adjusted;
+  GtkCssStyle *style;
+  GtkBorder margin, border, padding;
+  GskTransform *css_transform;
+
+  if (_gtk_widget_get_direction (widget) == GTK_TEXT_DIR_LTR)
+    adjusted.x = priv->margin.left;
+  else
+    adjusted.x = priv->margin.right;
+  adjusted.y = priv->margin.top;
+  adjusted.width = width - priv->margin.left - priv->margin.right;
+  adjusted.height = height - priv->margin.top - priv->margin.bottom;
+  if (*baseline >= 0)
+    *baseline -= priv->margin.top;
+
+  gtk_widget_adjust_size_allocation (widget, &adjusted);
+
+  if (adjusted.width < 0 || adjusted.height < 0)
+    {
+      g_warning ("gtk_widget_size_allocate(): attempt to allocate %s %s %p with width %d and height %d",
+                 G_OBJECT_TYPE_NAME (widget), g_quark_to_string (gtk_css_node_get_name (priv->cssnode)), widget,
+                 adjusted.width,
+                 adjusted.height);
+
+      adjusted.width = 0;
+      adjusted.height = 0;
+    }
+
+  style = gtk_css_node_get_style (priv->cssnode);
+  get_box_margin (style, &margin);
+  get_box_border (style, &border);
+  get_box_padding (style, &padding);
+
+  /* Apply CSS transformation */
+  adjusted.x += margin.left;
+  adjusted.y += margin.top;
+  adjusted.width -= margin.left + margin.right;
+  adjusted.height -= margin.top + margin.bottom;
+  css_transform = gtk_css_transform_value_get_transform (style->other->transform);
+
+  if (css_transform)
+    {
+      double origin_x, origin_y;
+
+      origin_x = _gtk_css_position_value_get_x (style->other->transform_origin, adjusted.width);
+      origin_y = _gtk_css_position_value_get_y (style->other->transform_origin, adjusted.height);
+
+      transform = gsk_transform_translate (transform, &GRAPHENE_POINT_INIT (adjusted.x, adjusted.y));
+      adjusted.x = adjusted.y = 0;
+
+      transform = gsk_transform_translate (transform, &GRAPHENE_POINT_INIT (origin_x, origin_y));
+      transform = gsk_transform_transform (transform, css_transform);
+      transform = gsk_transform_translate (transform, &GRAPHENE_POINT_INIT (- origin_x, - origin_y));
+
+      gsk_transform_unref (css_transform);
+    }
+
+  adjusted.x += border.left + padding.left;
+  adjusted.y += border.top + padding.top;
+
+  if (*baseline >= 0)
+    *baseline -= margin.top + border.top + padding.top;
+  if (adjusted.x || adjusted.y)
+    transform = gsk_transform_translate (transform, &GRAPHENE_POINT_INIT (adjusted.x, adjusted.y));
+
+  /* Since gtk_widget_measure does it for us, we can be sure here that
+   * the given alloaction is large enough for the css margin/bordder/padding */
+  *content_width = adjusted.width - (border.left + padding.left +
+                                     border.right + padding.right);
+  *content_height = adjusted.height - (border.top + padding.top +
+                                       border.bottom + padding.bottom);
+
+  return transform;
+}
+
 /**
  * gtk_widget_allocate:
  * @widget: A #GtkWidget
@@ -3839,14 +3928,11 @@ gtk_widget_allocate (GtkWidget    *widget,
                      GskTransform *transform)
 {
   GtkWidgetPrivate *priv = gtk_widget_get_instance_private (widget);
-  GdkRectangle adjusted;
+  int content_width, content_height;
   gboolean alloc_needed;
   gboolean size_changed;
   gboolean baseline_changed;
   gboolean transform_changed;
-  GtkCssStyle *style;
-  GtkBorder margin, border, padding;
-  GskTransform *css_transform;
 
   g_return_if_fail (GTK_IS_WIDGET (widget));
   g_return_if_fail (baseline >= -1);
@@ -3903,85 +3989,22 @@ gtk_widget_allocate (GtkWidget    *widget,
   priv->allocated_height = height;
   priv->allocated_size_baseline = baseline;
 
-  if (_gtk_widget_get_direction (widget) == GTK_TEXT_DIR_LTR)
-    adjusted.x = priv->margin.left;
-  else
-    adjusted.x = priv->margin.right;
-  adjusted.y = priv->margin.top;
-  adjusted.width = width - priv->margin.left - priv->margin.right;
-  adjusted.height = height - priv->margin.top - priv->margin.bottom;
-  if (baseline >= 0)
-    baseline -= priv->margin.top;
-
-  gtk_widget_adjust_size_allocation (widget, &adjusted);
-
-  if (adjusted.width < 0 || adjusted.height < 0)
-    {
-      g_warning ("gtk_widget_size_allocate(): attempt to allocate %s %s %p with width %d and height %d",
-                 G_OBJECT_TYPE_NAME (widget), g_quark_to_string (gtk_css_node_get_name (priv->cssnode)), widget,
-                 adjusted.width,
-                 adjusted.height);
-
-      adjusted.width = 0;
-      adjusted.height = 0;
-    }
-
-  style = gtk_css_node_get_style (priv->cssnode);
-  get_box_margin (style, &margin);
-  get_box_border (style, &border);
-  get_box_padding (style, &padding);
-
-  /* Apply CSS transformation */
-  adjusted.x += margin.left;
-  adjusted.y += margin.top;
-  adjusted.width -= margin.left + margin.right;
-  adjusted.height -= margin.top + margin.bottom;
-  css_transform = gtk_css_transform_value_get_transform (style->other->transform);
-
-  if (css_transform)
-    {
-      double origin_x, origin_y;
-
-      origin_x = _gtk_css_position_value_get_x (style->other->transform_origin, adjusted.width);
-      origin_y = _gtk_css_position_value_get_y (style->other->transform_origin, adjusted.height);
-
-      transform = gsk_transform_translate (transform, &GRAPHENE_POINT_INIT (adjusted.x, adjusted.y));
-      adjusted.x = adjusted.y = 0;
-
-      transform = gsk_transform_translate (transform, &GRAPHENE_POINT_INIT (origin_x, origin_y));
-      transform = gsk_transform_transform (transform, css_transform);
-      transform = gsk_transform_translate (transform, &GRAPHENE_POINT_INIT (- origin_x, - origin_y));
-
-      gsk_transform_unref (css_transform);
-    }
-
-  adjusted.x += border.left + padding.left;
-  adjusted.y += border.top + padding.top;
-
-  if (baseline >= 0)
-    baseline -= margin.top + border.top + padding.top;
-  if (adjusted.x || adjusted.y)
-    transform = gsk_transform_translate (transform, &GRAPHENE_POINT_INIT (adjusted.x, adjusted.y));
-
   gsk_transform_unref (priv->transform);
-  priv->transform = transform;
+  priv->transform = gtk_widget_transform_allocation (widget,
+                                                     width, height, &baseline,
+                                                     transform,
+                                                     &content_width, &content_height);
 
   if (priv->surface_transform_data)
     sync_widget_surface_transform (widget);
 
-  /* Since gtk_widget_measure does it for us, we can be sure here that
-   * the given alloaction is large enough for the css margin/bordder/padding */
-  adjusted.width -= border.left + padding.left +
-                    border.right + padding.right;
-  adjusted.height -= border.top + padding.top +
-                     border.bottom + padding.bottom;
-  size_changed = (priv->width != adjusted.width) || (priv->height != adjusted.height);
+  size_changed = (priv->width != content_width) || (priv->height != content_height);
 
   if (!alloc_needed && !size_changed && !baseline_changed)
     goto skip_allocate;
 
-  priv->width = adjusted.width;
-  priv->height = adjusted.height;
+  priv->width = content_width;
+  priv->height = content_height;
   priv->baseline = baseline;
 
   if (priv->layout_manager != NULL)
@@ -4854,6 +4877,126 @@ gtk_widget_query_tooltip (GtkWidget  *widget,
   return retval;
 }
 
+/* The opacity of widgets without a CSS filter is not part of their
+ * render node, it is applied when the node gets added to the parent's
+ * snapshot, see gtk_widget_ref_render_node(). So when only the opacity
+ * changes, like in fade transitions, the parent needs to snapshot again
+ * but the widget's render node can be reused.
+ */
+static inline gboolean
+gtk_widget_defers_opacity (GtkCssStyle *style)
+{
+  return gtk_css_filter_value_is_none (style->other->filter);
+}
+
+static double
+gtk_widget_get_render_opacity (GtkWidget   *widget,
+                               GtkCssStyle *style)
+{
+  GtkWidgetPrivate *priv = gtk_widget_get_instance_private (widget);
+  double css_opacity;
+
+  css_opacity = _gtk_css_number_value_get (style->other->opacity, 100);
+
+  return CLAMP (css_opacity, 0.0, 1.0) * priv->user_alpha / 255.0;
+}
+
+/* Queues a redraw after the opacity of @widget changed. Widgets that
+ * were invisible have no render node, so they need to snapshot again.
+ */
+static void
+gtk_widget_queue_draw_opacity (GtkWidget *widget,
+                               gboolean   was_visible)
+{
+  GtkWidgetPrivate *priv = gtk_widget_get_instance_private (widget);
+  GtkCssStyle *style;
+
+  if (!_gtk_widget_get_mapped (widget))
+    return;
+
+  style = gtk_css_node_get_style (priv->cssnode);
+
+  if (was_visible &&
+      priv->parent != NULL &&
+      !GTK_IS_NATIVE (widget) &&
+      gtk_widget_defers_opacity (style) &&
+      gtk_widget_get_render_opacity (widget, style) > 0.0)
+    gtk_widget_queue_draw (priv->parent);
+  else
+    gtk_widget_queue_draw (widget);
+}
+
+static gboolean
+gtk_widget_css_change_only_opacity (GtkWidget         *widget,
+                                    GtkCssStyleChange *change,
+                                    gboolean           has_text)
+{
+  if (!gtk_css_style_change_changes_property (change, GTK_CSS_PROPERTY_OPACITY) ||
+      gtk_css_style_change_changes_property (change, GTK_CSS_PROPERTY_FILTER))
+    return FALSE;
+
+  if (gtk_css_style_change_affects (change, GTK_CSS_AFFECTS_REDRAW & ~GTK_CSS_AFFECTS_POSTEFFECT))
+    return FALSE;
+
+  if (has_text && gtk_css_style_change_affects (change, GTK_CSS_AFFECTS_TEXT_CONTENT))
+    return FALSE;
+
+  return TRUE;
+}
+
+/* Applies a change of the CSS transform to the transform of the
+ * previous allocation, instead of allocating @widget or its parent
+ * again. That only works if nothing else about the allocation changed.
+ */
+static void
+gtk_widget_update_css_transform (GtkWidget *widget)
+{
+  GtkWidgetPrivate *priv = gtk_widget_get_instance_private (widget);
+  GskTransform *transform;
+  int baseline, width, height;
+
+  if (!_gtk_widget_get_mapped (widget) || GTK_IS_NATIVE (widget))
+    {
+      gtk_widget_queue_allocate (widget);
+      return;
+    }
+
+  /* The pending allocation will use the new transform */
+  if (priv->resize_needed ||
+      priv->alloc_needed ||
+      _gtk_widget_get_alloc_needed (priv->parent))
+    return;
+
+  baseline = priv->allocated_size_baseline;
+  transform = gtk_widget_transform_allocation (widget,
+                                               priv->allocated_width,
+                                               priv->allocated_height,
+                                               &baseline,
+                                               gsk_transform_ref (priv->allocated_transform),
+                                               &width, &height);
+
+  if (width != priv->width || height != priv->height)
+    {
+      gsk_transform_unref (transform);
+      gtk_widget_queue_allocate (widget);
+      return;
+    }
+
+  if (gsk_transform_equal (transform, priv->transform))
+    {
+      gsk_transform_unref (transform);
+      return;
+    }
+
+  gsk_transform_unref (priv->transform);
+  priv->transform = transform;
+
+  if (priv->surface_transform_data)
+    sync_widget_surface_transform (widget);
+
+  gtk_widget_queue_draw (priv->parent);
+}
+
 static void
 gtk_widget_real_css_changed (GtkWidget         *widget,
                              GtkCssStyleChange *change)
@@ -4876,11 +5019,17 @@ gtk_widget_real_css_changed (GtkWidget         *widget,
             }
           else if (gtk_css_style_change_affects (change, GTK_CSS_AFFECTS_TRANSFORM))
             {
-              gtk_widget_queue_allocate (priv->parent);
+              gtk_widget_update_css_transform (widget);
             }
 
-          if (gtk_css_style_change_affects (change, GTK_CSS_AFFECTS_REDRAW) ||
-              (has_text && gtk_css_style_change_affects (change, GTK_CSS_AFFECTS_TEXT_CONTENT)))
+          if (gtk_widget_css_change_only_opacity (widget, change, has_text))
+            {
+              GtkCssStyle *old_style = gtk_css_style_change_get_old_style (change);
+
+              gtk_widget_queue_draw_opacity (widget, gtk_widget_get_render_opacity (widget, old_style) > 0.0);
+            }
+          else if (gtk_css_style_change_affects (change, GTK_CSS_AFFECTS_REDRAW) ||
+                   (has_text && gtk_css_style_change_affects (change, GTK_CSS_AFFECTS_TEXT_CONTENT)))
             {
               gtk_widget_queue_draw (widget);
             }
@@ -10226,6 +10375,7 @@ gtk_widget_set_opacity (GtkWidget *widget,
                         double     opacity)
 {
   GtkWidgetPrivate *priv = gtk_widget_get_instance_private (widget);
+  gboolean was_visible;
   guint8 alpha;
 
   g_return_if_fail (GTK_IS_WIDGET (widget));
@@ -10237,9 +10387,10 @@ gtk_widget_set_opacity (GtkWidget *widget,
   if (alpha == priv->user_alpha)
     return;
 
+  was_visible = priv->user_alpha > 0;
   priv->user_alpha = alpha;
 
-  gtk_widget_queue_draw (widget);
+  gtk_widget_queue_draw_opacity (widget, was_visible);
 
   g_object_notify_by_pspec (G_OBJECT (widget), widget_props[PROP_OPACITY]);
 }
@@ -11360,17 +11511,19 @@ gtk_widget_create_render_node (GtkWidget   *widget,
   GtkWidgetPrivate *priv = gtk_widget_get_instance_private (widget);
   GtkCssBoxes boxes;
   GtkCssValue *filter_value;
-  double css_opacity, opacity;
+  gboolean push_opacity;
+  double opacity;
   GtkCssStyle *style;
 
   style = gtk_css_node_get_style (priv->cssnode);
 
-  css_opacity = _gtk_css_number_value_get (style->other->opacity, 100);
-  opacity = CLAMP (css_opacity, 0.0, 1.0) * priv->user_alpha / 255.0;
+  opacity = gtk_widget_get_render_opacity (widget, style);
 
   if (opacity <= 0.0)
     return NULL;
 
+  push_opacity = opacity < 1.0 && !gtk_widget_defers_opacity (style);
+
   gtk_css_boxes_init (&boxes, widget);
 
   gtk_snapshot_push_collect (snapshot);
@@ -11381,7 +11534,7 @@ gtk_widget_create_render_node (GtkWidget   *widget,
   filter_value = style->other->filter;
   gtk_css_filter_value_push_snapshot (filter_value, snapshot);
 
-  if (opacity < 1.0)
+  if (push_opacity)
     gtk_snapshot_push_opacity (snapshot, opacity);
 
   gtk_css_style_snapshot_background (&boxes, snapshot);
@@ -11400,7 +11553,7 @@ gtk_widget_create_render_node (GtkWidget   *widget,
 
   gtk_css_style_snapshot_outline (&boxes, snapshot);
 
-  if (opacity < 1.0)
+  if (push_opacity)
     gtk_snapshot_pop (snapshot);
 
   gtk_css_filter_value_pop_snapshot (filter_value, snapshot);
@@ -11442,19 +11595,55 @@ gtk_widget_do_snapshot (GtkWidget *widget,
   gtk_widget_update_paintables (widget);
 }
 
+/*
+ * gtk_widget_ref_render_node:
+ * @widget: a #GtkWidget
+ *
+ * Gets the last render node of @widget, with the opacity applied if
+ * it was not part of the node, see gtk_widget_defers_opacity().
+ *
+ * Returns: (transfer full) (nullable): the render node
+ */
+GskRenderNode *
+gtk_widget_ref_render_node (GtkWidget *widget)
+{
+  GtkWidgetPrivate *priv = gtk_widget_get_instance_private (widget);
+  GtkCssStyle *style;
+  double opacity;
+
+  if (priv->render_node == NULL)
+    return NULL;
+
+  style = gtk_css_node_get_style (priv->cssnode);
+  if (!gtk_widget_defers_opacity (style))
+    return gsk_render_node_ref (priv->render_node);
+
+  opacity = gtk_widget_get_render_opacity (widget, style);
+  if (opacity <= 0.0)
+    return NULL;
+  else if (opacity < 1.0)
+    return gsk_opacity_node_new (priv->render_node, opacity);
+  else
+    return gsk_render_node_ref (priv->render_node);
+}
+
 void
 gtk_widget_snapshot (GtkWidget   *widget,
                      GtkSnapshot *snapshot)
 {
-  GtkWidgetPrivate *priv = gtk_widget_get_instance_private (widget);
+  GskRenderNode *render_node;
 
   if (!_gtk_widget_get_mapped (widget))
     return;
 
   gtk_widget_do_snapshot (widget, snapshot);
 
-  if (priv->render_node)
-    gtk_snapshot_append_node (snapshot, priv->render_node);
+  render_node = gtk_widget_ref_render_node (widget);
+  if (render_node)
+    {
+      gtk_snapshot_append_node (snapshot, render_node);
+      gsk_render_node_unref (render_node);
+    }
 }
 
 void
@@ -11833,6 +12022,7 @@ gtk_widget_snapshot_child (GtkWidget   *widget,
                            GtkSnapshot *snapshot)
 {
   GtkWidgetPrivate *priv = gtk_widget_get_instance_private (child);
+  GskRenderNode *render_node;
 
   g_return_if_fail (_gtk_widget_get_parent (child) == widget);
   g_return_if_fail (snapshot != NULL);
@@ -11845,12 +12035,13 @@ gtk_widget_snapshot_child (GtkWidget   *widget,
 
   gtk_widget_do_snapshot (child, snapshot);
 
-  if (!priv->render_node)
+  render_node = gtk_widget_ref_render_node (child);
+  if (!render_node)
     return;
 
   if (priv->transform)
     {
-      GskRenderNode *transform_node = gsk_transform_node_new (priv->render_node,
+      GskRenderNode *transform_node = gsk_transform_node_new (render_node,
                                                               priv->transform);
 
       gtk_snapshot_append_node (snapshot, transform_node);
@@ -11858,8 +12049,10 @@ gtk_widget_snapshot_child (GtkWidget   *widget,
     }
   else
     {
-      gtk_snapshot_append_node (snapshot, priv->render_node);
+      gtk_snapshot_append_node (snapshot, render_node);
     }
+
+  gsk_render_node_unref (render_node);
 }
 
 /**
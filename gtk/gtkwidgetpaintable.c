@@ -282,6 +282,8 @@ gtk_widget_paintable_new (GtkWidget *widget)
 static GdkPaintable *
 gtk_widget_paintable_snapshot_widget (GtkWidgetPaintable *self)
 {
+  GskRenderNode *render_node;
+  GdkPaintable *paintable;
   graphene_rect_t bounds;
 
   if (self->widget == NULL)
@@ -290,10 +292,14 @@ gtk_widget_paintable_snapshot_widget (GtkWidgetPaintable *self)
   if (!gtk_widget_compute_bounds (self->widget, self->widget, &bounds))
     return gdk_paintable_new_empty (0, 0);
 
-  if (self->widget->priv->render_node == NULL)
+  render_node = gtk_widget_ref_render_node (self->widget);
+  if (render_node == NULL)
     return gdk_paintable_new_empty (bounds.size.width, bounds.size.height);
-  
-  return gtk_render_node_paintable_new (self->widget->priv->render_node, &bounds);
+
+  paintable = gtk_render_node_paintable_new (render_node, &bounds);
+  gsk_render_node_unref (render_node);
+
+  return paintable;
 }
 
 /**
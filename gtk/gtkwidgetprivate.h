@@ -234,6 +234,7 @@ GdkSurface * gtk_widget_get_surface         (GtkWidget *widget);
 void         gtk_widget_render              (GtkWidget            *widget,
                                              GdkSurface           *surface,
                                              const cairo_region_t *region);
+GskRenderNode * gtk_widget_ref_render_node  (GtkWidget            *widget);
 
 void         _gtk_widget_add_sizegroup         (GtkWidget    *widget,
 						gpointer      group);
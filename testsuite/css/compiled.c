@@ -0,0 +1,320 @@
+/*
+ * Copyright (C) 2020 GNOME Foundation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include <gtk/gtk.h>
+
+/* Tests for stylesheets loaded from compiled files, see GTK_CSS_CACHE */
+
+static GFile *
+create_css_file (const char *css)
+{
+  GFileIOStream *stream;
+  GError *error = NULL;
+  GFile *file;
+
+  file = g_file_new_tmp ("compiledXXXXXX.css", &stream, &error);
+  g_assert_no_error (error);
+  g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (stream)),
+                             css, strlen (css), NULL, NULL, &error);
+  g_assert_no_error (error);
+  g_object_unref (stream);
+
+  return file;
+}
+
+/* Loads @file twice, so the second provider is loaded from the
+ * compiled file the first one wrote */
+static GtkCssProvider *
+load_compiled (GFile *file)
+{
+  GtkCssProvider *provider;
+
+  provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_file (provider, file);
+  g_object_unref (provider);
+
+  provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_file (provider, file);
+
+  return provider;
+}
+
+/* Must match gtk_css_provider_get_compiled_path() */
+static char *
+get_compiled_path (GFile *file)
+{
+  char *uri, *key, *checksum, *basename, *path;
+
+  uri = g_file_get_uri (file);
+  key = g_strdup_printf ("%d.%d.%d %s",
+                         GTK_MAJOR_VERSION, GTK_MINOR_VERSION, GTK_MICRO_VERSION,
+                         uri);
+  checksum = g_compute_checksum_for_string (G_CHECKSUM_SHA1, key, -1);
+  basename = g_strconcat (checksum, ".compiled", NULL);
+  path = g_build_filename (g_get_user_cache_dir (), "gtk-4.0", "css", basename, NULL);
+
+  g_free (basename);
+  g_free (checksum);
+  g_free (key);
+  g_free (uri);
+
+  return path;
+}
+
+static void
+assert_color (GtkWidget  *widget,
+              const char *color)
+{
+  GdkRGBA expected, rgba;
+
+  gdk_rgba_parse (&expected, color);
+  gtk_style_context_get_color (gtk_widget_get_style_context (widget), &rgba);
+  g_assert_true (gdk_rgba_equal (&rgba, &expected));
+}
+
+/* Enough siblings to match their selectors in parallel, while the
+ * values of the provider aren't parsed yet */
+static void
+test_parallel_siblings (void)
+{
+  const char *css = "label { color: red; }\n"
+                    "label.odd { color: blue; }\n"
+                    "label:nth-child(5) { color: green; border: 1px solid green; }\n";
+  GtkCssProvider *provider;
+  GtkWidget *window, *box, *labels[32];
+  GFile *file;
+  guint i;
+
+  file = create_css_file (css);
+  provider = load_compiled (file);
+  gtk_style_context_add_provider_for_display (gdk_display_get_default (),
+                                              GTK_STYLE_PROVIDER (provider),
+                                              GTK_STYLE_PROVIDER_PRIORITY_USER);
+
+  window = gtk_window_new ();
+  box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+  for (i = 0; i < G_N_ELEMENTS (labels); i++)
+    {
+      labels[i] = gtk_label_new ("label");
+      if (i % 2)
+        gtk_widget_add_css_class (labels[i], "odd");
+      gtk_box_append (GTK_BOX (box), labels[i]);
+    }
+  gtk_window_set_child (GTK_WINDOW (window), box);
+
+  gtk_widget_show (window);
+  gtk_test_widget_wait_for_draw (window);
+
+  for (i = 0; i < G_N_ELEMENTS (labels); i++)
+    {
+      if (i == 4)
+        assert_color (labels[i], "green");
+      else if (i % 2)
+        assert_color (labels[i], "blue");
+      else
+        assert_color (labels[i], "red");
+    }
+
+  gtk_window_destroy (GTK_WINDOW (window));
+  gtk_style_context_remove_provider_for_display (gdk_display_get_default (),
+                                                 GTK_STYLE_PROVIDER (provider));
+  g_object_unref (provider);
+  g_file_delete (file, NULL, NULL);
+  g_object_unref (file);
+}
+
+static void
+test_round_trip (void)
+{
+  const char *css = "@define-color accent #3584e4;\n"
+                    "@keyframes spin { from { opacity: 0; } to { opacity: 1; } }\n"
+                    "label, button > label { color: @accent; margin: 1px 2px; }\n"
+                    "box:hover { border: 1px solid red; font: 12px Sans; }\n"
+                    "window { animation: spin 1s infinite; }\n";
+  GtkCssProvider *provider;
+  char *parsed, *compiled, *path;
+  GFile *file;
+
+  file = create_css_file (css);
+
+  provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_file (provider, file);
+  parsed = gtk_css_provider_to_string (provider);
+  g_object_unref (provider);
+
+  path = get_compiled_path (file);
+  g_assert_true (g_file_test (path, G_FILE_TEST_EXISTS));
+
+  provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_file (provider, file);
+  compiled = gtk_css_provider_to_string (provider);
+  g_object_unref (provider);
+
+  g_assert_cmpstr (compiled, ==, parsed);
+
+  g_free (compiled);
+  g_free (parsed);
+  g_unlink (path);
+  g_free (path);
+  g_file_delete (file, NULL, NULL);
+  g_object_unref (file);
+}
+
+static void
+assert_loads_color (GFile      *file,
+                    const char *color)
+{
+  GtkCssProvider *provider;
+  GtkWidget *window, *label;
+
+  provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_file (provider, file);
+  gtk_style_context_add_provider_for_display (gdk_display_get_default (),
+                                              GTK_STYLE_PROVIDER (provider),
+                                              GTK_STYLE_PROVIDER_PRIORITY_USER);
+
+  window = gtk_window_new ();
+  label = gtk_label_new ("label");
+  gtk_window_set_child (GTK_WINDOW (window), label);
+
+  gtk_widget_show (window);
+  gtk_test_widget_wait_for_draw (window);
+
+  assert_color (label, color);
+
+  gtk_window_destroy (GTK_WINDOW (window));
+  gtk_style_context_remove_provider_for_display (gdk_display_get_default (),
+                                                 GTK_STYLE_PROVIDER (provider));
+  g_object_unref (provider);
+}
+
+/* A compiled file that can't be loaded is replaced by parsing the
+ * stylesheet again */
+static void
+test_corrupt (void)
+{
+  GError *error = NULL;
+  char *path, *contents;
+  gsize length;
+  GFile *file;
+
+  file = create_css_file ("label { color: red; }\n");
+  assert_loads_color (file, "red");
+
+  path = get_compiled_path (file);
+  g_file_get_contents (path, &contents, &length, &error);
+  g_assert_no_error (error);
+
+  /* Truncated */
+  g_file_set_contents (path, contents, length / 2, &error);
+  g_assert_no_error (error);
+  assert_loads_color (file, "red");
+
+  /* Garbage */
+  memset (contents, 'x', length);
+  g_file_set_contents (path, contents, length, &error);
+  g_assert_no_error (error);
+  assert_loads_color (file, "red");
+
+  /* Empty */
+  g_file_set_contents (path, "", 0, &error);
+  g_assert_no_error (error);
+  assert_loads_color (file, "red");
+
+  /* And the parsed stylesheet was compiled again */
+  g_free (contents);
+  g_file_get_contents (path, &contents, &length, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (length, >, 0);
+  g_assert_true (g_str_has_prefix (contents, "GTKCSSC"));
+
+  g_free (contents);
+  g_unlink (path);
+  g_free (path);
+  g_file_delete (file, NULL, NULL);
+  g_object_unref (file);
+}
+
+/* Changing a stylesheet or a file it imports invalidates the
+ * compiled file */
+static void
+test_stale (void)
+{
+  GError *error = NULL;
+  char *path, *css;
+  GFile *imported, *file;
+
+  imported = create_css_file ("label { color: red; }\n");
+  path = g_file_get_path (imported);
+  css = g_strdup_printf ("@import url(\"%s\");\n", path);
+  file = create_css_file (css);
+  g_free (css);
+
+  assert_loads_color (file, "red");
+  assert_loads_color (file, "red");
+
+  g_file_set_contents (path, "label { color: blue; }\n", -1, &error);
+  g_assert_no_error (error);
+  assert_loads_color (file, "blue");
+  assert_loads_color (file, "blue");
+  g_free (path);
+
+  path = g_file_get_path (file);
+  g_file_set_contents (path, "label { color: green; }\n", -1, &error);
+  g_assert_no_error (error);
+  assert_loads_color (file, "green");
+  assert_loads_color (file, "green");
+  g_free (path);
+
+  path = get_compiled_path (file);
+  g_unlink (path);
+  g_free (path);
+  g_file_delete (file, NULL, NULL);
+  g_object_unref (file);
+  g_file_delete (imported, NULL, NULL);
+  g_object_unref (imported);
+}
+
+int
+main (int argc, char *argv[])
+{
+  char *cache_dir;
+  int result;
+
+  /* Before anything looks at them */
+  cache_dir = g_dir_make_tmp ("gtk-css-cache-XXXXXX", NULL);
+  g_assert_nonnull (cache_dir);
+  g_setenv ("XDG_CACHE_HOME", cache_dir, TRUE);
+  g_setenv ("GTK_CSS_CACHE", "1", TRUE);
+
+  gtk_init ();
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/css/compiled/round-trip", test_round_trip);
+  g_test_add_func ("/css/compiled/corrupt", test_corrupt);
+  g_test_add_func ("/css/compiled/stale", test_stale);
+  g_test_add_func ("/css/compiled/parallel-siblings", test_parallel_siblings);
+
+  result = g_test_run ();
+
+  g_free (cache_dir);
+
+  return result;
+}
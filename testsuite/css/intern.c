@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2021 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <gtk/gtk.h>
+#include "gtk/gtkcssvalueprivate.h"
+#include "gtk/gtkcssnumbervalueprivate.h"
+#include "gtk/gtkcssshadowvalueprivate.h"
+#include "gtk/gtkcssstylepropertyprivate.h"
+#include "gtk/gtkcssstaticstyleprivate.h"
+
+/* Tests for interned computed values, see GTK_CSS_INTERN */
+
+static GtkCssValue *
+value_from_string (guint       property_id,
+                   const char *str)
+{
+  GtkStyleProperty *prop;
+  GBytes *bytes;
+  GtkCssParser *parser;
+  GtkCssValue *value;
+
+  prop = (GtkStyleProperty *) _gtk_css_style_property_lookup_by_id (property_id);
+
+  bytes = g_bytes_new_static (str, strlen (str));
+  parser = gtk_css_parser_new_for_bytes (bytes, NULL, NULL, NULL, NULL, NULL);
+  value = _gtk_style_property_parse_value (prop, parser);
+  gtk_css_parser_unref (parser);
+  g_bytes_unref (bytes);
+
+  g_assert_nonnull (value);
+
+  return value;
+}
+
+static GtkCssValue *
+shadow_from_string (const char *str,
+                    gboolean    is_filter)
+{
+  GBytes *bytes;
+  GtkCssParser *parser;
+  GtkCssValue *value;
+
+  bytes = g_bytes_new_static (str, strlen (str));
+  parser = gtk_css_parser_new_for_bytes (bytes, NULL, NULL, NULL, NULL, NULL);
+  if (is_filter)
+    value = gtk_css_shadow_value_parse_filter (parser);
+  else
+    value = gtk_css_shadow_value_parse (parser, TRUE);
+  gtk_css_parser_unref (parser);
+  g_bytes_unref (bytes);
+
+  g_assert_nonnull (value);
+
+  return value;
+}
+
+static GtkCssValue *
+compute (GtkCssValue *value,
+         guint        property_id)
+{
+  GtkCssValue *computed;
+
+  computed = _gtk_css_value_compute (value,
+                                     property_id,
+                                     GTK_STYLE_PROVIDER (gtk_settings_get_default ()),
+                                     gtk_css_static_style_get_default (),
+                                     NULL);
+  gtk_css_value_unref (value);
+
+  return computed;
+}
+
+static void
+test_numbers (void)
+{
+  GtkCssValue *value1, *value2, *value3;
+
+  value1 = compute (value_from_string (GTK_CSS_PROPERTY_MARGIN_TOP, "3.5em"), GTK_CSS_PROPERTY_MARGIN_TOP);
+  value2 = compute (value_from_string (GTK_CSS_PROPERTY_MARGIN_TOP, "3.5em"), GTK_CSS_PROPERTY_MARGIN_TOP);
+  value3 = compute (value_from_string (GTK_CSS_PROPERTY_MARGIN_TOP, "4.5em"), GTK_CSS_PROPERTY_MARGIN_TOP);
+
+  g_assert_true (value1 == value2);
+  g_assert_false (value1 == value3);
+
+  gtk_css_value_unref (value1);
+  gtk_css_value_unref (value2);
+  gtk_css_value_unref (value3);
+}
+
+/* Equal values must hash the same, and -0 == 0 */
+static void
+test_negative_zero (void)
+{
+  GtkCssValue *zero, *negative_zero;
+
+  zero = gtk_css_dimension_value_new (0.0, GTK_CSS_EM);
+  negative_zero = gtk_css_dimension_value_new (-0.0, GTK_CSS_EM);
+
+  g_assert_true (_gtk_css_value_equal (zero, negative_zero));
+  g_assert_cmpuint (gtk_css_value_hash (zero), ==, gtk_css_value_hash (negative_zero));
+
+  gtk_css_value_unref (zero);
+  gtk_css_value_unref (negative_zero);
+}
+
+static void
+test_colors (void)
+{
+  GtkCssValue *value1, *value2, *value3;
+
+  value1 = compute (value_from_string (GTK_CSS_PROPERTY_BACKGROUND_COLOR, "alpha(currentColor, 0.5)"),
+                    GTK_CSS_PROPERTY_BACKGROUND_COLOR);
+  value2 = compute (value_from_string (GTK_CSS_PROPERTY_BACKGROUND_COLOR, "alpha(currentColor, 0.5)"),
+                    GTK_CSS_PROPERTY_BACKGROUND_COLOR);
+  value3 = compute (value_from_string (GTK_CSS_PROPERTY_BACKGROUND_COLOR, "alpha(currentColor, 0.25)"),
+                    GTK_CSS_PROPERTY_BACKGROUND_COLOR);
+
+  g_assert_true (value1 == value2);
+  g_assert_false (value1 == value3);
+
+  gtk_css_value_unref (value1);
+  gtk_css_value_unref (value2);
+  gtk_css_value_unref (value3);
+}
+
+/* A drop-shadow() filter must not be interned as a box shadow
+ * with the same numbers */
+static void
+test_shadows (void)
+{
+  GtkCssValue *box1, *box2, *filter1, *filter2;
+
+  box1 = compute (shadow_from_string ("1em 2em 3em red", FALSE), GTK_CSS_PROPERTY_BOX_SHADOW);
+  box2 = compute (shadow_from_string ("1em 2em 3em red", FALSE), GTK_CSS_PROPERTY_BOX_SHADOW);
+  filter1 = compute (shadow_from_string ("1em 2em 3em red", TRUE), GTK_CSS_PROPERTY_FILTER);
+  filter2 = compute (shadow_from_string ("1em 2em 3em red", TRUE), GTK_CSS_PROPERTY_FILTER);
+
+  g_assert_true (box1 == box2);
+  g_assert_true (filter1 == filter2);
+  g_assert_false (box1 == filter1);
+  g_assert_false (_gtk_css_value_equal (box1, filter1));
+
+  gtk_css_value_unref (box1);
+  gtk_css_value_unref (box2);
+  gtk_css_value_unref (filter1);
+  gtk_css_value_unref (filter2);
+}
+
+/* Values leave the table when they are freed */
+static void
+test_freed (void)
+{
+  GtkCssValue *value;
+  guint i;
+
+  for (i = 0; i < 3; i++)
+    {
+      value = compute (value_from_string (GTK_CSS_PROPERTY_MARGIN_TOP, "7.25em"), GTK_CSS_PROPERTY_MARGIN_TOP);
+      g_assert_true (gtk_css_value_is_computed (value));
+      gtk_css_value_unref (value);
+    }
+}
+
+int
+main (int argc, char **argv)
+{
+  /* Before any value is computed */
+  g_setenv ("GTK_CSS_INTERN", "1", TRUE);
+
+  gtk_test_init (&argc, &argv);
+
+  g_test_add_func ("/css/intern/numbers", test_numbers);
+  g_test_add_func ("/css/intern/negative-zero", test_negative_zero);
+  g_test_add_func ("/css/intern/colors", test_colors);
+  g_test_add_func ("/css/intern/shadows", test_shadows);
+  g_test_add_func ("/css/intern/freed", test_freed);
+
+  return g_test_run ();
+}
@@ -129,6 +129,20 @@ parse_css_file (GFile *file, gboolean generate)
   css_file = g_file_get_path (file);
   errors = g_string_new ("");
 
+  if (g_getenv ("GTK_CSS_CACHE"))
+    {
+      /* Load the file once, so the provider below is loaded from
+       * the compiled file, unless there were errors */
+      provider = gtk_css_provider_new ();
+      g_signal_connect (provider,
+                        "parsing-error",
+                        G_CALLBACK (parsing_error_cb),
+                        errors);
+      gtk_css_provider_load_from_path (provider, css_file);
+      g_object_unref (provider);
+      g_string_truncate (errors, 0);
+    }
+
   provider = gtk_css_provider_new ();
   g_signal_connect (provider, 
                     "parsing-error",
@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2021 Red Hat Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <gtk/gtk.h>
+#include "gtk/gtkcssanimatedstyleprivate.h"
+#include "gtk/gtkcsscolorvalueprivate.h"
+#include "gtk/gtkcsslookupprivate.h"
+#include "gtk/gtkcssnodeprivate.h"
+#include "gtk/gtkcssnumbervalueprivate.h"
+#include "gtk/gtkcsssharedstylesprivate.h"
+#include "gtk/gtkcssstaticstyleprivate.h"
+#include "gtk/gtkcssstyleprivate.h"
+#include "gtk/gtkcssstylepropertyprivate.h"
+#include "gtk/gtkstyleproviderprivate.h"
+#include "gtk/gtkwidgetprivate.h"
+
+/* Keep in sync with gtkcsssharedstyles.c */
+#define MAX_SHARED_STYLES 1024
+#define N_MARGINS (MAX_SHARED_STYLES + 100)
+
+/* Lookups are compared by the pointers of their values */
+static GtkCssValue *margins[N_MARGINS];
+
+/* A lookup that sets margin-top to @margin pixels */
+static void
+init_lookup (GtkCssLookup *lookup,
+             int           margin)
+{
+  g_assert (margin < N_MARGINS);
+
+  if (margins[margin] == NULL)
+    margins[margin] = gtk_css_dimension_value_new (margin, GTK_CSS_PX);
+
+  _gtk_css_lookup_init (lookup);
+  _gtk_css_lookup_set (lookup, GTK_CSS_PROPERTY_MARGIN_TOP, NULL, margins[margin]);
+}
+
+static GtkCssStyle *
+lookup_style (GtkStyleProvider *provider,
+              int               margin)
+{
+  GtkCssLookup lookup;
+  GtkCssStyle *style;
+
+  init_lookup (&lookup, margin);
+  style = gtk_css_shared_styles_lookup (provider, NULL, &lookup, 0);
+  _gtk_css_lookup_destroy (&lookup);
+
+  return style;
+}
+
+static GtkCssStyle *
+insert_style (GtkStyleProvider *provider,
+              int               margin)
+{
+  GtkCssLookup lookup;
+  GtkCssStyle *style;
+
+  init_lookup (&lookup, margin);
+  style = gtk_css_static_style_new_resolve (provider, NULL, &lookup, 0);
+  gtk_css_shared_styles_insert (provider, NULL, &lookup, 0, style);
+  _gtk_css_lookup_destroy (&lookup);
+
+  return style;
+}
+
+static void
+test_hit (void)
+{
+  GtkStyleProvider *provider = GTK_STYLE_PROVIDER (gtk_settings_get_default ());
+  GtkCssStyle *style;
+
+  gtk_css_shared_styles_clear ();
+
+  g_assert_null (lookup_style (provider, 5));
+
+  style = insert_style (provider, 5);
+  g_assert_true (lookup_style (provider, 5) == style);
+  g_assert_null (lookup_style (provider, 6));
+
+  g_object_unref (style);
+}
+
+/* Styles depend on settings that aren't in the key */
+static void
+test_provider_changed (void)
+{
+  GtkStyleProvider *provider = GTK_STYLE_PROVIDER (gtk_settings_get_default ());
+  GtkCssStyle *style;
+
+  gtk_css_shared_styles_clear ();
+
+  style = insert_style (provider, 5);
+  g_assert_true (lookup_style (provider, 5) == style);
+
+  gtk_style_provider_changed (provider);
+  g_assert_null (lookup_style (provider, 5));
+
+  g_object_unref (style);
+}
+
+static void
+test_eviction (void)
+{
+  GtkStyleProvider *provider = GTK_STYLE_PROVIDER (gtk_settings_get_default ());
+  GtkCssStyle *styles[N_MARGINS];
+  int i;
+
+  gtk_css_shared_styles_clear ();
+
+  for (i = 0; i < G_N_ELEMENTS (styles); i++)
+    {
+      styles[i] = insert_style (provider, i);
+
+      /* Keep the first style in use */
+      if (i > 0)
+        g_assert_true (lookup_style (provider, 0) == styles[0]);
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (styles); i++)
+    {
+      GtkCssStyle *style = lookup_style (provider, i);
+
+      if (i == 0 || i > G_N_ELEMENTS (styles) - MAX_SHARED_STYLES)
+        {
+          g_assert_true (style == styles[i]);
+          g_assert_cmpfloat (_gtk_css_number_value_get (gtk_css_style_get_value (style, GTK_CSS_PROPERTY_MARGIN_TOP), 100), ==, i);
+        }
+      else
+        {
+          g_assert_null (style);
+        }
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (styles); i++)
+    g_object_unref (styles[i]);
+}
+
+static GtkCssValue *
+value_from_string (guint       property_id,
+                   const char *str)
+{
+  GtkStyleProperty *prop;
+  GBytes *bytes;
+  GtkCssParser *parser;
+  GtkCssValue *value;
+
+  prop = (GtkStyleProperty *) _gtk_css_style_property_lookup_by_id (property_id);
+
+  bytes = g_bytes_new_static (str, strlen (str));
+  parser = gtk_css_parser_new_for_bytes (bytes, NULL, NULL, NULL, NULL, NULL);
+  value = _gtk_style_property_parse_value (prop, parser);
+  gtk_css_parser_unref (parser);
+  g_bytes_unref (bytes);
+
+  g_assert_nonnull (value);
+
+  return value;
+}
+
+static void
+assert_style_color (GtkCssStyle *style,
+                    const char  *color)
+{
+  GdkRGBA expected;
+
+  gdk_rgba_parse (&expected, color);
+  g_assert_true (gdk_rgba_equal (gtk_css_color_value_get_rgba (style->core->color), &expected));
+}
+
+/* Static styles share equal value groups, so animations must not
+ * change the groups of their base style */
+static void
+test_animated_values (void)
+{
+  GtkStyleProvider *provider = GTK_STYLE_PROVIDER (gtk_settings_get_default ());
+  GtkCssValue *red, *blue, *property, *duration;
+  GtkCssStyle *base, *other, *previous, *animated, *advanced;
+  GtkCssLookup lookup;
+
+  red = value_from_string (GTK_CSS_PROPERTY_COLOR, "red");
+  blue = value_from_string (GTK_CSS_PROPERTY_COLOR, "blue");
+  property = value_from_string (GTK_CSS_PROPERTY_TRANSITION_PROPERTY, "color");
+  duration = value_from_string (GTK_CSS_PROPERTY_TRANSITION_DURATION, "10s");
+
+  _gtk_css_lookup_init (&lookup);
+  _gtk_css_lookup_set (&lookup, GTK_CSS_PROPERTY_COLOR, NULL, red);
+  _gtk_css_lookup_set (&lookup, GTK_CSS_PROPERTY_TRANSITION_PROPERTY, NULL, property);
+  _gtk_css_lookup_set (&lookup, GTK_CSS_PROPERTY_TRANSITION_DURATION, NULL, duration);
+  base = gtk_css_static_style_new_resolve (provider, NULL, &lookup, 0);
+  other = gtk_css_static_style_new_resolve (provider, NULL, &lookup, 0);
+  _gtk_css_lookup_destroy (&lookup);
+
+  _gtk_css_lookup_init (&lookup);
+  _gtk_css_lookup_set (&lookup, GTK_CSS_PROPERTY_COLOR, NULL, blue);
+  previous = gtk_css_static_style_new_resolve (provider, NULL, &lookup, 0);
+  _gtk_css_lookup_destroy (&lookup);
+
+  g_assert_true (base->core == other->core);
+
+  animated = gtk_css_animated_style_new (base, NULL, 1, provider, previous);
+  g_assert_true (GTK_IS_CSS_ANIMATED_STYLE (animated));
+  g_assert_false (animated->core == base->core);
+  assert_style_color (animated, "blue");
+  assert_style_color (base, "red");
+  assert_style_color (other, "red");
+  g_assert_true (base->core == other->core);
+
+  advanced = gtk_css_animated_style_new_advance (GTK_CSS_ANIMATED_STYLE (animated), base, 1 + 5 * G_USEC_PER_SEC);
+  g_assert_true (GTK_IS_CSS_ANIMATED_STYLE (advanced));
+  g_assert_false (advanced->core == base->core);
+  g_assert_false (advanced->core == animated->core);
+  assert_style_color (animated, "blue");
+  assert_style_color (base, "red");
+  assert_style_color (other, "red");
+  g_assert_true (base->core == other->core);
+
+  g_object_unref (advanced);
+  g_object_unref (animated);
+  g_object_unref (previous);
+  g_object_unref (other);
+  g_object_unref (base);
+  gtk_css_value_unref (red);
+  gtk_css_value_unref (blue);
+  gtk_css_value_unref (property);
+  gtk_css_value_unref (duration);
+}
+
+/* Identical siblings in different parents share their style */
+static void
+test_widgets (void)
+{
+  GtkWidget *window, *box, *box1, *box2, *label1, *label2;
+
+  window = gtk_window_new ();
+  box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+  box1 = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+  box2 = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+  label1 = gtk_label_new ("label");
+  label2 = gtk_label_new ("label");
+  gtk_box_append (GTK_BOX (box1), label1);
+  gtk_box_append (GTK_BOX (box2), label2);
+  gtk_box_append (GTK_BOX (box), box1);
+  gtk_box_append (GTK_BOX (box), box2);
+  gtk_window_set_child (GTK_WINDOW (window), box);
+
+  gtk_widget_show (window);
+  gtk_test_widget_wait_for_draw (window);
+
+  g_assert_true (gtk_css_node_get_style (gtk_widget_get_css_node (label1)) ==
+                 gtk_css_node_get_style (gtk_widget_get_css_node (label2)));
+
+  gtk_window_destroy (GTK_WINDOW (window));
+}
+
+int
+main (int argc, char **argv)
+{
+  gtk_test_init (&argc, &argv);
+
+  g_test_add_func ("/css/shared-styles/hit", test_hit);
+  g_test_add_func ("/css/shared-styles/provider-changed", test_provider_changed);
+  g_test_add_func ("/css/shared-styles/eviction", test_eviction);
+  g_test_add_func ("/css/shared-styles/widgets", test_widgets);
+  g_test_add_func ("/css/shared-styles/animated-values", test_animated_values);
+
+  return g_test_run ();
+}
@@ -99,6 +99,15 @@ load_ui_file (GFile *file, gboolean generate)
   css_file = test_get_other_file (ui_file, ".css");
   g_assert (css_file != NULL);
 
+  if (g_getenv ("GTK_CSS_CACHE"))
+    {
+      /* Load the file once, so the provider below is
+       * loaded from the compiled file */
+      provider = gtk_css_provider_new ();
+      gtk_css_provider_load_from_path (provider, css_file);
+      g_object_unref (provider);
+    }
+
   provider = gtk_css_provider_new ();
   gtk_css_provider_load_from_path (provider, css_file);
   gtk_style_context_add_provider_for_display (gdk_display_get_default (),
@@ -0,0 +1,137 @@
+#include <string.h>
+
+#include <gdk/gdk.h>
+#include "gdk/gdkmemorytextureprivate.h"
+
+static const char *impl_names[GDK_MEMORY_CONVERT_N_IMPLS] = {
+  "scalar",
+  "ssse3",
+  "avx2",
+  "neon",
+};
+
+/* Odd widths leave pixels for the scalar code after the vectors, and
+ * the sizes are on both sides of converting in parallel bands */
+static const struct {
+  gsize width;
+  gsize height;
+} sizes[] = {
+  { 1, 1 },
+  { 3, 2 },
+  { 5, 3 },
+  { 7, 5 },
+  { 9, 4 },
+  { 17, 3 },
+  { 33, 7 },
+  { 511, 511 },
+  { 513, 513 },
+};
+
+typedef struct {
+  GdkMemoryFormat src_format;
+  guint dest_format;
+} TestData;
+
+static guchar *
+convert (GdkMemoryConvertImpl  impl,
+         TestData             *data,
+         const guchar         *src,
+         gsize                 src_stride,
+         gsize                 width,
+         gsize                 height,
+         gsize                 dest_stride)
+{
+  guchar *dest;
+
+  /* The padding must stay untouched */
+  dest = g_malloc (dest_stride * height);
+  memset (dest, 0xA5, dest_stride * height);
+
+  if (!gdk_memory_convert_with_impl (impl,
+                                     dest, dest_stride, data->dest_format,
+                                     src, src_stride, data->src_format,
+                                     width, height))
+    g_clear_pointer (&dest, g_free);
+
+  return dest;
+}
+
+static void
+test_convert (gconstpointer test_data)
+{
+  TestData *data = (TestData *) test_data;
+  gsize bpp = gdk_memory_format_bytes_per_pixel (data->src_format);
+  guint s, impl, i;
+
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++)
+    {
+      const gsize width = sizes[s].width;
+      const gsize height = sizes[s].height;
+      const gsize src_stride = width * bpp + 3;
+      const gsize dest_stride = width * 4 + 5;
+      const gsize src_size = src_stride * (height - 1) + width * bpp;
+      guchar *src, *expected, *result;
+
+      /* No padding after the last row, so reading past it is caught
+       * by memory checkers */
+      src = g_malloc (src_size);
+      for (i = 0; i < src_size; i++)
+        src[i] = g_test_rand_int_range (0, 256);
+
+      expected = convert (GDK_MEMORY_CONVERT_SCALAR, data, src, src_stride, width, height, dest_stride);
+      g_assert_nonnull (expected);
+
+      for (impl = GDK_MEMORY_CONVERT_SCALAR + 1; impl < GDK_MEMORY_CONVERT_N_IMPLS; impl++)
+        {
+          result = convert (impl, data, src, src_stride, width, height, dest_stride);
+          if (result == NULL)
+            continue;
+
+          if (memcmp (expected, result, dest_stride * height) != 0)
+            {
+              g_test_message ("%s differs from scalar for %zux%zu",
+                              impl_names[impl], width, height);
+              g_test_fail ();
+            }
+
+          g_free (result);
+        }
+
+      g_free (expected);
+      g_free (src);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  GEnumClass *enum_class;
+  GdkMemoryFormat src_format;
+  guint dest_format;
+
+  g_test_init (&argc, &argv, NULL);
+
+  enum_class = g_type_class_ref (GDK_TYPE_MEMORY_FORMAT);
+
+  for (src_format = 0; src_format < GDK_MEMORY_N_FORMATS; src_format++)
+    {
+      /* gdk_memory_convert() only converts to the first 3 formats */
+      for (dest_format = 0; dest_format < 3; dest_format++)
+        {
+          TestData *test_data = g_new (TestData, 1);
+          char *test_name;
+
+          test_data->src_format = src_format;
+          test_data->dest_format = dest_format;
+          test_name = g_strdup_printf ("/memoryconvert/%s/%s",
+                                       g_enum_get_value (enum_class, src_format)->value_nick,
+                                       g_enum_get_value (enum_class, dest_format)->value_nick);
+          g_test_add_data_func_full (test_name, test_data, test_convert, g_free);
+          g_free (test_name);
+        }
+    }
+
+  g_type_class_unref (enum_class);
+
+  return g_test_run ();
+}
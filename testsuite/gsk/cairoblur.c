@@ -0,0 +1,157 @@
+/*
+ * Copyright © 2020 GNOME Foundation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <gtk/gtk.h>
+#include "gsk/gskcairoblurprivate.h"
+
+static const char *impl_names[GSK_CAIRO_BLUR_N_IMPLS] = {
+  "scalar",
+  "sse2",
+  "avx2",
+  "neon",
+};
+
+/* Odd sizes leave columns for the scalar code after the vectors, and
+ * the big ones are blurred on several threads */
+static const struct {
+  int width;
+  int height;
+} sizes[] = {
+  { 1, 1 },
+  { 3, 5 },
+  { 7, 3 },
+  { 17, 9 },
+  { 33, 31 },
+  { 129, 65 },
+  { 511, 7 },
+  { 513, 513 },
+  { 1025, 257 },
+};
+
+static const double radii[] = { 2, 3, 8, 17, 50 };
+
+static const GskBlurFlags flags[] = {
+  GSK_BLUR_X,
+  GSK_BLUR_Y,
+  GSK_BLUR_X | GSK_BLUR_Y,
+};
+
+typedef struct {
+  const char *name;
+  int bytes_per_pixel;
+} TestData;
+
+/* The blur only looks at bytes, so ARGB buffers are blurred as A8
+ * buffers with 4 bytes per pixel */
+static const TestData formats[] = {
+  { "a8", 1 },
+  { "argb32", 4 },
+};
+
+static guchar *
+blur (GskCairoBlurImpl  impl,
+      const guchar     *src,
+      int               width,
+      int               height,
+      int               stride,
+      double            radius,
+      GskBlurFlags      blur_flags)
+{
+  cairo_surface_t *surface;
+  guchar *data;
+
+  data = g_memdup2 (src, stride * height);
+  surface = cairo_image_surface_create_for_data (data, CAIRO_FORMAT_A8, width, height, stride);
+
+  if (!gsk_cairo_blur_surface_with_impl (impl, surface, radius, blur_flags))
+    g_clear_pointer (&data, g_free);
+
+  cairo_surface_destroy (surface);
+
+  return data;
+}
+
+static void
+test_blur (gconstpointer test_data)
+{
+  const TestData *data = test_data;
+  guint s, r, f, impl;
+  int i;
+
+  for (s = 0; s < G_N_ELEMENTS (sizes); s++)
+    {
+      const int width = sizes[s].width * data->bytes_per_pixel;
+      const int height = sizes[s].height;
+      const int stride = cairo_format_stride_for_width (CAIRO_FORMAT_A8, width);
+      guchar *src;
+
+      src = g_malloc (stride * height);
+      for (i = 0; i < stride * height; i++)
+        src[i] = g_test_rand_int_range (0, 256);
+
+      for (r = 0; r < G_N_ELEMENTS (radii); r++)
+        for (f = 0; f < G_N_ELEMENTS (flags); f++)
+          {
+            guchar *expected, *result;
+
+            expected = blur (GSK_CAIRO_BLUR_SCALAR, src, width, height, stride, radii[r], flags[f]);
+            g_assert_nonnull (expected);
+
+            for (impl = GSK_CAIRO_BLUR_SCALAR + 1; impl < GSK_CAIRO_BLUR_N_IMPLS; impl++)
+              {
+                result = blur (impl, src, width, height, stride, radii[r], flags[f]);
+                if (result == NULL)
+                  continue;
+
+                if (memcmp (expected, result, stride * height) != 0)
+                  {
+                    g_test_message ("%s differs from scalar for %dx%d, radius %g, flags %u",
+                                    impl_names[impl], width, height, radii[r], flags[f]);
+                    g_test_fail ();
+                  }
+
+                g_free (result);
+              }
+
+            g_free (expected);
+          }
+
+      g_free (src);
+    }
+}
+
+int
+main (int argc, char *argv[])
+{
+  guint i;
+
+  g_test_init (&argc, &argv, NULL);
+
+  for (i = 0; i < G_N_ELEMENTS (formats); i++)
+    {
+      char *test_name = g_strdup_printf ("/cairoblur/%s", formats[i].name);
+
+      g_test_add_data_func (test_name, &formats[i], test_blur);
+      g_free (test_name);
+    }
+
+  return g_test_run ();
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright © 2020 GNOME Foundation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include <glib/gstdio.h>
+
+#include <gtk/gtk.h>
+#include "gsk/gskglyphdiskcacheprivate.h"
+
+#define WIDTH 7
+#define HEIGHT 5
+#define STRIDE 32
+
+static gboolean
+has_glyph_file (const char *dir)
+{
+  GDir *d;
+  const char *name;
+  gboolean found = FALSE;
+
+  d = g_dir_open (dir, 0, NULL);
+  g_assert_nonnull (d);
+  while (!found && (name = g_dir_read_name (d)) != NULL)
+    found = g_str_has_suffix (name, ".glyphs");
+  g_dir_close (d);
+
+  return found;
+}
+
+static void
+remove_dir (const char *dir)
+{
+  GDir *d;
+  const char *name;
+
+  d = g_dir_open (dir, 0, NULL);
+  g_assert_nonnull (d);
+  while ((name = g_dir_read_name (d)) != NULL)
+    {
+      char *path = g_build_filename (dir, name, NULL);
+      g_remove (path);
+      g_free (path);
+    }
+  g_dir_close (d);
+  g_rmdir (dir);
+}
+
+static void
+assert_pixels (const guchar *pixels,
+               const guchar *data)
+{
+  int y;
+
+  g_assert_nonnull (pixels);
+  for (y = 0; y < HEIGHT; y++)
+    g_assert_cmpmem (pixels + y * WIDTH * 4, WIDTH * 4, data + y * STRIDE, WIDTH * 4);
+}
+
+static PangoFont *
+load_font (void)
+{
+  PangoFontMap *fontmap;
+  PangoContext *context;
+  PangoFontDescription *desc;
+  PangoFont *font;
+
+  fontmap = pango_cairo_font_map_get_default ();
+  context = pango_font_map_create_context (fontmap);
+  desc = pango_font_description_from_string ("Sans 12");
+  font = pango_font_map_load_font (fontmap, context, desc);
+  pango_font_description_free (desc);
+  g_object_unref (context);
+  g_assert_nonnull (font);
+
+  return font;
+}
+
+static void
+wait_for_glyph_file (const char *dir)
+{
+  guint i;
+
+  for (i = 0; i < 1000 && !has_glyph_file (dir); i++)
+    {
+      g_main_context_iteration (NULL, FALSE);
+      g_usleep (G_USEC_PER_SEC / 100);
+    }
+  g_assert_true (has_glyph_file (dir));
+}
+
+static void
+test_round_trip (void)
+{
+  GskGlyphDiskCache *cache, *cache2;
+  PangoFont *font;
+  guchar data[HEIGHT * STRIDE];
+  const guchar *pixels;
+  char *dir;
+  guint i;
+
+  for (i = 0; i < sizeof (data); i++)
+    data[i] = i * 7;
+
+  dir = g_dir_make_tmp ("gsk-glyphs-XXXXXX", NULL);
+  g_assert_nonnull (dir);
+
+  font = load_font ();
+
+  cache = gsk_glyph_disk_cache_new (dir);
+  g_assert_nonnull (cache);
+
+  gsk_glyph_disk_cache_add (cache, font, 1024, 42, 1, 0, WIDTH, HEIGHT, data, STRIDE);
+  pixels = gsk_glyph_disk_cache_lookup (cache, font, 1024, 42, 1, 0, WIDTH, HEIGHT);
+  if (pixels == NULL)
+    {
+      g_test_skip ("Font can't be identified");
+      gsk_glyph_disk_cache_free (cache);
+      g_object_unref (font);
+      remove_dir (dir);
+      g_free (dir);
+      return;
+    }
+  assert_pixels (pixels, data);
+
+  gsk_glyph_disk_cache_save (cache);
+  wait_for_glyph_file (dir);
+
+  /* Whether or not the saved file replaced the new glyphs yet */
+  while (g_main_context_iteration (NULL, FALSE));
+  assert_pixels (gsk_glyph_disk_cache_lookup (cache, font, 1024, 42, 1, 0, WIDTH, HEIGHT), data);
+
+  cache2 = gsk_glyph_disk_cache_new (dir);
+  assert_pixels (gsk_glyph_disk_cache_lookup (cache2, font, 1024, 42, 1, 0, WIDTH, HEIGHT), data);
+  g_assert_null (gsk_glyph_disk_cache_lookup (cache2, font, 1024, 42, 2, 0, WIDTH, HEIGHT));
+  g_assert_null (gsk_glyph_disk_cache_lookup (cache2, font, 1024, 42, 1, 0, WIDTH + 1, HEIGHT));
+  g_assert_null (gsk_glyph_disk_cache_lookup (cache2, font, 2048, 42, 1, 0, WIDTH, HEIGHT));
+
+  gsk_glyph_disk_cache_free (cache2);
+  gsk_glyph_disk_cache_free (cache);
+  g_object_unref (font);
+  remove_dir (dir);
+  g_free (dir);
+}
+
+/* Glyphs that couldn't be written are written with the next save */
+static void
+test_failed_save (void)
+{
+  GskGlyphDiskCache *cache;
+  PangoFont *font;
+  guchar data[HEIGHT * STRIDE];
+  char *dir;
+  guint i;
+
+  for (i = 0; i < sizeof (data); i++)
+    data[i] = i * 3;
+
+  dir = g_dir_make_tmp ("gsk-glyphs-XXXXXX", NULL);
+  g_assert_nonnull (dir);
+
+  font = load_font ();
+
+  cache = gsk_glyph_disk_cache_new (dir);
+  g_assert_nonnull (cache);
+
+  gsk_glyph_disk_cache_add (cache, font, 1024, 42, 1, 0, WIDTH, HEIGHT, data, STRIDE);
+  if (gsk_glyph_disk_cache_lookup (cache, font, 1024, 42, 1, 0, WIDTH, HEIGHT) == NULL)
+    {
+      g_test_skip ("Font can't be identified");
+      gsk_glyph_disk_cache_free (cache);
+      g_object_unref (font);
+      remove_dir (dir);
+      g_free (dir);
+      return;
+    }
+
+  /* Writing fails without the directory */
+  g_rmdir (dir);
+  gsk_glyph_disk_cache_save (cache);
+  for (i = 0; i < 1000 && !g_main_context_iteration (NULL, FALSE); i++)
+    g_usleep (G_USEC_PER_SEC / 100);
+
+  g_assert_cmpint (g_mkdir (dir, 0700), ==, 0);
+  g_assert_false (has_glyph_file (dir));
+
+  gsk_glyph_disk_cache_save (cache);
+  wait_for_glyph_file (dir);
+
+  while (g_main_context_iteration (NULL, FALSE));
+
+  gsk_glyph_disk_cache_free (cache);
+  g_object_unref (font);
+  remove_dir (dir);
+  g_free (dir);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/glyphdiskcache/round-trip", test_round_trip);
+  g_test_add_func ("/glyphdiskcache/failed-save", test_failed_save);
+
+  return g_test_run ();
+}
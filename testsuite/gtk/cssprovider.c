@@ -1,4 +1,5 @@
 #include <gtk/gtk.h>
+#include <string.h>
 
 static void
 assert_section_is_not_null (GtkCssProvider *provider,
@@ -33,6 +34,313 @@ test_section_load_nonexisting_file (void)
   g_object_unref (provider);
 }
 
+static void
+load_async_done (GObject      *source,
+                 GAsyncResult *result,
+                 gpointer      data)
+{
+  GAsyncResult **out = data;
+
+  *out = g_object_ref (result);
+}
+
+static void
+test_load_file_async (void)
+{
+  const char *css = "label { color: red; }\n"
+                    "@define-color fg blue;\n"
+                    "button:hover { background-color: @fg; }\n";
+  GtkCssProvider *provider, *expected;
+  GAsyncResult *result = NULL;
+  GFileIOStream *stream;
+  GError *error = NULL;
+  char *s1, *s2;
+  GFile *file;
+
+  file = g_file_new_tmp ("cssproviderXXXXXX.css", &stream, &error);
+  g_assert_no_error (error);
+  g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (stream)),
+                             css, strlen (css), NULL, NULL, &error);
+  g_assert_no_error (error);
+  g_object_unref (stream);
+
+  provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_data (provider, "box { opacity: 0.5; }", -1);
+  gtk_css_provider_load_from_file_async (provider, file, NULL, load_async_done, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_true (gtk_css_provider_load_from_file_finish (provider, result, &error));
+  g_assert_no_error (error);
+  g_clear_object (&result);
+
+  expected = gtk_css_provider_new ();
+  gtk_css_provider_load_from_data (expected, css, -1);
+
+  s1 = gtk_css_provider_to_string (provider);
+  s2 = gtk_css_provider_to_string (expected);
+  g_assert_cmpstr (s1, ==, s2);
+  g_free (s1);
+  g_free (s2);
+
+  g_file_delete (file, NULL, NULL);
+  g_object_unref (file);
+  g_object_unref (expected);
+  g_object_unref (provider);
+}
+
+static void
+test_load_nonexisting_file_async (void)
+{
+  GtkCssProvider *provider;
+  GAsyncResult *result = NULL;
+  GError *error = NULL;
+  GFile *file;
+  char *s;
+
+  provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_data (provider, "box { opacity: 0.5; }", -1);
+
+  file = g_file_new_for_path ("this/path/does/absolutely/not/exist.css");
+  gtk_css_provider_load_from_file_async (provider, file, NULL, load_async_done, &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_false (gtk_css_provider_load_from_file_finish (provider, result, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_clear_error (&error);
+  g_clear_object (&result);
+
+  /* The old data is still there */
+  s = gtk_css_provider_to_string (provider);
+  g_assert_nonnull (strstr (s, "opacity"));
+  g_free (s);
+
+  g_object_unref (file);
+  g_object_unref (provider);
+}
+
+static GFile *
+create_css_file (const char *css)
+{
+  GFileIOStream *stream;
+  GError *error = NULL;
+  GFile *file;
+
+  file = g_file_new_tmp ("cssproviderXXXXXX.css", &stream, &error);
+  g_assert_no_error (error);
+  g_output_stream_write_all (g_io_stream_get_output_stream (G_IO_STREAM (stream)),
+                             css, strlen (css), NULL, NULL, &error);
+  g_assert_no_error (error);
+  g_object_unref (stream);
+
+  return file;
+}
+
+static void
+count_changes (GtkCssProvider *provider,
+               guint          *n_changes)
+{
+  (*n_changes)++;
+}
+
+static void
+assert_provider_contents (GtkCssProvider *provider,
+                          const char     *css)
+{
+  GtkCssProvider *expected;
+  char *s1, *s2;
+
+  expected = gtk_css_provider_new ();
+  gtk_css_provider_load_from_data (expected, css, -1);
+
+  s1 = gtk_css_provider_to_string (provider);
+  s2 = gtk_css_provider_to_string (expected);
+  g_assert_cmpstr (s1, ==, s2);
+  g_free (s1);
+  g_free (s2);
+
+  g_object_unref (expected);
+}
+
+static void
+test_load_file_async_superseded (void)
+{
+  const char *old_css = "label { color: red; }\n";
+  const char *new_css = "label { color: blue; }\n";
+  GAsyncResult *old_result = NULL, *new_result = NULL;
+  GtkCssProvider *provider;
+  GFile *old_file, *new_file;
+  GError *error = NULL;
+  guint n_changes = 0;
+
+  old_file = create_css_file (old_css);
+  new_file = create_css_file (new_css);
+
+  provider = gtk_css_provider_new ();
+  g_signal_connect (provider, "gtk-private-changed", G_CALLBACK (count_changes), &n_changes);
+
+  /* A newer async load wins */
+  gtk_css_provider_load_from_file_async (provider, old_file, NULL, load_async_done, &old_result);
+  gtk_css_provider_load_from_file_async (provider, new_file, NULL, load_async_done, &new_result);
+
+  while (old_result == NULL || new_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_false (gtk_css_provider_load_from_file_finish (provider, old_result, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_clear_error (&error);
+  g_assert_true (gtk_css_provider_load_from_file_finish (provider, new_result, &error));
+  g_assert_no_error (error);
+  g_clear_object (&old_result);
+  g_clear_object (&new_result);
+
+  g_assert_cmpuint (n_changes, ==, 1);
+  assert_provider_contents (provider, new_css);
+
+  /* A newer sync load wins */
+  n_changes = 0;
+  gtk_css_provider_load_from_file_async (provider, old_file, NULL, load_async_done, &old_result);
+  gtk_css_provider_load_from_data (provider, "box { opacity: 0.5; }", -1);
+
+  while (old_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_false (gtk_css_provider_load_from_file_finish (provider, old_result, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_clear_error (&error);
+  g_clear_object (&old_result);
+
+  g_assert_cmpuint (n_changes, ==, 1);
+  assert_provider_contents (provider, "box { opacity: 0.5; }");
+
+  g_file_delete (old_file, NULL, NULL);
+  g_file_delete (new_file, NULL, NULL);
+  g_object_unref (old_file);
+  g_object_unref (new_file);
+  g_object_unref (provider);
+}
+
+static void
+assert_color (GtkWidget  *widget,
+              const char *color)
+{
+  GdkRGBA expected, rgba;
+
+  gdk_rgba_parse (&expected, color);
+  gtk_style_context_get_color (gtk_widget_get_style_context (widget), &rgba);
+  g_assert_true (gdk_rgba_equal (&rgba, &expected));
+}
+
+static void
+test_reload_changed_rules (void)
+{
+  const char *css = "label { color: red; }\n"
+                    "button { color: green; }\n"
+                    "button:hover { color: yellow; }\n"
+                    "box { opacity: 0.5; }\n"
+                    "window { opacity: 1; }\n";
+  GtkCssProvider *provider;
+  GtkWidget *window, *box, *label, *button;
+
+  provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_data (provider, css, -1);
+  gtk_style_context_add_provider_for_display (gdk_display_get_default (),
+                                              GTK_STYLE_PROVIDER (provider),
+                                              GTK_STYLE_PROVIDER_PRIORITY_USER);
+
+  window = gtk_window_new ();
+  box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+  label = gtk_label_new ("label");
+  button = gtk_button_new ();
+  gtk_box_append (GTK_BOX (box), label);
+  gtk_box_append (GTK_BOX (box), button);
+  gtk_window_set_child (GTK_WINDOW (window), box);
+
+  assert_color (label, "red");
+  assert_color (button, "green");
+
+  /* Only the label rule changes */
+  gtk_css_provider_load_from_data (provider,
+                                   "label { color: blue; }\n"
+                                   "button { color: green; }\n"
+                                   "button:hover { color: yellow; }\n"
+                                   "box { opacity: 0.5; }\n"
+                                   "window { opacity: 1; }\n",
+                                   -1);
+  assert_color (label, "blue");
+  assert_color (button, "green");
+
+  /* Rules for states the widget is not in */
+  gtk_css_provider_load_from_data (provider,
+                                   "label { color: blue; }\n"
+                                   "button { color: green; }\n"
+                                   "button:hover { color: black; }\n"
+                                   "box { opacity: 0.5; }\n"
+                                   "window { opacity: 1; }\n",
+                                   -1);
+  gtk_widget_set_state_flags (button, GTK_STATE_FLAG_PRELIGHT, FALSE);
+  assert_color (button, "black");
+
+  gtk_window_destroy (GTK_WINDOW (window));
+  gtk_style_context_remove_provider_for_display (gdk_display_get_default (),
+                                                 GTK_STYLE_PROVIDER (provider));
+  g_object_unref (provider);
+}
+
+static void
+test_reload_reordered_rules (void)
+{
+  GtkCssProvider *provider;
+  GtkWidget *window, *box, *label, *button;
+
+  provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_data (provider,
+                                   "label { color: red; }\n"
+                                   "label { color: blue; }\n"
+                                   "button { color: green; }\n",
+                                   -1);
+  gtk_style_context_add_provider_for_display (gdk_display_get_default (),
+                                              GTK_STYLE_PROVIDER (provider),
+                                              GTK_STYLE_PROVIDER_PRIORITY_USER);
+
+  window = gtk_window_new ();
+  box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+  label = gtk_label_new ("label");
+  button = gtk_button_new ();
+  gtk_box_append (GTK_BOX (box), label);
+  gtk_box_append (GTK_BOX (box), button);
+  gtk_window_set_child (GTK_WINDOW (window), box);
+
+  assert_color (label, "blue");
+  assert_color (button, "green");
+
+  /* Same rules, but the other one wins now */
+  gtk_css_provider_load_from_data (provider,
+                                   "label { color: blue; }\n"
+                                   "label { color: red; }\n"
+                                   "button { color: green; }\n",
+                                   -1);
+  assert_color (label, "red");
+  assert_color (button, "green");
+
+  /* Moving a rule past rules it doesn't compete with */
+  gtk_css_provider_load_from_data (provider,
+                                   "button { color: green; }\n"
+                                   "label { color: blue; }\n"
+                                   "label { color: red; }\n",
+                                   -1);
+  assert_color (label, "red");
+  assert_color (button, "green");
+
+  gtk_window_destroy (GTK_WINDOW (window));
+  gtk_style_context_remove_provider_for_display (gdk_display_get_default (),
+                                                 GTK_STYLE_PROVIDER (provider));
+  g_object_unref (provider);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -41,6 +349,11 @@ main (int argc, char *argv[])
 
   g_test_add_func ("/cssprovider/section-in-load-from-data", test_section_in_load_from_data);
   g_test_add_func ("/cssprovider/load-nonexisting-file", test_section_load_nonexisting_file);
+  g_test_add_func ("/cssprovider/load-file-async", test_load_file_async);
+  g_test_add_func ("/cssprovider/load-nonexisting-file-async", test_load_nonexisting_file_async);
+  g_test_add_func ("/cssprovider/load-file-async-superseded", test_load_file_async_superseded);
+  g_test_add_func ("/cssprovider/reload-changed-rules", test_reload_changed_rules);
+  g_test_add_func ("/cssprovider/reload-reordered-rules", test_reload_reordered_rules);
 
   return g_test_run ();
 }
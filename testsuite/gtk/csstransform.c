@@ -0,0 +1,253 @@
+/* Copyright (C) 2020 GNOME Foundation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <gtk/gtk.h>
+
+/* Changes of the CSS opacity and transform must not allocate widgets again */
+
+#define GTK_TYPE_GIZMO                 (gtk_gizmo_get_type ())
+#define GTK_GIZMO(obj)                 (G_TYPE_CHECK_INSTANCE_CAST ((obj), GTK_TYPE_GIZMO, GtkGizmo))
+
+typedef struct _GtkGizmo GtkGizmo;
+
+struct _GtkGizmo {
+  GtkWidget parent;
+
+  guint n_allocations;
+};
+
+typedef GtkWidgetClass GtkGizmoClass;
+
+G_DEFINE_TYPE (GtkGizmo, gtk_gizmo, GTK_TYPE_WIDGET);
+
+static void
+gtk_gizmo_measure (GtkWidget      *widget,
+                   GtkOrientation  orientation,
+                   int             for_size,
+                   int            *minimum,
+                   int            *natural,
+                   int            *minimum_baseline,
+                   int            *natural_baseline)
+{
+  *minimum = *natural = 50;
+}
+
+static void
+gtk_gizmo_size_allocate (GtkWidget *widget,
+                         int        width,
+                         int        height,
+                         int        baseline)
+{
+  GTK_GIZMO (widget)->n_allocations++;
+}
+
+static void
+gtk_gizmo_snapshot (GtkWidget   *widget,
+                    GtkSnapshot *snapshot)
+{
+  gtk_snapshot_append_color (snapshot,
+                             &(GdkRGBA) { 1, 0, 0, 1 },
+                             &GRAPHENE_RECT_INIT (0, 0,
+                                                  gtk_widget_get_width (widget),
+                                                  gtk_widget_get_height (widget)));
+}
+
+static void
+gtk_gizmo_class_init (GtkGizmoClass *klass)
+{
+  GtkWidgetClass *widget_class = GTK_WIDGET_CLASS (klass);
+
+  widget_class->measure = gtk_gizmo_measure;
+  widget_class->size_allocate = gtk_gizmo_size_allocate;
+  widget_class->snapshot = gtk_gizmo_snapshot;
+}
+
+static void
+gtk_gizmo_init (GtkGizmo *self)
+{
+}
+
+typedef struct {
+  GtkCssProvider *provider;
+  GtkWidget *window;
+  GtkWidget *gizmo;
+  GtkWidget *sibling;
+} Fixture;
+
+static void
+fixture_setup (Fixture       *fixture,
+               gconstpointer  data)
+{
+  GtkWidget *box;
+
+  fixture->provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_data (fixture->provider,
+                                   ".faded { opacity: 0.5; }\n"
+                                   ".moved { transform: translate(10px, 20px); }\n",
+                                   -1);
+  gtk_style_context_add_provider_for_display (gdk_display_get_default (),
+                                              GTK_STYLE_PROVIDER (fixture->provider),
+                                              GTK_STYLE_PROVIDER_PRIORITY_USER);
+
+  fixture->window = gtk_window_new ();
+  box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 0);
+  fixture->gizmo = g_object_new (GTK_TYPE_GIZMO, NULL);
+  fixture->sibling = g_object_new (GTK_TYPE_GIZMO, NULL);
+  gtk_box_append (GTK_BOX (box), fixture->gizmo);
+  gtk_box_append (GTK_BOX (box), fixture->sibling);
+  gtk_window_set_child (GTK_WINDOW (fixture->window), box);
+
+  gtk_widget_show (fixture->window);
+  gtk_test_widget_wait_for_draw (fixture->window);
+}
+
+static void
+fixture_teardown (Fixture       *fixture,
+                  gconstpointer  data)
+{
+  gtk_window_destroy (GTK_WINDOW (fixture->window));
+  gtk_style_context_remove_provider_for_display (gdk_display_get_default (),
+                                                 GTK_STYLE_PROVIDER (fixture->provider));
+  g_object_unref (fixture->provider);
+}
+
+/* Adds @css_class to the gizmo and checks that neither it nor its
+ * sibling were allocated again */
+static void
+change_css_class (Fixture    *fixture,
+                  const char *css_class)
+{
+  GtkAllocation gizmo_before, sibling_before, gizmo_after, sibling_after;
+  guint gizmo_allocations, sibling_allocations;
+
+  gtk_widget_get_allocation (fixture->gizmo, &gizmo_before);
+  gtk_widget_get_allocation (fixture->sibling, &sibling_before);
+  gizmo_allocations = GTK_GIZMO (fixture->gizmo)->n_allocations;
+  sibling_allocations = GTK_GIZMO (fixture->sibling)->n_allocations;
+
+  gtk_widget_add_css_class (fixture->gizmo, css_class);
+  gtk_test_widget_wait_for_draw (fixture->window);
+
+  gtk_widget_get_allocation (fixture->gizmo, &gizmo_after);
+  gtk_widget_get_allocation (fixture->sibling, &sibling_after);
+  g_assert_cmpint (gizmo_after.width, ==, gizmo_before.width);
+  g_assert_cmpint (gizmo_after.height, ==, gizmo_before.height);
+  g_assert_cmpint (sibling_after.x, ==, sibling_before.x);
+  g_assert_cmpint (sibling_after.y, ==, sibling_before.y);
+  g_assert_cmpint (sibling_after.width, ==, sibling_before.width);
+  g_assert_cmpint (sibling_after.height, ==, sibling_before.height);
+  g_assert_cmpuint (GTK_GIZMO (fixture->gizmo)->n_allocations, ==, gizmo_allocations);
+  g_assert_cmpuint (GTK_GIZMO (fixture->sibling)->n_allocations, ==, sibling_allocations);
+}
+
+static gboolean
+find_opacity_node (GskRenderNode *node,
+                   float          opacity)
+{
+  guint i;
+
+  switch ((int) gsk_render_node_get_node_type (node))
+    {
+    case GSK_OPACITY_NODE:
+      if (G_APPROX_VALUE (gsk_opacity_node_get_opacity (node), opacity, 0.001))
+        return TRUE;
+      return find_opacity_node (gsk_opacity_node_get_child (node), opacity);
+
+    case GSK_CONTAINER_NODE:
+      for (i = 0; i < gsk_container_node_get_n_children (node); i++)
+        {
+          if (find_opacity_node (gsk_container_node_get_child (node, i), opacity))
+            return TRUE;
+        }
+      return FALSE;
+
+    case GSK_TRANSFORM_NODE:
+      return find_opacity_node (gsk_transform_node_get_child (node), opacity);
+
+    case GSK_CLIP_NODE:
+      return find_opacity_node (gsk_clip_node_get_child (node), opacity);
+
+    case GSK_ROUNDED_CLIP_NODE:
+      return find_opacity_node (gsk_rounded_clip_node_get_child (node), opacity);
+
+    case GSK_DEBUG_NODE:
+      return find_opacity_node (gsk_debug_node_get_child (node), opacity);
+
+    default:
+      return FALSE;
+    }
+}
+
+static void
+test_opacity (Fixture       *fixture,
+              gconstpointer  data)
+{
+  GdkPaintable *paintable;
+  GtkSnapshot *snapshot;
+  GskRenderNode *node;
+
+  change_css_class (fixture, "faded");
+
+  paintable = gtk_widget_paintable_new (fixture->window);
+  snapshot = gtk_snapshot_new ();
+  gdk_paintable_snapshot (paintable, snapshot,
+                          gdk_paintable_get_intrinsic_width (paintable),
+                          gdk_paintable_get_intrinsic_height (paintable));
+  node = gtk_snapshot_free_to_node (snapshot);
+  g_assert_nonnull (node);
+  g_assert_true (find_opacity_node (node, 0.5));
+
+  gsk_render_node_unref (node);
+  g_object_unref (paintable);
+}
+
+static void
+test_transform (Fixture       *fixture,
+                gconstpointer  data)
+{
+  graphene_point_t before, after;
+
+  g_assert_true (gtk_widget_compute_point (fixture->gizmo, fixture->window,
+                                           &GRAPHENE_POINT_INIT (0, 0), &before));
+
+  change_css_class (fixture, "moved");
+
+  g_assert_true (gtk_widget_compute_point (fixture->gizmo, fixture->window,
+                                           &GRAPHENE_POINT_INIT (0, 0), &after));
+  g_assert_cmpfloat_with_epsilon (after.x, before.x + 10, 0.001);
+  g_assert_cmpfloat_with_epsilon (after.y, before.y + 20, 0.001);
+
+  /* And back */
+  gtk_widget_remove_css_class (fixture->gizmo, "moved");
+  gtk_test_widget_wait_for_draw (fixture->window);
+
+  g_assert_true (gtk_widget_compute_point (fixture->gizmo, fixture->window,
+                                           &GRAPHENE_POINT_INIT (0, 0), &after));
+  g_assert_cmpfloat_with_epsilon (after.x, before.x, 0.001);
+  g_assert_cmpfloat_with_epsilon (after.y, before.y, 0.001);
+}
+
+int
+main (int argc, char *argv[])
+{
+  gtk_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/css-transform/opacity", Fixture, NULL,
+              fixture_setup, test_opacity, fixture_teardown);
+  g_test_add ("/css-transform/transform", Fixture, NULL,
+              fixture_setup, test_transform, fixture_teardown);
+
+  return g_test_run ();
+}
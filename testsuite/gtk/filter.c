@@ -277,6 +277,39 @@ test_string_simple (void)
   g_object_unref (filter);
 }
 
+/* The strings are cached, but not per item */
+static void
+test_string_changed_items (void)
+{
+  GtkFilterListModel *model;
+  GtkFilter *filter;
+  GObject *item;
+
+  filter = GTK_FILTER (gtk_string_filter_new (
+               gtk_cclosure_expression_new (G_TYPE_STRING,
+                                            NULL,
+                                            0, NULL,
+                                            G_CALLBACK (get_string),
+                                            NULL, NULL)));
+
+  model = new_model (20, filter);
+  gtk_string_filter_set_search (GTK_STRING_FILTER (filter), "1");
+  assert_model (model, "1 10 11 12 13 14 15 16 17 18 19");
+
+  item = g_list_model_get_item (gtk_filter_list_model_get_model (model), 1);
+  g_object_set_qdata (item, number_quark, GUINT_TO_POINTER (21));
+  g_object_unref (item);
+  item = g_list_model_get_item (gtk_filter_list_model_get_model (model), 9);
+  g_object_set_qdata (item, number_quark, GUINT_TO_POINTER (2));
+  g_object_unref (item);
+
+  gtk_filter_changed (filter, GTK_FILTER_CHANGE_DIFFERENT);
+  assert_model (model, "1 21 11 12 13 14 15 16 17 18 19");
+
+  g_object_unref (model);
+  g_object_unref (filter);
+}
+
 static void
 test_string_properties (void)
 {
@@ -404,6 +437,7 @@ main (int argc, char *argv[])
   g_test_add_func ("/filter/simple", test_simple);
   g_test_add_func ("/filter/any/simple", test_any_simple);
   g_test_add_func ("/filter/string/simple", test_string_simple);
+  g_test_add_func ("/filter/string/changed-items", test_string_changed_items);
   g_test_add_func ("/filter/string/properties", test_string_properties);
   g_test_add_func ("/filter/bool/simple", test_bool_simple);
   g_test_add_func ("/filter/every/dispose", test_every_dispose);
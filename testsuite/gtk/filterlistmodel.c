@@ -18,6 +18,7 @@
  */
 
 #include <locale.h>
+#include <string.h>
 
 #include <gtk/gtk.h>
 
@@ -376,6 +377,406 @@ test_incremental (void)
   g_object_unref (filter);
 }
 
+static guint n_evaluations;
+
+static char *
+get_string (GObject *object)
+{
+  n_evaluations++;
+
+  return g_strdup_printf ("%u", GPOINTER_TO_UINT (g_object_get_qdata (object, number_quark)));
+}
+
+static gboolean
+is_odd (GObject *object)
+{
+  return GPOINTER_TO_UINT (g_object_get_qdata (object, number_quark)) % 2;
+}
+
+/* Big enough to be filtered on several threads */
+static void
+test_parallel (void)
+{
+  GtkFilterListModel *filter;
+  GtkStringFilter *string_filter;
+  GtkBoolFilter *bool_filter;
+  GtkEveryFilter *every;
+  const guint n_items = 100000;
+  guint i, n_matches, number;
+  char *s;
+
+  filter = new_model (n_items, NULL, NULL);
+
+  string_filter = gtk_string_filter_new (gtk_cclosure_expression_new (G_TYPE_STRING,
+                                                                      NULL,
+                                                                      0, NULL,
+                                                                      G_CALLBACK (get_string),
+                                                                      NULL, NULL));
+  gtk_string_filter_set_search (string_filter, "99");
+  gtk_filter_list_model_set_filter (filter, GTK_FILTER (string_filter));
+
+  n_matches = 0;
+  for (i = 1; i <= n_items; i++)
+    {
+      s = g_strdup_printf ("%u", i);
+      if (strstr (s, "99"))
+        {
+          g_assert_cmpuint (i, ==, get (G_LIST_MODEL (filter), n_matches));
+          n_matches++;
+        }
+      g_free (s);
+    }
+  g_assert_cmpuint (n_matches, ==, g_list_model_get_n_items (G_LIST_MODEL (filter)));
+
+  bool_filter = gtk_bool_filter_new (gtk_cclosure_expression_new (G_TYPE_BOOLEAN,
+                                                                  NULL,
+                                                                  0, NULL,
+                                                                  G_CALLBACK (is_odd),
+                                                                  NULL, NULL));
+  every = gtk_every_filter_new ();
+  gtk_multi_filter_append (GTK_MULTI_FILTER (every), GTK_FILTER (string_filter));
+  gtk_multi_filter_append (GTK_MULTI_FILTER (every), GTK_FILTER (bool_filter));
+  gtk_filter_list_model_set_filter (filter, GTK_FILTER (every));
+
+  n_matches = 0;
+  for (i = 0; i < g_list_model_get_n_items (G_LIST_MODEL (filter)); i++)
+    {
+      number = get (G_LIST_MODEL (filter), i);
+      g_assert_cmpuint (number % 2, ==, 1);
+      s = g_strdup_printf ("%u", number);
+      g_assert_nonnull (strstr (s, "99"));
+      g_free (s);
+    }
+  for (i = 1; i <= n_items; i += 2)
+    {
+      s = g_strdup_printf ("%u", i);
+      if (strstr (s, "99"))
+        n_matches++;
+      g_free (s);
+    }
+  g_assert_cmpuint (n_matches, ==, g_list_model_get_n_items (G_LIST_MODEL (filter)));
+
+  ignore_changes (filter);
+
+  g_object_unref (every);
+  g_object_unref (filter);
+}
+
+/* Incremental filtering matches batches, which can be big enough
+ * to be filtered on several threads */
+static void
+test_incremental_parallel (void)
+{
+  GtkFilterListModel *filter;
+  GtkStringFilter *string_filter;
+  const guint n_items = 100000;
+  guint i, n_matches;
+  char *s;
+
+  filter = new_model (n_items, NULL, NULL);
+  gtk_filter_list_model_set_incremental (filter, TRUE);
+
+  string_filter = gtk_string_filter_new (gtk_cclosure_expression_new (G_TYPE_STRING,
+                                                                      NULL,
+                                                                      0, NULL,
+                                                                      G_CALLBACK (get_string),
+                                                                      NULL, NULL));
+  gtk_string_filter_set_search (string_filter, "99");
+  gtk_filter_list_model_set_filter (filter, GTK_FILTER (string_filter));
+  g_assert_cmpuint (gtk_filter_list_model_get_pending (filter), >, 0);
+
+  while (g_main_context_pending (NULL))
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_cmpuint (gtk_filter_list_model_get_pending (filter), ==, 0);
+
+  n_matches = 0;
+  for (i = 1; i <= n_items; i++)
+    {
+      s = g_strdup_printf ("%u", i);
+      if (strstr (s, "99"))
+        {
+          g_assert_cmpuint (i, ==, get (G_LIST_MODEL (filter), n_matches));
+          n_matches++;
+        }
+      g_free (s);
+    }
+  g_assert_cmpuint (n_matches, ==, g_list_model_get_n_items (G_LIST_MODEL (filter)));
+
+  ignore_changes (filter);
+
+  g_object_unref (string_filter);
+  g_object_unref (filter);
+}
+
+static guint
+count_containing (guint       n_items,
+                  const char *search)
+{
+  guint i, n = 0;
+  char *s;
+
+  for (i = 1; i <= n_items; i++)
+    {
+      s = g_strdup_printf ("%u", i);
+      if (strstr (s, search))
+        n++;
+      g_free (s);
+    }
+
+  return n;
+}
+
+/* Going back to previous searches must not check any items again */
+static void
+test_search_history (void)
+{
+  GtkFilterListModel *filter;
+  GtkStringFilter *string_filter;
+  const guint n_items = 1000;
+  guint n_one;
+
+  filter = new_model (n_items, NULL, NULL);
+  n_one = count_containing (n_items, "1");
+
+  string_filter = gtk_string_filter_new (gtk_cclosure_expression_new (G_TYPE_STRING,
+                                                                      NULL,
+                                                                      0, NULL,
+                                                                      G_CALLBACK (get_string),
+                                                                      NULL, NULL));
+  gtk_string_filter_set_search (string_filter, "1");
+  gtk_filter_list_model_set_filter (filter, GTK_FILTER (string_filter));
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (filter)), ==, n_one);
+
+  gtk_string_filter_set_search (string_filter, "12");
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (filter)), ==, count_containing (n_items, "12"));
+  ignore_changes (filter);
+
+  n_evaluations = 0;
+  gtk_string_filter_set_search (string_filter, "1");
+  g_assert_cmpuint (n_evaluations, ==, 0);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (filter)), ==, n_one);
+
+  gtk_string_filter_set_search (string_filter, "12");
+  g_assert_cmpuint (n_evaluations, ==, 0);
+  assert_model (filter, "12 112 120 121 122 123 124 125 126 127 128 129 212 312 412 512 612 712 812 912");
+  ignore_changes (filter);
+
+  /* Only the matches of "1" can match */
+  gtk_string_filter_set_search (string_filter, "13");
+  g_assert_cmpuint (n_evaluations, ==, n_one);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (filter)), ==, count_containing (n_items, "13"));
+  ignore_changes (filter);
+
+  /* Changing the items drops the old results */
+  g_list_store_remove (G_LIST_STORE (gtk_filter_list_model_get_model (filter)), 0);
+  n_evaluations = 0;
+  gtk_string_filter_set_search (string_filter, "1");
+  g_assert_cmpuint (n_evaluations, ==, n_items - 1 - count_containing (n_items, "13"));
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (filter)), ==, n_one - 1);
+  ignore_changes (filter);
+
+  g_object_unref (string_filter);
+  g_object_unref (filter);
+}
+
+static guint
+count_odd_containing (guint       n_items,
+                      const char *search)
+{
+  guint i, n = 0;
+  char *s;
+
+  for (i = 1; i <= n_items; i += 2)
+    {
+      s = g_strdup_printf ("%u", i);
+      if (strstr (s, search))
+        n++;
+      g_free (s);
+    }
+
+  return n;
+}
+
+/* When one filter of an every filter changes to a search that has a
+ * base state, only the matches of the every filter with that base
+ * state need to be checked */
+static void
+test_multi_filter_base_state (void)
+{
+  GtkFilterListModel *filter;
+  GtkStringFilter *string_filter;
+  GtkBoolFilter *bool_filter;
+  GtkEveryFilter *every;
+  const guint n_items = 1000;
+
+  filter = new_model (n_items, NULL, NULL);
+
+  string_filter = gtk_string_filter_new (gtk_cclosure_expression_new (G_TYPE_STRING,
+                                                                      NULL,
+                                                                      0, NULL,
+                                                                      G_CALLBACK (get_string),
+                                                                      NULL, NULL));
+  gtk_string_filter_set_search (string_filter, "1");
+  bool_filter = gtk_bool_filter_new (gtk_cclosure_expression_new (G_TYPE_BOOLEAN,
+                                                                  NULL,
+                                                                  0, NULL,
+                                                                  G_CALLBACK (is_odd),
+                                                                  NULL, NULL));
+  every = gtk_every_filter_new ();
+  gtk_multi_filter_append (GTK_MULTI_FILTER (every), g_object_ref (GTK_FILTER (string_filter)));
+  gtk_multi_filter_append (GTK_MULTI_FILTER (every), GTK_FILTER (bool_filter));
+  gtk_filter_list_model_set_filter (filter, GTK_FILTER (every));
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (filter)), ==, count_odd_containing (n_items, "1"));
+  ignore_changes (filter);
+
+  gtk_string_filter_set_search (string_filter, "123");
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (filter)), ==, count_odd_containing (n_items, "123"));
+  ignore_changes (filter);
+
+  /* "12" is less strict than "123" and more strict than "1". The
+   * string filter is checked first, so it is called once for every
+   * odd item containing "1" but not "123" and for nothing else. */
+  n_evaluations = 0;
+  gtk_string_filter_set_search (string_filter, "12");
+  g_assert_cmpuint (n_evaluations, ==, count_odd_containing (n_items, "1") - count_odd_containing (n_items, "123"));
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (filter)), ==, count_odd_containing (n_items, "12"));
+  ignore_changes (filter);
+
+  /* And going back doesn't need to check anything */
+  n_evaluations = 0;
+  gtk_string_filter_set_search (string_filter, "1");
+  g_assert_cmpuint (n_evaluations, ==, 0);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (filter)), ==, count_odd_containing (n_items, "1"));
+  ignore_changes (filter);
+
+  g_object_unref (string_filter);
+  g_object_unref (every);
+  g_object_unref (filter);
+}
+
+static void
+assert_sorted_strings (GListModel *model,
+                       const char *search)
+{
+  GtkStringObject *object, *last;
+  guint i;
+
+  last = NULL;
+  for (i = 0; i < g_list_model_get_n_items (model); i++)
+    {
+      object = g_list_model_get_item (model, i);
+      if (search)
+        g_assert_nonnull (strstr (gtk_string_object_get_string (object), search));
+      if (last)
+        {
+          g_assert_cmpstr (gtk_string_object_get_string (last), <=, gtk_string_object_get_string (object));
+          g_object_unref (last);
+        }
+      last = object;
+    }
+  g_clear_object (&last);
+}
+
+static gboolean
+is_referenced (gpointer item,
+               gpointer data)
+{
+  /* The model's reference and the one of whoever called us */
+  g_assert_cmpuint (G_OBJECT (item)->ref_count, >=, 2);
+
+  return TRUE;
+}
+
+/* Filter functions are application code, which may change the model,
+ * so they must get items they hold a reference on */
+static void
+test_custom_filter_refs (void)
+{
+  GtkStringList *list;
+  GtkSliceListModel *slice;
+  GtkFilterListModel *filter;
+  GtkFilter *custom;
+  guint i;
+  char *s;
+
+  list = gtk_string_list_new (NULL);
+  for (i = 0; i < 1000; i++)
+    {
+      s = g_strdup_printf ("%u", i);
+      gtk_string_list_append (list, s);
+      g_free (s);
+    }
+
+  slice = gtk_slice_list_model_new (G_LIST_MODEL (list), 0, 1000);
+  custom = GTK_FILTER (gtk_custom_filter_new (is_referenced, NULL, NULL));
+  filter = gtk_filter_list_model_new (G_LIST_MODEL (slice), custom);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (filter)), ==, 1000);
+
+  g_object_unref (filter);
+}
+
+/* Filtering and sorting a stack of models that can lend their items
+ * must give the same results as getting them one by one */
+static void
+test_stacked_models (void)
+{
+  GtkStringList *first, *second;
+  GListStore *store;
+  GtkFlattenListModel *flatten;
+  GtkSliceListModel *slice;
+  GtkMapListModel *map;
+  GtkSortListModel *sort;
+  GtkFilterListModel *filter;
+  GtkStringFilter *string_filter;
+  const guint n_items = 50000;
+  guint i;
+  char *s;
+
+  first = gtk_string_list_new (NULL);
+  second = gtk_string_list_new (NULL);
+  for (i = 1; i <= n_items; i++)
+    {
+      s = g_strdup_printf ("%u", i);
+      gtk_string_list_append (i <= n_items / 2 ? first : second, s);
+      g_free (s);
+    }
+
+  store = g_list_store_new (G_TYPE_LIST_MODEL);
+  g_list_store_append (store, first);
+  g_list_store_append (store, second);
+  flatten = gtk_flatten_list_model_new (G_LIST_MODEL (store));
+  slice = gtk_slice_list_model_new (G_LIST_MODEL (flatten), 1000, n_items - 2000);
+  map = gtk_map_list_model_new (G_LIST_MODEL (slice), NULL, NULL, NULL);
+  sort = gtk_sort_list_model_new (G_LIST_MODEL (map),
+                                  GTK_SORTER (gtk_string_sorter_new (gtk_property_expression_new (GTK_TYPE_STRING_OBJECT, NULL, "string"))));
+  string_filter = gtk_string_filter_new (gtk_property_expression_new (GTK_TYPE_STRING_OBJECT, NULL, "string"));
+  gtk_string_filter_set_search (string_filter, "99");
+  filter = gtk_filter_list_model_new (G_LIST_MODEL (sort), GTK_FILTER (string_filter));
+
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (sort)), ==, n_items - 2000);
+  assert_sorted_strings (G_LIST_MODEL (sort), NULL);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (filter)), ==,
+                    count_containing (n_items - 1000, "99") - count_containing (1000, "99"));
+  assert_sorted_strings (G_LIST_MODEL (filter), "99");
+
+  /* Moves the slice to 1101 - 49100 */
+  gtk_string_list_splice (first, 0, 100, NULL);
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (filter)), ==,
+                    count_containing (n_items - 900, "99") - count_containing (1100, "99"));
+  assert_sorted_strings (G_LIST_MODEL (filter), "99");
+
+  /* Narrows down the matches found after the change */
+  gtk_string_filter_set_search (string_filter, "9");
+  gtk_string_filter_set_search (string_filter, "99");
+  g_assert_cmpuint (g_list_model_get_n_items (G_LIST_MODEL (filter)), ==,
+                    count_containing (n_items - 900, "99") - count_containing (1100, "99"));
+  assert_sorted_strings (G_LIST_MODEL (filter), "99");
+
+  g_object_unref (filter);
+  g_object_unref (first);
+  g_object_unref (second);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -389,6 +790,12 @@ main (int argc, char *argv[])
   g_test_add_func ("/filterlistmodel/empty_set_filter", test_empty_set_filter);
   g_test_add_func ("/filterlistmodel/change_filter", test_change_filter);
   g_test_add_func ("/filterlistmodel/incremental", test_incremental);
+  g_test_add_func ("/filterlistmodel/parallel", test_parallel);
+  g_test_add_func ("/filterlistmodel/incremental_parallel", test_incremental_parallel);
+  g_test_add_func ("/filterlistmodel/search_history", test_search_history);
+  g_test_add_func ("/filterlistmodel/multi_filter_base_state", test_multi_filter_base_state);
+  g_test_add_func ("/filterlistmodel/stacked_models", test_stacked_models);
+  g_test_add_func ("/filterlistmodel/custom_filter_refs", test_custom_filter_refs);
 
   return g_test_run ();
 }
@@ -517,6 +517,54 @@ test_incremental_remove (void)
   g_object_unref (removed);
 }
 
+static guint
+get_number (GObject *object)
+{
+  return GPOINTER_TO_UINT (g_object_get_qdata (object, number_quark));
+}
+
+/* Big enough to be sorted on several threads */
+static void
+test_parallel (void)
+{
+  GListStore *store;
+  GtkSortListModel *model;
+  GtkSorter *sorter;
+  const guint n_items = 100000;
+  guint i;
+
+  store = new_shuffled_store (n_items);
+  model = new_model (NULL);
+  gtk_sort_list_model_set_model (model, G_LIST_MODEL (store));
+
+  sorter = GTK_SORTER (gtk_numeric_sorter_new (gtk_cclosure_expression_new (G_TYPE_UINT,
+                                                                            NULL,
+                                                                            0, NULL,
+                                                                            G_CALLBACK (get_number),
+                                                                            NULL, NULL)));
+  gtk_sort_list_model_set_sorter (model, sorter);
+
+  g_assert_cmpuint (gtk_sort_list_model_get_pending (model), ==, 0);
+  for (i = 0; i < n_items; i++)
+    g_assert_cmpuint (i + 1, ==, get (G_LIST_MODEL (model), i));
+
+  /* Sorting an already sorted model changes nothing */
+  ignore_changes (model);
+  gtk_numeric_sorter_set_sort_order (GTK_NUMERIC_SORTER (sorter), GTK_SORT_ASCENDING);
+  gtk_sorter_changed (sorter, GTK_SORTER_CHANGE_DIFFERENT);
+  assert_changes (model, "");
+
+  gtk_numeric_sorter_set_sort_order (GTK_NUMERIC_SORTER (sorter), GTK_SORT_DESCENDING);
+  for (i = 0; i < n_items; i++)
+    g_assert_cmpuint (n_items - i, ==, get (G_LIST_MODEL (model), i));
+
+  ignore_changes (model);
+
+  g_object_unref (sorter);
+  g_object_unref (store);
+  g_object_unref (model);
+}
+
 static void
 test_out_of_bounds_access (void)
 {
@@ -553,6 +601,7 @@ main (int argc, char *argv[])
 #endif
   g_test_add_func ("/sortlistmodel/stability", test_stability);
   g_test_add_func ("/sortlistmodel/incremental/remove", test_incremental_remove);
+  g_test_add_func ("/sortlistmodel/parallel", test_parallel);
   g_test_add_func ("/sortlistmodel/oob-access", test_out_of_bounds_access);
 
   return g_test_run ();
@@ -0,0 +1,461 @@
+/*
+ * Copyright © 2020 GNOME Foundation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Benchmarks for style resolution
+ *
+ * Builds synthetic widget trees and measures, for each of them with
+ * just Adwaita and with Adwaita plus a big custom stylesheet:
+ *
+ *  - selector_match: looking up the rules for every node
+ *  - style_compute: computing the styles of a new tree
+ *  - state_change: propagating a state change of the top container
+ *  - theme_switch: switching to the dark variant and back
+ *
+ * Times are the median and minimum in microseconds over all runs but
+ * the first. The cache numbers are from computing the styles of a new
+ * tree. The results are printed as JSON.
+ */
+
+#include "config.h"
+
+#include <gtk/gtk.h>
+#include "gtk/gtkcssnodeprivate.h"
+#include "gtk/gtkcsssharedstylesprivate.h"
+#include "gtk/gtkstyleproviderprivate.h"
+#include "gtk/gtkwidgetprivate.h"
+
+#include <stdlib.h>
+
+#define N_CLASSES 97
+#define N_CUSTOM_RULES 2000
+
+#define DEEP_DEPTH 64
+#define WIDE_CHILDREN 1500
+#define LIST_ROWS 400
+
+static int opt_runs = 5;
+static char *opt_output;
+
+static GOptionEntry options[] = {
+  { "runs", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &opt_runs, "Number of runs", "COUNT" },
+  { "output", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &opt_output, "File to write the results to", "FILE" },
+  { NULL, }
+};
+
+static void
+add_bench_class (GtkWidget *widget,
+                 guint      i)
+{
+  char *name = g_strdup_printf ("bench-%u", i % N_CLASSES);
+
+  gtk_widget_add_css_class (widget, name);
+  g_free (name);
+}
+
+static GtkWidget *
+create_deep (void)
+{
+  GtkWidget *window, *parent, *box, *button;
+  guint i;
+
+  window = gtk_window_new ();
+  parent = window;
+
+  for (i = 0; i < DEEP_DEPTH; i++)
+    {
+      box = gtk_box_new (i % 2 ? GTK_ORIENTATION_HORIZONTAL : GTK_ORIENTATION_VERTICAL, 0);
+      add_bench_class (box, i);
+
+      gtk_box_append (GTK_BOX (box), gtk_label_new ("Label"));
+      button = gtk_button_new_with_label ("Button");
+      add_bench_class (button, i + 1);
+      gtk_box_append (GTK_BOX (box), button);
+
+      if (parent == window)
+        gtk_window_set_child (GTK_WINDOW (window), box);
+      else
+        gtk_box_append (GTK_BOX (parent), box);
+
+      parent = box;
+    }
+
+  return window;
+}
+
+static GtkWidget *
+create_wide (void)
+{
+  GtkWidget *window, *box, *child;
+  guint i;
+
+  window = gtk_window_new ();
+  box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
+  gtk_window_set_child (GTK_WINDOW (window), box);
+
+  for (i = 0; i < WIDE_CHILDREN; i++)
+    {
+      switch (i % 4)
+        {
+        case 0:
+          child = gtk_label_new ("Label");
+          break;
+        case 1:
+          child = gtk_button_new_with_label ("Button");
+          break;
+        case 2:
+          child = gtk_entry_new ();
+          break;
+        case 3:
+        default:
+          child = gtk_check_button_new_with_label ("Check");
+          break;
+        }
+
+      add_bench_class (child, i);
+      gtk_box_append (GTK_BOX (box), child);
+    }
+
+  return window;
+}
+
+static GtkWidget *
+create_list (void)
+{
+  GtkWidget *window, *list, *box, *label, *button;
+  guint i;
+
+  window = gtk_window_new ();
+  list = gtk_list_box_new ();
+  gtk_window_set_child (GTK_WINDOW (window), list);
+
+  for (i = 0; i < LIST_ROWS; i++)
+    {
+      box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
+
+      label = gtk_label_new ("Title");
+      add_bench_class (label, i);
+      gtk_box_append (GTK_BOX (box), label);
+
+      label = gtk_label_new ("Subtitle");
+      gtk_widget_add_css_class (label, "dim-label");
+      gtk_box_append (GTK_BOX (box), label);
+
+      button = gtk_button_new_with_label ("Edit");
+      gtk_widget_add_css_class (button, "flat");
+      gtk_box_append (GTK_BOX (box), button);
+
+      gtk_box_append (GTK_BOX (box), gtk_switch_new ());
+
+      gtk_list_box_append (GTK_LIST_BOX (list), box);
+      add_bench_class (gtk_widget_get_parent (box), i);
+    }
+
+  return window;
+}
+
+static const struct {
+  const char *name;
+  GtkWidget * (* create) (void);
+} trees[] = {
+  { "deep", create_deep },
+  { "wide", create_wide },
+  { "list", create_list },
+};
+
+/* Rules of the kinds themes use, most of which match some nodes */
+static GtkCssProvider *
+create_custom_provider (void)
+{
+  GtkCssProvider *provider;
+  GString *css;
+  guint i;
+
+  css = g_string_new ("");
+
+  for (i = 0; i < N_CUSTOM_RULES; i++)
+    {
+      guint c = i % N_CLASSES;
+
+      switch (i % 6)
+        {
+        case 0:
+          g_string_append_printf (css, ".bench-%u { color: rgb(%u, %u, 0); }\n", c, i % 256, c);
+          break;
+        case 1:
+          g_string_append_printf (css, "box.bench-%u > label { margin: %upx; }\n", c, i % 5);
+          break;
+        case 2:
+          g_string_append_printf (css, "button.bench-%u:hover { background-color: rgba(0, 0, %u, 0.5); }\n", c, i % 256);
+          break;
+        case 3:
+          g_string_append_printf (css, ".bench-%u .bench-%u label:nth-child(odd) { padding: 1px; }\n", c, (c + 1) % N_CLASSES);
+          break;
+        case 4:
+          g_string_append_printf (css, "row.bench-%u:selected button { opacity: 0.9; }\n", c);
+          break;
+        case 5:
+        default:
+          g_string_append_printf (css, "window .bench-%u:backdrop:not(:disabled) { border-radius: %upx; }\n", c, i % 7);
+          break;
+        }
+    }
+
+  provider = gtk_css_provider_new ();
+  gtk_css_provider_load_from_data (provider, css->str, css->len);
+  g_string_free (css, TRUE);
+
+  return provider;
+}
+
+static guint
+count_nodes (GtkCssNode *node)
+{
+  GtkCssNode *child;
+  guint n = 1;
+
+  for (child = gtk_css_node_get_first_child (node);
+       child;
+       child = gtk_css_node_get_next_sibling (child))
+    n += count_nodes (child);
+
+  return n;
+}
+
+static void
+match_nodes (GtkCssNode             *node,
+             GtkCountingBloomFilter *filter)
+{
+  GtkCssNode *child;
+  GtkCssLookup lookup;
+  GtkCssChange change;
+
+  _gtk_css_lookup_init (&lookup);
+  gtk_style_provider_lookup (gtk_css_node_get_style_provider (node), filter, node, &lookup, &change);
+  _gtk_css_lookup_destroy (&lookup);
+
+  if (gtk_css_node_get_first_child (node) == NULL)
+    return;
+
+  gtk_css_node_declaration_add_bloom_hashes (gtk_css_node_get_declaration (node), filter);
+
+  for (child = gtk_css_node_get_first_child (node);
+       child;
+       child = gtk_css_node_get_next_sibling (child))
+    match_nodes (child, filter);
+
+  gtk_css_node_declaration_remove_bloom_hashes (gtk_css_node_get_declaration (node), filter);
+}
+
+typedef struct {
+  gint64 *selector_match;
+  gint64 *style_compute;
+  gint64 *state_change;
+  gint64 *theme_switch;
+  GtkCssNodeStats compute_stats;
+  guint state_change_invalidated;
+  guint nodes;
+} Result;
+
+static void
+run_once (GtkWidget * (* create) (void),
+          Result     *result,
+          int         run)
+{
+  GtkCountingBloomFilter filter = GTK_COUNTING_BLOOM_FILTER_INIT;
+  GtkSettings *settings = gtk_settings_get_default ();
+  GtkCssNodeStats stats;
+  GtkWidget *window, *top;
+  GtkCssNode *root;
+  gint64 start;
+
+  window = create ();
+  root = gtk_widget_get_css_node (window);
+  top = gtk_window_get_child (GTK_WINDOW (window));
+
+  /* Styles of earlier runs would be shared with the new nodes */
+  gtk_css_shared_styles_clear ();
+  gtk_css_node_reset_stats ();
+
+  start = g_get_monotonic_time ();
+  gtk_css_node_validate (root);
+  result->style_compute[run] = g_get_monotonic_time () - start;
+  gtk_css_node_get_stats (&result->compute_stats);
+
+  result->nodes = count_nodes (root);
+
+  start = g_get_monotonic_time ();
+  match_nodes (root, &filter);
+  result->selector_match[run] = g_get_monotonic_time () - start;
+
+  gtk_css_node_reset_stats ();
+  start = g_get_monotonic_time ();
+  gtk_widget_set_state_flags (top, GTK_STATE_FLAG_BACKDROP, FALSE);
+  gtk_css_node_validate (root);
+  gtk_widget_unset_state_flags (top, GTK_STATE_FLAG_BACKDROP);
+  gtk_css_node_validate (root);
+  result->state_change[run] = g_get_monotonic_time () - start;
+  gtk_css_node_get_stats (&stats);
+  result->state_change_invalidated = stats.invalidated_nodes;
+
+  start = g_get_monotonic_time ();
+  g_object_set (settings, "gtk-application-prefer-dark-theme", TRUE, NULL);
+  gtk_css_node_validate (root);
+  g_object_set (settings, "gtk-application-prefer-dark-theme", FALSE, NULL);
+  gtk_css_node_validate (root);
+  result->theme_switch[run] = g_get_monotonic_time () - start;
+
+  gtk_window_destroy (GTK_WINDOW (window));
+}
+
+static int
+compare_times (gconstpointer a,
+               gconstpointer b)
+{
+  const gint64 *ta = a;
+  const gint64 *tb = b;
+
+  return (*ta > *tb) - (*ta < *tb);
+}
+
+/* Skips the first run, which fills the caches of the theme */
+static void
+print_times (GString    *json,
+             const char *name,
+             gint64     *times)
+{
+  int n = opt_runs - 1;
+
+  qsort (times + 1, n, sizeof (gint64), compare_times);
+
+  g_string_append_printf (json,
+                          "        \"%s\": { \"median_us\": %" G_GINT64_FORMAT ", \"min_us\": %" G_GINT64_FORMAT " },\n",
+                          name, times[1 + n / 2], times[1]);
+}
+
+static void
+print_result (GString      *json,
+              const char   *tree,
+              const char   *stylesheet,
+              Result       *result,
+              gboolean      last)
+{
+  const GtkCssNodeStats *stats = &result->compute_stats;
+
+  g_string_append (json, "    {\n");
+  g_string_append_printf (json, "      \"tree\": \"%s\",\n", tree);
+  g_string_append_printf (json, "      \"stylesheet\": \"%s\",\n", stylesheet);
+  g_string_append_printf (json, "      \"nodes\": %u,\n", result->nodes);
+  g_string_append (json, "      \"times\": {\n");
+  print_times (json, "selector_match", result->selector_match);
+  print_times (json, "style_compute", result->style_compute);
+  print_times (json, "state_change", result->state_change);
+  print_times (json, "theme_switch", result->theme_switch);
+  /* Remove the trailing comma */
+  g_string_truncate (json, json->len - 2);
+  g_string_append (json, "\n      },\n");
+  g_string_append (json, "      \"style_compute\": {\n");
+  g_string_append_printf (json, "        \"style_lookups\": %u,\n", stats->style_lookups);
+  g_string_append_printf (json, "        \"style_cache_hits\": %u,\n", stats->style_cache_hits);
+  g_string_append_printf (json, "        \"shared_style_hits\": %u,\n", stats->shared_style_hits);
+  g_string_append_printf (json, "        \"computed_styles\": %u,\n", stats->computed_styles);
+  g_string_append_printf (json, "        \"cache_hit_rate\": %.3f\n",
+                          stats->style_lookups > 0
+                          ? (double) (stats->style_cache_hits + stats->shared_style_hits) / stats->style_lookups
+                          : 0.0);
+  g_string_append (json, "      },\n");
+  g_string_append_printf (json, "      \"state_change_invalidated_nodes\": %u\n", result->state_change_invalidated);
+  g_string_append_printf (json, "    }%s\n", last ? "" : ",");
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GtkCssProvider *custom;
+  GError *error = NULL;
+  GString *json;
+  Result result;
+  guint i, s;
+  int run;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    g_error ("Parsing options: %s", error->message);
+  g_option_context_free (context);
+
+  if (opt_runs < 2)
+    g_error ("COUNT must be at least 2");
+
+  gtk_init ();
+
+  g_object_set (gtk_settings_get_default (),
+                "gtk-theme-name", "Adwaita",
+                "gtk-application-prefer-dark-theme", FALSE,
+                NULL);
+
+  custom = create_custom_provider ();
+
+  result.selector_match = g_new (gint64, opt_runs);
+  result.style_compute = g_new (gint64, opt_runs);
+  result.state_change = g_new (gint64, opt_runs);
+  result.theme_switch = g_new (gint64, opt_runs);
+
+  json = g_string_new ("{\n");
+  g_string_append_printf (json, "  \"gtk_version\": \"%u.%u.%u\",\n",
+                          gtk_get_major_version (), gtk_get_minor_version (), gtk_get_micro_version ());
+  g_string_append_printf (json, "  \"runs\": %d,\n", opt_runs - 1);
+  g_string_append (json, "  \"benchmarks\": [\n");
+
+  for (s = 0; s < 2; s++)
+    {
+      if (s == 1)
+        gtk_style_context_add_provider_for_display (gdk_display_get_default (),
+                                                    GTK_STYLE_PROVIDER (custom),
+                                                    GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+
+      for (i = 0; i < G_N_ELEMENTS (trees); i++)
+        {
+          for (run = 0; run < opt_runs; run++)
+            run_once (trees[i].create, &result, run);
+
+          print_result (json, trees[i].name, s == 0 ? "adwaita" : "custom",
+                        &result, s == 1 && i + 1 == G_N_ELEMENTS (trees));
+        }
+    }
+
+  g_string_append (json, "  ]\n}\n");
+
+  if (opt_output)
+    {
+      if (!g_file_set_contents (opt_output, json->str, json->len, &error))
+        g_error ("Writing results: %s", error->message);
+    }
+  else
+    g_print ("%s", json->str);
+
+  gtk_style_context_remove_provider_for_display (gdk_display_get_default (),
+                                                 GTK_STYLE_PROVIDER (custom));
+  g_object_unref (custom);
+  g_string_free (json, TRUE);
+  g_free (result.selector_match);
+  g_free (result.style_compute);
+  g_free (result.state_change);
+  g_free (result.theme_switch);
+
+  return 0;
+}
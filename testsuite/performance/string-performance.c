@@ -0,0 +1,294 @@
+/*
+ * Copyright © 2020 GNOME Foundation
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* Benchmarks for string filtering and sorting of big models
+ *
+ * Uses more distinct strings than the string cache can hold and
+ * measures for each of them:
+ *
+ *  - filter: changing the search of a string filter
+ *  - sort: changing whether a string sorter ignores case
+ *
+ * once through a #GtkFilterListModel or #GtkSortListModel and once by
+ * preparing the strings directly, without any cache. Times are the
+ * median and minimum in microseconds over all runs but the first. The
+ * results are printed as JSON.
+ */
+
+#include "config.h"
+
+#include <gtk/gtk.h>
+#include "gtk/gtkstringcacheprivate.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define N_STRINGS (4 * GTK_STRING_CACHE_MAX_STRINGS)
+
+static int opt_runs = 5;
+static char *opt_output;
+
+static GOptionEntry options[] = {
+  { "runs", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT, &opt_runs, "Number of runs", "COUNT" },
+  { "output", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME, &opt_output, "File to write the results to", "FILE" },
+  { NULL, }
+};
+
+typedef struct {
+  gint64 *model;
+  gint64 *direct;
+} Result;
+
+static GtkStringList *
+create_strings (void)
+{
+  GtkStringList *list;
+  guint i;
+
+  list = gtk_string_list_new (NULL);
+  for (i = 0; i < N_STRINGS; i++)
+    {
+      char *s = g_strdup_printf ("Ítem Número %u", (i * 7919) % N_STRINGS);
+
+      gtk_string_list_take (list, s);
+    }
+
+  return list;
+}
+
+static char *
+get_search (int run)
+{
+  /* Different searches, so no run can reuse the matches of another */
+  return g_strdup_printf ("%d", 10 + run);
+}
+
+static guint
+filter_directly (GtkStringList *list,
+                 const char    *search)
+{
+  guint i, n_matches = 0;
+
+  for (i = 0; i < N_STRINGS; i++)
+    {
+      char *normalized, *folded;
+
+      normalized = g_utf8_normalize (gtk_string_list_get_string (list, i), -1, G_NORMALIZE_ALL);
+      folded = g_utf8_casefold (normalized, -1);
+      if (strstr (folded, search))
+        n_matches++;
+      g_free (folded);
+      g_free (normalized);
+    }
+
+  return n_matches;
+}
+
+static void
+run_filter (GtkStringList *list,
+            Result        *result)
+{
+  GtkFilterListModel *model;
+  GtkStringFilter *filter;
+  guint n_matches;
+  gint64 start;
+  int run;
+
+  filter = gtk_string_filter_new (gtk_property_expression_new (GTK_TYPE_STRING_OBJECT, NULL, "string"));
+  model = gtk_filter_list_model_new (G_LIST_MODEL (list), GTK_FILTER (filter));
+
+  for (run = 0; run < opt_runs; run++)
+    {
+      char *search = get_search (run);
+
+      start = g_get_monotonic_time ();
+      gtk_string_filter_set_search (filter, search);
+      result->model[run] = g_get_monotonic_time () - start;
+
+      start = g_get_monotonic_time ();
+      n_matches = filter_directly (list, search);
+      result->direct[run] = g_get_monotonic_time () - start;
+
+      g_assert_cmpuint (n_matches, ==, g_list_model_get_n_items (G_LIST_MODEL (model)));
+
+      g_free (search);
+    }
+
+  g_object_unref (model);
+  g_object_unref (filter);
+}
+
+static int
+compare_keys (gconstpointer a,
+              gconstpointer b,
+              gpointer      unused)
+{
+  return strcmp (*(const char **) a, *(const char **) b);
+}
+
+static void
+sort_directly (GtkStringList *list,
+               gboolean       ignore_case)
+{
+  char **keys;
+  guint i;
+
+  keys = g_new (char *, N_STRINGS);
+  for (i = 0; i < N_STRINGS; i++)
+    {
+      const char *s = gtk_string_list_get_string (list, i);
+
+      if (ignore_case)
+        {
+          char *folded = g_utf8_casefold (s, -1);
+          keys[i] = g_utf8_collate_key (folded, -1);
+          g_free (folded);
+        }
+      else
+        keys[i] = g_utf8_collate_key (s, -1);
+    }
+
+  g_qsort_with_data (keys, N_STRINGS, sizeof (char *), compare_keys, NULL);
+
+  for (i = 0; i < N_STRINGS; i++)
+    g_free (keys[i]);
+  g_free (keys);
+}
+
+static void
+run_sort (GtkStringList *list,
+          Result        *result)
+{
+  GtkSortListModel *model;
+  GtkStringSorter *sorter;
+  gint64 start;
+  int run;
+
+  sorter = gtk_string_sorter_new (gtk_property_expression_new (GTK_TYPE_STRING_OBJECT, NULL, "string"));
+  model = gtk_sort_list_model_new (G_LIST_MODEL (list), GTK_SORTER (sorter));
+
+  for (run = 0; run < opt_runs; run++)
+    {
+      start = g_get_monotonic_time ();
+      gtk_string_sorter_set_ignore_case (sorter, run % 2);
+      result->model[run] = g_get_monotonic_time () - start;
+
+      start = g_get_monotonic_time ();
+      sort_directly (list, run % 2);
+      result->direct[run] = g_get_monotonic_time () - start;
+    }
+
+  g_object_unref (model);
+  g_object_unref (sorter);
+}
+
+static int
+compare_times (gconstpointer a,
+               gconstpointer b)
+{
+  const gint64 *ta = a;
+  const gint64 *tb = b;
+
+  return (*ta > *tb) - (*ta < *tb);
+}
+
+/* Skips the first run */
+static void
+print_times (GString    *json,
+             const char *name,
+             gint64     *times,
+             gboolean    last)
+{
+  int n = opt_runs - 1;
+
+  qsort (times + 1, n, sizeof (gint64), compare_times);
+
+  g_string_append_printf (json,
+                          "        \"%s\": { \"median_us\": %" G_GINT64_FORMAT ", \"min_us\": %" G_GINT64_FORMAT " }%s\n",
+                          name, times[1 + n / 2], times[1], last ? "" : ",");
+}
+
+static void
+print_result (GString    *json,
+              const char *name,
+              Result     *result,
+              gboolean    last)
+{
+  g_string_append (json, "    {\n");
+  g_string_append_printf (json, "      \"benchmark\": \"%s\",\n", name);
+  g_string_append_printf (json, "      \"strings\": %u,\n", N_STRINGS);
+  g_string_append (json, "      \"times\": {\n");
+  print_times (json, "model", result->model, FALSE);
+  print_times (json, "direct", result->direct, TRUE);
+  g_string_append (json, "      }\n");
+  g_string_append_printf (json, "    }%s\n", last ? "" : ",");
+}
+
+int
+main (int argc, char *argv[])
+{
+  GOptionContext *context;
+  GtkStringList *list;
+  GError *error = NULL;
+  GString *json;
+  Result result;
+
+  context = g_option_context_new (NULL);
+  g_option_context_add_main_entries (context, options, NULL);
+  if (!g_option_context_parse (context, &argc, &argv, &error))
+    g_error ("Parsing options: %s", error->message);
+  g_option_context_free (context);
+
+  if (opt_runs < 2)
+    g_error ("COUNT must be at least 2");
+
+  gtk_init ();
+
+  list = create_strings ();
+
+  result.model = g_new (gint64, opt_runs);
+  result.direct = g_new (gint64, opt_runs);
+
+  json = g_string_new ("{\n");
+  g_string_append_printf (json, "  \"gtk_version\": \"%u.%u.%u\",\n",
+                          gtk_get_major_version (), gtk_get_minor_version (), gtk_get_micro_version ());
+  g_string_append_printf (json, "  \"runs\": %d,\n", opt_runs - 1);
+  g_string_append (json, "  \"benchmarks\": [\n");
+
+  run_filter (list, &result);
+  print_result (json, "filter", &result, FALSE);
+
+  run_sort (list, &result);
+  print_result (json, "sort", &result, TRUE);
+
+  g_string_append (json, "  ]\n}\n");
+
+  if (opt_output)
+    {
+      if (!g_file_set_contents (opt_output, json->str, json->len, &error))
+        g_error ("Writing results: %s", error->message);
+    }
+  else
+    g_print ("%s", json->str);
+
+  g_object_unref (list);
+  g_string_free (json, TRUE);
+  g_free (result.model);
+  g_free (result.direct);
+
+  return 0;
+}